@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Headless linux build, see linux_ray.cpp. Usage: ./build.sh [release] [avx2]
+#
+# Needs clang++. The warning flags are clang's, and g++ won't take the array designated
+# initializers in ray.cpp (MuKeyMap). There's no metaprogram step like build.bat's, since
+# nothing the linux build compiles includes external/md or generated/.
+
+cd "$(dirname "$0")"
+
+if [ "$1" = "release" ]; then
+    echo "*** BUILDING RELEASE BUILD FROM SOURCE ***"
+else
+    echo "*** BUILDING DEBUG BUILD FROM SOURCE ***"
+fi
+
+SOURCE="linux_ray.cpp ray.cpp"
+OUTPUT=ray_linux
+
+# Pass avx2 as the second argument to build the 8-wide lane kernels instead of the 4-wide SSE4.1 ones
+ARCH_FLAGS="-msse4.1"
+if [ "$2" = "avx2" ]; then ARCH_FLAGS="-msse4.1 -mavx2 -mfma"; fi
+
+SHARED_FLAGS="-g -W -Wall -Wextra -Werror -Wno-unused-function -Wno-deprecated-declarations -Wno-unused-parameter -Wno-unused-variable -Wno-writable-strings -Wno-reorder-init-list -Wno-missing-field-initializers -Wno-missing-braces -Wno-c99-designator $ARCH_FLAGS -ferror-limit=3"
+DEBUG_FLAGS="-O0 -DRAY_DEBUG=1"
+RELEASE_FLAGS="-O3"
+LINK_LIBRARIES="-lpthread -lm"
+INCLUDE_DIRECTORIES="-Iexternal/"
+
+mkdir -p ../build
+
+if [ "$1" = "release" ]; then
+    FLAGS="$SHARED_FLAGS $RELEASE_FLAGS"
+else
+    FLAGS="$SHARED_FLAGS $DEBUG_FLAGS"
+fi
+
+clang++ $SOURCE $INCLUDE_DIRECTORIES $FLAGS -std=c++20 -o ../build/$OUTPUT $LINK_LIBRARIES
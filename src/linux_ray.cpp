@@ -0,0 +1,567 @@
+#include "linux_ray.h"
+
+//
+// NOTE: Headless platform layer. There's no window and no input, it just ticks the app until
+//       enough passes have been rendered (or the time budget runs out), and writes the result to disk.
+//
+
+global linux_state G_LinuxState;
+
+//
+// Platform Callbacks
+//
+
+internal void *
+LinuxReserve(usize Size, u32 Flags, const char *Tag)
+{
+    usize PageSize = Platform.PageSize;
+    usize TotalSize = PageSize + Size;
+
+    void *Result = nullptr;
+
+    char *Memory = (char *)mmap(nullptr, TotalSize, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (Memory != MAP_FAILED)
+    {
+        mprotect(Memory, PageSize, PROT_READ|PROT_WRITE);
+
+        linux_allocation_header *Header = (linux_allocation_header *)Memory;
+        Header->Size = TotalSize;
+        Header->Base = Memory + PageSize;
+        Header->Flags = Flags;
+        Header->Tag = Tag;
+
+        Header->Next = &G_LinuxState.AllocationSentinel;
+        Header->Prev = G_LinuxState.AllocationSentinel.Prev;
+        Header->Next->Prev = Header;
+        Header->Prev->Next = Header;
+
+        Result = Header->Base;
+    }
+
+    return Result;
+}
+
+internal void *
+LinuxCommit(usize Size, void *Pointer)
+{
+    void *Result = nullptr;
+    if (mprotect(Pointer, Size, PROT_READ|PROT_WRITE) == 0)
+    {
+        Result = Pointer;
+    }
+    return Result;
+}
+
+internal void *
+LinuxAllocate(usize Size, u32 Flags, const char *Tag)
+{
+    void *Result = LinuxReserve(Size, Flags, Tag);
+    if (Result)
+    {
+        Result = LinuxCommit(AlignPow2(Size, Platform.PageSize), Result);
+    }
+    return Result;
+}
+
+internal void
+LinuxDeallocate(void *Pointer)
+{
+    if (Pointer)
+    {
+        linux_allocation_header *Header = (linux_allocation_header *)((char *)Pointer - Platform.PageSize);
+        Header->Prev->Next = Header->Next;
+        Header->Next->Prev = Header->Prev;
+        munmap(Header, Header->Size);
+    }
+}
+
+internal string_u8
+LinuxReadEntireFile(arena *Arena, const char *FileName)
+{
+    string_u8 Result = {};
+
+    int File = open(FileName, O_RDONLY);
+    if (File != -1)
+    {
+        struct stat Stat;
+        if (fstat(File, &Stat) == 0)
+        {
+            temporary_memory ResultTemp = BeginTemporaryMemory(Arena);
+            Result.Data = PushArrayNoClear(Arena, (usize)Stat.st_size + 1, u8);
+
+            usize GotSize = 0;
+            while (GotSize < (usize)Stat.st_size)
+            {
+                ssize_t ReadSize = read(File, Result.Data + GotSize, (usize)Stat.st_size - GotSize);
+                if (ReadSize <= 0)
+                {
+                    break;
+                }
+                GotSize += (usize)ReadSize;
+            }
+
+            if (GotSize == (usize)Stat.st_size)
+            {
+                Result.Count = GotSize;
+                Result.Data[GotSize] = 0;
+                CommitTemporaryMemory(&ResultTemp);
+            }
+            else
+            {
+                EndTemporaryMemory(ResultTemp);
+                ZeroStruct(&Result);
+            }
+        }
+
+        close(File);
+    }
+
+    return Result;
+}
+
+internal bool
+LinuxWriteEntireFile(const char *FileName, string_u8 Data)
+{
+    bool Result = false;
+
+    int File = open(FileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (File != -1)
+    {
+        usize WrittenSize = 0;
+        while (WrittenSize < Data.Count)
+        {
+            ssize_t WriteSize = write(File, Data.Data + WrittenSize, Data.Count - WrittenSize);
+            if (WriteSize <= 0)
+            {
+                break;
+            }
+            WrittenSize += (usize)WriteSize;
+        }
+
+        Result = (WrittenSize == Data.Count);
+
+        close(File);
+    }
+
+    return Result;
+}
+
+internal string_u8
+LinuxMapFile(const char *FileName)
+{
+    string_u8 Result = {};
+
+    int File = open(FileName, O_RDONLY);
+    if (File != -1)
+    {
+        struct stat Stat;
+        if ((fstat(File, &Stat) == 0) && (Stat.st_size > 0))
+        {
+            void *Data = mmap(nullptr, (usize)Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+            if (Data != MAP_FAILED)
+            {
+                // NOTE: Whoever maps a file is going to read all of it, so start paging it in now
+                madvise(Data, (usize)Stat.st_size, MADV_WILLNEED);
+                Result.Data = (u8 *)Data;
+                Result.Count = (usize)Stat.st_size;
+            }
+        }
+
+        // NOTE: The mapping keeps the file alive by itself
+        close(File);
+    }
+
+    return Result;
+}
+
+internal void
+LinuxUnmapFile(string_u8 File)
+{
+    if (File.Data)
+    {
+        munmap(File.Data, File.Count);
+    }
+}
+
+internal bool
+LinuxGetFileInfo(const char *FileName, platform_file_info *Info)
+{
+    bool Result = false;
+
+    struct stat Stat;
+    if (stat(FileName, &Stat) == 0)
+    {
+        Info->Size = (u64)Stat.st_size;
+        Info->ModifiedTime = 1000000000ull*(u64)Stat.st_mtim.tv_sec + (u64)Stat.st_mtim.tv_nsec;
+        Result = true;
+    }
+
+    return Result;
+}
+
+internal platform_semaphore_handle
+LinuxCreateSemaphore(int InitialCount, int MaxCount)
+{
+    // NOTE: POSIX semaphores have no maximum count, which is fine since nothing relies on releases
+    //       being clamped to it.
+    sem_t *Semaphore = (sem_t *)LinuxAllocate(sizeof(sem_t), MemFlag_NoLeakCheck, LOCATION_STRING("Linux Semaphore"));
+    sem_init(Semaphore, 0, (unsigned int)InitialCount);
+
+    platform_semaphore_handle Result =
+    {
+        .Opaque = (void *)Semaphore,
+    };
+
+    return Result;
+}
+
+internal void
+LinuxWaitOnSemaphore(platform_semaphore_handle Handle)
+{
+    sem_t *Semaphore = (sem_t *)Handle.Opaque;
+    while (sem_wait(Semaphore) != 0)
+    {
+        // NOTE: Interrupted by a signal, try again
+    }
+}
+
+internal void
+LinuxReleaseSemaphore(platform_semaphore_handle Handle, int Count, int *PreviousCount)
+{
+    sem_t *Semaphore = (sem_t *)Handle.Opaque;
+    if (PreviousCount)
+    {
+        sem_getvalue(Semaphore, PreviousCount);
+    }
+    for (int I = 0; I < Count; ++I)
+    {
+        sem_post(Semaphore);
+    }
+}
+
+struct linux_thread_data
+{
+    platform_semaphore_handle Semaphore;
+    platform_thread_proc Proc;
+    void *UserData;
+};
+
+internal void *
+LinuxThreadProc(void *Param)
+{
+    linux_thread_data *LinuxData = (linux_thread_data *)Param;
+
+    platform_semaphore_handle Semaphore = LinuxData->Semaphore;
+    platform_thread_proc Proc = LinuxData->Proc;
+    void *UserData = LinuxData->UserData;
+
+    Proc(UserData, Semaphore);
+
+    return nullptr;
+}
+
+internal platform_thread_handle
+LinuxCreateThread(platform_thread_proc Proc, void *UserData)
+{
+    local_persist platform_semaphore_handle ThreadStartSemaphore;
+    if (!ThreadStartSemaphore.Opaque)
+    {
+        ThreadStartSemaphore = LinuxCreateSemaphore(0, 1);
+    }
+
+    linux_thread_data LinuxThreadData =
+    {
+        .Semaphore = ThreadStartSemaphore,
+        .Proc      = Proc,
+        .UserData  = UserData,
+    };
+
+    pthread_t Thread;
+    pthread_create(&Thread, nullptr, LinuxThreadProc, &LinuxThreadData);
+    pthread_detach(Thread);
+
+    platform_thread_handle Result =
+    {
+        .Opaque = (void *)Thread,
+    };
+
+    LinuxWaitOnSemaphore(LinuxThreadData.Semaphore);
+
+    return Result;
+}
+
+//
+//
+//
+
+internal f64
+LinuxGetSeconds(void)
+{
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    f64 Result = (f64)Time.tv_sec + 1.0e-9*(f64)Time.tv_nsec;
+    return Result;
+}
+
+internal void
+LinuxResizeImageBuffer(app_imagebuffer *ImageBuffer, u32 W, u32 H)
+{
+    ImageBuffer->W = W;
+    ImageBuffer->H = H;
+    ImageBuffer->Backbuffer = (app_pixel *)LinuxAllocate(sizeof(app_pixel)*W*H, 0, LOCATION_STRING("Linux Backbuffer"));
+    ImageBuffer->Frontbuffer = (app_pixel *)LinuxAllocate(sizeof(app_pixel)*W*H, 0, LOCATION_STRING("Linux Frontbuffer"));
+}
+
+internal bool
+LinuxWriteImage(const char *FileName, app_imagebuffer *ImageBuffer)
+{
+    // NOTE: Writes the accumulated image, divided through by the sample count, as a PFM. Rows in a PFM
+    //       go bottom to top, which is the same order the image buffer is in.
+    bool Result = false;
+
+    char Header[64];
+    int HeaderSize = snprintf(Header, sizeof(Header), "PF\n%u %u\n-1.0\n", ImageBuffer->W, ImageBuffer->H);
+
+    usize PixelCount = (usize)ImageBuffer->W*ImageBuffer->H;
+    usize Size = (usize)HeaderSize + 3*sizeof(f32)*PixelCount;
+
+    u8 *Data = (u8 *)LinuxAllocate(Size, 0, LOCATION_STRING("Linux Image Output"));
+    if (Data)
+    {
+        CopySize((usize)HeaderSize, Header, Data);
+
+        f32 *Dst = (f32 *)(Data + HeaderSize);
+        for (usize I = 0; I < PixelCount; ++I)
+        {
+            app_pixel Pixel = ImageBuffer->Backbuffer[I];
+            f32 RcpW = (Pixel.w > 0.0f ? 1.0f / Pixel.w : 0.0f);
+            *Dst++ = RcpW*Pixel.r;
+            *Dst++ = RcpW*Pixel.g;
+            *Dst++ = RcpW*Pixel.b;
+        }
+
+        Result = LinuxWriteEntireFile(FileName, string_u8 { .Count = Size, .Data = Data });
+        LinuxDeallocate(Data);
+    }
+
+    return Result;
+}
+
+internal bool
+LinuxExportTrace(app_links *Links, const char *FileName)
+{
+    // NOTE: Succeeds trivially if no trace was asked for
+    bool Result = true;
+    if (FileName)
+    {
+        Result = (Links->AppExportTrace && Links->AppExportTrace(FileName));
+        fprintf(stderr, (Result ? "Wrote %s\n" : "Could not write %s\n"), FileName);
+    }
+    return Result;
+}
+
+internal bool
+ParseOptions(int ArgumentCount, char **Arguments, linux_options *Options)
+{
+    bool Result = true;
+    for (int ArgumentIndex = 1; ArgumentIndex < ArgumentCount; ++ArgumentIndex)
+    {
+        char *Argument = Arguments[ArgumentIndex];
+        if (strcmp(Argument, "-benchmark") == 0)
+        {
+            Options->Benchmark = true;
+            continue;
+        }
+        if (strcmp(Argument, "-test") == 0)
+        {
+            Options->Test = true;
+            continue;
+        }
+
+        char *Value = (ArgumentIndex + 1 < ArgumentCount ? Arguments[ArgumentIndex + 1] : nullptr);
+
+        if (!Value)
+        {
+            fprintf(stderr, "Missing value for argument '%s'\n", Argument);
+            Result = false;
+            break;
+        }
+
+        if      (strcmp(Argument, "-width") == 0)   Options->W = (u32)atoi(Value);
+        else if (strcmp(Argument, "-height") == 0)  Options->H = (u32)atoi(Value);
+        else if (strcmp(Argument, "-passes") == 0)  Options->PassCount = (u32)atoi(Value);
+        else if (strcmp(Argument, "-seconds") == 0) Options->TimeBudget = atof(Value);
+        else if (strcmp(Argument, "-threads") == 0) Options->ThreadCount = (u32)atoi(Value);
+        else if (strcmp(Argument, "-out") == 0)     Options->OutputFileName = Value;
+        else if (strcmp(Argument, "-trace") == 0)   Options->TraceFileName = Value;
+        else if (strcmp(Argument, "-mesh") == 0)    Options->MeshFileName = Value;
+        else
+        {
+            fprintf(stderr, "Unknown argument '%s'\n", Argument);
+            Result = false;
+            break;
+        }
+
+        ++ArgumentIndex;
+    }
+    return Result;
+}
+
+int
+main(int ArgumentCount, char **Arguments)
+{
+    G_LinuxState.AllocationSentinel.Next = &G_LinuxState.AllocationSentinel;
+    G_LinuxState.AllocationSentinel.Prev = &G_LinuxState.AllocationSentinel;
+
+    platform_api API =
+    {
+        .Reserve = LinuxReserve,
+        .Commit = LinuxCommit,
+        .Allocate = LinuxAllocate,
+        .Deallocate = LinuxDeallocate,
+        .ReadEntireFile = LinuxReadEntireFile,
+        .WriteEntireFile = LinuxWriteEntireFile,
+        .MapFile = LinuxMapFile,
+        .UnmapFile = LinuxUnmapFile,
+        .GetFileInfo = LinuxGetFileInfo,
+        .CreateThread = LinuxCreateThread,
+        .CreateSemaphore = LinuxCreateSemaphore,
+        .WaitOnSemaphore = LinuxWaitOnSemaphore,
+        .ReleaseSemaphore = LinuxReleaseSemaphore,
+        .GetSeconds = LinuxGetSeconds,
+        .PageSize = (usize)sysconf(_SC_PAGESIZE),
+        .LogicalCoreCount = (u32)sysconf(_SC_NPROCESSORS_ONLN),
+    };
+    Platform = API;
+
+    app_links Links = AppLinks();
+
+    // NOTE: Zeroes get replaced with defaults once we know whether this is a benchmark run
+    linux_options Options = {};
+
+    if (!ParseOptions(ArgumentCount, Arguments, &Options))
+    {
+        fprintf(stderr, "Usage: %s [-benchmark] [-test] [-width W] [-height H] [-passes N] [-seconds S] [-threads T] [-out file] [-trace file.json] [-mesh file.obj|ply]\n", Arguments[0]);
+        return -1;
+    }
+
+    app_init_params Params =
+    {
+        .WindowTitle = "Unnamed Window",
+        .WindowW = 1280,
+        .WindowH = 720,
+        .MeshFileName = Options.MeshFileName,
+    };
+
+    if (Links.AppInit)
+    {
+        Links.AppInit(&Params);
+    }
+
+    if (Options.ThreadCount)
+    {
+        API.LogicalCoreCount = Options.ThreadCount;
+        Platform = API;
+    }
+
+    if (Options.Test)
+    {
+        return (Links.AppTest ? Links.AppTest(API) : -1);
+    }
+
+    if (Options.Benchmark)
+    {
+        app_benchmark_params BenchmarkParams =
+        {
+            .W = (Options.W ? Options.W : 640),
+            .H = (Options.H ? Options.H : 360),
+            .SampleCount = (Options.PassCount ? Options.PassCount : 16),
+            .OutputFileName = (Options.OutputFileName ? Options.OutputFileName : "benchmark.csv"),
+        };
+
+        int ExitCode = -1;
+        if (Links.AppBenchmark)
+        {
+            ExitCode = Links.AppBenchmark(API, &BenchmarkParams);
+        }
+
+        if (!LinuxExportTrace(&Links, Options.TraceFileName))
+        {
+            ExitCode = -1;
+        }
+        return ExitCode;
+    }
+
+    if (!Options.W)              Options.W = (u32)Params.WindowW;
+    if (!Options.H)              Options.H = (u32)Params.WindowH;
+    if (!Options.PassCount)      Options.PassCount = 64;
+    if (!Options.OutputFileName) Options.OutputFileName = "ray.pfm";
+
+    app_input Input = {};
+    Input.TargetPassCount = Options.PassCount;
+
+    app_imagebuffer ImageBuffer = {};
+    LinuxResizeImageBuffer(&ImageBuffer, Options.W, Options.H);
+
+    app_render_commands RenderCommands = {};
+    RenderCommands.CommandBufferSize = Megabytes(1);
+    RenderCommands.CommandBuffer = (char *)LinuxAllocate(RenderCommands.CommandBufferSize, MemFlag_NoLeakCheck,
+                                                         LOCATION_STRING("Linux Render Commands"));
+
+    fprintf(stderr, "Rendering %ux%u with %u threads\n", Options.W, Options.H, API.LogicalCoreCount);
+
+    f64 StartTime = LinuxGetSeconds();
+    f64 LastTickTime = StartTime;
+    for (;;)
+    {
+        f64 Now = LinuxGetSeconds();
+        Input.FrameTime = (f32)(Now - LastTickTime);
+        LastTickTime = Now;
+
+        RenderCommands.CommandBufferAt = 0;
+        if (Links.AppTick)
+        {
+            Links.AppTick(API, &Input, &ImageBuffer, &RenderCommands);
+        }
+
+        f64 SecondsElapsed = LinuxGetSeconds() - StartTime;
+
+        // NOTE: With adaptive sampling, the app can decide every pixel is done before we hit the pass count
+        if (Input.ExitRequested || Input.Converged ||
+            (Options.PassCount && (Input.FinishedPassCount >= Options.PassCount)) ||
+            ((Options.TimeBudget > 0.0) && (SecondsElapsed >= Options.TimeBudget)))
+        {
+            break;
+        }
+
+        struct timespec SleepTime = { 0, 1000000 };
+        nanosleep(&SleepTime, nullptr);
+    }
+
+    if (Links.AppExit)
+    {
+        Links.AppExit(&Input);
+    }
+
+    f64 SecondsElapsed = LinuxGetSeconds() - StartTime;
+    fprintf(stderr, "Rendered %u passes in %fs%s\n", Input.FinishedPassCount, SecondsElapsed,
+            (Input.Converged ? ", every tile converged" : ""));
+
+    int ExitCode = 0;
+    if (LinuxWriteImage(Options.OutputFileName, &ImageBuffer))
+    {
+        fprintf(stderr, "Wrote %s\n", Options.OutputFileName);
+    }
+    else
+    {
+        fprintf(stderr, "Could not write %s\n", Options.OutputFileName);
+        ExitCode = -1;
+    }
+
+    if (!LinuxExportTrace(&Links, Options.TraceFileName))
+    {
+        ExitCode = -1;
+    }
+
+    return ExitCode;
+}
@@ -0,0 +1,49 @@
+#ifndef LINUX_RAY_H
+#define LINUX_RAY_H
+
+#include "ray_platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+global platform_api Platform;
+
+#include "ray_handmade_math.h"
+#include "ray_arena.h"
+
+struct linux_allocation_header
+{
+    linux_allocation_header *Next, *Prev;
+    usize Size;
+    char *Base;
+    u32 Flags;
+    const char *Tag;
+};
+
+struct linux_state
+{
+    linux_allocation_header AllocationSentinel;
+};
+
+struct linux_options
+{
+    bool Benchmark;
+    bool Test;
+    u32 W, H;
+    u32 PassCount;
+    f64 TimeBudget;
+    u32 ThreadCount;
+    const char *OutputFileName;
+    const char *TraceFileName;
+    const char *MeshFileName;
+};
+
+#endif /* LINUX_RAY_H */
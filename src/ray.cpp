@@ -1,13 +1,22 @@
 #include "microui.c"
 
 #include "ray.h"
+#include "ray_parallel.cpp"
 #include "ray_assets.cpp"
+#include "ray_bvh.cpp"
 #include "ray_render_context.cpp"
+#include "ray_profiler.cpp"
 
 #define EPSILON 0.001f
+#define MAX_BOUNCE_COUNT 8
+
+// NOTE: After a diffuse bounce the footprint that picks the IBL mip is the solid angle the bounce
+//       pdf gives each sample, as if this many samples had shared it
+#define DIFFUSE_FOOTPRINT_SAMPLE_COUNT 256.0f
 
 global bool FpsLook;
 global u32 FrameIndex;
+global thread_local ray_counters ThreadRayCounters;
 
 global mu_Context *Mu;
 global int MuKeyMap[] =
@@ -156,6 +165,294 @@ HashCoordinate(u32 X, u32 Y, u32 Z)
     return Result;
 }
 
+internal always_inline u32
+HashU32(u32 X)
+{
+    // SOURCE: https://nullprogram.com/blog/2018/07/31/ (lowbias32)
+    X ^= X >> 16;
+    X *= 0x7feb352d;
+    X ^= X >> 15;
+    X *= 0x846ca68b;
+    X ^= X >> 16;
+    return X;
+}
+
+internal always_inline u32
+HashCombine(u32 Seed, u32 Value)
+{
+    u32 Result = Seed ^ (Value + 0x9e3779b9 + (Seed << 6) + (Seed >> 2));
+    return Result;
+}
+
+internal u64
+HashBytes(string_u8 Data)
+{
+    // NOTE: Only used to tell whether a file changed, so it's the xxHash64 round on one accumulator
+    //       rather than the whole thing
+    // SOURCE: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+    u64 Prime1 = 0x9e3779b185ebca87ull;
+    u64 Prime2 = 0xc2b2ae3d27d4eb4full;
+
+    u64 Acc = Prime1 ^ (u64)Data.Count;
+    usize At = 0;
+    for (; At + 8 <= Data.Count; At += 8)
+    {
+        u64 Word;
+        memcpy(&Word, Data.Data + At, sizeof(Word));
+        Acc += Word*Prime2;
+        Acc = (Acc << 31) | (Acc >> 33);
+        Acc *= Prime1;
+    }
+    for (; At < Data.Count; ++At)
+    {
+        Acc = (Acc ^ Data.Data[At])*Prime1;
+    }
+
+    Acc ^= Acc >> 33;
+    Acc *= Prime2;
+    Acc ^= Acc >> 29;
+    return Acc;
+}
+
+internal always_inline lane_u32
+Xorshift(random_series_lane *Series)
+{
+    lane_u32 X = Series->State;
+    X ^= X << 13;
+    X ^= X >> 17;
+    X ^= X << 5;
+    return Series->State = X;
+}
+
+internal always_inline lane_f32
+UnilateralFromU32(lane_u32 X)
+{
+    lane_f32 Result = ConvertToF32(X >> 8)*LaneF32(0x1.0p-24f);
+    return Result;
+}
+
+internal always_inline lane_f32
+RandomUnilateral(random_series_lane *Series)
+{
+    return UnilateralFromU32(Xorshift(Series));
+}
+
+internal always_inline lane_f32
+RandomBilateral(random_series_lane *Series)
+{
+    return LaneF32(-1.0f) + LaneF32(2.0f)*UnilateralFromU32(Xorshift(Series));
+}
+
+internal random_series_lane
+RandomSeriesLane(u32 Seed)
+{
+    // NOTE: Xorshift gets stuck on a zero state, hence the low bit
+    alignas(32) u32 States[LANE_WIDTH];
+    for (u32 LaneIndex = 0; LaneIndex < LANE_WIDTH; ++LaneIndex)
+    {
+        States[LaneIndex] = HashU32(Seed + LaneIndex*0x9e3779b9) | 1;
+    }
+
+    random_series_lane Result = { LoadU32(States) };
+    return Result;
+}
+
+internal void
+RefillRandomBatch(random_batch *Batch)
+{
+    for (u32 Offset = 0; Offset < RANDOM_BATCH_SIZE; Offset += LANE_WIDTH)
+    {
+        StoreF32(Batch->Values + Offset, RandomUnilateral(&Batch->Series));
+    }
+    Batch->Next = 0;
+}
+
+internal void
+InitRandomBatch(random_batch *Batch, u32 Seed)
+{
+    Batch->Series = RandomSeriesLane(Seed);
+    RefillRandomBatch(Batch);
+}
+
+internal always_inline f32
+RandomUnilateral(random_batch *Batch)
+{
+    if (Batch->Next == RANDOM_BATCH_SIZE)
+    {
+        RefillRandomBatch(Batch);
+    }
+    return Batch->Values[Batch->Next++];
+}
+
+internal always_inline u32
+ReverseBits(u32 X)
+{
+    X = ((X >> 1) & 0x55555555) | ((X & 0x55555555) << 1);
+    X = ((X >> 2) & 0x33333333) | ((X & 0x33333333) << 2);
+    X = ((X >> 4) & 0x0f0f0f0f) | ((X & 0x0f0f0f0f) << 4);
+    X = ((X >> 8) & 0x00ff00ff) | ((X & 0x00ff00ff) << 8);
+    X = (X >> 16) | (X << 16);
+    return X;
+}
+
+// NOTE: The second dimension of Sobol, which together with the van der Corput sequence in the
+//       first makes a (0, 2) sequence. Every sampler dimension reuses the pair with its own
+//       scramble, rather than going further up the sequence.
+global constexpr u32 SobolDirections[32] =
+{
+    0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+    0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+    0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+    0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff,
+};
+
+struct sobol_byte_table
+{
+    u32 Entries[4][256];
+};
+
+internal constexpr sobol_byte_table
+BuildSobolByteTable(void)
+{
+    sobol_byte_table Result = {};
+    for (u32 Byte = 0; Byte < 4; ++Byte)
+    {
+        for (u32 Value = 0; Value < 256; ++Value)
+        {
+            for (u32 Bit = 0; Bit < 8; ++Bit)
+            {
+                if (Value & (1 << Bit))
+                {
+                    Result.Entries[Byte][Value] ^= SobolDirections[8*Byte + Bit];
+                }
+            }
+        }
+    }
+    return Result;
+}
+
+// NOTE: The shuffled index uses all 32 bits, so walking it bit by bit costs 32 iterations of an
+//       unpredictable branch per draw. Doing it a byte at a time out of a table is four loads.
+global constexpr sobol_byte_table SobolByteTable = BuildSobolByteTable();
+
+internal always_inline u32
+SobolSample1(u32 Index)
+{
+    u32 Result = (SobolByteTable.Entries[0][(Index >>  0) & 0xff] ^
+                  SobolByteTable.Entries[1][(Index >>  8) & 0xff] ^
+                  SobolByteTable.Entries[2][(Index >> 16) & 0xff] ^
+                  SobolByteTable.Entries[3][(Index >> 24) & 0xff]);
+    return Result;
+}
+
+internal always_inline u32
+LaineKarrasPermutation(u32 X, u32 Seed)
+{
+    // SOURCE: https://psychopath.io/post/2021_01_30_building_a_better_lk_hash
+    X += Seed;
+    X ^= X*0x6c50b47c;
+    X ^= X*0xb82f1e52;
+    X ^= X*0xc7afe638;
+    X ^= X*0x8d22f6e6;
+    return X;
+}
+
+internal always_inline u32
+NestedUniformScramble(u32 X, u32 Seed)
+{
+    // SOURCE: Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+    X = ReverseBits(LaineKarrasPermutation(ReverseBits(X), Seed));
+    return X;
+}
+
+internal always_inline void
+BeginPixelSample(sampler *Sampler, u32 Type, random_batch *Batch, image_u32 *BlueNoise,
+                 u32 PixelX, u32 PixelY, u32 SampleIndex)
+{
+    Sampler->Type = Type;
+    Sampler->ScrambleSeed = (BlueNoise ? 0 : HashU32(PixelX ^ HashU32(PixelY)));
+    Sampler->SampleIndex = SampleIndex;
+    Sampler->Dimension = 0;
+    Sampler->Batch = Batch;
+    Sampler->BlueNoise = BlueNoise;
+    Sampler->PixelX = PixelX;
+    Sampler->PixelY = PixelY;
+}
+
+internal always_inline u32
+BlueNoiseTexel(sampler *Sampler, u32 Seed)
+{
+    // NOTE: Each dimension looks at the mask through its own toroidal shift, which keeps the
+    //       rotations blue within a dimension without them lining up across dimensions.
+    //       The mask is a power of two in both directions, see LoadBlueNoise.
+    image_u32 *Mask = Sampler->BlueNoise;
+    u32 X = (Sampler->PixelX + Seed) & (Mask->W - 1);
+    u32 Y = (Sampler->PixelY + (Seed >> 16)) & (Mask->H - 1);
+    u32 Result = Mask->Pixels[Y*Mask->W + X];
+    return Result;
+}
+
+internal always_inline vec2
+SampleUnilateralVec2(sampler *Sampler)
+{
+    vec2 Result;
+    if (Sampler->Type == Sampler_Sobol)
+    {
+        // NOTE: Shuffling the index too keeps the dimensions from lining up with each other
+        u32 Seed = HashU32(HashCombine(Sampler->ScrambleSeed, Sampler->Dimension++));
+        u32 Index = NestedUniformScramble(Sampler->SampleIndex, Seed);
+        // NOTE: The first dimension is the bit reversed index, so its reversal in the scramble cancels
+        u32 X = ReverseBits(LaineKarrasPermutation(Index, HashCombine(Seed, 0)));
+        u32 Y = NestedUniformScramble(SobolSample1(Index), HashCombine(Seed, 1));
+        if (Sampler->BlueNoise)
+        {
+            // NOTE: Rotates by the red and green of the texel. A plain Cranley-Patterson rotation
+            //       wraps one stratum around the ends of each dimension, which doubled the error at
+            //       4 spp. Its base 2 version, xor-ing in the offset, keeps the strata intact.
+            u32 Texel = BlueNoiseTexel(Sampler, Seed);
+            X ^= (Texel << 8) & 0xff000000;
+            Y ^= (Texel << 16) & 0xff000000;
+        }
+        Result = Vec2(UnilateralFromU32(X), UnilateralFromU32(Y));
+    }
+    else
+    {
+        Result.X = RandomUnilateral(Sampler->Batch);
+        Result.Y = RandomUnilateral(Sampler->Batch);
+    }
+    return Result;
+}
+
+internal always_inline f32
+SampleUnilateral(sampler *Sampler)
+{
+    f32 Result;
+    if (Sampler->Type == Sampler_Sobol)
+    {
+        u32 Seed = HashU32(HashCombine(Sampler->ScrambleSeed, Sampler->Dimension++));
+        u32 Index = NestedUniformScramble(Sampler->SampleIndex, Seed);
+        u32 X = ReverseBits(LaineKarrasPermutation(Index, HashCombine(Seed, 0)));
+        if (Sampler->BlueNoise)
+        {
+            X ^= (BlueNoiseTexel(Sampler, Seed) << 8) & 0xff000000;
+        }
+        Result = UnilateralFromU32(X);
+    }
+    else
+    {
+        Result = RandomUnilateral(Sampler->Batch);
+    }
+    return Result;
+}
+
+internal always_inline vec2
+SampleBilateralVec2(sampler *Sampler)
+{
+    vec2 Result = SampleUnilateralVec2(Sampler);
+    Result = Vec2(-1.0f + 2.0f*Result.X, -1.0f + 2.0f*Result.Y);
+    return Result;
+}
+
 internal always_inline void
 GetTangents(vec3 N, vec3* B1, vec3* B2)
 {
@@ -181,10 +478,13 @@ MapToHemisphere(vec3 N, vec2 Sample) {
 	f32 Azimuth = Tau32*Sample.X;
 	f32 Y       = Sample.Y;
 
+    f32 SinAzimuth, CosAzimuth;
+    FastSinCosF(Azimuth, &SinAzimuth, &CosAzimuth);
+
     vec3 Hemi;
-    Hemi.X = CosF(Azimuth)*SquareRootF(1.0f - Y*Y);
+    Hemi.X = CosAzimuth*SquareRootF(1.0f - Y*Y);
     Hemi.Y = Y;
-    Hemi.Z = SinF(Azimuth)*SquareRootF(1.0f - Y*Y);
+    Hemi.Z = SinAzimuth*SquareRootF(1.0f - Y*Y);
 
     vec3 Result = OrientedAroundNormal(Hemi, N);
     return Result;
@@ -195,15 +495,38 @@ MapToCosineWeightedHemisphere(vec3 N, vec2 Sample) {
 	f32 Azimuth = Tau32*Sample.X;
 	f32 Y       = Sample.Y;
 
+    f32 SinAzimuth, CosAzimuth;
+    FastSinCosF(Azimuth, &SinAzimuth, &CosAzimuth);
+
     vec3 Hemi;
-    Hemi.X = CosF(Azimuth)*SquareRootF(1.0f - Y);
+    Hemi.X = CosAzimuth*SquareRootF(1.0f - Y);
     Hemi.Y = SquareRootF(Y);
-    Hemi.Z = SinF(Azimuth)*SquareRootF(1.0f - Y);
+    Hemi.Z = SinAzimuth*SquareRootF(1.0f - Y);
 
     vec3 Result = OrientedAroundNormal(Hemi, N);
     return Result;
 }
 
+internal always_inline vec3
+MapToCone(vec3 N, f32 OneMinusCosThetaMax, vec2 Sample) {
+    // NOTE: Uniform over the solid angle of the cone around N. Taking 1 - CosThetaMax rather than
+    //       CosThetaMax keeps precision for narrow cones.
+	f32 Azimuth = Tau32*Sample.X;
+	f32 Y       = 1.0f - Sample.Y*OneMinusCosThetaMax;
+    f32 SinTheta = SquareRootF(MaxF(0.0f, 1.0f - Y*Y));
+
+    f32 SinAzimuth, CosAzimuth;
+    FastSinCosF(Azimuth, &SinAzimuth, &CosAzimuth);
+
+    vec3 Cone;
+    Cone.X = CosAzimuth*SinTheta;
+    Cone.Y = Y;
+    Cone.Z = SinAzimuth*SinTheta;
+
+    vec3 Result = OrientedAroundNormal(Cone, N);
+    return Result;
+}
+
 internal always_inline bool
 RayIntersectPlane(vec3 RayP, vec3 RayD, vec3 PlaneNormal, f32 PlaneDistance, f32 *tOut)
 {
@@ -249,349 +572,3118 @@ RayIntersectSphere(vec3 RayP, vec3 RayD, vec3 SphereO, f32 SphereR, f32 *tOut)
 }
 
 template <bool ShadowRay>
-internal always_inline bool
-TraceSceneInternal(scene *Scene, vec3 RayP, vec3 RayD, f32 *tOut, u32 *OutHitMaterial, vec3 *OutHitNormal)
+internal always_inline s32
+RayIntersectSphereBlock(lane_v3 RayP, lane_v3 RayD, sphere_block *Block, f32 *tOut)
 {
-    u32 HitMaterial = 0;
-    vec3 HitNormal = {};
-    f32 t = *tOut;
+    // NOTE: Returns the block lane of the closest hit below *tOut, or -1. Shadow rays return 0 on
+    //       any hit without bothering to find the closest one.
+    s32 Result = -1;
+
+    lane_f32 Zero = LaneF32(0.0f);
+    lane_f32 Epsilon = LaneF32(EPSILON);
+    lane_f32 tMax = LaneF32(*tOut);
+    lane_f32 tMiss = LaneF32(F32_MAX);
+
+    lane_f32 tBest = tMiss;
+    lane_f32 tHits[SPHERE_BLOCK_WIDTH / LANE_WIDTH];
 
-    for (usize I = 1; I < Scene->PlaneCount; ++I)
+    for (u32 Sub = 0; Sub < SPHERE_BLOCK_WIDTH / LANE_WIDTH; ++Sub)
     {
-        plane *Plane = &Scene->Planes[I];
-        if (RayIntersectPlane(RayP, RayD, Plane->N, Plane->d, &t))
+        u32 Offset = Sub*LANE_WIDTH;
+        lane_v3 SphereP = LaneV3(LoadF32(Block->X + Offset),
+                                 LoadF32(Block->Y + Offset),
+                                 LoadF32(Block->Z + Offset));
+        lane_f32 SphereRSq = LoadF32(Block->RSq + Offset);
+
+        lane_v3 SphereRelO = RayP - SphereP;
+        lane_f32 B = Dot(RayD, SphereRelO);
+        lane_f32 C = Dot(SphereRelO, SphereRelO) - SphereRSq;
+        lane_f32 Discr = MulAdd(B, B, -C);
+        lane_f32 DiscrRoot = SquareRoot(Max(Discr, Zero));
+        lane_f32 tN = -B - DiscrRoot;
+        lane_f32 tF = DiscrRoot - B;
+        lane_f32 t = Select(tN >= Zero, tN, tF);
+
+        lane_u32 HitMask = (Discr >= Zero) & (t >= Epsilon) & (t < tMax);
+        if constexpr(ShadowRay)
         {
-            if constexpr(ShadowRay)
+            if (!MaskIsZeroed(HitMask))
             {
-                return true;
+                return 0;
             }
-            HitMaterial = Plane->Material;
-            HitNormal = Plane->N;
+        }
+        else
+        {
+            tHits[Sub] = Select(HitMask, t, tMiss);
+            tBest = Min(tBest, tHits[Sub]);
         }
     }
 
-    for (usize I = 1; I < Scene->SphereCount; ++I)
+    if constexpr(!ShadowRay)
     {
-        sphere *Sphere = &Scene->Spheres[I];
-        if (RayIntersectSphere(RayP, RayD, Sphere->P, Sphere->r, &t))
+        f32 t = HorizontalMin(tBest);
+        if (t < *tOut)
         {
-            if constexpr(ShadowRay)
+            lane_f32 tLane = LaneF32(t);
+            for (u32 Sub = 0; Sub < SPHERE_BLOCK_WIDTH / LANE_WIDTH; ++Sub)
             {
-                return true;
+                u32 LaneBits = MoveMask(tHits[Sub] == tLane);
+                if (LaneBits)
+                {
+                    Result = (s32)(Sub*LANE_WIDTH + __builtin_ctz(LaneBits));
+                    break;
+                }
             }
-            HitMaterial = Sphere->Material;
-            HitNormal = Normalize(RayP + t*RayD - Sphere->P);
+            *tOut = t;
         }
     }
 
-    *tOut = t;
-    if (OutHitMaterial)
-    {
-        *OutHitMaterial = HitMaterial;
-    }
-    if (OutHitNormal)
-    {
-        *OutHitNormal = HitNormal;
-    }
-
-    return !!HitMaterial;
+    return Result;
 }
 
-internal always_inline bool
-TraceScene(scene *Scene, vec3 RayP, vec3 RayD, f32 *tOut, u32 *OutHitMaterial, vec3 *OutHitNormal)
+internal always_inline triangle_ray
+TriangleRay(vec3 RayD)
 {
-    return TraceSceneInternal<false>(Scene, RayP, RayD, tOut, OutHitMaterial, OutHitNormal);
-}
+    triangle_ray Result;
 
-internal always_inline bool
-Occluded(scene *Scene, vec3 RayP, vec3 RayD, f32 max_t)
-{
-    return TraceSceneInternal<true>(Scene, RayP, RayD, &max_t, nullptr, nullptr);
+    vec3 AbsD = Vec3(AbsoluteValueF(RayD.X), AbsoluteValueF(RayD.Y), AbsoluteValueF(RayD.Z));
+    Result.KZ = ((AbsD.X > AbsD.Y) ? ((AbsD.X > AbsD.Z) ? 0 : 2) : ((AbsD.Y > AbsD.Z) ? 1 : 2));
+    Result.KX = (Result.KZ + 1) % 3;
+    Result.KY = (Result.KX + 1) % 3;
+    if (RayD[Result.KZ] < 0.0f)
+    {
+        Swap(Result.KX, Result.KY);
+    }
+
+    Result.ShearZ = 1.0f / RayD[Result.KZ];
+    Result.ShearX = RayD[Result.KX]*Result.ShearZ;
+    Result.ShearY = RayD[Result.KY]*Result.ShearZ;
+    return Result;
 }
 
-internal always_inline f32
-FresnelDielectric(f32 CosThetaI, f32 EtaI, f32 EtaT, f32 EtaIOverEtaT, f32 *OutCosThetaT)
+internal always_inline bool
+RayIntersectTriangle(vec3 RayP, triangle_ray *Ray, vec3 P0, vec3 P1, vec3 P2, f32 *tOut, f32 *OutU, f32 *OutV)
 {
-    // SOURCE: http://www.pbr-book.org/3ed-2018/Reflection_Models/Specular_Reflection_and_Transmission.html#fragment-ComputemonocosThetaTusingSnellslaw-0
-
-    // NOTE: Compute CosThetaT using snell's law
-    f32 SinThetaI = SquareRootF(MaxF(0.0f, 1.0f - CosThetaI*CosThetaI));
-    f32 SinThetaT = EtaIOverEtaT*SinThetaI;
-    f32 CosThetaT = SquareRootF(MaxF(0.0f, 1.0f - SinThetaT*SinThetaT));
+    // NOTE: Edges shared by two triangles are hit by exactly one of them, so rays can't slip through
+    //       the seams of a closed mesh. U and V are the barycentric weights of P0 and P1.
+    vec3 A = P0 - RayP;
+    vec3 B = P1 - RayP;
+    vec3 C = P2 - RayP;
+
+    f32 Ax = A[Ray->KX] - Ray->ShearX*A[Ray->KZ];
+    f32 Ay = A[Ray->KY] - Ray->ShearY*A[Ray->KZ];
+    f32 Bx = B[Ray->KX] - Ray->ShearX*B[Ray->KZ];
+    f32 By = B[Ray->KY] - Ray->ShearY*B[Ray->KZ];
+    f32 Cx = C[Ray->KX] - Ray->ShearX*C[Ray->KZ];
+    f32 Cy = C[Ray->KY] - Ray->ShearY*C[Ray->KZ];
+
+    f32 U = Cx*By - Cy*Bx;
+    f32 V = Ax*Cy - Ay*Cx;
+    f32 W = Bx*Ay - By*Ax;
+
+    if ((U == 0.0f) || (V == 0.0f) || (W == 0.0f))
+    {
+        // NOTE: Right on an edge the sign of the f32 products can't be trusted, so redo them in f64
+        U = (f32)((f64)Cx*(f64)By - (f64)Cy*(f64)Bx);
+        V = (f32)((f64)Ax*(f64)Cy - (f64)Ay*(f64)Cx);
+        W = (f32)((f64)Bx*(f64)Ay - (f64)By*(f64)Ax);
+    }
 
-    *OutCosThetaT = CosThetaT;
+    if (((U < 0.0f) || (V < 0.0f) || (W < 0.0f)) &&
+        ((U > 0.0f) || (V > 0.0f) || (W > 0.0f)))
+    {
+        return false;
+    }
 
-    // NOTE: Handle total internal reflection
-    if (SinThetaT >= 1)
+    f32 Det = U + V + W;
+    if (Det == 0.0f)
     {
-        return 1;
+        return false;
     }
 
-    f32 rParallel      = (((EtaT*CosThetaI) - (EtaI*CosThetaT)) /
-                          ((EtaT*CosThetaI) + (EtaI*CosThetaT)));
-    f32 rPerpendicular = (((EtaI*CosThetaI) - (EtaT*CosThetaT)) /
-                          ((EtaI*CosThetaI) + (EtaT*CosThetaT)));
+    f32 Az = Ray->ShearZ*A[Ray->KZ];
+    f32 Bz = Ray->ShearZ*B[Ray->KZ];
+    f32 Cz = Ray->ShearZ*C[Ray->KZ];
+    f32 T = U*Az + V*Bz + W*Cz;
 
-    f32 Result = 0.5f*(rParallel*rParallel + rPerpendicular*rPerpendicular);
-    return Result;
-}
+    // NOTE: Range check on the unnormalized T, so the divide only happens for actual hits
+    f32 AbsDet = AbsoluteValueF(Det);
+    f32 SignedT = CopySignF(1.0f, Det)*T;
+    if ((SignedT < EPSILON*AbsDet) || (SignedT >= *tOut*AbsDet))
+    {
+        return false;
+    }
 
-internal always_inline vec3
-Refract(vec3 D, vec3 N, f32 CosThetaI, f32 CosThetaT, f32 EtaIOverEtaT)
-{
-    vec3 Result = EtaIOverEtaT*D + N*(EtaIOverEtaT*CosThetaI - CosThetaT);
-    return Result;
+    f32 RcpDet = 1.0f / Det;
+    *tOut = T*RcpDet;
+    *OutU = U*RcpDet;
+    *OutV = V*RcpDet;
+    return true;
 }
 
-internal void
-CastRays(scene *Scene, int MinX, int MinY, int OnePastMaxX, int OnePastMaxY, app_imagebuffer *ImageBuffer)
+template <bool ShadowRay>
+internal always_inline bool
+TraceMesh(mesh *Mesh, vec3 RayP, vec3 RayInvD, triangle_ray *TriRay, f32 *tOut, u32 *OutTriangle, f32 *OutU, f32 *OutV)
 {
-    u32 W = ImageBuffer->W;
-    u32 H = ImageBuffer->H;
-    f32 RcpW = 1.0f / (f32)W;
-    f32 RcpH = 1.0f / (f32)H;
-    vec4 *Pixels = GetBackbuffer(ImageBuffer);
-
-    vec3 CamP = Scene->Camera.P;
-    vec3 CamX = Scene->Camera.X;
-    vec3 CamY = Scene->Camera.Y;
-    vec3 CamZ = Scene->Camera.Z;
+    bool Result = false;
 
-    f32 FilmDistance = 1.0f;
-    vec2 FilmDim = Vec2(1.0f, (f32)H / (f32)W);
-    vec3 FilmP = CamP - CamZ*FilmDistance;
+    bvh8 *BVH = &Mesh->BVH;
+    triangle_mesh *Geometry = Mesh->Geometry;
+    f32 t = *tOut;
 
-    vec3 DirectionalLightD = Scene->DirectionalLightD;
-    vec3 DirectionalLightEmission = Scene->DirectionalLightEmission;
+    if (!BVH->NodeCount)
+    {
+        return false;
+    }
 
-    random_series Entropy = { HashCoordinate((u32)MinX, (u32)MinY, FrameIndex) };
+    u32 StackAt = 0;
+    u32 ChildStack[BVH8_STACK_SIZE];
+    f32 tNearStack[BVH8_STACK_SIZE];
+    ChildStack[StackAt] = 0;
+    tNearStack[StackAt] = 0.0f;
+    ++StackAt;
 
-    for (ssize Y = MinY; Y < OnePastMaxY; ++Y)
+    while (StackAt > 0)
     {
-        f32 V = -1.0f + 2.0f*RcpH*(f32)Y;
-        for (ssize X = MinX; X < OnePastMaxX; ++X)
+        --StackAt;
+        u32 Child = ChildStack[StackAt];
+        if (tNearStack[StackAt] >= t)
         {
-            f32 U = -1.0f + 2.0f*RcpW*(f32)X;
-
-            vec2 AAJitter = RandomBilateralVec2(&Entropy);
-            vec2 FilmUV = Vec2(RcpW*AAJitter.X + FilmDim.X*U,
-                               RcpH*AAJitter.Y + FilmDim.Y*V);
-
-            vec3 RayP = CamP;
-            vec3 RayD = Normalize(FilmP + FilmUV.X*CamX + FilmUV.Y*CamY - CamP);
-
-            vec3 TotalColor = Vec3(0, 0, 0);
-            vec3 Throughput = Vec3(1, 1, 1);
+            continue;
+        }
 
-            usize MaxBounceIndex = 8;
-            for (usize BounceIndex = 0; BounceIndex < MaxBounceIndex; ++BounceIndex)
+        if (Child & BVH8_LEAF_BIT)
+        {
+            u32 First = Child & BVH8_LEAF_FIRST_MASK;
+            u32 Count = ((Child & ~BVH8_LEAF_BIT) >> BVH8_LEAF_COUNT_SHIFT) + 1;
+            for (u32 Triangle = First; Triangle < First + Count; ++Triangle)
             {
-                f32 t = F32_MAX;
-                u32 HitMaterial;
-                vec3 N;
-                if (TraceScene(Scene, RayP, RayD, &t, &HitMaterial, &N))
+                u32 *Indices = Geometry->Indices + 3*(usize)Triangle;
+                f32 U, V;
+                if (RayIntersectTriangle(RayP, TriRay,
+                                         Geometry->Positions[Indices[0]],
+                                         Geometry->Positions[Indices[1]],
+                                         Geometry->Positions[Indices[2]], &t, &U, &V))
                 {
-                    vec3 HitP = RayP + t*RayD;
-                    f32 CosThetaI = -Dot(N, RayD);
-
-                    if (CosThetaI < 0.0f)
+                    if constexpr(ShadowRay)
                     {
-                        N = -N;
-                        CosThetaI = -CosThetaI;
+                        return true;
                     }
+                    Result = true;
+                    *OutTriangle = Triangle;
+                    *OutU = U;
+                    *OutV = V;
+                }
+            }
+        }
+        else
+        {
+            bvh8_node *Node = &BVH->Nodes[Child];
+            f32 tNear[BVH8_WIDTH];
+            u32 HitMask = RayIntersectBVH8Node(RayP, RayInvD, Node, t, tNear);
+
+            // NOTE: Push the children that were hit farthest first, so the nearest one comes off next.
+            //       Leaves start where the ones in the slots before them end, so every slot up to the
+            //       last one that was hit gets looked at to keep count.
+            Assert(StackAt + BVH8_WIDTH <= BVH8_STACK_SIZE);
+            u32 Base = StackAt;
+            u32 TriangleAt = Node->TriangleBase;
+            for (u32 Slot = 0; HitMask >> Slot; ++Slot)
+            {
+                u32 Meta = Node->Meta[Slot];
+                u32 Value = Meta & BVH8_META_VALUE_MASK;
+                u32 Entry = Node->ChildBase + Value;
+                if (Meta & BVH8_META_LEAF)
+                {
+                    Entry = BVH8_LEAF_BIT|(Value << BVH8_LEAF_COUNT_SHIFT)|TriangleAt;
+                    TriangleAt += Value + 1;
+                }
 
-                    material *Material = &Scene->Materials[HitMaterial];
-
-                    f32 EtaI = 1.0f;
-                    f32 EtaT = Material->IOR;
-                    f32 EtaIOverEtaT = EtaI / EtaT;
-
-                    b32 IsMirror = (Material->Flags & Material_Mirror);
-                    b32 ShouldReflect = IsMirror;
-                    if (!ShouldReflect && (EtaI != EtaT))
+                if (HitMask & (1u << Slot))
+                {
+                    u32 At = StackAt++;
+                    while ((At > Base) && (tNearStack[At - 1] < tNear[Slot]))
                     {
-                        f32 CosThetaT;
-                        f32 Reflectance = FresnelDielectric(CosThetaI, EtaI, EtaT, EtaIOverEtaT, &CosThetaT);
-                        f32 ReflectTest = RandomUnilateral(&Entropy);
-                        ShouldReflect = (ReflectTest < Reflectance);
+                        ChildStack[At] = ChildStack[At - 1];
+                        tNearStack[At] = tNearStack[At - 1];
+                        --At;
                     }
+                    ChildStack[At] = Entry;
+                    tNearStack[At] = tNear[Slot];
+                }
+            }
+        }
+    }
 
-                    if (ShouldReflect)
-                    {
-                        vec3 R = Reflect(RayD, N);
-                        RayP = HitP + EPSILON*R;
-                        RayD = R;
-                        if (IsMirror)
-                        {
-                            Throughput *= Material->Albedo;
-                        }
-                    }
-                    else
+    *tOut = t;
+    return Result;
+}
+
+internal vec3
+MeshHitNormal(triangle_mesh *Geometry, u32 Triangle, f32 U, f32 V)
+{
+    // NOTE: Interpolated vertex normals if the mesh has them, the face normal if it doesn't
+    //       (or if the interpolated one comes out degenerate). In object space and not normalized.
+    vec3 Result = {};
+    if (Geometry->Normals)
+    {
+        u32 *NormalIndices = Geometry->NormalIndices + 3*(usize)Triangle;
+        Result = (U*Geometry->Normals[NormalIndices[0]] +
+                  V*Geometry->Normals[NormalIndices[1]] +
+                  (1.0f - U - V)*Geometry->Normals[NormalIndices[2]]);
+    }
+
+    if (Dot(Result, Result) < 1.0e-12f)
+    {
+        u32 *Indices = Geometry->Indices + 3*(usize)Triangle;
+        vec3 P0 = Geometry->Positions[Indices[0]];
+        Result = Cross(Geometry->Positions[Indices[1]] - P0, Geometry->Positions[Indices[2]] - P0);
+    }
+
+    return Result;
+}
+
+template <bool ShadowRay>
+internal always_inline bool
+TraceInstance(scene *Scene, u32 InstanceIndex, vec3 RayP, vec3 RayD, f32 *tOut, u32 *OutTriangle, f32 *OutU, f32 *OutV)
+{
+    // NOTE: Takes the ray into object space for the instance's mesh BVH. The object space direction
+    //       isn't renormalized, so t means the same thing on both sides.
+    instance *Instance = &Scene->Instances.Data[InstanceIndex];
+    mesh *Mesh = &Scene->Meshes.Data[Instance->Mesh];
+
+    vec3 ObjectP = TransformPoint(&Instance->WorldToObject, RayP);
+    vec3 ObjectD = TransformVector(&Instance->WorldToObject, RayD);
+    vec3 ObjectInvD = Vec3(1.0f / ObjectD.X, 1.0f / ObjectD.Y, 1.0f / ObjectD.Z);
+    triangle_ray TriRay = TriangleRay(ObjectD);
+
+    bool Result = TraceMesh<ShadowRay>(Mesh, ObjectP, ObjectInvD, &TriRay, tOut, OutTriangle, OutU, OutV);
+    return Result;
+}
+
+template <bool ShadowRay>
+internal always_inline bool
+TraceInstances(scene *Scene, vec3 RayP, vec3 RayD, vec3 RayInvD, f32 *tOut,
+               u32 *OutInstance, u32 *OutTriangle, f32 *OutU, f32 *OutV)
+{
+    // NOTE: Walks the top level like the sphere BVH, and every instance leaf goes down its mesh's BVH
+    bool Result = false;
+
+    bvh *BVH = &Scene->InstanceBVH;
+    f32 t = *tOut;
+
+    u32 StackAt = 0;
+    u32 NodeStack[BVH_MAX_DEPTH];
+    f32 tNearStack[BVH_MAX_DEPTH];
+
+    u32 NodeIndex = 0;
+    f32 tNear = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[0].Bounds, t);
+
+    while (tNear != F32_MAX)
+    {
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        if (Node->Count)
+        {
+            for (u32 I = Node->LeftFirst; I < Node->LeftFirst + Node->Count; ++I)
+            {
+                u32 InstanceIndex = BVH->Primitives[I];
+                if (TraceInstance<ShadowRay>(Scene, InstanceIndex, RayP, RayD, &t, OutTriangle, OutU, OutV))
+                {
+                    if constexpr(ShadowRay)
+                    {
+                        return true;
+                    }
+                    Result = true;
+                    *OutInstance = InstanceIndex;
+                }
+            }
+
+            tNear = F32_MAX;
+        }
+        else
+        {
+            u32 NearIndex = Node->LeftFirst;
+            u32 FarIndex = Node->LeftFirst + 1;
+            f32 tNearChild = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[NearIndex].Bounds, t);
+            f32 tFarChild = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[FarIndex].Bounds, t);
+            if (tFarChild < tNearChild)
+            {
+                Swap(NearIndex, FarIndex);
+                Swap(tNearChild, tFarChild);
+            }
+
+            if (tFarChild != F32_MAX)
+            {
+                NodeStack[StackAt] = FarIndex;
+                tNearStack[StackAt] = tFarChild;
+                ++StackAt;
+            }
+
+            NodeIndex = NearIndex;
+            tNear = tNearChild;
+        }
+
+        while ((tNear == F32_MAX) && (StackAt > 0))
+        {
+            --StackAt;
+            if (tNearStack[StackAt] < t)
+            {
+                NodeIndex = NodeStack[StackAt];
+                tNear = tNearStack[StackAt];
+            }
+        }
+    }
+
+    *tOut = t;
+    return Result;
+}
+
+internal vec3
+InstanceHitNormal(scene *Scene, u32 InstanceIndex, u32 Triangle, f32 U, f32 V)
+{
+    instance *Instance = &Scene->Instances.Data[InstanceIndex];
+    mesh *Mesh = &Scene->Meshes.Data[Instance->Mesh];
+    vec3 ObjectN = MeshHitNormal(Mesh->Geometry, Triangle, U, V);
+    vec3 Result = NormalizeFast(TransformNormal(&Instance->WorldToObject, ObjectN));
+    return Result;
+}
+
+template <bool ShadowRay>
+internal always_inline bool
+TraceSceneInternal(scene *Scene, vec3 RayP, vec3 RayD, f32 *tOut, u32 *OutHitMaterial, u32 *OutHitLight, vec3 *OutHitNormal)
+{
+    u32 HitMaterial = 0;
+    u32 HitLight = 0;
+    vec3 HitNormal = {};
+    sphere_block *HitBlock = nullptr;
+    s32 HitLane = -1;
+    u32 HitInstance = 0;
+    u32 HitTriangle = 0;
+    f32 HitU = 0.0f, HitV = 0.0f;
+    f32 t = *tOut;
+
+    ThreadRayCounters.TotalRays += 1;
+    if constexpr(ShadowRay)
+    {
+        ThreadRayCounters.ShadowRays += 1;
+    }
+
+    // NOTE: Planes are unbounded, so they stay out of the BVH
+    for (usize I = 1; I < Scene->Planes.Count; ++I)
+    {
+        plane *Plane = &Scene->Planes.Data[I];
+        if (RayIntersectPlane(RayP, RayD, Plane->N, Plane->d, &t))
+        {
+            if constexpr(ShadowRay)
+            {
+                return true;
+            }
+            HitMaterial = Plane->Material;
+            HitNormal = Plane->N;
+        }
+    }
+
+    vec3 RayInvD = Vec3(1.0f / RayD.X, 1.0f / RayD.Y, 1.0f / RayD.Z);
+
+    bvh *BVH = &Scene->SphereBVH;
+    if (BVH->NodeCount)
+    {
+        lane_v3 LaneRayP = LaneV3(RayP);
+        lane_v3 LaneRayD = LaneV3(RayD);
+
+        u32 StackAt = 0;
+        u32 NodeStack[BVH_MAX_DEPTH];
+        f32 tNearStack[BVH_MAX_DEPTH];
+
+        u32 NodeIndex = 0;
+        f32 tNear = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[0].Bounds, t);
+
+        while (tNear != F32_MAX)
+        {
+            bvh_node *Node = &BVH->Nodes[NodeIndex];
+            if (Node->Count)
+            {
+                for (usize I = Node->LeftFirst; I < Node->LeftFirst + Node->Count; ++I)
+                {
+                    sphere_block *Block = &Scene->SphereBlocks[I];
+                    s32 Lane = RayIntersectSphereBlock<ShadowRay>(LaneRayP, LaneRayD, Block, &t);
+                    if (Lane >= 0)
+                    {
+                        if constexpr(ShadowRay)
+                        {
+                            return true;
+                        }
+                        HitBlock = Block;
+                        HitLane = Lane;
+                    }
+                }
+
+                tNear = F32_MAX;
+            }
+            else
+            {
+                u32 NearIndex = Node->LeftFirst;
+                u32 FarIndex = Node->LeftFirst + 1;
+                f32 tNearChild = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[NearIndex].Bounds, t);
+                f32 tFarChild = RayIntersectBounds(RayP, RayInvD, BVH->Nodes[FarIndex].Bounds, t);
+                if (tFarChild < tNearChild)
+                {
+                    Swap(NearIndex, FarIndex);
+                    Swap(tNearChild, tFarChild);
+                }
+
+                if (tFarChild != F32_MAX)
+                {
+                    NodeStack[StackAt] = FarIndex;
+                    tNearStack[StackAt] = tFarChild;
+                    ++StackAt;
+                }
+
+                NodeIndex = NearIndex;
+                tNear = tNearChild;
+            }
+
+            // NOTE: Pop until we find a node that's still closer than the current closest hit
+            while ((tNear == F32_MAX) && (StackAt > 0))
+            {
+                --StackAt;
+                if (tNearStack[StackAt] < t)
+                {
+                    NodeIndex = NodeStack[StackAt];
+                    tNear = tNearStack[StackAt];
+                }
+            }
+        }
+    }
+
+    if (Scene->InstanceBVH.NodeCount &&
+        TraceInstances<ShadowRay>(Scene, RayP, RayD, RayInvD, &t, &HitInstance, &HitTriangle, &HitU, &HitV))
+    {
+        if constexpr(ShadowRay)
+        {
+            return true;
+        }
+        HitBlock = nullptr;
+    }
+
+    if (HitBlock)
+    {
+        vec3 SphereP = Vec3(HitBlock->X[HitLane], HitBlock->Y[HitLane], HitBlock->Z[HitLane]);
+        HitMaterial = HitBlock->Material[HitLane];
+        HitLight = HitBlock->Light[HitLane];
+        HitNormal = NormalizeFast(RayP + t*RayD - SphereP);
+    }
+    else if (HitInstance)
+    {
+        HitMaterial = Scene->Instances.Data[HitInstance].Material;
+        HitNormal = InstanceHitNormal(Scene, HitInstance, HitTriangle, HitU, HitV);
+    }
+
+    *tOut = t;
+    if (OutHitMaterial)
+    {
+        *OutHitMaterial = HitMaterial;
+    }
+    if (OutHitLight)
+    {
+        *OutHitLight = HitLight;
+    }
+    if (OutHitNormal)
+    {
+        *OutHitNormal = HitNormal;
+    }
+
+    return !!HitMaterial;
+}
+
+internal always_inline bool
+TraceScene(scene *Scene, vec3 RayP, vec3 RayD, f32 *tOut, u32 *OutHitMaterial, u32 *OutHitLight, vec3 *OutHitNormal)
+{
+    return TraceSceneInternal<false>(Scene, RayP, RayD, tOut, OutHitMaterial, OutHitLight, OutHitNormal);
+}
+
+internal always_inline bool
+Occluded(scene *Scene, vec3 RayP, vec3 RayD, f32 max_t)
+{
+    return TraceSceneInternal<true>(Scene, RayP, RayD, &max_t, nullptr, nullptr, nullptr);
+}
+
+internal void
+PushPacketChildren(bvh *BVH, bvh_node *Node, vec3 PacketD, u32 *NodeStack, u32 *StackAt)
+{
+    // NOTE: Push the far child first, judged by the packet's summed direction along the axis the
+    //       two children are most separated on.
+    bvh_node *Left = &BVH->Nodes[Node->LeftFirst];
+    bvh_node *Right = &BVH->Nodes[Node->LeftFirst + 1];
+    vec3 Separation = (Right->Bounds.Min + Right->Bounds.Max) - (Left->Bounds.Min + Left->Bounds.Max);
+
+    u32 Axis = 0;
+    if (ABS(Separation.Y) > ABS(Separation[Axis])) Axis = 1;
+    if (ABS(Separation.Z) > ABS(Separation[Axis])) Axis = 2;
+
+    b32 LeftFirst = (Separation[Axis]*PacketD[Axis] >= 0.0f);
+    NodeStack[(*StackAt)++] = Node->LeftFirst + (LeftFirst ? 1 : 0);
+    NodeStack[(*StackAt)++] = Node->LeftFirst + (LeftFirst ? 0 : 1);
+}
+
+template <bool ShadowRay>
+internal void
+TracePacket(scene *Scene, ray_packet *Packet, packet_hit *Hit, u32 GroupCount)
+{
+    // NOTE: Traces the first GroupCount lane groups of the packet. Shadow rays only care whether
+    //       anything is in the way, so a lane that hits gets its t dropped to 0. That keeps it out
+    //       of every later test, and once every lane is blocked the walk ends. Their HitID is
+    //       nonzero if they're occluded, and nothing else in Hit is meaningful.
+    lane_f32 Zero = LaneF32(0.0f);
+    lane_f32 Epsilon = LaneF32(EPSILON);
+
+    vec3 PacketD = {};
+    for (u32 G = 0; G < GroupCount; ++G)
+    {
+        Hit->t[G] = Packet->tMax[G];
+        Hit->Material[G] = LaneU32(0);
+        Hit->HitID[G] = LaneU32(0);
+
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            PacketD += Vec3(ExtractF32(Packet->D[G].X, Lane),
+                            ExtractF32(Packet->D[G].Y, Lane),
+                            ExtractF32(Packet->D[G].Z, Lane));
+        }
+    }
+
+    for (u32 PlaneIndex = 1; PlaneIndex < Scene->Planes.Count; ++PlaneIndex)
+    {
+        plane *Plane = &Scene->Planes.Data[PlaneIndex];
+        lane_v3 PlaneN = LaneV3(Plane->N);
+        lane_f32 PlaneD = LaneF32(Plane->d);
+        lane_u32 PlaneMaterial = LaneU32(Plane->Material);
+        lane_u32 PlaneID = LaneU32(PACKET_HIT_PLANE|PlaneIndex);
+
+        for (u32 G = 0; G < GroupCount; ++G)
+        {
+            lane_f32 Denom = Dot(PlaneN, Packet->D[G]);
+            lane_f32 t = (PlaneD - Dot(PlaneN, Packet->P[G])) / Denom;
+            lane_u32 HitMask = (Denom < Zero) & (t >= Epsilon) & (t < Hit->t[G]);
+            Hit->t[G] = Select(HitMask, (ShadowRay ? Zero : t), Hit->t[G]);
+            Hit->Material[G] = Select(HitMask, PlaneMaterial, Hit->Material[G]);
+            Hit->HitID[G] = Select(HitMask, PlaneID, Hit->HitID[G]);
+        }
+    }
+
+    bvh *BVH = &Scene->SphereBVH;
+    if (BVH->NodeCount)
+    {
+        // NOTE: The whole packet walks the tree together. A node gets visited if any lane's
+        //       ray still reaches it, and lanes that miss it are masked out by their own t.
+        u32 StackAt = 0;
+        u32 NodeStack[BVH_MAX_DEPTH];
+        NodeStack[StackAt++] = 0;
+
+        while (StackAt > 0)
+        {
+            bvh_node *Node = &BVH->Nodes[NodeStack[--StackAt]];
+
+            lane_u32 AnyHit = LaneU32(0);
+            for (u32 G = 0; G < GroupCount; ++G)
+            {
+                AnyHit |= RayIntersectBounds(Packet->P[G], Packet->InvD[G], Node->Bounds, Hit->t[G]);
+            }
+
+            if (MaskIsZeroed(AnyHit))
+            {
+                continue;
+            }
+
+            if (Node->Count)
+            {
+                for (u32 BlockIndex = Node->LeftFirst; BlockIndex < Node->LeftFirst + Node->Count; ++BlockIndex)
+                {
+                    sphere_block *Block = &Scene->SphereBlocks[BlockIndex];
+                    for (u32 BlockLane = 0; BlockLane < SPHERE_BLOCK_WIDTH; ++BlockLane)
+                    {
+                        if (Block->RSq[BlockLane] < 0.0f)
+                        {
+                            // NOTE: Padding only ever sits at the end of a block
+                            break;
+                        }
+
+                        lane_v3 SphereP = LaneV3(Vec3(Block->X[BlockLane], Block->Y[BlockLane], Block->Z[BlockLane]));
+                        lane_f32 SphereRSq = LaneF32(Block->RSq[BlockLane]);
+                        lane_u32 SphereMaterial = LaneU32(Block->Material[BlockLane]);
+                        lane_u32 SphereID = LaneU32(1 + BlockIndex*SPHERE_BLOCK_WIDTH + BlockLane);
+
+                        for (u32 G = 0; G < GroupCount; ++G)
+                        {
+                            lane_v3 SphereRelO = Packet->P[G] - SphereP;
+                            lane_f32 B = Dot(Packet->D[G], SphereRelO);
+                            lane_f32 C = Dot(SphereRelO, SphereRelO) - SphereRSq;
+                            lane_f32 Discr = MulAdd(B, B, -C);
+                            lane_f32 DiscrRoot = SquareRoot(Max(Discr, Zero));
+                            lane_f32 tN = -B - DiscrRoot;
+                            lane_f32 tF = DiscrRoot - B;
+                            lane_f32 t = Select(tN >= Zero, tN, tF);
+
+                            lane_u32 HitMask = (Discr >= Zero) & (t >= Epsilon) & (t < Hit->t[G]);
+                            Hit->t[G] = Select(HitMask, (ShadowRay ? Zero : t), Hit->t[G]);
+                            Hit->Material[G] = Select(HitMask, SphereMaterial, Hit->Material[G]);
+                            Hit->HitID[G] = Select(HitMask, SphereID, Hit->HitID[G]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                PushPacketChildren(BVH, Node, PacketD, NodeStack, &StackAt);
+            }
+        }
+    }
+
+    bvh *InstanceBVH = &Scene->InstanceBVH;
+    if (InstanceBVH->NodeCount)
+    {
+        // NOTE: The top level gets walked by the whole packet the same way. At its leaves every lane
+        //       whose ray reaches an instance's bounds goes down that mesh's BVH on its own, starting
+        //       from whatever the planes and spheres left in t. Shadow lanes that are already
+        //       blocked sit at t = 0 and stay out.
+        u32 StackAt = 0;
+        u32 NodeStack[BVH_MAX_DEPTH];
+        NodeStack[StackAt++] = 0;
+
+        while (StackAt > 0)
+        {
+            bvh_node *Node = &InstanceBVH->Nodes[NodeStack[--StackAt]];
+
+            lane_u32 AnyHit = LaneU32(0);
+            for (u32 G = 0; G < GroupCount; ++G)
+            {
+                AnyHit |= RayIntersectBounds(Packet->P[G], Packet->InvD[G], Node->Bounds, Hit->t[G]);
+            }
+
+            if (MaskIsZeroed(AnyHit))
+            {
+                continue;
+            }
+
+            if (Node->Count)
+            {
+                for (u32 I = Node->LeftFirst; I < Node->LeftFirst + Node->Count; ++I)
+                {
+                    u32 InstanceIndex = InstanceBVH->Primitives[I];
+                    instance *Instance = &Scene->Instances.Data[InstanceIndex];
+                    lane_u32 InstanceMaterial = LaneU32(Instance->Material);
+                    lane_u32 InstanceID = LaneU32(PACKET_HIT_INSTANCE|InstanceIndex);
+
+                    for (u32 G = 0; G < GroupCount; ++G)
+                    {
+                        u32 LaneBits = MoveMask(RayIntersectBounds(Packet->P[G], Packet->InvD[G], Instance->Bounds, Hit->t[G]) &
+                                                (Hit->t[G] > Zero));
+                        if (!LaneBits)
+                        {
+                            continue;
+                        }
+
+                        f32 t[LANE_WIDTH];
+                        StoreF32(t, Hit->t[G]);
+                        for (; LaneBits; LaneBits &= LaneBits - 1)
+                        {
+                            u32 Lane = __builtin_ctz(LaneBits);
+                            u32 RayIndex = G*LANE_WIDTH + Lane;
+                            vec3 RayP = Vec3(ExtractF32(Packet->P[G].X, Lane), ExtractF32(Packet->P[G].Y, Lane), ExtractF32(Packet->P[G].Z, Lane));
+                            vec3 RayD = Vec3(ExtractF32(Packet->D[G].X, Lane), ExtractF32(Packet->D[G].Y, Lane), ExtractF32(Packet->D[G].Z, Lane));
+                            if (TraceInstance<ShadowRay>(Scene, InstanceIndex, RayP, RayD, &t[Lane],
+                                                         &Hit->MeshTriangle[RayIndex], &Hit->MeshU[RayIndex], &Hit->MeshV[RayIndex]))
+                            {
+                                if constexpr(ShadowRay)
+                                {
+                                    // NOTE: Shadow rays stop at the first hit without handing its t back
+                                    t[Lane] = 0.0f;
+                                }
+                            }
+                        }
+
+                        // NOTE: A mesh hit only ever brings t down
+                        lane_f32 tMesh = LoadF32(t);
+                        lane_u32 HitMask = (tMesh < Hit->t[G]);
+                        Hit->t[G] = Select(HitMask, (ShadowRay ? Zero : tMesh), Hit->t[G]);
+                        Hit->Material[G] = Select(HitMask, InstanceMaterial, Hit->Material[G]);
+                        Hit->HitID[G] = Select(HitMask, InstanceID, Hit->HitID[G]);
+                    }
+                }
+            }
+            else
+            {
+                PushPacketChildren(InstanceBVH, Node, PacketD, NodeStack, &StackAt);
+            }
+        }
+    }
+}
+
+internal scene_hit
+ExtractPacketHit(scene *Scene, ray_packet *Packet, packet_hit *Hit, u32 RayIndex)
+{
+    u32 G = RayIndex / LANE_WIDTH;
+    u32 Lane = RayIndex % LANE_WIDTH;
+
+    scene_hit Result = {};
+    Result.t = ExtractF32(Hit->t[G], Lane);
+    Result.Material = ExtractU32(Hit->Material[G], Lane);
+
+    u32 HitID = ExtractU32(Hit->HitID[G], Lane);
+    if (HitID & PACKET_HIT_PLANE)
+    {
+        Result.N = Scene->Planes.Data[HitID & ~PACKET_HIT_PLANE].N;
+    }
+    else if (HitID & PACKET_HIT_INSTANCE)
+    {
+        Result.N = InstanceHitNormal(Scene, HitID & ~PACKET_HIT_INSTANCE,
+                                     Hit->MeshTriangle[RayIndex], Hit->MeshU[RayIndex], Hit->MeshV[RayIndex]);
+    }
+    else if (HitID)
+    {
+        sphere_block *Block = &Scene->SphereBlocks[(HitID - 1) / SPHERE_BLOCK_WIDTH];
+        u32 BlockLane = (HitID - 1) % SPHERE_BLOCK_WIDTH;
+
+        vec3 RayP = Vec3(ExtractF32(Packet->P[G].X, Lane), ExtractF32(Packet->P[G].Y, Lane), ExtractF32(Packet->P[G].Z, Lane));
+        vec3 RayD = Vec3(ExtractF32(Packet->D[G].X, Lane), ExtractF32(Packet->D[G].Y, Lane), ExtractF32(Packet->D[G].Z, Lane));
+        vec3 SphereP = Vec3(Block->X[BlockLane], Block->Y[BlockLane], Block->Z[BlockLane]);
+        Result.N = NormalizeFast(RayP + Result.t*RayD - SphereP);
+        Result.Light = Block->Light[BlockLane];
+    }
+
+    return Result;
+}
+
+internal always_inline f32
+FresnelDielectric(f32 CosThetaI, f32 EtaI, f32 EtaT, f32 EtaIOverEtaT, f32 *OutCosThetaT)
+{
+    // SOURCE: http://www.pbr-book.org/3ed-2018/Reflection_Models/Specular_Reflection_and_Transmission.html#fragment-ComputemonocosThetaTusingSnellslaw-0
+
+    // NOTE: Compute CosThetaT using snell's law
+    f32 SinThetaI = SquareRootF(MaxF(0.0f, 1.0f - CosThetaI*CosThetaI));
+    f32 SinThetaT = EtaIOverEtaT*SinThetaI;
+    f32 CosThetaT = SquareRootF(MaxF(0.0f, 1.0f - SinThetaT*SinThetaT));
+
+    *OutCosThetaT = CosThetaT;
+
+    // NOTE: Handle total internal reflection
+    if (SinThetaT >= 1)
+    {
+        return 1;
+    }
+
+    f32 rParallel      = (((EtaT*CosThetaI) - (EtaI*CosThetaT)) /
+                          ((EtaT*CosThetaI) + (EtaI*CosThetaT)));
+    f32 rPerpendicular = (((EtaI*CosThetaI) - (EtaT*CosThetaT)) /
+                          ((EtaI*CosThetaI) + (EtaT*CosThetaT)));
+
+    f32 Result = 0.5f*(rParallel*rParallel + rPerpendicular*rPerpendicular);
+    return Result;
+}
+
+internal always_inline vec3
+Refract(vec3 D, vec3 N, f32 CosThetaI, f32 CosThetaT, f32 EtaIOverEtaT)
+{
+    vec3 Result = EtaIOverEtaT*D + N*(EtaIOverEtaT*CosThetaI - CosThetaT);
+    return Result;
+}
+
+internal always_inline f32
+Luminance(vec3 Color)
+{
+    f32 Result = Dot(Color, Vec3(0.2126f, 0.7152f, 0.0722f));
+    return Result;
+}
+
+internal always_inline vec2
+DirectionToEquirect(vec3 D)
+{
+    f32 Phi = FastATan2F(D.Z, D.X);
+    f32 Theta = FastASinF(D.Y);
+    vec2 Result = Vec2(0.5f + (0.5f / Pi32)*Phi,
+                       0.5f + RcpPi32*Theta);
+    return Result;
+}
+
+internal always_inline void
+DirectionToEquirect(lane_v3 D, lane_f32 *OutU, lane_f32 *OutV)
+{
+    lane_f32 Phi = FastATan2(D.Z, D.X);
+    lane_f32 Theta = FastASin(D.Y);
+    *OutU = LaneF32(0.5f) + LaneF32(0.5f / Pi32)*Phi;
+    *OutV = LaneF32(0.5f) + LaneF32(RcpPi32)*Theta;
+}
+
+internal always_inline vec3
+EquirectToDirection(vec2 UV, f32 *OutCosTheta)
+{
+    // NOTE: Theta is latitude here, so CosTheta is what scales the solid angle of a texel
+    f32 Phi = 2.0f*Pi32*(UV.X - 0.5f);
+    f32 Theta = Pi32*(UV.Y - 0.5f);
+    f32 SinTheta, CosTheta;
+    FastSinCosF(Theta, &SinTheta, &CosTheta);
+    f32 SinPhi, CosPhi;
+    FastSinCosF(Phi, &SinPhi, &CosPhi);
+    *OutCosTheta = CosTheta;
+
+    vec3 Result = Vec3(CosTheta*CosPhi, SinTheta, CosTheta*SinPhi);
+    return Result;
+}
+
+internal always_inline u32
+EquirectTexelIndex(image_rgb9e5 *IBL, vec2 UV)
+{
+    s32 X = (s32)(UV.X*(f32)IBL->W) % IBL->W;
+    s32 Y = (s32)(UV.Y*(f32)IBL->H) % IBL->H;
+    u32 Result = Y*IBL->W + X;
+    return Result;
+}
+
+internal vec3
+SampleEquirectBilinear(image_rgb9e5 *Image, vec2 UV)
+{
+    // NOTE: Wraps around horizontally and clamps at the poles
+    f32 X = UV.X*(f32)Image->W - 0.5f;
+    f32 Y = Clamp(0.0f, UV.Y*(f32)Image->H - 0.5f, (f32)(Image->H - 1));
+    f32 FloorX = FloorF(X);
+    f32 FloorY = FloorF(Y);
+    f32 tX = X - FloorX;
+    f32 tY = Y - FloorY;
+
+    s32 X0 = (s32)FloorX;
+    X0 = (X0 < 0 ? X0 + (s32)Image->W : MIN(X0, (s32)Image->W - 1));
+    u32 X1 = ((u32)X0 + 1 < Image->W ? (u32)X0 + 1 : 0);
+    u32 Y0 = (u32)FloorY;
+    u32 Y1 = MIN(Y0 + 1, Image->H - 1);
+
+    u32 *Row0 = Image->Pixels + Y0*Image->W;
+    u32 *Row1 = Image->Pixels + Y1*Image->W;
+    u32 Bias = Image->ExponentBias;
+    vec3 Top = Lerp(DecodeRGB9E5(Row0[X0], Bias), tX, DecodeRGB9E5(Row0[X1], Bias));
+    vec3 Bottom = Lerp(DecodeRGB9E5(Row1[X0], Bias), tX, DecodeRGB9E5(Row1[X1], Bias));
+    vec3 Result = Lerp(Top, tY, Bottom);
+    return Result;
+}
+
+internal u32
+EnvironmentLevel(image_rgb9e5_pyramid *Mips, vec3 D, f32 Footprint)
+{
+    // NOTE: The level whose texels cover about Footprint. A texel of an equirect covers
+    //       2*Pi^2*cos(latitude) / (W*H), and every level up covers four times that.
+    image_rgb9e5 *Base = &Mips->Levels[0];
+    f32 CosTheta = SquareRootF(MaxF(0.0f, 1.0f - D.Y*D.Y));
+    f32 TexelSolidAngle = 2.0f*Pi32*Pi32*MaxF(CosTheta, 1.0e-4f) / ((f32)Base->W*(f32)Base->H);
+
+    u32 Result = 0;
+    if (Footprint > TexelSolidAngle)
+    {
+        f32 Level = 0.5f*Log2F(Footprint / TexelSolidAngle);
+        Result = (u32)MinF(Level + 0.5f, (f32)(Mips->LevelCount - 1));
+    }
+    return Result;
+}
+
+internal always_inline f32
+PixelFootprint(f32 RcpW, vec2 FilmDim, f32 FilmDistance)
+{
+    // NOTE: The solid angle of a pixel in the middle of the film, which is where camera rays start off
+    f32 Result = SquareF(2.0f*RcpW*FilmDim.X / FilmDistance);
+    return Result;
+}
+
+internal always_inline f32
+DiffuseFootprint(f32 Footprint, f32 BouncePdf)
+{
+    f32 Result = MaxF(Footprint, 1.0f / (DIFFUSE_FOOTPRINT_SAMPLE_COUNT*BouncePdf));
+    return Result;
+}
+
+internal vec3
+SampleSky(scene *Scene, vec3 RayD, vec2 UV, f32 Footprint)
+{
+    // NOTE: UV is DirectionToEquirect(RayD), which is only read if there is an IBL
+    vec3 Result = Vec3(0.5f, 0.8f, 1.0f);
+    if (Scene->IBL)
+    {
+        image_rgb9e5 *Level = &Scene->IBLMips.Levels[EnvironmentLevel(&Scene->IBLMips, RayD, Footprint)];
+        Result = SampleEquirectBilinear(Level, UV);
+    }
+    return Result;
+}
+
+internal void
+BuildEnvironmentDistribution(arena *Arena, image_rgb9e5 *IBL, environment_distribution *Distribution)
+{
+    u32 W = IBL->W;
+    u32 H = IBL->H;
+
+    Distribution->W = W;
+    Distribution->H = H;
+    Distribution->MarginalCdf = PushArrayNoClear(Arena, H + 1, f32);
+    Distribution->ConditionalCdfs = PushArrayNoClear(Arena, H*(W + 1), f32);
+
+    f32 *MarginalCdf = Distribution->MarginalCdf;
+    MarginalCdf[0] = 0.0f;
+
+    for (u32 Y = 0; Y < H; ++Y)
+    {
+        // NOTE: Rows near the poles cover less solid angle, by the cosine of their latitude
+        f32 Theta = Pi32*(((f32)Y + 0.5f) / (f32)H - 0.5f);
+        f32 SolidAngleWeight = CosF(Theta);
+
+        u32 *Row = IBL->Pixels + Y*W;
+        f32 *Cdf = Distribution->ConditionalCdfs + Y*(W + 1);
+        Cdf[0] = 0.0f;
+        for (u32 X = 0; X < W; ++X)
+        {
+            Cdf[X + 1] = Cdf[X] + SolidAngleWeight*MaxF(0.0f, Luminance(DecodeRGB9E5(Row[X], IBL->ExponentBias)));
+        }
+
+        f32 RowWeight = Cdf[W];
+        for (u32 X = 1; X <= W; ++X)
+        {
+            Cdf[X] = (RowWeight > 0.0f ? Cdf[X] / RowWeight : (f32)X / (f32)W);
+        }
+        Cdf[W] = 1.0f;
+
+        MarginalCdf[Y + 1] = MarginalCdf[Y] + RowWeight;
+    }
+
+    f32 TotalWeight = MarginalCdf[H];
+    for (u32 Y = 1; Y <= H; ++Y)
+    {
+        MarginalCdf[Y] = (TotalWeight > 0.0f ? MarginalCdf[Y] / TotalWeight : (f32)Y / (f32)H);
+    }
+    MarginalCdf[H] = 1.0f;
+}
+
+internal environment_cache_header *
+ValidEnvironmentCache(string_u8 Cache)
+{
+    environment_cache_header *Result = NULL;
+    if (Cache.Count >= sizeof(environment_cache_header))
+    {
+        environment_cache_header *Header = (environment_cache_header *)Cache.Data;
+        u64 W = Header->W;
+        u64 H = Header->H;
+        if ((Header->Magic == ENVIRONMENT_CACHE_MAGIC) &&
+            (Header->Version == ENVIRONMENT_CACHE_VERSION) &&
+            (Header->FileSize == Cache.Count) &&
+            (W > 0) && (H > 0) &&
+            (W <= 0x7fff) && (H <= 0x7fff) &&
+            (Header->ExponentBias >= 1) && (Header->ExponentBias + 31 < 255) &&
+            (Header->LevelCount >= 1) && (Header->LevelCount <= IMAGE_MAX_LEVEL_COUNT) &&
+            ((Header->MarginalCdfOffset | Header->ConditionalCdfsOffset) % 64 == 0) &&
+            (Header->MarginalCdfOffset + (H + 1)*sizeof(f32) <= Cache.Count) &&
+            (Header->ConditionalCdfsOffset + H*(W + 1)*sizeof(f32) <= Cache.Count))
+        {
+            Result = Header;
+
+            // NOTE: The levels have to be there, and as many as BuildImagePyramid would have made
+            u64 LevelW = W;
+            u64 LevelH = H;
+            for (u32 LevelIndex = 0; LevelIndex < Header->LevelCount; ++LevelIndex)
+            {
+                u64 Offset = Header->LevelOffsets[LevelIndex];
+                if ((LevelIndex && (LevelW == 1) && (LevelH == 1)) ||
+                    (Offset % 64) ||
+                    (Offset < sizeof(environment_cache_header)) ||
+                    (Offset + LevelW*LevelH*sizeof(u32) > Cache.Count))
+                {
+                    Result = NULL;
+                }
+                if (LevelIndex + 1 < Header->LevelCount)
+                {
+                    LevelW = (LevelW + 1) / 2;
+                    LevelH = (LevelH + 1) / 2;
+                }
+            }
+
+            if ((Header->LevelCount < IMAGE_MAX_LEVEL_COUNT) && ((LevelW > 1) || (LevelH > 1)))
+            {
+                Result = NULL;
+            }
+        }
+    }
+    return Result;
+}
+
+internal bool
+WriteEnvironmentCache(arena *TempArena, const char *CacheFileName, platform_file_info SourceInfo, u64 SourceHash,
+                      image_rgb9e5_pyramid *Mips, environment_distribution *Distribution)
+{
+    bool Result = false;
+
+    image_rgb9e5 *IBL = &Mips->Levels[0];
+    u64 W = IBL->W;
+    u64 H = IBL->H;
+
+    environment_cache_header Header =
+    {
+        .Magic = ENVIRONMENT_CACHE_MAGIC,
+        .Version = ENVIRONMENT_CACHE_VERSION,
+        .SourceSize = SourceInfo.Size,
+        .SourceModifiedTime = SourceInfo.ModifiedTime,
+        .SourceHash = SourceHash,
+        .W = IBL->W,
+        .H = IBL->H,
+        .ExponentBias = IBL->ExponentBias,
+        .LevelCount = Mips->LevelCount,
+    };
+
+    u64 At = sizeof(Header);
+    for (u32 LevelIndex = 0; LevelIndex < Mips->LevelCount; ++LevelIndex)
+    {
+        image_rgb9e5 *Level = &Mips->Levels[LevelIndex];
+        Header.LevelOffsets[LevelIndex] = AlignPow2(At, 64);
+        At = Header.LevelOffsets[LevelIndex] + (u64)Level->W*Level->H*sizeof(u32);
+    }
+    Header.MarginalCdfOffset = AlignPow2(At, 64);
+    Header.ConditionalCdfsOffset = AlignPow2(Header.MarginalCdfOffset + (H + 1)*sizeof(f32), 64);
+    Header.FileSize = Header.ConditionalCdfsOffset + H*(W + 1)*sizeof(f32);
+
+    ScopedMemory(TempArena)
+    {
+        u8 *File = PushAlignedArray(TempArena, Header.FileSize, u8, 64);
+        memcpy(File, &Header, sizeof(Header));
+        for (u32 LevelIndex = 0; LevelIndex < Mips->LevelCount; ++LevelIndex)
+        {
+            image_rgb9e5 *Level = &Mips->Levels[LevelIndex];
+            memcpy(File + Header.LevelOffsets[LevelIndex], Level->Pixels, (usize)Level->W*Level->H*sizeof(u32));
+        }
+        memcpy(File + Header.MarginalCdfOffset, Distribution->MarginalCdf, (H + 1)*sizeof(f32));
+        memcpy(File + Header.ConditionalCdfsOffset, Distribution->ConditionalCdfs, H*(W + 1)*sizeof(f32));
+
+        Result = Platform.WriteEntireFile(CacheFileName, string_u8 { .Count = Header.FileSize, .Data = File });
+    }
+
+    return Result;
+}
+
+internal void
+LoadEnvironmentMap(scene *Scene, arena *TempArena, const char *FileName, thread_dispatch *Dispatch)
+{
+    // NOTE: Fills in the scene's IBL, its mips and its distribution, from FileName.cache if that's still good,
+    //       and from the HDR itself otherwise (rewriting the cache on the way)
+    char CacheFileName[512];
+    snprintf(CacheFileName, sizeof(CacheFileName), "%s.cache", FileName);
+
+    platform_file_info SourceInfo = {};
+    if (!Platform.GetFileInfo(FileName, &SourceInfo))
+    {
+        fprintf(stderr, "Could not open %s\n", FileName);
+        return;
+    }
+
+    string_u8 Source = {};
+    u64 SourceHash = 0;
+
+    string_u8 Cache = Platform.MapFile(CacheFileName);
+    environment_cache_header *Header = ValidEnvironmentCache(Cache);
+    if (Header &&
+        ((Header->SourceSize != SourceInfo.Size) ||
+         (Header->SourceModifiedTime != SourceInfo.ModifiedTime)))
+    {
+        Source = Platform.MapFile(FileName);
+        SourceHash = HashBytes(Source);
+        if ((Source.Count != Header->SourceSize) || (SourceHash != Header->SourceHash))
+        {
+            Header = NULL;
+        }
+        else
+        {
+            // NOTE: Same contents under a new timestamp (touched, copied, checked out again), so restamp
+            //       the cache or every later load hashes the whole source again. WriteEntireFile truncates,
+            //       which would pull the pages out from under the mapping, so the patched copy is written
+            //       with the cache unmapped and then mapped again.
+            bool Written = false;
+            ScopedMemory(TempArena)
+            {
+                u8 *File = PushAlignedArray(TempArena, Cache.Count, u8, 64);
+                memcpy(File, Cache.Data, Cache.Count);
+                environment_cache_header *NewHeader = (environment_cache_header *)File;
+                NewHeader->SourceSize = SourceInfo.Size;
+                NewHeader->SourceModifiedTime = SourceInfo.ModifiedTime;
+
+                Platform.UnmapFile(Cache);
+                Written = Platform.WriteEntireFile(CacheFileName, string_u8 { .Count = Cache.Count, .Data = File });
+            }
+            if (!Written)
+            {
+                fprintf(stderr, "Could not write %s\n", CacheFileName);
+            }
+
+            Cache = Platform.MapFile(CacheFileName);
+            Header = ValidEnvironmentCache(Cache);
+            if (Header && (SourceHash != Header->SourceHash))
+            {
+                Header = NULL;
+            }
+        }
+    }
+
+    if (Header)
+    {
+        image_rgb9e5_pyramid *Mips = &Scene->IBLMips;
+        Mips->LevelCount = Header->LevelCount;
+        for (u32 LevelIndex = 0; LevelIndex < Mips->LevelCount; ++LevelIndex)
+        {
+            image_rgb9e5 *Level = &Mips->Levels[LevelIndex];
+            Level->W = (LevelIndex ? (Level[-1].W + 1) / 2 : Header->W);
+            Level->H = (LevelIndex ? (Level[-1].H + 1) / 2 : Header->H);
+            Level->ExponentBias = Header->ExponentBias;
+            Level->Pixels = (u32 *)(Cache.Data + Header->LevelOffsets[LevelIndex]);
+        }
+
+        Scene->IBL = &Mips->Levels[0];
+        Scene->IBLDistribution.W = Header->W;
+        Scene->IBLDistribution.H = Header->H;
+        Scene->IBLDistribution.MarginalCdf = (f32 *)(Cache.Data + Header->MarginalCdfOffset);
+        Scene->IBLDistribution.ConditionalCdfs = (f32 *)(Cache.Data + Header->ConditionalCdfsOffset);
+        Scene->IBLCache = Cache;
+    }
+    else
+    {
+        Platform.UnmapFile(Cache);
+
+        if (!Source.Count)
+        {
+            Source = Platform.MapFile(FileName);
+            SourceHash = HashBytes(Source);
+        }
+
+        image_rgb9e5 *IBL = (Source.Count ? ParseHdr(&Scene->Arena, TempArena, Source, Dispatch) : NULL);
+        if (IBL)
+        {
+            BuildImagePyramid(&Scene->Arena, IBL, &Scene->IBLMips, Dispatch);
+            Scene->IBL = &Scene->IBLMips.Levels[0];
+
+            BuildEnvironmentDistribution(&Scene->Arena, Scene->IBL, &Scene->IBLDistribution);
+            if (!WriteEnvironmentCache(TempArena, CacheFileName, SourceInfo, SourceHash, &Scene->IBLMips, &Scene->IBLDistribution))
+            {
+                fprintf(stderr, "Could not write %s\n", CacheFileName);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Could not load %s\n", FileName);
+        }
+    }
+
+    Platform.UnmapFile(Source);
+}
+
+internal always_inline u32
+SampleCdf(f32 *Cdf, u32 Count, f32 Sample, f32 *OutOffset)
+{
+    // NOTE: Finds the last bin whose start is <= Sample, which skips over empty bins.
+    //       OutOffset is where in that bin the sample landed, in [0, 1).
+    u32 Lo = 0;
+    u32 Hi = Count;
+    while (Hi - Lo > 1)
+    {
+        u32 Mid = (Lo + Hi) / 2;
+        if (Cdf[Mid] <= Sample)
+        {
+            Lo = Mid;
+        }
+        else
+        {
+            Hi = Mid;
+        }
+    }
+
+    f32 BinWidth = Cdf[Lo + 1] - Cdf[Lo];
+    *OutOffset = (BinWidth > 0.0f ? Clamp(0.0f, (Sample - Cdf[Lo]) / BinWidth, 1.0f) : 0.0f);
+    return Lo;
+}
+
+internal always_inline f32
+EnvironmentTexelPdf(environment_distribution *Distribution, u32 X, u32 Y, f32 CosTheta)
+{
+    // NOTE: Converts the probability of picking a texel to a density over solid angle. A texel
+    //       covers (2pi / W)*(pi / H)*CosTheta steradians.
+    f32 Result = 0.0f;
+    if (CosTheta > 1.0e-4f)
+    {
+        f32 *MarginalCdf = Distribution->MarginalCdf;
+        f32 *Cdf = Distribution->ConditionalCdfs + Y*(Distribution->W + 1);
+        f32 TexelProbability = (MarginalCdf[Y + 1] - MarginalCdf[Y])*(Cdf[X + 1] - Cdf[X]);
+        Result = TexelProbability*(f32)(Distribution->W*Distribution->H) / (2.0f*Pi32*Pi32*CosTheta);
+    }
+    return Result;
+}
+
+internal f32
+EnvironmentPdf(scene *Scene, vec3 D, vec2 UV)
+{
+    u32 TexelIndex = EquirectTexelIndex(Scene->IBL, UV);
+    u32 W = Scene->IBLDistribution.W;
+    f32 CosTheta = SquareRootF(MaxF(0.0f, 1.0f - D.Y*D.Y));
+
+    f32 Result = EnvironmentTexelPdf(&Scene->IBLDistribution, TexelIndex % W, TexelIndex / W, CosTheta);
+    return Result;
+}
+
+internal vec3
+SampleEnvironment(scene *Scene, vec2 Sample, f32 *OutPdf)
+{
+    environment_distribution *Distribution = &Scene->IBLDistribution;
+    u32 W = Distribution->W;
+    u32 H = Distribution->H;
+
+    f32 OffsetY;
+    u32 Y = SampleCdf(Distribution->MarginalCdf, H, Sample.Y, &OffsetY);
+
+    f32 OffsetX;
+    u32 X = SampleCdf(Distribution->ConditionalCdfs + Y*(W + 1), W, Sample.X, &OffsetX);
+
+    vec2 UV = Vec2(((f32)X + OffsetX) / (f32)W,
+                   ((f32)Y + OffsetY) / (f32)H);
+
+    f32 CosTheta;
+    vec3 Result = EquirectToDirection(UV, &CosTheta);
+    *OutPdf = EnvironmentTexelPdf(Distribution, X, Y, CosTheta);
+    return Result;
+}
+
+internal always_inline f32
+PowerHeuristic(f32 PdfA, f32 PdfB)
+{
+    // NOTE: MIS weight for a sample taken with strategy A, when B could have produced it too
+    f32 A2 = PdfA*PdfA;
+    f32 B2 = PdfB*PdfB;
+    f32 Result = (A2 > 0.0f ? A2 / (A2 + B2) : 0.0f);
+    return Result;
+}
+
+struct light_sample
+{
+    vec3 D;
+    f32 tMax;
+    vec3 Contribution;
+    b32 Valid;
+};
+
+internal light_sample
+SampleEnvironmentLight(scene *Scene, vec3 N, vec3 Albedo, f32 Footprint, sampler *Sampler)
+{
+    // NOTE: Next event estimation against the IBL, for a lambertian surface. Contribution already
+    //       includes the BRDF, the cosine, the pdf and the MIS weight against the cosine weighted
+    //       bounce, so the caller only has to multiply in the throughput and check visibility.
+    //       The IBL is read through the mip a bounce in the same direction would have read, so
+    //       both strategies see the same filtered environment and the MIS weights still add up.
+    light_sample Result = {};
+
+    f32 LightPdf;
+    vec3 L = SampleEnvironment(Scene, SampleUnilateralVec2(Sampler), &LightPdf);
+    f32 NdotL = Dot(N, L);
+    if ((LightPdf > 0.0f) && (NdotL > 0.0f))
+    {
+        f32 BsdfPdf = RcpPi32*NdotL;
+        f32 Weight = PowerHeuristic(LightPdf, BsdfPdf);
+
+        Result.D = L;
+        Result.tMax = F32_MAX;
+        Result.Contribution = (Weight*BsdfPdf / LightPdf)*Albedo*SampleSky(Scene, L, DirectionToEquirect(L), DiffuseFootprint(Footprint, BsdfPdf));
+        Result.Valid = true;
+    }
+
+    return Result;
+}
+
+internal always_inline vec3
+SampleSkyMIS(scene *Scene, vec3 RayD, vec2 UV, f32 BouncePdf, f32 Footprint)
+{
+    // NOTE: Counterpart of SampleEnvironmentLight, for paths that reach the IBL by bouncing.
+    //       Camera rays and specular bounces have no pdf to compare, so they keep all of it.
+    f32 Weight = 1.0f;
+    if (Scene->IBL && (BouncePdf > 0.0f))
+    {
+        Weight = PowerHeuristic(BouncePdf, EnvironmentPdf(Scene, RayD, UV));
+    }
+    vec3 Result = Weight*SampleSky(Scene, RayD, UV, Footprint);
+    return Result;
+}
+
+internal always_inline vec3
+SampleSkyMIS(scene *Scene, vec3 RayD, f32 BouncePdf, f32 Footprint)
+{
+    vec2 UV = (Scene->IBL ? DirectionToEquirect(RayD) : Vec2(0, 0));
+    vec3 Result = SampleSkyMIS(Scene, RayD, UV, BouncePdf, Footprint);
+    return Result;
+}
+
+internal always_inline f32
+SphereLightOneMinusCosThetaMax(sphere_light *Light, vec3 P)
+{
+    // NOTE: The size of the cone the light subtends from P, or 0 if P is inside it
+    f32 Result = 0.0f;
+    f32 DistanceSq = LengthSquared(Light->P - P);
+    f32 RSq = Light->r*Light->r;
+    if (DistanceSq > RSq)
+    {
+        f32 SinThetaMaxSq = RSq / DistanceSq;
+        Result = (SinThetaMaxSq < 1.0e-3f ? 0.5f*SinThetaMaxSq : 1.0f - SquareRootF(1.0f - SinThetaMaxSq));
+    }
+    return Result;
+}
+
+internal f32
+SphereLightPdf(scene *Scene, u32 LightIndex, vec3 P)
+{
+    // NOTE: Density over solid angle of SampleSphereLight picking this light and landing on D,
+    //       for any D inside the cone it subtends
+    f32 Result = 0.0f;
+    f32 OneMinusCosThetaMax = SphereLightOneMinusCosThetaMax(&Scene->Lights[LightIndex], P);
+    if (OneMinusCosThetaMax > 0.0f)
+    {
+        Result = Scene->LightAliasTable[LightIndex].Pdf / (Tau32*OneMinusCosThetaMax);
+    }
+    return Result;
+}
+
+internal light_sample
+SampleSphereLight(scene *Scene, vec3 P, vec3 N, vec3 Albedo, sampler *Sampler)
+{
+    // NOTE: Same deal as SampleEnvironmentLight, for the emissive spheres. The light is picked
+    //       with the alias table, then a direction is picked uniformly in the cone it subtends.
+    light_sample Result = {};
+
+    f32 Pick = SampleUnilateral(Sampler)*(f32)Scene->LightCount;
+    u32 LightIndex = MIN((u32)Pick, Scene->LightCount - 1);
+    alias_entry *Entry = &Scene->LightAliasTable[LightIndex];
+    if ((Pick - (f32)LightIndex) >= Entry->KeepProbability)
+    {
+        LightIndex = Entry->Alias;
+    }
+
+    sphere_light *Light = &Scene->Lights[LightIndex];
+    vec3 ToLight = Light->P - P;
+    f32 Distance = Length(ToLight);
+
+    f32 OneMinusCosThetaMax = SphereLightOneMinusCosThetaMax(Light, P);
+    if (OneMinusCosThetaMax > 0.0f)
+    {
+        vec3 L = MapToCone((1.0f / Distance)*ToLight, OneMinusCosThetaMax, SampleUnilateralVec2(Sampler));
+        f32 NdotL = Dot(N, L);
+        if (NdotL > 0.0f)
+        {
+            f32 LightPdf = Scene->LightAliasTable[LightIndex].Pdf / (Tau32*OneMinusCosThetaMax);
+            f32 BsdfPdf = RcpPi32*NdotL;
+            f32 Weight = PowerHeuristic(LightPdf, BsdfPdf);
+
+            // NOTE: Distance to the near side of the sphere. The shadow ray starts EPSILON along L,
+            //       and has to stop EPSILON short of the light so it doesn't hit the light itself.
+            f32 DdotL = Dot(ToLight, L);
+            f32 tLight = DdotL - SquareRootF(MaxF(0.0f, DdotL*DdotL - Distance*Distance + Light->r*Light->r));
+
+            Result.D = L;
+            Result.tMax = tLight - 2.0f*EPSILON;
+            Result.Contribution = (Weight*BsdfPdf / LightPdf)*Albedo*Light->Emission;
+            Result.Valid = true;
+        }
+    }
+
+    return Result;
+}
+
+internal always_inline f32
+EmissionMISWeight(scene *Scene, u32 Light, vec3 RayP, f32 BouncePdf)
+{
+    // NOTE: Counterpart of SampleSphereLight, for paths that run into a light by bouncing. Light
+    //       is 1 + the light index, 0 for emitters that aren't in the light list.
+    f32 Result = 1.0f;
+    if (Light && (BouncePdf > 0.0f))
+    {
+        Result = PowerHeuristic(BouncePdf, SphereLightPdf(Scene, Light - 1, RayP));
+    }
+    return Result;
+}
+
+struct surface_scatter
+{
+    vec3 D;
+    vec3 Weight;
+    b32 Diffuse;
+};
+
+internal always_inline surface_scatter
+ScatterSurface(material *Material, vec3 RayD, vec3 N, f32 CosThetaI, sampler *Sampler)
+{
+    // NOTE: Picks the continuation of a path at a surface hit. N must face the incoming ray.
+    //       Weight is what the throughput gets multiplied by. Diffuse bounces also want direct
+    //       light, which is up to the caller.
+    surface_scatter Result = {};
+
+    f32 EtaI = 1.0f;
+    f32 EtaT = Material->IOR;
+    f32 EtaIOverEtaT = EtaI / EtaT;
+
+    b32 IsMirror = (Material->Flags & Material_Mirror);
+    b32 ShouldReflect = IsMirror;
+    if (!ShouldReflect && (EtaI != EtaT))
+    {
+        f32 CosThetaT;
+        f32 Reflectance = FresnelDielectric(CosThetaI, EtaI, EtaT, EtaIOverEtaT, &CosThetaT);
+        f32 ReflectTest = SampleUnilateral(Sampler);
+        ShouldReflect = (ReflectTest < Reflectance);
+    }
+
+    if (ShouldReflect)
+    {
+        Result.D = Reflect(RayD, N);
+        Result.Weight = (IsMirror ? Material->Albedo : Vec3(1, 1, 1));
+    }
+    else
+    {
+        // NOTE: Cosine weighted sampling cancels the cosine and the 1/pi of the lambertian BRDF
+        Result.D = MapToCosineWeightedHemisphere(N, SampleUnilateralVec2(Sampler));
+        Result.Weight = Material->Albedo;
+        Result.Diffuse = true;
+    }
+
+    return Result;
+}
+
+internal always_inline bool
+RussianRoulette(vec3 *Throughput, sampler *Sampler)
+{
+    // NOTE: Returns false if the path should be terminated
+    bool Result = true;
+
+    f32 RouletteTest = SampleUnilateral(Sampler);
+    f32 RouletteChance = Clamp(0.1f, Max3(*Throughput), 0.9f);
+    if (RouletteTest > RouletteChance)
+    {
+        Result = false;
+    }
+    *Throughput *= 1.0f / RouletteChance;
+
+    return Result;
+}
+
+internal vec3
+TracePath(scene *Scene, vec3 RayP, vec3 RayD, f32 Footprint, scene_hit *PrimaryHit, sampler *Sampler)
+{
+    // NOTE: If PrimaryHit is passed, the first segment was already traced (by a packet) and is taken from there.
+    //       Footprint is the solid angle the camera ray stands for.
+    vec3 DirectionalLightD = Scene->DirectionalLightD;
+    vec3 DirectionalLightEmission = Scene->DirectionalLightEmission;
+
+    vec3 TotalColor = Vec3(0, 0, 0);
+    vec3 Throughput = Vec3(1, 1, 1);
+    f32 BouncePdf = 0.0f;
+
+    usize MaxBounceIndex = MAX_BOUNCE_COUNT;
+    for (usize BounceIndex = 0; BounceIndex < MaxBounceIndex; ++BounceIndex)
+    {
+        f32 t = F32_MAX;
+        u32 HitMaterial;
+        u32 HitLight;
+        vec3 N;
+        bool Hit;
+        if ((BounceIndex == 0) && PrimaryHit)
+        {
+            t = PrimaryHit->t;
+            HitMaterial = PrimaryHit->Material;
+            HitLight = PrimaryHit->Light;
+            N = PrimaryHit->N;
+            Hit = !!HitMaterial;
+        }
+        else
+        {
+            Hit = TraceScene(Scene, RayP, RayD, &t, &HitMaterial, &HitLight, &N);
+        }
+
+        if (Hit)
+        {
+            vec3 HitP = RayP + t*RayD;
+            f32 CosThetaI = -Dot(N, RayD);
+
+            if (CosThetaI < 0.0f)
+            {
+                N = -N;
+                CosThetaI = -CosThetaI;
+            }
+
+            material *Material = &Scene->Materials.Data[HitMaterial];
+            if (Material->Flags & Material_Emissive)
+            {
+                f32 Weight = EmissionMISWeight(Scene, HitLight, RayP, BouncePdf);
+                TotalColor += Weight*Throughput*Material->Emissive;
+            }
+
+            surface_scatter Scatter = ScatterSurface(Material, RayD, N, CosThetaI, Sampler);
+
+            if (Scatter.Diffuse)
+            {
+                f32 NdotL = Dot(N, DirectionalLightD);
+                if ((NdotL > 0.0f) &&
+                    !Occluded(Scene, HitP + EPSILON*DirectionalLightD, DirectionalLightD, F32_MAX))
+                {
+                    vec3 BRDF = RcpPi32*Material->Albedo;
+                    TotalColor += Throughput*BRDF*NdotL*DirectionalLightEmission;
+                }
+
+                if (Scene->IBL)
+                {
+                    light_sample Light = SampleEnvironmentLight(Scene, N, Material->Albedo, Footprint, Sampler);
+                    if (Light.Valid && !Occluded(Scene, HitP + EPSILON*Light.D, Light.D, Light.tMax))
+                    {
+                        TotalColor += Throughput*Light.Contribution;
+                    }
+                }
+
+                if (Scene->LightCount)
+                {
+                    light_sample Light = SampleSphereLight(Scene, HitP, N, Material->Albedo, Sampler);
+                    if (Light.Valid && !Occluded(Scene, HitP + EPSILON*Light.D, Light.D, Light.tMax))
+                    {
+                        TotalColor += Throughput*Light.Contribution;
+                    }
+                }
+            }
+
+            RayP = HitP + EPSILON*Scatter.D;
+            RayD = Scatter.D;
+            Throughput *= Scatter.Weight;
+            BouncePdf = (Scatter.Diffuse ? RcpPi32*Dot(N, Scatter.D) : 0.0f);
+            if (Scatter.Diffuse)
+            {
+                Footprint = DiffuseFootprint(Footprint, BouncePdf);
+            }
+
+            if (Scatter.Diffuse && !RussianRoulette(&Throughput, Sampler))
+            {
+                break;
+            }
+        }
+        else
+        {
+            TotalColor += Throughput*SampleSkyMIS(Scene, RayD, BouncePdf, Footprint);
+            break;
+        }
+    }
+
+    return TotalColor;
+}
+
+internal always_inline void
+AccumulateSample(vec4 *Pixels, f32 *SecondMoments, u32 PixelIndex, vec3 Color)
+{
+    Pixels[PixelIndex].RGB += Color;
+    Pixels[PixelIndex].A   += 1;
+    SecondMoments[PixelIndex] += SquareF(Luminance(Color));
+}
+
+internal void
+CastRays(scene *Scene, int MinX, int MinY, int OnePastMaxX, int OnePastMaxY, app_imagebuffer *ImageBuffer, f32 *SecondMoments,
+         sampler_type SamplerType, image_u32 *BlueNoise)
+{
+    u32 W = ImageBuffer->W;
+    u32 H = ImageBuffer->H;
+    f32 RcpW = 1.0f / (f32)W;
+    f32 RcpH = 1.0f / (f32)H;
+    vec4 *Pixels = GetBackbuffer(ImageBuffer);
+
+    vec3 CamP = Scene->Camera.P;
+    vec3 CamX = Scene->Camera.X;
+    vec3 CamY = Scene->Camera.Y;
+    vec3 CamZ = Scene->Camera.Z;
+
+    f32 FilmDistance = 1.0f;
+    vec2 FilmDim = Vec2(1.0f, (f32)H / (f32)W);
+    vec3 FilmP = CamP - CamZ*FilmDistance;
+    f32 Footprint = PixelFootprint(RcpW, FilmDim, FilmDistance);
+
+    random_batch Entropy;
+    InitRandomBatch(&Entropy, HashCoordinate((u32)MinX, (u32)MinY, FrameIndex));
+
+    for (ssize Y = MinY; Y < OnePastMaxY; ++Y)
+    {
+        f32 V = -1.0f + 2.0f*RcpH*(f32)Y;
+        for (ssize X = MinX; X < OnePastMaxX; ++X)
+        {
+            f32 U = -1.0f + 2.0f*RcpW*(f32)X;
+            u32 PixelIndex = (u32)(Y*W + X);
+
+            sampler Sampler;
+            BeginPixelSample(&Sampler, SamplerType, &Entropy, BlueNoise, (u32)X, (u32)Y, (u32)Pixels[PixelIndex].A);
+
+            vec2 AAJitter = SampleBilateralVec2(&Sampler);
+            vec2 FilmUV = Vec2(RcpW*AAJitter.X + FilmDim.X*U,
+                               RcpH*AAJitter.Y + FilmDim.Y*V);
+
+            vec3 RayP = CamP;
+            vec3 RayD = NormalizeFast(FilmP + FilmUV.X*CamX + FilmUV.Y*CamY - CamP);
+
+            ThreadRayCounters.PrimaryRays += 1;
+            vec3 TotalColor = TracePath(Scene, RayP, RayD, Footprint, nullptr, &Sampler);
+
+            AccumulateSample(Pixels, SecondMoments, PixelIndex, TotalColor);
+        }
+    }
+}
+
+internal void
+CastRaysPacketed(scene *Scene, int MinX, int MinY, int OnePastMaxX, int OnePastMaxY, app_imagebuffer *ImageBuffer, f32 *SecondMoments,
+                 sampler_type SamplerType, image_u32 *BlueNoise)
+{
+    // NOTE: Same as CastRays, but primary rays are traced PACKET_DIM x PACKET_DIM at a time.
+    //       Everything after the first hit goes through the regular single ray TracePath.
+    u32 W = ImageBuffer->W;
+    u32 H = ImageBuffer->H;
+    f32 RcpW = 1.0f / (f32)W;
+    f32 RcpH = 1.0f / (f32)H;
+    vec4 *Pixels = GetBackbuffer(ImageBuffer);
+
+    vec3 CamP = Scene->Camera.P;
+    vec3 CamX = Scene->Camera.X;
+    vec3 CamY = Scene->Camera.Y;
+    vec3 CamZ = Scene->Camera.Z;
+
+    f32 FilmDistance = 1.0f;
+    vec2 FilmDim = Vec2(1.0f, (f32)H / (f32)W);
+    vec3 FilmP = CamP - CamZ*FilmDistance;
+    f32 Footprint = PixelFootprint(RcpW, FilmDim, FilmDistance);
+
+    random_batch Entropy;
+    InitRandomBatch(&Entropy, HashCoordinate((u32)MinX, (u32)MinY, FrameIndex));
+
+    for (ssize PacketY = MinY; PacketY < OnePastMaxY; PacketY += PACKET_DIM)
+    {
+        for (ssize PacketX = MinX; PacketX < OnePastMaxX; PacketX += PACKET_DIM)
+        {
+            alignas(32) f32 PX[PACKET_SIZE], PY[PACKET_SIZE], PZ[PACKET_SIZE];
+            alignas(32) f32 DX[PACKET_SIZE], DY[PACKET_SIZE], DZ[PACKET_SIZE];
+            alignas(32) f32 tMax[PACKET_SIZE];
+            sampler Samplers[PACKET_SIZE];
+
+            for (u32 RayIndex = 0; RayIndex < PACKET_SIZE; ++RayIndex)
+            {
+                ssize X = PacketX + RayIndex % PACKET_DIM;
+                ssize Y = PacketY + RayIndex / PACKET_DIM;
+                b32 Inside = ((X < OnePastMaxX) && (Y < OnePastMaxY));
+
+                f32 U = -1.0f + 2.0f*RcpW*(f32)X;
+                f32 V = -1.0f + 2.0f*RcpH*(f32)Y;
+
+                u32 SampleIndex = (Inside ? (u32)Pixels[Y*W + X].A : 0);
+                BeginPixelSample(&Samplers[RayIndex], SamplerType, &Entropy, BlueNoise, (u32)X, (u32)Y, SampleIndex);
+
+                vec2 AAJitter = SampleBilateralVec2(&Samplers[RayIndex]);
+                vec2 FilmUV = Vec2(RcpW*AAJitter.X + FilmDim.X*U,
+                                   RcpH*AAJitter.Y + FilmDim.Y*V);
+
+                // NOTE: Normalized below, a lane group at a time
+                vec3 RayD = FilmP + FilmUV.X*CamX + FilmUV.Y*CamY - CamP;
+
+                PX[RayIndex] = CamP.X;
+                PY[RayIndex] = CamP.Y;
+                PZ[RayIndex] = CamP.Z;
+                DX[RayIndex] = RayD.X;
+                DY[RayIndex] = RayD.Y;
+                DZ[RayIndex] = RayD.Z;
+                tMax[RayIndex] = (Inside ? F32_MAX : 0.0f);
+            }
+
+            ray_packet Packet;
+            for (u32 G = 0; G < PACKET_LANE_GROUPS; ++G)
+            {
+                u32 Offset = G*LANE_WIDTH;
+                lane_v3 D = NormalizeFast(LaneV3(LoadF32(DX + Offset), LoadF32(DY + Offset), LoadF32(DZ + Offset)));
+                StoreF32(DX + Offset, D.X);
+                StoreF32(DY + Offset, D.Y);
+                StoreF32(DZ + Offset, D.Z);
+
+                Packet.P[G] = LaneV3(LoadF32(PX + Offset), LoadF32(PY + Offset), LoadF32(PZ + Offset));
+                Packet.D[G] = D;
+                Packet.InvD[G] = LaneV3(LaneF32(1.0f) / Packet.D[G].X,
+                                        LaneF32(1.0f) / Packet.D[G].Y,
+                                        LaneF32(1.0f) / Packet.D[G].Z);
+                Packet.tMax[G] = LoadF32(tMax + Offset);
+            }
+
+            packet_hit Hit;
+            TracePacket<false>(Scene, &Packet, &Hit, PACKET_LANE_GROUPS);
+
+            // NOTE: The packet doesn't go through TraceSceneInternal, so count its rays here
+            u32 PacketRayCount = 0;
+            for (u32 RayIndex = 0; RayIndex < PACKET_SIZE; ++RayIndex)
+            {
+                PacketRayCount += (tMax[RayIndex] > 0.0f);
+            }
+            ThreadRayCounters.PrimaryRays += PacketRayCount;
+            ThreadRayCounters.TotalRays += PacketRayCount;
+
+            for (u32 RayIndex = 0; RayIndex < PACKET_SIZE; ++RayIndex)
+            {
+                if (tMax[RayIndex] > 0.0f)
+                {
+                    ssize X = PacketX + RayIndex % PACKET_DIM;
+                    ssize Y = PacketY + RayIndex / PACKET_DIM;
+
+                    vec3 RayP = Vec3(PX[RayIndex], PY[RayIndex], PZ[RayIndex]);
+                    vec3 RayD = Vec3(DX[RayIndex], DY[RayIndex], DZ[RayIndex]);
+                    scene_hit PrimaryHit = ExtractPacketHit(Scene, &Packet, &Hit, RayIndex);
+
+                    vec3 TotalColor = TracePath(Scene, RayP, RayD, Footprint, &PrimaryHit, &Samplers[RayIndex]);
+
+                    AccumulateSample(Pixels, SecondMoments, Y*W + X, TotalColor);
+                }
+            }
+        }
+    }
+}
+
+//
+// NOTE: Wavefront Integrator
+//
+// Instead of running every path through all its bounces one at a time, CastRaysWavefront keeps
+// up to WAVEFRONT_SIZE paths in flight and runs each stage (extend, shade, shadow) over all of them
+// before moving on to the next. Dead paths are compacted out after every bounce, so later stages
+// only touch live ones.
+//
+
+internal void
+LoadWavefrontRays(ray_packet *Packet, u32 First, u32 Count, f32 *PX, f32 *PY, f32 *PZ, f32 *DX, f32 *DY, f32 *DZ, f32 *tMax)
+{
+    // NOTE: Fills the first lane group of the packet with rays First to First + LANE_WIDTH. On the
+    //       last group, lanes at or past Count get a copy of the last ray with tMax 0, so they
+    //       can't hit anything. A null tMax means unbounded rays.
+    if (First + LANE_WIDTH <= Count)
+    {
+        Packet->P[0] = LaneV3(LoadF32(PX + First), LoadF32(PY + First), LoadF32(PZ + First));
+        Packet->D[0] = LaneV3(LoadF32(DX + First), LoadF32(DY + First), LoadF32(DZ + First));
+        Packet->tMax[0] = (tMax ? LoadF32(tMax + First) : LaneF32(F32_MAX));
+    }
+    else
+    {
+        f32 LaneTMax[LANE_WIDTH];
+        f32 LanePX[LANE_WIDTH], LanePY[LANE_WIDTH], LanePZ[LANE_WIDTH];
+        f32 LaneDX[LANE_WIDTH], LaneDY[LANE_WIDTH], LaneDZ[LANE_WIDTH];
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            u32 I = MIN(First + Lane, Count - 1);
+            LaneTMax[Lane] = ((First + Lane < Count) ? (tMax ? tMax[I] : F32_MAX) : 0.0f);
+            LanePX[Lane] = PX[I];
+            LanePY[Lane] = PY[I];
+            LanePZ[Lane] = PZ[I];
+            LaneDX[Lane] = DX[I];
+            LaneDY[Lane] = DY[I];
+            LaneDZ[Lane] = DZ[I];
+        }
+
+        Packet->P[0] = LaneV3(LoadF32(LanePX), LoadF32(LanePY), LoadF32(LanePZ));
+        Packet->D[0] = LaneV3(LoadF32(LaneDX), LoadF32(LaneDY), LoadF32(LaneDZ));
+        Packet->tMax[0] = LoadF32(LaneTMax);
+    }
+
+    Packet->InvD[0] = LaneV3(LaneF32(1.0f) / Packet->D[0].X,
+                             LaneF32(1.0f) / Packet->D[0].Y,
+                             LaneF32(1.0f) / Packet->D[0].Z);
+}
+
+internal void
+WavefrontExtend(scene *Scene, wavefront_paths *Paths)
+{
+    // NOTE: LANE_WIDTH paths at a time through the packet traversal. Bounced rays go every which way,
+    //       so they're traced as single lane groups rather than whole packets.
+    ray_packet Packet;
+    packet_hit Hit;
+    for (u32 First = 0; First < Paths->Count; First += LANE_WIDTH)
+    {
+        LoadWavefrontRays(&Packet, First, Paths->Count, Paths->PX, Paths->PY, Paths->PZ,
+                          Paths->DX, Paths->DY, Paths->DZ, nullptr);
+        TracePacket<false>(Scene, &Packet, &Hit, 1);
+
+        u32 OnePastLast = MIN(First + LANE_WIDTH, Paths->Count);
+        for (u32 I = First; I < OnePastLast; ++I)
+        {
+            scene_hit SceneHit = ExtractPacketHit(Scene, &Packet, &Hit, I - First);
+            Paths->t[I] = SceneHit.t;
+            Paths->Material[I] = SceneHit.Material;
+            Paths->Light[I] = SceneHit.Light;
+            Paths->NX[I] = SceneHit.N.X;
+            Paths->NY[I] = SceneHit.N.Y;
+            Paths->NZ[I] = SceneHit.N.Z;
+        }
+    }
+
+    ThreadRayCounters.TotalRays += Paths->Count;
+}
+
+internal always_inline void
+PushShadowRay(wavefront_shadow_rays *ShadowRays, u32 Slot, vec3 P, vec3 D, f32 tMax, vec3 Contribution)
+{
+    u32 ShadowIndex = ShadowRays->Count++;
+    Assert(ShadowIndex < WAVEFRONT_SHADOW_RAY_COUNT);
+    ShadowRays->Slot[ShadowIndex] = Slot;
+    ShadowRays->PX[ShadowIndex] = P.X;
+    ShadowRays->PY[ShadowIndex] = P.Y;
+    ShadowRays->PZ[ShadowIndex] = P.Z;
+    ShadowRays->DX[ShadowIndex] = D.X;
+    ShadowRays->DY[ShadowIndex] = D.Y;
+    ShadowRays->DZ[ShadowIndex] = D.Z;
+    ShadowRays->tMax[ShadowIndex] = tMax;
+    ShadowRays->ContributionR[ShadowIndex] = Contribution.X;
+    ShadowRays->ContributionG[ShadowIndex] = Contribution.Y;
+    ShadowRays->ContributionB[ShadowIndex] = Contribution.Z;
+}
+
+internal void
+WavefrontShade(scene *Scene, wavefront *Wavefront)
+{
+    wavefront_paths *Paths = &Wavefront->Paths;
+    wavefront_shadow_rays *ShadowRays = &Wavefront->ShadowRays;
+
+    vec3 DirectionalLightD = Scene->DirectionalLightD;
+    vec3 DirectionalLightEmission = Scene->DirectionalLightEmission;
+
+    ShadowRays->Count = 0;
+
+    // NOTE: Paths that missed read the IBL at the equirect UV of their direction. The atan2 and asin
+    //       that takes are done here a lane group at a time, skipping groups where everything hit.
+    alignas(32) f32 SkyU[WAVEFRONT_SIZE];
+    alignas(32) f32 SkyV[WAVEFRONT_SIZE];
+    if (Scene->IBL)
+    {
+        for (u32 First = 0; First < Paths->Count; First += LANE_WIDTH)
+        {
+            u32 LaneMask = (1u << MIN(LANE_WIDTH, Paths->Count - First)) - 1;
+            if (MoveMask(LoadU32(Paths->Material + First) == LaneU32(0)) & LaneMask)
+            {
+                lane_v3 D = LaneV3(LoadF32(Paths->DX + First), LoadF32(Paths->DY + First), LoadF32(Paths->DZ + First));
+                lane_f32 U, V;
+                DirectionToEquirect(D, &U, &V);
+                StoreF32(SkyU + First, U);
+                StoreF32(SkyV + First, V);
+            }
+        }
+    }
+
+    for (u32 I = 0; I < Paths->Count; ++I)
+    {
+        vec3 RayP = Vec3(Paths->PX[I], Paths->PY[I], Paths->PZ[I]);
+        vec3 RayD = Vec3(Paths->DX[I], Paths->DY[I], Paths->DZ[I]);
+        vec3 Throughput = Vec3(Paths->ThroughputR[I], Paths->ThroughputG[I], Paths->ThroughputB[I]);
+        u32 Slot = Paths->Slot[I];
+        sampler *Sampler = &Wavefront->Samplers[Slot];
+
+        b32 Alive = true;
+        if (Paths->Material[I])
+        {
+            vec3 N = Vec3(Paths->NX[I], Paths->NY[I], Paths->NZ[I]);
+            vec3 HitP = RayP + Paths->t[I]*RayD;
+            f32 CosThetaI = -Dot(N, RayD);
+
+            if (CosThetaI < 0.0f)
+            {
+                N = -N;
+                CosThetaI = -CosThetaI;
+            }
+
+            material *Material = &Scene->Materials.Data[Paths->Material[I]];
+            if (Material->Flags & Material_Emissive)
+            {
+                f32 Weight = EmissionMISWeight(Scene, Paths->Light[I], RayP, Paths->BouncePdf[I]);
+                Wavefront->Radiance[Slot] += Weight*Throughput*Material->Emissive;
+            }
+
+            surface_scatter Scatter = ScatterSurface(Material, RayD, N, CosThetaI, Sampler);
+
+            if (Scatter.Diffuse)
+            {
+                f32 NdotL = Dot(N, DirectionalLightD);
+                if (NdotL > 0.0f)
+                {
+                    vec3 BRDF = RcpPi32*Material->Albedo;
+                    vec3 Contribution = Throughput*BRDF*NdotL*DirectionalLightEmission;
+                    PushShadowRay(ShadowRays, Slot, HitP + EPSILON*DirectionalLightD, DirectionalLightD, F32_MAX, Contribution);
+                }
+
+                if (Scene->IBL)
+                {
+                    light_sample Light = SampleEnvironmentLight(Scene, N, Material->Albedo, Paths->Footprint[I], Sampler);
+                    if (Light.Valid)
+                    {
+                        PushShadowRay(ShadowRays, Slot, HitP + EPSILON*Light.D, Light.D, Light.tMax, Throughput*Light.Contribution);
+                    }
+                }
+
+                if (Scene->LightCount)
+                {
+                    light_sample Light = SampleSphereLight(Scene, HitP, N, Material->Albedo, Sampler);
+                    if (Light.Valid)
+                    {
+                        PushShadowRay(ShadowRays, Slot, HitP + EPSILON*Light.D, Light.D, Light.tMax, Throughput*Light.Contribution);
+                    }
+                }
+            }
+
+            RayP = HitP + EPSILON*Scatter.D;
+            RayD = Scatter.D;
+            Throughput *= Scatter.Weight;
+            Paths->BouncePdf[I] = (Scatter.Diffuse ? RcpPi32*Dot(N, Scatter.D) : 0.0f);
+            if (Scatter.Diffuse)
+            {
+                Paths->Footprint[I] = DiffuseFootprint(Paths->Footprint[I], Paths->BouncePdf[I]);
+            }
+
+            if (Scatter.Diffuse && !RussianRoulette(&Throughput, Sampler))
+            {
+                Alive = false;
+            }
+        }
+        else
+        {
+            vec2 SkyUV = (Scene->IBL ? Vec2(SkyU[I], SkyV[I]) : Vec2(0, 0));
+            Wavefront->Radiance[Slot] += Throughput*SampleSkyMIS(Scene, RayD, SkyUV, Paths->BouncePdf[I], Paths->Footprint[I]);
+            Alive = false;
+        }
+
+        Paths->Alive[I] = Alive;
+        Paths->PX[I] = RayP.X;
+        Paths->PY[I] = RayP.Y;
+        Paths->PZ[I] = RayP.Z;
+        Paths->DX[I] = RayD.X;
+        Paths->DY[I] = RayD.Y;
+        Paths->DZ[I] = RayD.Z;
+        Paths->ThroughputR[I] = Throughput.X;
+        Paths->ThroughputG[I] = Throughput.Y;
+        Paths->ThroughputB[I] = Throughput.Z;
+    }
+}
+
+internal void
+WavefrontShadow(scene *Scene, wavefront *Wavefront)
+{
+    wavefront_shadow_rays *ShadowRays = &Wavefront->ShadowRays;
+
+    ray_packet Packet;
+    packet_hit Hit;
+    for (u32 First = 0; First < ShadowRays->Count; First += LANE_WIDTH)
+    {
+        LoadWavefrontRays(&Packet, First, ShadowRays->Count, ShadowRays->PX, ShadowRays->PY, ShadowRays->PZ,
+                          ShadowRays->DX, ShadowRays->DY, ShadowRays->DZ, ShadowRays->tMax);
+        TracePacket<true>(Scene, &Packet, &Hit, 1);
+
+        u32 Unoccluded = MoveMask(Hit.HitID[0] == LaneU32(0));
+        u32 OnePastLast = MIN(First + LANE_WIDTH, ShadowRays->Count);
+        for (u32 I = First; I < OnePastLast; ++I)
+        {
+            if (Unoccluded & (1u << (I - First)))
+            {
+                Wavefront->Radiance[ShadowRays->Slot[I]] += Vec3(ShadowRays->ContributionR[I],
+                                                                 ShadowRays->ContributionG[I],
+                                                                 ShadowRays->ContributionB[I]);
+            }
+        }
+    }
+
+    ThreadRayCounters.TotalRays += ShadowRays->Count;
+    ThreadRayCounters.ShadowRays += ShadowRays->Count;
+}
+
+internal void
+WavefrontCompact(wavefront_paths *Paths)
+{
+    // NOTE: Stable, so paths keep roughly the screen order they were generated in
+    u32 LiveCount = 0;
+    for (u32 I = 0; I < Paths->Count; ++I)
+    {
+        if (Paths->Alive[I])
+        {
+            if (LiveCount != I)
+            {
+                Paths->Slot[LiveCount] = Paths->Slot[I];
+                Paths->PX[LiveCount] = Paths->PX[I];
+                Paths->PY[LiveCount] = Paths->PY[I];
+                Paths->PZ[LiveCount] = Paths->PZ[I];
+                Paths->DX[LiveCount] = Paths->DX[I];
+                Paths->DY[LiveCount] = Paths->DY[I];
+                Paths->DZ[LiveCount] = Paths->DZ[I];
+                Paths->ThroughputR[LiveCount] = Paths->ThroughputR[I];
+                Paths->ThroughputG[LiveCount] = Paths->ThroughputG[I];
+                Paths->ThroughputB[LiveCount] = Paths->ThroughputB[I];
+                Paths->BouncePdf[LiveCount] = Paths->BouncePdf[I];
+                Paths->Footprint[LiveCount] = Paths->Footprint[I];
+            }
+            ++LiveCount;
+        }
+    }
+    Paths->Count = LiveCount;
+}
+
+internal void
+CastRaysWavefront(scene *Scene, int MinX, int MinY, int OnePastMaxX, int OnePastMaxY, app_imagebuffer *ImageBuffer, f32 *SecondMoments,
+                  sampler_type SamplerType, image_u32 *BlueNoise)
+{
+    u32 W = ImageBuffer->W;
+    u32 H = ImageBuffer->H;
+    f32 RcpW = 1.0f / (f32)W;
+    f32 RcpH = 1.0f / (f32)H;
+    vec4 *Pixels = GetBackbuffer(ImageBuffer);
+
+    vec3 CamP = Scene->Camera.P;
+    vec3 CamX = Scene->Camera.X;
+    vec3 CamY = Scene->Camera.Y;
+    vec3 CamZ = Scene->Camera.Z;
+
+    f32 FilmDistance = 1.0f;
+    vec2 FilmDim = Vec2(1.0f, (f32)H / (f32)W);
+    vec3 FilmP = CamP - CamZ*FilmDistance;
+    f32 Footprint = PixelFootprint(RcpW, FilmDim, FilmDistance);
+
+    random_batch Entropy;
+    InitRandomBatch(&Entropy, HashCoordinate((u32)MinX, (u32)MinY, FrameIndex));
+
+    // NOTE: This is ~60KB, which is fine to keep on each worker's stack
+    wavefront Wavefront;
+
+    u32 TileW = (u32)(OnePastMaxX - MinX);
+    u32 PixelCount = TileW*(u32)(OnePastMaxY - MinY);
+    for (u32 FirstPixel = 0; FirstPixel < PixelCount; FirstPixel += WAVEFRONT_SIZE)
+    {
+        u32 SlotCount = MIN(WAVEFRONT_SIZE, PixelCount - FirstPixel);
+
+        //
+        // NOTE: Generate primary rays
+        //
+
+        wavefront_paths *Paths = &Wavefront.Paths;
+        Paths->Count = SlotCount;
+        for (u32 Slot = 0; Slot < SlotCount; ++Slot)
+        {
+            u32 X = MinX + (FirstPixel + Slot) % TileW;
+            u32 Y = MinY + (FirstPixel + Slot) / TileW;
+
+            f32 U = -1.0f + 2.0f*RcpW*(f32)X;
+            f32 V = -1.0f + 2.0f*RcpH*(f32)Y;
+
+            sampler *Sampler = &Wavefront.Samplers[Slot];
+            BeginPixelSample(Sampler, SamplerType, &Entropy, BlueNoise, X, Y, (u32)Pixels[Y*W + X].A);
+
+            vec2 AAJitter = SampleBilateralVec2(Sampler);
+            vec2 FilmUV = Vec2(RcpW*AAJitter.X + FilmDim.X*U,
+                               RcpH*AAJitter.Y + FilmDim.Y*V);
+
+            // NOTE: Normalized below, a lane group at a time
+            vec3 RayD = FilmP + FilmUV.X*CamX + FilmUV.Y*CamY - CamP;
+
+            Paths->Slot[Slot] = Slot;
+            Paths->PX[Slot] = CamP.X;
+            Paths->PY[Slot] = CamP.Y;
+            Paths->PZ[Slot] = CamP.Z;
+            Paths->DX[Slot] = RayD.X;
+            Paths->DY[Slot] = RayD.Y;
+            Paths->DZ[Slot] = RayD.Z;
+            Paths->ThroughputR[Slot] = 1.0f;
+            Paths->ThroughputG[Slot] = 1.0f;
+            Paths->ThroughputB[Slot] = 1.0f;
+            Paths->BouncePdf[Slot] = 0.0f;
+            Paths->Footprint[Slot] = Footprint;
+
+            Wavefront.Radiance[Slot] = Vec3(0, 0, 0);
+        }
+
+        for (u32 First = 0; First < SlotCount; First += LANE_WIDTH)
+        {
+            lane_v3 D = NormalizeFast(LaneV3(LoadF32(Paths->DX + First), LoadF32(Paths->DY + First), LoadF32(Paths->DZ + First)));
+            StoreF32(Paths->DX + First, D.X);
+            StoreF32(Paths->DY + First, D.Y);
+            StoreF32(Paths->DZ + First, D.Z);
+        }
+
+        ThreadRayCounters.PrimaryRays += SlotCount;
+
+        //
+        // NOTE: Bounce until every path is dead
+        //
+
+        for (u32 BounceIndex = 0; (BounceIndex < MAX_BOUNCE_COUNT) && Paths->Count; ++BounceIndex)
+        {
+            WavefrontExtend(Scene, Paths);
+            WavefrontShade(Scene, &Wavefront);
+            WavefrontShadow(Scene, &Wavefront);
+            WavefrontCompact(Paths);
+        }
+
+        for (u32 Slot = 0; Slot < SlotCount; ++Slot)
+        {
+            u32 X = MinX + (FirstPixel + Slot) % TileW;
+            u32 Y = MinY + (FirstPixel + Slot) / TileW;
+
+            AccumulateSample(Pixels, SecondMoments, Y*W + X, Wavefront.Radiance[Slot]);
+        }
+    }
+}
+
+internal void
+Aim(camera *Camera, vec3 Z)
+{
+    vec3 WorldUp = Vec3(0, 1, 0);
+
+    Camera->Z = Normalize(Z);
+    Camera->Z.Y = Clamp(-0.9f, Camera->Z.Y, 0.9f);
+    Camera->X = Normalize(Cross(WorldUp, Camera->Z));
+    Camera->Y = Normalize(Cross(Camera->Z, Camera->X));
+}
+
+internal void
+AimAt(camera *Camera, vec3 P, vec3 TargetP)
+{
+    Aim(Camera, P - TargetP);
+    Camera->P = P;
+}
+
+internal void
+ReserveSceneCapacity(scene *Scene, u32 MaterialCount, u32 PlaneCount, u32 SphereCount, u32 MeshCount, u32 InstanceCount)
+{
+    // NOTE: Call this before adding anything to the scene, it also pushes the NULL entries.
+    //       Counts include those NULL entries.
+    ReserveArray(&Scene->Arena, &Scene->Materials, MaterialCount);
+    ReserveArray(&Scene->Arena, &Scene->Planes, PlaneCount);
+    ReserveArray(&Scene->Arena, &Scene->Spheres, SphereCount);
+    ReserveArray(&Scene->Arena, &Scene->Meshes, MeshCount);
+    ReserveArray(&Scene->Arena, &Scene->Instances, InstanceCount);
+    ReserveArray(&Scene->Arena, &Scene->PendingMoves, InstanceCount);
+
+    if (!Scene->Materials.Count) PushArrayItem(&Scene->Arena, &Scene->Materials);
+    if (!Scene->Planes.Count)    PushArrayItem(&Scene->Arena, &Scene->Planes);
+    if (!Scene->Spheres.Count)   PushArrayItem(&Scene->Arena, &Scene->Spheres);
+    if (!Scene->Meshes.Count)    PushArrayItem(&Scene->Arena, &Scene->Meshes);
+    if (!Scene->Instances.Count) PushArrayItem(&Scene->Arena, &Scene->Instances);
+}
+
+internal u32
+AddMaterial(scene *Scene, material MaterialPrototype)
+{
+    Assert(Scene->Materials.Count > 0);
+    u32 Index = Scene->Materials.Count;
+    material *Material = PushArrayItem(&Scene->Arena, &Scene->Materials);
+    *Material = MaterialPrototype;
+    if (Max3(Material->Emissive) > 0.0f)
+    {
+        Material->Flags |= Material_Emissive;
+    }
+    return Index;
+}
+
+internal u32
+AddPlane(scene *Scene, plane Prototype)
+{
+    Assert(Scene->Planes.Count > 0);
+    u32 Index = Scene->Planes.Count;
+    plane *Plane = PushArrayItem(&Scene->Arena, &Scene->Planes);
+    *Plane = Prototype;
+    return Index;
+}
+
+internal u32
+AddSphere(scene *Scene, sphere Prototype)
+{
+    Assert(Scene->Spheres.Count > 0);
+    u32 Index = Scene->Spheres.Count;
+    sphere *Sphere = PushArrayItem(&Scene->Arena, &Scene->Spheres);
+    *Sphere = Prototype;
+    return Index;
+}
+
+internal void
+GatherTriangleBounds(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    mesh_primitive_job *Job = (mesh_primitive_job *)UserData;
+    triangle_mesh *Geometry = Job->Geometry;
+
+    u32 FirstTriangle = ItemIndex*MESH_TRIANGLES_PER_ITEM;
+    u32 OnePastLastTriangle = MIN(FirstTriangle + MESH_TRIANGLES_PER_ITEM, Geometry->TriangleCount);
+    for (u32 Triangle = FirstTriangle; Triangle < OnePastLastTriangle; ++Triangle)
+    {
+        u32 *Indices = Geometry->Indices + 3*(usize)Triangle;
+        vec3 P0 = Geometry->Positions[Indices[0]];
+        vec3 P1 = Geometry->Positions[Indices[1]];
+        vec3 P2 = Geometry->Positions[Indices[2]];
+
+        bvh_build_primitive *Primitive = &Job->Primitives[Triangle];
+        Primitive->Bounds.Min = Min(Min(P0, P1), P2);
+        Primitive->Bounds.Max = Max(Max(P0, P1), P2);
+        Primitive->Centroid = 0.5f*(Primitive->Bounds.Min + Primitive->Bounds.Max);
+        Primitive->Index = Triangle;
+    }
+}
+
+internal void
+BuildMeshBVH(scene *Scene, mesh *Mesh, arena *TempArena, thread_dispatch *Dispatch)
+{
+    triangle_mesh *Geometry = Mesh->Geometry;
+
+    ScopedMemory(TempArena)
+    {
+        u32 TriangleCount = Geometry->TriangleCount;
+        bvh_build_primitive *Primitives = PushArrayNoClear(TempArena, TriangleCount, bvh_build_primitive);
+
+        mesh_primitive_job Job = { .Geometry = Geometry, .Primitives = Primitives };
+        RunParallel(Dispatch, (TriangleCount + MESH_TRIANGLES_PER_ITEM - 1) / MESH_TRIANGLES_PER_ITEM, GatherTriangleBounds, &Job);
+
+        // NOTE: The binary BVH only lives until it's been collapsed, so it goes on the end of
+        //       Scene->Arena and gets popped back off once the wide one has been copied over
+        char *BinaryStart = GetNextAllocationLocation(&Scene->Arena, 1);
+        bvh Binary = BuildBVH(&Scene->Arena, TempArena, TriangleCount, Primitives, Dispatch);
+        Mesh->Bounds = (Binary.NodeCount ? Binary.Nodes[0].Bounds : InvertedBounds());
+
+        bvh8 Wide = CollapseBVH8(TempArena, &Binary);
+
+        // NOTE: Put the triangles in the order the wide leaves use, so each node's leaf triangles
+        //       start at its TriangleBase and sit next to each other in memory
+        u32 *Order = Binary.Primitives;
+        u32 *OldIndices = PushArrayNoClear(TempArena, 3*(usize)TriangleCount, u32);
+        CopyArray(3*(usize)TriangleCount, Geometry->Indices, OldIndices);
+        for (usize Triangle = 0; Triangle < TriangleCount; ++Triangle)
+        {
+            for (usize Corner = 0; Corner < 3; ++Corner)
+            {
+                Geometry->Indices[3*Triangle + Corner] = OldIndices[3*(usize)Order[Triangle] + Corner];
+            }
+        }
+
+        if (Geometry->NormalIndices && (Geometry->NormalIndices != Geometry->Indices))
+        {
+            CopyArray(3*(usize)TriangleCount, Geometry->NormalIndices, OldIndices);
+            for (usize Triangle = 0; Triangle < TriangleCount; ++Triangle)
+            {
+                for (usize Corner = 0; Corner < 3; ++Corner)
+                {
+                    Geometry->NormalIndices[3*Triangle + Corner] = OldIndices[3*(usize)Order[Triangle] + Corner];
+                }
+            }
+        }
+
+        ResetArenaTo(&Scene->Arena, BinaryStart);
+        Mesh->BVH.NodeCount = Wide.NodeCount;
+        Mesh->BVH.Nodes = PushAlignedArrayNoClear(&Scene->Arena, Wide.NodeCount, bvh8_node, 64);
+        CopyArray(Wide.NodeCount, Wide.Nodes, Mesh->BVH.Nodes);
+    }
+}
+
+internal u32
+AddMesh(scene *Scene, u32 Material, triangle_mesh *Geometry, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: Geometry should live in Scene->Arena (LoadMesh(&Scene->Arena, ...)). Its BVH gets built
+    //       right away, which reorders its triangles in place. Place it with AddInstance.
+    Assert(Scene->Meshes.Count > 0);
+    u32 Index = Scene->Meshes.Count;
+    mesh *Mesh = PushArrayItem(&Scene->Arena, &Scene->Meshes);
+    Mesh->Material = Material;
+    Mesh->Geometry = Geometry;
+    BuildMeshBVH(Scene, Mesh, TempArena, Dispatch);
+    return Index;
+}
+
+internal void
+RefitInstanceLeaf(scene *Scene, u32 NodeIndex)
+{
+    bvh *BVH = &Scene->InstanceBVH;
+    bvh_node *Leaf = &BVH->Nodes[NodeIndex];
+
+    aabb Bounds = InvertedBounds();
+    for (u32 I = 0; I < Leaf->Count; ++I)
+    {
+        Bounds = Union(Bounds, Scene->Instances.Data[BVH->Primitives[Leaf->LeftFirst + I]].Bounds);
+    }
+    RefitBVHLeaf(BVH, &Scene->InstanceRefit, NodeIndex, Bounds);
+}
+
+internal void
+PlaceInstance(scene *Scene, u32 InstanceIndex, affine_transform ObjectToWorld)
+{
+    instance *Instance = &Scene->Instances.Data[InstanceIndex];
+    mesh *Mesh = &Scene->Meshes.Data[Instance->Mesh];
+    Instance->ObjectToWorld = ObjectToWorld;
+    Instance->WorldToObject = Inverse(ObjectToWorld);
+    Instance->Bounds = (Mesh->BVH.NodeCount ? TransformBounds(&ObjectToWorld, Mesh->Bounds) : InvertedBounds());
+}
+
+internal void
+MoveInstance(scene *Scene, u32 InstanceIndex, affine_transform ObjectToWorld)
+{
+    // NOTE: Fine to call from the main thread while a pass is running, nothing the workers look
+    //       at changes until UpdateInstanceBVH. Only the top level needs updating, but instances
+    //       added since the last build still need BuildInstanceBVH. Moving one twice before then
+    //       keeps the last.
+    Assert((InstanceIndex > 0) && (InstanceIndex < Scene->Instances.Count));
+    instance_move *Move = PushArrayItem(&Scene->Arena, &Scene->PendingMoves);
+    Move->Instance = InstanceIndex;
+    Move->ObjectToWorld = ObjectToWorld;
+}
+
+internal u32
+AddInstance(scene *Scene, instance Prototype)
+{
+    // NOTE: Only Mesh, Material and ObjectToWorld need to be filled in
+    Assert(Scene->Instances.Count > 0);
+    Assert((Prototype.Mesh > 0) && (Prototype.Mesh < Scene->Meshes.Count));
+    u32 Index = Scene->Instances.Count;
+    instance *Instance = PushArrayItem(&Scene->Arena, &Scene->Instances);
+    *Instance = Prototype;
+    if (!Instance->Material)
+    {
+        Instance->Material = Scene->Meshes.Data[Instance->Mesh].Material;
+    }
+    PlaceInstance(Scene, Index, Prototype.ObjectToWorld);
+    return Index;
+}
+
+// NOTE: An OBJ or PLY file to stand in the middle of the test scene, from -mesh on the command line
+global const char *TestSceneMeshFileName;
+
+// NOTE: Not in the repository, the test scene is lit by nothing but this
+#define TEST_SCENE_ENVIRONMENT_MAP "ballroom_4k.hdr"
+
+internal void
+BuildTestScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    ReserveSceneCapacity(Scene, 16, 16, 16, 4, 16);
+
+    AimAt(&Scene->NewCamera, Vec3(0, 2, -5), Vec3(0, 1, 0));
+
+    LoadEnvironmentMap(Scene, TempArena, TEST_SCENE_ENVIRONMENT_MAP, Dispatch);
+
+    u32 PlaneMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.1f, 1, 0.1f) });
+    u32 Plane2MaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.3f, 0.5f) });
+    u32 SphereMaterialIndex = AddMaterial(Scene, { .IOR = 1.5f, .Albedo = Vec3(1, 1, 1) });
+    u32 Sphere2MaterialIndex = AddMaterial(Scene, { .Flags = Material_Mirror, .Albedo = Vec3(1, 0.5f, 0.2f) });
+
+    AddSphere(Scene,
+    {
+        .Material = SphereMaterialIndex,
+        .P = Vec3(5, 5.0f, 5.5f),
+        .r = 4.0f,
+    });
+
+    AddSphere(Scene,
+    {
+        .Material = Sphere2MaterialIndex,
+        .P = Vec3(5, 3.0f, 0),
+        .r = 2.0f,
+    });
+
+    AddSphere(Scene,
+    {
+        .Material = PlaneMaterialIndex,
+        .P = Vec3(0, -100, 0),
+        .r = 100.0f,
+    });
+
+    if (TestSceneMeshFileName)
+    {
+        triangle_mesh *Geometry = LoadMesh(&Scene->Arena, TempArena, TestSceneMeshFileName);
+        if (Geometry)
+        {
+            u32 MeshMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.8f, 0.8f) });
+
+            u32 MeshIndex = AddMesh(Scene, MeshMaterialIndex, Geometry, TempArena, Dispatch);
+
+            // NOTE: Whatever units the file is in, scale it to 2 across and stand it on the ground
+            //       where the camera is looking
+            aabb Bounds = Scene->Meshes.Data[MeshIndex].Bounds;
+            f32 Scale = 2.0f / MaxF(Max3(Bounds.Max - Bounds.Min), 1.0e-6f);
+            vec3 Base = Vec3(0.5f*(Bounds.Min.X + Bounds.Max.X), Bounds.Min.Y, 0.5f*(Bounds.Min.Z + Bounds.Max.Z));
+
+            affine_transform ObjectToWorld = IdentityTransform();
+            ObjectToWorld.X = Scale*ObjectToWorld.X;
+            ObjectToWorld.Y = Scale*ObjectToWorld.Y;
+            ObjectToWorld.Z = Scale*ObjectToWorld.Z;
+            ObjectToWorld.P = -Scale*Base;
+
+            AddInstance(Scene, { .Mesh = MeshIndex, .ObjectToWorld = ObjectToWorld });
+            fprintf(stderr, "Loaded %s: %u vertices, %u triangles\n", TestSceneMeshFileName, Geometry->VertexCount, Geometry->TriangleCount);
+        }
+    }
+}
+
+internal void
+BuildSphereBVH(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    ScopedMemory(TempArena)
+    {
+        // NOTE: Skip the NULL sphere
+        u32 PrimitiveCount = Scene->Spheres.Count - 1;
+        bvh_build_primitive *Primitives = PushArrayNoClear(TempArena, PrimitiveCount, bvh_build_primitive);
+        for (u32 SphereIndex = 1; SphereIndex < Scene->Spheres.Count; ++SphereIndex)
+        {
+            sphere *Sphere = &Scene->Spheres.Data[SphereIndex];
+            vec3 R = Vec3(Sphere->r, Sphere->r, Sphere->r);
+
+            bvh_build_primitive *Primitive = &Primitives[SphereIndex - 1];
+            Primitive->Bounds.Min = Sphere->P - R;
+            Primitive->Bounds.Max = Sphere->P + R;
+            Primitive->Centroid = Sphere->P;
+            Primitive->Index = SphereIndex;
+        }
+
+        Scene->SphereBVH = BuildBVH(&Scene->Arena, TempArena, PrimitiveCount, Primitives, Dispatch);
+    }
+
+    //
+    // NOTE: Repack the spheres of every leaf into SoA blocks, and point the leaves at those instead
+    //
+
+    bvh *BVH = &Scene->SphereBVH;
+
+    u32 BlockCount = 0;
+    for (usize NodeIndex = 0; NodeIndex < BVH->NodeCount; ++NodeIndex)
+    {
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        if (Node->Count)
+        {
+            BlockCount += (Node->Count + SPHERE_BLOCK_WIDTH - 1) / SPHERE_BLOCK_WIDTH;
+        }
+    }
+
+    Scene->SphereBlockCount = BlockCount;
+    Scene->SphereBlocks = PushAlignedArrayNoClear(&Scene->Arena, BlockCount, sphere_block, 64);
+
+    u32 BlockAt = 0;
+    for (usize NodeIndex = 0; NodeIndex < BVH->NodeCount; ++NodeIndex)
+    {
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        if (Node->Count)
+        {
+            u32 FirstBlock = BlockAt;
+            for (u32 I = 0; I < Node->Count; ++I)
+            {
+                u32 Lane = I % SPHERE_BLOCK_WIDTH;
+                if (Lane == 0)
+                {
+                    sphere_block *Block = &Scene->SphereBlocks[BlockAt++];
+                    for (usize Pad = 0; Pad < SPHERE_BLOCK_WIDTH; ++Pad)
                     {
-                        vec3 BRDF = RcpPi32*Material->Albedo;
-                        Throughput *= BRDF;
+                        Block->X[Pad] = Block->Y[Pad] = Block->Z[Pad] = 0.0f;
+                        Block->RSq[Pad] = -F32_MAX;
+                        Block->Material[Pad] = 0;
+                        Block->Light[Pad] = 0;
+                    }
+                }
+
+                sphere_block *Block = &Scene->SphereBlocks[BlockAt - 1];
+                sphere *Sphere = &Scene->Spheres.Data[BVH->Primitives[Node->LeftFirst + I]];
+                Block->X[Lane] = Sphere->P.X;
+                Block->Y[Lane] = Sphere->P.Y;
+                Block->Z[Lane] = Sphere->P.Z;
+                Block->RSq[Lane] = Sphere->r*Sphere->r;
+                Block->Material[Lane] = Sphere->Material;
+            }
+
+            Node->LeftFirst = FirstBlock;
+            Node->Count = BlockAt - FirstBlock;
+        }
+    }
+}
+
+internal void
+GatherInstancePrimitives(scene *Scene, bvh_build_primitive *Primitives)
+{
+    // NOTE: Skips the NULL instance, so there's Instances.Count - 1 of them
+    for (u32 InstanceIndex = 1; InstanceIndex < Scene->Instances.Count; ++InstanceIndex)
+    {
+        instance *Instance = &Scene->Instances.Data[InstanceIndex];
+
+        bvh_build_primitive *Primitive = &Primitives[InstanceIndex - 1];
+        Primitive->Bounds = Instance->Bounds;
+        Primitive->Centroid = 0.5f*(Instance->Bounds.Min + Instance->Bounds.Max);
+        Primitive->Index = InstanceIndex;
+    }
+}
+
+internal void
+InitInstanceRefit(scene *Scene)
+{
+    // NOTE: Goes in InstanceArena next to the tree, so it gets thrown out along with it
+    bvh *BVH = &Scene->InstanceBVH;
+    Scene->InstanceLeaves = PushArray(&Scene->InstanceArena, Scene->Instances.Count, u32);
+    for (u32 NodeIndex = 0; NodeIndex < BVH->NodeCount; ++NodeIndex)
+    {
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        for (u32 I = 0; I < Node->Count; ++I)
+        {
+            Scene->InstanceLeaves[BVH->Primitives[Node->LeftFirst + I]] = NodeIndex;
+        }
+    }
+    Scene->InstanceRefit = InitBVHRefit(&Scene->InstanceArena, BVH);
+}
+
+internal void
+BuildInstanceBVH(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: Cheap enough to redo from scratch whenever instances get added, the mesh BVHs stay as
+    //       they are. A rebuild still going in the background would come back with a stale tree.
+    CancelBVHRebuild(&Scene->InstanceRebuild);
+    ClearArena(&Scene->InstanceArena);
+    ZeroStruct(&Scene->InstanceBVH);
+
+    ScopedMemory(TempArena)
+    {
+        u32 PrimitiveCount = Scene->Instances.Count - 1;
+        bvh_build_primitive *Primitives = PushArrayNoClear(TempArena, PrimitiveCount, bvh_build_primitive);
+        GatherInstancePrimitives(Scene, Primitives);
+
+        Scene->InstanceBVH = BuildBVH(&Scene->InstanceArena, TempArena, PrimitiveCount, Primitives, Dispatch);
+    }
+
+    InitInstanceRefit(Scene);
+}
+
+internal void
+UpdateInstanceBVH(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: Call this between passes. It swaps in a finished background rebuild, moves the
+    //       instances MoveInstance queued up, refits the tree for them, and starts a rebuild if the
+    //       refits have made the tree BVH_REBUILD_COST_RATIO times as expensive as it was when it
+    //       was built.
+    if (FinishBVHRebuild(&Scene->InstanceRebuild, &Scene->InstanceArena, &Scene->InstanceBVH))
+    {
+        InitInstanceRefit(Scene);
+
+        // NOTE: The new tree went by the bounds from when the rebuild started, so it has to catch
+        //       up with whatever moved while it was being built
+        bvh *BVH = &Scene->InstanceBVH;
+        for (u32 NodeIndex = 0; NodeIndex < BVH->NodeCount; ++NodeIndex)
+        {
+            if (BVH->Nodes[NodeIndex].Count)
+            {
+                RefitInstanceLeaf(Scene, NodeIndex);
+            }
+        }
+    }
+
+    for (u32 MoveIndex = 0; MoveIndex < Scene->PendingMoves.Count; ++MoveIndex)
+    {
+        instance_move *Move = &Scene->PendingMoves.Data[MoveIndex];
+        PlaceInstance(Scene, Move->Instance, Move->ObjectToWorld);
+        if (Scene->InstanceLeaves && (Move->Instance <= Scene->InstanceBVH.PrimitiveCount))
+        {
+            RefitInstanceLeaf(Scene, Scene->InstanceLeaves[Move->Instance]);
+        }
+        Scene->InstancesMoved = true;
+    }
+    Scene->PendingMoves.Count = 0;
+
+    RefitBVH(TempArena, &Scene->InstanceBVH, &Scene->InstanceRefit, Dispatch);
+
+    if ((Scene->InstanceRebuild.State == BVHRebuild_Idle) &&
+        (GetBVHCostRatio(&Scene->InstanceBVH, &Scene->InstanceRefit) > BVH_REBUILD_COST_RATIO))
+    {
+        ScopedMemory(TempArena)
+        {
+            u32 PrimitiveCount = Scene->Instances.Count - 1;
+            bvh_build_primitive *Primitives = PushArrayNoClear(TempArena, PrimitiveCount, bvh_build_primitive);
+            GatherInstancePrimitives(Scene, Primitives);
+            StartBVHRebuild(&Scene->InstanceRebuild, PrimitiveCount, Primitives);
+        }
+    }
+}
+
+internal void
+BuildAliasTable(arena *TempArena, u32 Count, f32 *Weights, alias_entry *Table)
+{
+    // SOURCE: https://www.keithschwarz.com/darts-dice-coins/ (Vose's alias method)
+    f32 TotalWeight = 0.0f;
+    for (u32 I = 0; I < Count; ++I)
+    {
+        TotalWeight += Weights[I];
+    }
+
+    ScopedMemory(TempArena)
+    {
+        f32 *Scaled = PushArrayNoClear(TempArena, Count, f32);
+        u32 *Small = PushArrayNoClear(TempArena, Count, u32);
+        u32 *Large = PushArrayNoClear(TempArena, Count, u32);
+        u32 SmallCount = 0;
+        u32 LargeCount = 0;
+
+        for (u32 I = 0; I < Count; ++I)
+        {
+            Table[I].Pdf = Weights[I] / TotalWeight;
+            Scaled[I] = Table[I].Pdf*(f32)Count;
+            if (Scaled[I] < 1.0f)
+            {
+                Small[SmallCount++] = I;
+            }
+            else
+            {
+                Large[LargeCount++] = I;
+            }
+        }
+
+        while (SmallCount && LargeCount)
+        {
+            u32 S = Small[--SmallCount];
+            u32 L = Large[--LargeCount];
+
+            Table[S].KeepProbability = Scaled[S];
+            Table[S].Alias = L;
+
+            Scaled[L] -= 1.0f - Scaled[S];
+            if (Scaled[L] < 1.0f)
+            {
+                Small[SmallCount++] = L;
+            }
+            else
+            {
+                Large[LargeCount++] = L;
+            }
+        }
 
-                        f32 NdotL = Dot(N, DirectionalLightD);
-                        if ((NdotL > 0.0f) &&
-                            !Occluded(Scene, HitP + EPSILON*DirectionalLightD, DirectionalLightD, F32_MAX))
-                        {
-                            TotalColor += Throughput*NdotL*DirectionalLightEmission;
-                        }
+        // NOTE: Whatever is left over is only off from 1 by rounding error
+        while (LargeCount)
+        {
+            u32 L = Large[--LargeCount];
+            Table[L].KeepProbability = 1.0f;
+            Table[L].Alias = L;
+        }
+        while (SmallCount)
+        {
+            u32 S = Small[--SmallCount];
+            Table[S].KeepProbability = 1.0f;
+            Table[S].Alias = S;
+        }
+    }
+}
 
-                        vec3 R = MapToCosineWeightedHemisphere(N, RandomUnilateralVec2(&Entropy));
+internal void
+BuildLightList(scene *Scene, arena *TempArena)
+{
+    // NOTE: Call this after BuildSphereBVH. It tags the emissive spheres in the sphere blocks
+    //       with their light index, so hits can tell which light they landed on.
+    u32 LightCount = 0;
+    for (u32 BlockIndex = 0; BlockIndex < Scene->SphereBlockCount; ++BlockIndex)
+    {
+        sphere_block *Block = &Scene->SphereBlocks[BlockIndex];
+        for (u32 Lane = 0; Lane < SPHERE_BLOCK_WIDTH; ++Lane)
+        {
+            material *Material = &Scene->Materials.Data[Block->Material[Lane]];
+            if (Material->Flags & Material_Emissive)
+            {
+                ++LightCount;
+            }
+        }
+    }
 
-                        RayP = HitP + EPSILON*R;
-                        RayD = R;
+    Scene->LightCount = LightCount;
+    Scene->Lights = PushArrayNoClear(&Scene->Arena, LightCount, sphere_light);
+    Scene->LightAliasTable = PushArrayNoClear(&Scene->Arena, LightCount, alias_entry);
 
-                        Throughput *= Pi32;
+    if (LightCount)
+    {
+        ScopedMemory(TempArena)
+        {
+            f32 *Powers = PushArrayNoClear(TempArena, LightCount, f32);
 
-                        f32 RouletteTest = RandomUnilateral(&Entropy);
-                        f32 RouletteChance = Clamp(0.1f, Max3(Throughput), 0.9f);
-                        if (RouletteTest > RouletteChance)
-                        {
-                            break;
-                        }
-                        Throughput *= 1.0f / RouletteChance;
-                    }
-                }
-                else
+            u32 LightIndex = 0;
+            for (u32 BlockIndex = 0; BlockIndex < Scene->SphereBlockCount; ++BlockIndex)
+            {
+                sphere_block *Block = &Scene->SphereBlocks[BlockIndex];
+                for (u32 Lane = 0; Lane < SPHERE_BLOCK_WIDTH; ++Lane)
                 {
-                    vec3 SkyLight = Vec3(0.5f, 0.8f, 1.0f);
-                    if (Scene->IBL)
+                    material *Material = &Scene->Materials.Data[Block->Material[Lane]];
+                    if (Material->Flags & Material_Emissive)
                     {
-                        image *IBL = Scene->IBL;
+                        sphere_light *Light = &Scene->Lights[LightIndex];
+                        Light->P = Vec3(Block->X[Lane], Block->Y[Lane], Block->Z[Lane]);
+                        Light->r = SquareRootF(Block->RSq[Lane]);
+                        Light->Emission = Material->Emissive;
 
-                        f32 Phi = ATan2F(RayD.Z, RayD.X);
-                        f32 Theta = ASinF(RayD.Y);
-                        f32 U = 0.5f + (0.5f / Pi32)*Phi;
-                        f32 V = 0.5f + RcpPi32*Theta;
+                        // NOTE: Emitted power goes with the surface area, so with r^2
+                        Powers[LightIndex] = MaxF(1.0e-6f, Luminance(Light->Emission))*Block->RSq[Lane];
 
-                        s32 SkyX = (s32)(U*(f32)IBL->W) % IBL->W;
-                        s32 SkyY = (s32)(V*(f32)IBL->H) % IBL->H;
-
-                        SkyLight = IBL->Pixels[SkyY*IBL->W + SkyX];
+                        Block->Light[Lane] = ++LightIndex;
                     }
-
-                    TotalColor += Throughput*SkyLight;
-                    break;
                 }
             }
 
-            Pixels[Y*W + X].RGB += TotalColor;
-            Pixels[Y*W + X].A   += 1;
+            BuildAliasTable(TempArena, LightCount, Powers, Scene->LightAliasTable);
         }
     }
 }
 
-internal void
-Aim(camera *Camera, vec3 Z)
+internal always_inline u64
+PackTileRange(u32 Begin, u32 End)
 {
-    vec3 WorldUp = Vec3(0, 1, 0);
+    u64 Result = ((u64)End << 32)|(u64)Begin;
+    return Result;
+}
 
-    Camera->Z = Normalize(Z);
-    Camera->Z.Y = Clamp(-0.9f, Camera->Z.Y, 0.9f);
-    Camera->X = Normalize(Cross(WorldUp, Camera->Z));
-    Camera->Y = Normalize(Cross(Camera->Z, Camera->X));
+internal bool
+PopTile(tile_deque *Deque, u32 *OutSequence)
+{
+    bool Result = false;
+    for (;;)
+    {
+        u64 Range = Deque->Range;
+        u32 Begin = (u32)Range;
+        u32 End = (u32)(Range >> 32);
+        if (Begin == End)
+        {
+            break;
+        }
+
+        if (AtomicCompareExchangeU64(&Deque->Range, Range, PackTileRange(Begin + 1, End)) == Range)
+        {
+            *OutSequence = Begin;
+            Result = true;
+            break;
+        }
+    }
+    return Result;
+}
+
+internal bool
+StealTile(thread_dispatch *Dispatch, u32 ThiefIndex, u32 *OutSequence)
+{
+    bool Result = false;
+    u32 ActiveThreadCount = Dispatch->ActiveThreadCount;
+    for (u32 Offset = 1; !Result && (Offset < ActiveThreadCount); ++Offset)
+    {
+        tile_deque *Victim = &Dispatch->Deques[(ThiefIndex + Offset) % ActiveThreadCount];
+        for (;;)
+        {
+            u64 Range = Victim->Range;
+            u32 Begin = (u32)Range;
+            u32 End = (u32)(Range >> 32);
+            if (Begin == End)
+            {
+                break;
+            }
+
+            if (AtomicCompareExchangeU64(&Victim->Range, Range, PackTileRange(Begin, End - 1)) == Range)
+            {
+                *OutSequence = End - 1;
+                Result = true;
+                break;
+            }
+        }
+    }
+    return Result;
 }
 
 internal void
-AimAt(camera *Camera, vec3 P, vec3 TargetP)
+BuildTileOrder(thread_dispatch *Dispatch, arena *Arena)
 {
-    Aim(Camera, P - TargetP);
-    Camera->P = P;
+    // NOTE: Tiles are handed out in Z-order, so the contiguous chunk each worker gets seeded with
+    //       covers a compact patch of the screen rather than a long thin band.
+    if (Dispatch->TileOrderCapacity < Dispatch->TileCount)
+    {
+        Dispatch->TileOrderCapacity = Dispatch->TileCount;
+        Dispatch->TileOrder = PushArrayNoClear(Arena, Dispatch->TileCount, u32);
+        Dispatch->TileCost = PushArrayNoClear(Arena, Dispatch->TileCount, u64);
+        Dispatch->TileConverged = PushArrayNoClear(Arena, Dispatch->TileCount, b32);
+        Dispatch->PassTiles = PushArrayNoClear(Arena, Dispatch->TileCount, u32);
+    }
+    ZeroArray(Dispatch->TileCount, Dispatch->TileCost);
+    ZeroArray(Dispatch->TileCount, Dispatch->TileConverged);
+
+    u32 GridDim = 1;
+    while ((GridDim < Dispatch->TilesPerRow) || (GridDim < Dispatch->TilesPerCol))
+    {
+        GridDim *= 2;
+    }
+
+    u32 OrderAt = 0;
+    for (u32 Code = 0; Code < GridDim*GridDim; ++Code)
+    {
+        u32 X = 0;
+        u32 Y = 0;
+        for (u32 Bit = 0; (1u << 2*Bit) < GridDim*GridDim; ++Bit)
+        {
+            X |= ((Code >> (2*Bit + 0)) & 1) << Bit;
+            Y |= ((Code >> (2*Bit + 1)) & 1) << Bit;
+        }
+
+        if ((X < Dispatch->TilesPerRow) && (Y < Dispatch->TilesPerCol))
+        {
+            Dispatch->TileOrder[OrderAt++] = Y*Dispatch->TilesPerRow + X;
+        }
+    }
+    Assert(OrderAt == Dispatch->TileCount);
 }
 
-internal u32
-AddMaterial(scene *Scene, material MaterialPrototype)
+internal f32
+EstimateTileError(app_imagebuffer *Buffer, f32 *SecondMoments, u32 MinX, u32 MinY, u32 OnePastMaxX, u32 OnePastMaxY,
+                  u32 *OutMinSampleCount)
 {
-    u32 Index = Scene->MaterialCount++;
-    material *Material = &Scene->Materials[Index];
-    *Material = MaterialPrototype;
-    if (Max3(Material->Emissive) > 0.0f)
+    // NOTE: Average relative standard error of the mean luminance of the tile's pixels. With N samples
+    //       the standard error is sqrt((E[L^2] - E[L]^2) / N). The small bias on the mean keeps black
+    //       pixels from blowing up the estimate.
+    f32 TotalError = 0.0f;
+    f32 MinSampleCount = F32_MAX;
+    for (u32 Y = MinY; Y < OnePastMaxY; ++Y)
     {
-        Material->Flags |= Material_Emissive;
+        for (u32 X = MinX; X < OnePastMaxX; ++X)
+        {
+            u32 PixelIndex = Y*Buffer->W + X;
+            app_pixel Pixel = Buffer->Backbuffer[PixelIndex];
+
+            f32 SampleCount = Pixel.w;
+            MinSampleCount = MinF(MinSampleCount, SampleCount);
+            if (SampleCount > 0.0f)
+            {
+                f32 RcpSampleCount = 1.0f / SampleCount;
+                f32 Mean = RcpSampleCount*Luminance(Vec3(Pixel.r, Pixel.g, Pixel.b));
+                f32 MeanSq = RcpSampleCount*SecondMoments[PixelIndex];
+                f32 Variance = MaxF(0.0f, MeanSq - Mean*Mean);
+                TotalError += SquareRootF(RcpSampleCount*Variance) / (Mean + 0.01f);
+            }
+        }
     }
-    return Index;
+
+    u32 PixelCount = (OnePastMaxX - MinX)*(OnePastMaxY - MinY);
+    f32 Result = TotalError / (f32)MAX(1, PixelCount);
+    *OutMinSampleCount = (u32)MinSampleCount;
+    return Result;
 }
 
-internal void
-BuildTestScene(scene *Scene, arena *TempArena)
+internal bool
+SeedPass(thread_dispatch *Dispatch)
 {
-    ++Scene->MaterialCount; // NOTE: NULL material
-    ++Scene->PlaneCount;    // NOTE: NULL plane
-    ++Scene->SphereCount;   // NOTE: NULL sphere
+    // NOTE: Called by whoever starts a pass, while no tiles are in flight. Converged tiles are left
+    //       out, and if that leaves nothing to do no pass is started and this returns false.
+    u32 PassTileCount = 0;
+    for (u32 OrderIndex = 0; OrderIndex < Dispatch->TileCount; ++OrderIndex)
+    {
+        u32 TileIndex = Dispatch->TileOrder[OrderIndex];
+        if (!Dispatch->TileConverged[TileIndex])
+        {
+            Dispatch->PassTiles[PassTileCount++] = TileIndex;
+        }
+    }
 
-    AimAt(&Scene->NewCamera, Vec3(0, 2, -5), Vec3(0, 1, 0));
+    Dispatch->PassTileCount = PassTileCount;
+    Dispatch->Converged = (PassTileCount == 0);
+    if (!PassTileCount)
+    {
+        return false;
+    }
 
-    Scene->IBL = LoadHdr(&Scene->Arena, TempArena, "ballroom_4k.hdr");
+    u32 SequenceBase = Dispatch->SequenceEnd;
+    Dispatch->SequenceBase = SequenceBase;
+    Dispatch->SequenceEnd = SequenceBase + PassTileCount;
+    Dispatch->RetiredTileCount = 0;
+    Dispatch->PassRunning = true;
+    Dispatch->PassBeginClock = ReadClock();
 
-    u32 PlaneMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.1f, 1, 0.1f) });
-    u32 Plane2MaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.3f, 0.5f) });
-    u32 SphereMaterialIndex = AddMaterial(Scene, { .IOR = 1.5f, .Albedo = Vec3(1, 1, 1) });
-    u32 Sphere2MaterialIndex = AddMaterial(Scene, { .Flags = Material_Mirror, .Albedo = Vec3(1, 0.5f, 0.2f) });
+    u32 ActiveThreadCount = Dispatch->ThreadCount;
+    if (Dispatch->Common.Settings.ThreadCount > 0)
+    {
+        ActiveThreadCount = MIN((u32)Dispatch->Common.Settings.ThreadCount, Dispatch->ThreadCount);
+    }
+    Dispatch->ActiveThreadCount = ActiveThreadCount;
 
-    Scene->Spheres[Scene->SphereCount++] =
+    MEMORY_BARRIER;
+
+    // NOTE: Inactive workers get an empty range
+    u32 TilesPerThread = (PassTileCount + ActiveThreadCount - 1) / ActiveThreadCount;
+    for (u32 ThreadIndex = 0; ThreadIndex < Dispatch->ThreadCount; ++ThreadIndex)
     {
-        .Material = SphereMaterialIndex,
-        .P = Vec3(5, 5.0f, 5.5f),
-        .r = 4.0f,
-    };
+        u32 Begin = MIN(ThreadIndex*TilesPerThread, PassTileCount);
+        u32 End = MIN(Begin + TilesPerThread, PassTileCount);
+        if (ThreadIndex >= ActiveThreadCount)
+        {
+            Begin = End = PassTileCount;
+        }
+        Dispatch->Deques[ThreadIndex].Range = PackTileRange(SequenceBase + Begin, SequenceBase + End);
+    }
 
-    Scene->Spheres[Scene->SphereCount++] =
+    MEMORY_BARRIER;
+
+    // NOTE: Workers that are still spinning will eat a spurious wakeup later, which is harmless
+    for (u32 ThreadIndex = 0; ThreadIndex < ActiveThreadCount; ++ThreadIndex)
     {
-        .Material = Sphere2MaterialIndex,
-        .P = Vec3(5, 3.0f, 0),
-        .r = 2.0f,
-    };
+        Platform.ReleaseSemaphore(Dispatch->WakeSemaphores[ThreadIndex], 1, nullptr);
+    }
+
+    return true;
+}
+
+internal bool
+ConsumePassBudget(thread_dispatch *Dispatch)
+{
+    bool Result = false;
+    for (;;)
+    {
+        u32 Budget = Dispatch->PassBudget;
+        if (!Budget)
+        {
+            break;
+        }
+        if (AtomicCompareExchangeU32(&Dispatch->PassBudget, Budget, Budget - 1) == Budget)
+        {
+            Result = true;
+            break;
+        }
+    }
+    return Result;
+}
+
+internal bool
+ReachedTargetPassCount(thread_dispatch *Dispatch)
+{
+    bool Result = (Dispatch->TargetPassCount && (Dispatch->FinishedPassCount >= Dispatch->TargetPassCount));
+    return Result;
+}
 
-    Scene->Spheres[Scene->SphereCount++] =
+internal u32
+RunAheadPassCount(thread_dispatch *Dispatch)
+{
+    // NOTE: No more budget than there are passes left to reach the target. FinishedPassCount can
+    //       go up between reading it here and the workers using the budget, so FinishPass checks
+    //       the target again before it starts a pass.
+    u32 Result = RUN_AHEAD_PASS_COUNT;
+    if (Dispatch->TargetPassCount)
     {
-        .Material = PlaneMaterialIndex,
-        .P = Vec3(0, -100, 0),
-        .r = 100.0f,
-    };
+        u32 FinishedPassCount = Dispatch->FinishedPassCount;
+        Result = ((FinishedPassCount < Dispatch->TargetPassCount) ?
+                  MIN(Result, Dispatch->TargetPassCount - FinishedPassCount) : 0);
+    }
+    return Result;
+}
+
+internal void
+FinishPass(thread_dispatch *Dispatch)
+{
+    // NOTE: Called by the worker that retired the last tile of a pass. If there's budget left it
+    //       presents the pass and kicks off the next one right away, without waiting for the main thread.
+    bool StartedPass = false;
+    if (!ReachedTargetPassCount(Dispatch) && ConsumePassBudget(Dispatch))
+    {
+        app_imagebuffer *Buffer = Dispatch->Common.Buffer;
+        CopyArray(Buffer->W*Buffer->H, Buffer->Backbuffer, Buffer->Frontbuffer);
+
+        FrameIndex += 1;
+        StartedPass = SeedPass(Dispatch);
+    }
+
+    if (!StartedPass)
+    {
+        MEMORY_BARRIER;
+        Dispatch->PassRunning = false;
+
+        if (Dispatch->SignalIdle)
+        {
+            Dispatch->SignalIdle = false;
+            Platform.ReleaseSemaphore(Dispatch->IdleSemaphore, 1, nullptr);
+        }
+    }
 }
 
 internal void
 RayThreadProc(void *UserData, platform_semaphore_handle ParentSemaphore)
 {
     thread_dispatch *Dispatch = (thread_dispatch *)UserData;
+    u32 ThreadIndex = AtomicAddU32(&Dispatch->NextThreadIndex, 1);
     Platform.ReleaseSemaphore(ParentSemaphore, 1, nullptr);
 
     common_thread_params *CommonParams = &Dispatch->Common;
+    tile_deque *Deque = &Dispatch->Deques[ThreadIndex];
+    ray_counters *Counters = &Dispatch->Counters[ThreadIndex];
+    profile_ring *Ring = &Dispatch->Profiler.Rings[ThreadIndex];
 
     for (;;)
     {
-        u32 TileIndex = AtomicAddU32(&Dispatch->NextTileIndex, 1);
-        if (TileIndex < Dispatch->TileCount)
+        if (Dispatch->JobPending)
+        {
+            AtomicAddU32(&Dispatch->JobWorkerCount, 1);
+            if (Dispatch->JobPending)
+            {
+                WorkOnParallelJob(&Dispatch->Job, ThreadIndex);
+            }
+            AtomicAddU32(&Dispatch->JobWorkerCount, -1);
+        }
+
+        u32 Sequence;
+        if ((ThreadIndex < Dispatch->ActiveThreadCount) &&
+            (PopTile(Deque, &Sequence) || StealTile(Dispatch, ThreadIndex, &Sequence)))
         {
+            render_settings *Settings = &CommonParams->Settings;
             scene *Scene = CommonParams->Scene;
             app_imagebuffer *Buffer = CommonParams->Buffer;
 
+            u32 TileIndex = Dispatch->PassTiles[Sequence - Dispatch->SequenceBase];
             u32 TileIndexX = TileIndex % Dispatch->TilesPerRow;
             u32 TileIndexY = TileIndex / Dispatch->TilesPerRow;
             u32 TileMinX = TileIndexX*Dispatch->TileW;
             u32 TileMinY = TileIndexY*Dispatch->TileH;
             u32 TileOnePastMaxX = MIN(TileMinX + Dispatch->TileW, Buffer->W);
             u32 TileOnePastMaxY = MIN(TileMinY + Dispatch->TileH, Buffer->H);
-            CastRays(Scene, TileMinX, TileMinY, TileOnePastMaxX, TileOnePastMaxY, Buffer);
 
-            AtomicAddU32(&Dispatch->RetiredTileCount, 1);
+            sampler_type SamplerType = (Settings->XorshiftSampler ? Sampler_Xorshift : Sampler_Sobol);
+            image_u32 *BlueNoise = (Settings->BlueNoiseRotation ? CommonParams->BlueNoise : nullptr);
+
+            u64 TileBeginClock = ReadClock();
+            if (Settings->WavefrontIntegrator)
+            {
+                CastRaysWavefront(Scene, TileMinX, TileMinY, TileOnePastMaxX, TileOnePastMaxY, Buffer, Dispatch->SecondMoments, SamplerType, BlueNoise);
+            }
+            else if (Settings->PacketPrimaryRays)
+            {
+                CastRaysPacketed(Scene, TileMinX, TileMinY, TileOnePastMaxX, TileOnePastMaxY, Buffer, Dispatch->SecondMoments, SamplerType, BlueNoise);
+            }
+            else
+            {
+                CastRays(Scene, TileMinX, TileMinY, TileOnePastMaxX, TileOnePastMaxY, Buffer, Dispatch->SecondMoments, SamplerType, BlueNoise);
+            }
+
+            u64 TileEndClock = ReadClock();
+            Dispatch->TileCost[TileIndex] = TileEndClock - TileBeginClock;
+            RecordProfileEvent(Ring, ProfileEvent_Tile, TileIndex, TileBeginClock, TileEndClock);
+
+            if (Settings->AdaptiveSampling)
+            {
+                u32 MinSampleCount;
+                f32 Error = EstimateTileError(Buffer, Dispatch->SecondMoments, TileMinX, TileMinY,
+                                              TileOnePastMaxX, TileOnePastMaxY, &MinSampleCount);
+                Dispatch->TileConverged[TileIndex] = ((MinSampleCount >= ADAPTIVE_MIN_SAMPLE_COUNT) &&
+                                                      (Error < Settings->AdaptiveErrorThreshold));
+            }
+
+            *Counters = ThreadRayCounters;
+
+            u32 RetiredTileCount = AtomicAddU32(&Dispatch->RetiredTileCount, 1) + 1;
+            if (RetiredTileCount == Dispatch->PassTileCount)
+            {
+                Dispatch->FinishedPassCount = Dispatch->FinishedPassCount + 1;
+                RecordProfileEvent(Ring, ProfileEvent_Pass, FrameIndex, Dispatch->PassBeginClock, ReadClock());
+                FinishPass(Dispatch);
+            }
         } 
         else
         {
-            Platform.WaitOnSemaphore(Dispatch->Semaphore);
+            u64 WaitBeginClock = ReadClock();
+            Platform.WaitOnSemaphore(Dispatch->WakeSemaphores[ThreadIndex]);
+            RecordProfileEvent(Ring, ProfileEvent_Wait, 0, WaitBeginClock, ReadClock());
         }
     }
 }
 
 internal void
-InitThreadDispatcher(thread_dispatch *Dispatch)
+InitThreadDispatcher(thread_dispatch *Dispatch, arena *Arena)
 {
     u32 ThreadCount = Platform.LogicalCoreCount;
 
     Dispatch->ThreadCount = ThreadCount;
-    Dispatch->Semaphore = Platform.CreateSemaphore(0, ThreadCount);
+    Dispatch->ActiveThreadCount = ThreadCount;
+    Dispatch->IdleSemaphore = Platform.CreateSemaphore(0, 1);
+    Dispatch->WakeSemaphores = PushArray(Arena, ThreadCount, platform_semaphore_handle);
+    Dispatch->Deques = PushAlignedArray(Arena, ThreadCount, tile_deque, 64);
+    Dispatch->Counters = PushAlignedArray(Arena, ThreadCount, ray_counters, 64);
+    Dispatch->ThreadArenas = PushAlignedArray(Arena, ThreadCount + 1, arena, 64);
+    InitProfiler(&Dispatch->Profiler, Arena, ThreadCount + 1);
+
+    for (usize ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        Dispatch->WakeSemaphores[ThreadIndex] = Platform.CreateSemaphore(0, 1);
+    }
 
     for (usize ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
     {
@@ -599,56 +3691,147 @@ InitThreadDispatcher(thread_dispatch *Dispatch)
     }
 }
 
-internal bool
-ManageDispatch(thread_dispatch *Dispatch, u32 TileW, u32 TileH, common_thread_params Common)
+internal void
+BeginPasses(thread_dispatch *Dispatch, arena *Arena, u32 TileW, u32 TileH, common_thread_params Common, u32 PassBudget)
 {
-    bool Result = false;
-    if (Dispatch->NextTileIndex >= Dispatch->TileCount)
+    // NOTE: Starts a pass while the workers are idle. They'll go on to run up to PassBudget more
+    //       passes by themselves.
+    Assert(!Dispatch->PassRunning);
+
+    scene *Scene = Common.Scene;
+
+    bool SettingsChanged = !StructsAreEqual(&Common.Settings, &Dispatch->Common.Settings);
+
+    Dispatch->Common = Common;
+    app_imagebuffer *Buffer = Dispatch->Common.Buffer;
+
+    u32 W = Buffer->W;
+    u32 H = Buffer->H;
+    u32 TilesPerRow = (W + (TileW - 1)) / TileW;
+    u32 TilesPerCol = (H + (TileH - 1)) / TileH;
+    u32 TileCount = TilesPerRow*TilesPerCol;
+
+    bool TilesChanged = ((Dispatch->TileW != TileW) ||
+                         (Dispatch->TileH != TileH) ||
+                         (Dispatch->TilesPerRow != TilesPerRow) ||
+                         (Dispatch->TilesPerCol != TilesPerCol));
+
+    Dispatch->TileW = TileW;
+    Dispatch->TileH = TileH;
+    Dispatch->TilesPerRow = TilesPerRow;
+    Dispatch->TilesPerCol = TilesPerCol;
+    Dispatch->TileCount = TileCount;
+
+    if (TilesChanged)
     {
-        Result = true;
+        BuildTileOrder(Dispatch, Arena);
+    }
 
-        Dispatch->Common = Common;
-        scene *Scene = Dispatch->Common.Scene;
-        app_imagebuffer *Buffer = Dispatch->Common.Buffer;
+    bool ResetAccumulation = (!StructsAreEqual(&Scene->Camera, &Scene->NewCamera) || Scene->InstancesMoved);
+    if ((Dispatch->MomentsW != W) || (Dispatch->MomentsH != H))
+    {
+        if (Dispatch->MomentsCapacity < W*H)
+        {
+            Dispatch->MomentsCapacity = W*H;
+            Dispatch->SecondMoments = PushArrayNoClear(Arena, W*H, f32);
+        }
+        Dispatch->MomentsW = W;
+        Dispatch->MomentsH = H;
 
-        u32 W = Buffer->W;
-        u32 H = Buffer->W;
-        u32 TilesPerRow = (W + (TileW - 1)) / TileW;
-        u32 TilesPerCol = (H + (TileH - 1)) / TileH;
-        u32 TileCount = TilesPerRow*TilesPerCol;
+        // NOTE: The platform hands us fresh buffers when the window is resized
+        ZeroArray(W*H, Dispatch->SecondMoments);
+        Dispatch->FinishedPassCount = 0;
+        ResetAccumulation = true;
+    }
 
-        Dispatch->TileW = TileW;
-        Dispatch->TileH = TileH;
-        Dispatch->TilesPerRow = TilesPerRow;
-        Dispatch->TilesPerCol = TilesPerCol;
-        Dispatch->TileCount = TileCount;
-        Dispatch->NextTileIndex = 0;
-        Dispatch->RetiredTileCount = 0;
+    if (ResetAccumulation || SettingsChanged)
+    {
+        ZeroArray(TileCount, Dispatch->TileConverged);
+        Dispatch->Converged = false;
+    }
 
+    // NOTE: Once every tile has converged the front buffer is already up to date, and there's
+    //       nothing to do until something changes
+    if (!Dispatch->Converged)
+    {
         CopyArray(Buffer->W*Buffer->H, Buffer->Backbuffer, Buffer->Frontbuffer);
         Swap(Buffer->Backbuffer, Buffer->Frontbuffer);
 
-        if (!StructsAreEqual(&Scene->Camera, &Scene->NewCamera))
+        if (ResetAccumulation)
         {
             ZeroArray(Buffer->W*Buffer->H, Buffer->Backbuffer);
+            ZeroArray(Buffer->W*Buffer->H, Dispatch->SecondMoments);
+            Dispatch->FinishedPassCount = 0;
             Scene->Camera = Scene->NewCamera;
+            Scene->InstancesMoved = false;
         }
 
         FrameIndex += 1;
 
-        MEMORY_BARRIER;
+        Dispatch->PassBudget = PassBudget;
+        if (TileCount)
+        {
+            SeedPass(Dispatch);
+        }
+    }
+}
+
+internal bool
+ManageDispatch(thread_dispatch *Dispatch, arena *Arena, u32 TileW, u32 TileH, common_thread_params Common)
+{
+    bool Result = false;
 
-        int PreviousCount;
-        Platform.ReleaseSemaphore(Dispatch->Semaphore, Dispatch->ThreadCount, &PreviousCount);
+    scene *Scene = Common.Scene;
+    if (Dispatch->PassRunning)
+    {
+        // NOTE: Top up the workers' budget, unless something changed that needs us to start over
+        bool NeedsRestart = (!Common.Settings.ContinuousPasses ||
+                             !StructsAreEqual(&Scene->Camera, &Scene->NewCamera) ||
+                             !StructsAreEqual(&Common.Settings, &Dispatch->Common.Settings) ||
+                             (Scene->PendingMoves.Count > 0) ||
+                             (Scene->InstanceRebuild.State == BVHRebuild_Done));
+        Dispatch->PassBudget = (NeedsRestart ? 0 : RunAheadPassCount(Dispatch));
+        MEMORY_BARRIER;
+    }
 
-        Assert(PreviousCount == 0);
+    if (!Dispatch->PassRunning && !ReachedTargetPassCount(Dispatch))
+    {
+        Result = true;
+        UpdateInstanceBVH(Scene, Arena, Dispatch);
+        BeginPasses(Dispatch, Arena, TileW, TileH, Common,
+                    (Common.Settings.ContinuousPasses ? RunAheadPassCount(Dispatch) : 0));
     }
     return Result;
 }
 
+internal void
+PushTileHeatmap(render_context *RenderContext, thread_dispatch *Dispatch)
+{
+    // NOTE: Tints each tile from blue to red by how long it took in the latest pass, relative to the
+    //       most expensive tile. Image rows go bottom to top, same as the render commands.
+    u64 MaxCost = 1;
+    for (u32 TileIndex = 0; TileIndex < Dispatch->TileCount; ++TileIndex)
+    {
+        MaxCost = MAX(MaxCost, Dispatch->TileCost[TileIndex]);
+    }
+
+    f32 RcpMaxCost = 1.0f / (f32)MaxCost;
+    for (u32 TileIndex = 0; TileIndex < Dispatch->TileCount; ++TileIndex)
+    {
+        u32 TileIndexX = TileIndex % Dispatch->TilesPerRow;
+        u32 TileIndexY = TileIndex / Dispatch->TilesPerRow;
+
+        f32 Heat = RcpMaxCost*(f32)Dispatch->TileCost[TileIndex];
+        vec2 Min = Vec2((f32)(TileIndexX*Dispatch->TileW), (f32)(TileIndexY*Dispatch->TileH));
+        vec2 Dim = Vec2((f32)Dispatch->TileW, (f32)Dispatch->TileH);
+        PushRect(RenderContext, Min, Dim, Vec4(Heat, 0.0f, 1.0f - Heat, 0.5f));
+    }
+}
+
 internal void
 RayInit(app_init_params *Params)
 {
+    TestSceneMeshFileName = Params->MeshFileName;
     Params->WindowW = 1280;
     Params->WindowH = 720;
 }
@@ -669,10 +3852,18 @@ RayTick(platform_api API, app_input *Input, app_imagebuffer *ImageBuffer, app_re
 
         RayState = BootstrapPushStruct(ray_state, Arena);
         scene *Scene = RayState->Scene = PushStruct(&RayState->Arena, scene);
+        RayState->Settings.ContinuousPasses = true;
+        RayState->Settings.BlueNoiseRotation = true;
+        RayState->Settings.AdaptiveSampling = true;
+        RayState->Settings.AdaptiveErrorThreshold = 0.01f;
         InitializeRenderContext(&RayState->RenderContext, RenderCommands);
 
-        InitThreadDispatcher(&RayState->Dispatch);
-        BuildTestScene(Scene, &RayState->Arena);
+        InitThreadDispatcher(&RayState->Dispatch, &RayState->Arena);
+        BuildTestScene(Scene, &RayState->Arena, &RayState->Dispatch);
+        BuildSphereBVH(Scene, &RayState->Arena, &RayState->Dispatch);
+        BuildInstanceBVH(Scene, &RayState->Arena, &RayState->Dispatch);
+        BuildLightList(Scene, &RayState->Arena);
+        RayState->BlueNoise = LoadBlueNoise(&RayState->Arena, "blue_noise_64.bmp");
 
         Mu = PushStruct(&RayState->Arena, mu_Context);
         mu_init(Mu);
@@ -766,6 +3957,26 @@ RayTick(platform_api API, app_input *Input, app_imagebuffer *ImageBuffer, app_re
         {
             Aim(Camera, -Camera->Z);
         }
+        mu_checkbox(Mu, "Packet Primary Rays", &RayState->Settings.PacketPrimaryRays);
+        mu_checkbox(Mu, "Wavefront Integrator", &RayState->Settings.WavefrontIntegrator);
+        mu_checkbox(Mu, "Continuous Passes", &RayState->Settings.ContinuousPasses);
+        mu_checkbox(Mu, "Xorshift Sampler", &RayState->Settings.XorshiftSampler);
+        mu_checkbox(Mu, "Blue Noise Rotation", &RayState->Settings.BlueNoiseRotation);
+        mu_checkbox(Mu, "Adaptive Sampling", &RayState->Settings.AdaptiveSampling);
+
+        // NOTE: The slider gets its label on the same row, then the layout goes back to one item per row
+        int AdaptiveErrorRow[] = { 100, -1 };
+        mu_layout_row(Mu, ArrayCount(AdaptiveErrorRow), AdaptiveErrorRow, 0);
+        mu_label(Mu, "Adaptive Error");
+        mu_slider_ex(Mu, &RayState->Settings.AdaptiveErrorThreshold, 0.001f, 0.1f, 0, "%.3f", MU_OPT_ALIGNCENTER);
+        int DefaultRow[] = { 0 };
+        mu_layout_row(Mu, ArrayCount(DefaultRow), DefaultRow, 0);
+
+        mu_checkbox(Mu, "Tile Heatmap", &RayState->ShowTileHeatmap);
+        if (mu_button(Mu, "Export Trace"))
+        {
+            ExportChromeTrace(&RayState->Dispatch.Profiler, &RayState->Arena, "ray_trace.json");
+        }
         mu_end_window(Mu);
     }
     mu_end(Mu);
@@ -776,6 +3987,11 @@ RayTick(platform_api API, app_input *Input, app_imagebuffer *ImageBuffer, app_re
 
     render_context *RenderContext = &RayState->RenderContext;
 
+    if (RayState->ShowTileHeatmap)
+    {
+        PushTileHeatmap(RenderContext, &RayState->Dispatch);
+    }
+
     mu_Command *Command = NULL;
     while (mu_next_command(Mu, &Command))
     {
@@ -810,23 +4026,54 @@ RayTick(platform_api API, app_input *Input, app_imagebuffer *ImageBuffer, app_re
     //
 
     thread_dispatch *Dispatch = &RayState->Dispatch;
-    bool FinishedPass = ManageDispatch(Dispatch, 16, 16, common_thread_params {
+    profile_ring *MainRing = &Dispatch->Profiler.Rings[Dispatch->ThreadCount];
+
+    Dispatch->TargetPassCount = Input->TargetPassCount;
+
+    u64 DispatchBeginClock = ReadClock();
+    bool FinishedPass = ManageDispatch(Dispatch, &RayState->Arena, 16, 16, common_thread_params {
+        .Settings = RayState->Settings,
         .Scene = Scene,
         .Buffer = ImageBuffer,
+        .BlueNoise = (ValidImage(&RayState->BlueNoise) ? &RayState->BlueNoise : nullptr),
     });
+    RecordProfileEvent(MainRing, ProfileEvent_Dispatch, FinishedPass, DispatchBeginClock, ReadClock());
+
+    Input->FinishedPassCount = Dispatch->FinishedPassCount;
+    Input->Converged = (Dispatch->Converged && !Dispatch->PassRunning);
 }
 
 internal void
-RayExit(void)
+RayExit(app_input *Input)
 {
-    // NOTE: Wait for threads to finish before exiting the program
+    // NOTE: Wait for threads to finish before exiting the program. Passes can finish after the last
+    //       tick, so the counts in Input only get final here.
     thread_dispatch *Dispatch = &RayState->Dispatch;
-    while (Dispatch->RetiredTileCount < Dispatch->TileCount)
+    Dispatch->PassBudget = 0;
+    MEMORY_BARRIER;
+    while (Dispatch->PassRunning)
     {
         _mm_pause();
     }
+
+    Input->FinishedPassCount = Dispatch->FinishedPassCount;
+    Input->Converged = Dispatch->Converged;
+}
+
+internal bool
+RayExportTrace(const char *FileName)
+{
+    bool Result = false;
+    if (RayState)
+    {
+        Result = ExportChromeTrace(&RayState->Dispatch.Profiler, &RayState->Arena, FileName);
+    }
+    return Result;
 }
 
+#include "ray_benchmark.cpp"
+#include "ray_test.cpp"
+
 app_links
 AppLinks(void)
 {
@@ -835,6 +4082,9 @@ AppLinks(void)
         .AppInit = RayInit,
         .AppTick = RayTick,
         .AppExit = RayExit,
+        .AppBenchmark = RayBenchmark,
+        .AppTest = RayTest,
+        .AppExportTrace = RayExportTrace,
     };
     return Result;
 }
@@ -6,18 +6,65 @@
 global platform_api Platform;
 
 #include <stdio.h>
+#include <stdarg.h>
 
 #include "ray_arena.h"
 #include "ray_handmade_math.h"
+#include "ray_lane.h"
+#include "ray_fast_math.h"
 #include "ray_assets.h"
+#include "ray_bvh.h"
 #include "ray_render_commands.h"
 #include "ray_render_context.h"
+#include "ray_profiler.h"
 
 struct random_series
 {
     u32 State;
 };
 
+// NOTE: LANE_WIDTH xorshift streams side by side, each lane with its own state
+struct random_series_lane
+{
+    lane_u32 State;
+};
+
+// NOTE: Unilateral floats generated a whole lane at a time and handed out one by one. Refilling
+//       in bulk takes the state update off the dependency chain of whoever draws from it.
+#define RANDOM_BATCH_SIZE (4*LANE_WIDTH)
+struct random_batch
+{
+    random_series_lane Series;
+    u32 Next;
+    alignas(32) f32 Values[RANDOM_BATCH_SIZE];
+};
+
+enum sampler_type
+{
+    Sampler_Sobol,
+    Sampler_Xorshift,
+};
+
+// NOTE: Hands out the random numbers for one sample of one pixel. The Sobol sampler gives each
+//       draw its own dimension: an Owen scrambled Sobol sequence seeded by pixel and dimension,
+//       indexed by the number of samples the pixel already has. The Xorshift sampler ignores all
+//       that and pulls from Batch, which is shared by the whole tile.
+//
+//       With a blue noise mask, all pixels share one scramble and each rotates it by its texel in
+//       the mask instead, so the error left over at low sample counts comes out as blue noise.
+//       That only means something for Sobol, Xorshift ignores the mask.
+struct sampler
+{
+    u32 Type;
+    u32 ScrambleSeed;
+    u32 SampleIndex;
+    u32 Dimension;
+    random_batch *Batch;
+
+    image_u32 *BlueNoise;
+    u32 PixelX, PixelY;
+};
+
 struct accumulator
 {
     u32 W, H;
@@ -38,6 +85,209 @@ struct sphere
     f32 r;
 };
 
+// NOTE: Triangles get reordered when the BVH is built so that leaves index them directly. The BVH
+//       is the quantized 8 wide kind, the binary one it gets collapsed from is thrown away. Meshes
+//       are in object space and only show up in the scene through instances.
+struct mesh
+{
+    u32 Material;
+    triangle_mesh *Geometry;
+    aabb Bounds;
+    bvh8 BVH;
+};
+
+#define MESH_TRIANGLES_PER_ITEM 32768
+
+// NOTE: Gathers the bounds of the triangles for BuildBVH, MESH_TRIANGLES_PER_ITEM at a time
+struct mesh_primitive_job
+{
+    triangle_mesh *Geometry;
+    bvh_build_primitive *Primitives;
+};
+
+// NOTE: One placement of a mesh. Material 0 means the mesh's own material. Bounds is the world
+//       space box around the mesh's bounds, and gets updated along with the transform.
+struct instance
+{
+    u32 Mesh;
+    u32 Material;
+    affine_transform ObjectToWorld;
+    affine_transform WorldToObject;
+    aabb Bounds;
+};
+
+// NOTE: A new transform for an instance, waiting for the next pass boundary
+struct instance_move
+{
+    u32 Instance;
+    affine_transform ObjectToWorld;
+};
+
+// NOTE: Per ray setup for the watertight triangle test: the axis the ray is most aligned with
+//       becomes Z (KX, KY, KZ keep the winding intact) and the shear takes the direction to +Z.
+// SOURCE: Woop, Benthin, Wald, "Watertight Ray/Triangle Intersection", JCGT 2013
+//         https://jcgt.org/published/0002/01/05/
+struct triangle_ray
+{
+    u32 KX, KY, KZ;
+    f32 ShearX, ShearY, ShearZ;
+};
+
+#define SPHERE_BLOCK_WIDTH 8
+
+// NOTE: Spheres repacked SoA so that one ray can be tested against a whole block at once.
+//       Unused lanes have a hugely negative RSq so they never register a hit.
+struct alignas(32) sphere_block
+{
+    f32 X[SPHERE_BLOCK_WIDTH];
+    f32 Y[SPHERE_BLOCK_WIDTH];
+    f32 Z[SPHERE_BLOCK_WIDTH];
+    f32 RSq[SPHERE_BLOCK_WIDTH];
+    u32 Material[SPHERE_BLOCK_WIDTH];
+
+    // NOTE: 1 + the index into scene::Lights for emissive spheres, 0 for everything else
+    u32 Light[SPHERE_BLOCK_WIDTH];
+};
+
+#define PACKET_DIM 4
+#define PACKET_SIZE (PACKET_DIM*PACKET_DIM)
+#define PACKET_LANE_GROUPS (PACKET_SIZE / LANE_WIDTH)
+
+// NOTE: A PACKET_DIM x PACKET_DIM block of primary rays, split into lane-wide groups.
+//       Rays that shouldn't be traced get a tMax of 0.
+struct ray_packet
+{
+    lane_v3 P[PACKET_LANE_GROUPS];
+    lane_v3 D[PACKET_LANE_GROUPS];
+    lane_v3 InvD[PACKET_LANE_GROUPS];
+    lane_f32 tMax[PACKET_LANE_GROUPS];
+};
+
+// NOTE: HitID is 0 for a miss, PACKET_HIT_PLANE|PlaneIndex for planes, PACKET_HIT_INSTANCE|InstanceIndex
+//       for meshes, and 1 + BlockIndex*SPHERE_BLOCK_WIDTH + BlockLane for spheres.
+#define PACKET_HIT_PLANE    0x80000000u
+#define PACKET_HIT_INSTANCE 0x40000000u
+
+struct packet_hit
+{
+    lane_f32 t[PACKET_LANE_GROUPS];
+    lane_u32 Material[PACKET_LANE_GROUPS];
+    lane_u32 HitID[PACKET_LANE_GROUPS];
+
+    // NOTE: Only meaningful for rays whose HitID has PACKET_HIT_INSTANCE set
+    u32 MeshTriangle[PACKET_SIZE];
+    f32 MeshU[PACKET_SIZE];
+    f32 MeshV[PACKET_SIZE];
+};
+
+// NOTE: Piecewise constant distribution over the texels of an equirectangular IBL, proportional to
+//       luminance times the solid angle each texel covers. MarginalCdf picks a row and that row's
+//       conditional CDF (W + 1 entries, starting at ConditionalCdfs + Row*(W + 1)) picks a column.
+struct environment_distribution
+{
+    u32 W, H;
+    f32 *MarginalCdf;
+    f32 *ConditionalCdfs;
+};
+
+// NOTE: Decoding a big HDR and building its sampling tables is most of the startup time, so the result
+//       gets written next to the source as FileName.cache and mapped straight back in on later runs.
+//       A cache is used if the source size and modified time match, and failing that if the source
+//       still hashes the same (files copied around keep their contents but not their timestamps).
+//       Sections are at 64 byte aligned offsets from the start of the file. Bump the version whenever
+//       the layout or anything that feeds into the tables changes.
+#define ENVIRONMENT_CACHE_MAGIC   0x45564e52 // 'RNVE'
+#define ENVIRONMENT_CACHE_VERSION 3
+
+struct environment_cache_header
+{
+    u32 Magic;
+    u32 Version;
+    u64 SourceSize;
+    u64 SourceModifiedTime;
+    u64 SourceHash;
+    u32 W, H;
+    u32 ExponentBias;
+    u32 LevelCount;
+    u64 LevelOffsets[IMAGE_MAX_LEVEL_COUNT]; // RGB9E5, sized as BuildImagePyramid does
+    u64 MarginalCdfOffset;                   // H + 1 f32
+    u64 ConditionalCdfsOffset;               // H*(W + 1) f32
+    u64 FileSize;
+};
+
+// NOTE: An emissive sphere, as seen by next event estimation
+struct sphere_light
+{
+    vec3 P;
+    f32 r;
+    vec3 Emission;
+};
+
+// NOTE: One bucket of an alias table. A uniformly picked bucket keeps its own index with
+//       probability KeepProbability and otherwise hands over to Alias. Pdf is the overall
+//       probability of ending up at this index, for MIS.
+struct alias_entry
+{
+    f32 KeepProbability;
+    u32 Alias;
+    f32 Pdf;
+};
+
+struct scene_hit
+{
+    f32 t;
+    u32 Material;
+    u32 Light;
+    vec3 N;
+};
+
+#define WAVEFRONT_SIZE 256
+
+// NOTE: Each diffuse hit can send one shadow ray at the directional light, one at the environment
+//       and one at a sphere light
+#define WAVEFRONT_SHADOW_RAY_COUNT (3*WAVEFRONT_SIZE)
+
+// NOTE: The live paths of a wavefront, stored SoA so each stage streams through them linearly.
+//       Slot is the index of the pixel (within the wavefront) that the path contributes to.
+struct wavefront_paths
+{
+    u32 Count;
+    u32 Slot[WAVEFRONT_SIZE];
+    b32 Alive[WAVEFRONT_SIZE];
+    f32 PX[WAVEFRONT_SIZE], PY[WAVEFRONT_SIZE], PZ[WAVEFRONT_SIZE];
+    f32 DX[WAVEFRONT_SIZE], DY[WAVEFRONT_SIZE], DZ[WAVEFRONT_SIZE];
+    f32 ThroughputR[WAVEFRONT_SIZE], ThroughputG[WAVEFRONT_SIZE], ThroughputB[WAVEFRONT_SIZE];
+
+    // NOTE: The pdf of the last diffuse bounce, for weighting environment hits. Zero after specular bounces.
+    f32 BouncePdf[WAVEFRONT_SIZE];
+    // NOTE: The solid angle the ray stands for, which picks the IBL mip it reads on a miss
+    f32 Footprint[WAVEFRONT_SIZE];
+
+    // NOTE: Written by the extend stage, read by the shade stage
+    f32 t[WAVEFRONT_SIZE];
+    u32 Material[WAVEFRONT_SIZE];
+    u32 Light[WAVEFRONT_SIZE];
+    f32 NX[WAVEFRONT_SIZE], NY[WAVEFRONT_SIZE], NZ[WAVEFRONT_SIZE];
+};
+
+struct wavefront_shadow_rays
+{
+    u32 Count;
+    u32 Slot[WAVEFRONT_SHADOW_RAY_COUNT];
+    f32 PX[WAVEFRONT_SHADOW_RAY_COUNT], PY[WAVEFRONT_SHADOW_RAY_COUNT], PZ[WAVEFRONT_SHADOW_RAY_COUNT];
+    f32 DX[WAVEFRONT_SHADOW_RAY_COUNT], DY[WAVEFRONT_SHADOW_RAY_COUNT], DZ[WAVEFRONT_SHADOW_RAY_COUNT];
+    f32 tMax[WAVEFRONT_SHADOW_RAY_COUNT];
+    f32 ContributionR[WAVEFRONT_SHADOW_RAY_COUNT], ContributionG[WAVEFRONT_SHADOW_RAY_COUNT], ContributionB[WAVEFRONT_SHADOW_RAY_COUNT];
+};
+
+struct wavefront
+{
+    wavefront_paths Paths;
+    wavefront_shadow_rays ShadowRays;
+    vec3 Radiance[WAVEFRONT_SIZE];
+    sampler Samplers[WAVEFRONT_SIZE];
+};
+
 enum material_flag
 {
     Material_Emissive = 0x1,
@@ -64,14 +314,35 @@ struct scene
 {
     arena Arena;
 
-    u32 MaterialCount;
-    material Materials[256];
+    // NOTE: Index 0 of each of these is a NULL entry
+    arena_array<material> Materials;
+    arena_array<plane> Planes;
+    arena_array<sphere> Spheres;
+    arena_array<mesh> Meshes;
+    arena_array<instance> Instances;
+
+    // NOTE: The leaves of SphereBVH index SphereBlocks rather than bvh::Primitives
+    bvh SphereBVH;
+    u32 SphereBlockCount;
+    sphere_block *SphereBlocks;
 
-    u32 PlaneCount;
-    plane Planes[256];
+    // NOTE: The top level over Instances, its leaves go through InstanceBVH.Primitives. It has an
+    //       arena of its own so it can be rebuilt whenever instances move, without touching the
+    //       mesh BVHs or leaking into Arena.
+    arena InstanceArena;
+    bvh InstanceBVH;
 
-    u32 SphereCount;
-    sphere Spheres[256];
+    // NOTE: MoveInstance only queues the new transform in PendingMoves, the same way NewCamera
+    //       holds a camera change, since the workers may be tracing against the old one. Between
+    //       passes UpdateInstanceBVH applies them and refits InstanceBVH instead of rebuilding it,
+    //       InstanceLeaves has the leaf each instance is in. Once the refits have worn the tree
+    //       down, InstanceRebuild builds a new one in the background. InstancesMoved throws out the
+    //       accumulated image at the start of the next pass.
+    arena_array<instance_move> PendingMoves;
+    u32 *InstanceLeaves;
+    bvh_refit InstanceRefit;
+    bvh_rebuild InstanceRebuild;
+    b32 InstancesMoved;
 
     camera Camera;
     camera NewCamera;
@@ -79,34 +350,157 @@ struct scene
     vec3 DirectionalLightD;
     vec3 DirectionalLightEmission;
 
-    image *IBL;
+    // NOTE: IBL is level 0 of IBLMips
+    image_rgb9e5 *IBL;
+    image_rgb9e5_pyramid IBLMips;
+    environment_distribution IBLDistribution;
+    // NOTE: If the IBL came out of a cache, its pixels and tables point into this mapping
+    string_u8 IBLCache;
+
+    // NOTE: Built from the sphere blocks by BuildLightList. Lights are picked in proportion to
+    //       their emitted power.
+    u32 LightCount;
+    sphere_light *Lights;
+    alias_entry *LightAliasTable;
+};
+
+struct render_settings
+{
+    // NOTE: These are ints and floats so microui can poke at them directly
+    int PacketPrimaryRays;
+    int WavefrontIntegrator;
+    int ContinuousPasses;
+    int XorshiftSampler;
+    int BlueNoiseRotation;
+
+    // NOTE: With adaptive sampling on, a tile stops getting samples once the relative standard error
+    //       of its pixels drops below AdaptiveErrorThreshold
+    int AdaptiveSampling;
+    float AdaptiveErrorThreshold;
+
+    // NOTE: Caps how many workers pick up tiles, 0 means all of them
+    int ThreadCount;
 };
 
 struct common_thread_params
 {
+    render_settings Settings;
     scene *Scene;
     app_imagebuffer *Buffer;
+    image_u32 *BlueNoise;
+};
+
+// NOTE: Each worker owns a contiguous range of tile sequence numbers, packed as (End << 32)|Begin so
+//       it can be updated with a single compare exchange. The owner pops from the front and thieves
+//       take from the back. Sequence numbers keep counting up across passes, so a thief holding on
+//       to a range from a finished pass can never succeed in swapping it.
+struct alignas(64) tile_deque
+{
+    volatile u64 Range;
+};
+
+#define RUN_AHEAD_PASS_COUNT 16
+#define ADAPTIVE_MIN_SAMPLE_COUNT 16
+
+// NOTE: Running totals, bumped by each worker in a thread local copy and published to
+//       thread_dispatch::Counters after every tile. They're never reset, so take differences.
+struct alignas(64) ray_counters
+{
+    u64 PrimaryRays;
+    u64 TotalRays;
+    u64 ShadowRays;
+};
+
+// NOTE: ThreadIndex is the worker's index, or ThreadCount for the thread that called RunParallel
+typedef void parallel_job_proc(void *UserData, u32 ItemIndex, u32 ThreadIndex);
+
+// NOTE: Work the main thread hands to the workers while no passes are running, see RunParallel.
+//       Items are claimed one at a time off NextItem, so keep them coarse.
+struct parallel_job
+{
+    parallel_job_proc *Proc;
+    void *UserData;
+    u32 ItemCount;
+    volatile u32 NextItem;
+    volatile u32 FinishedItemCount;
 };
 
 struct thread_dispatch
 {
     u32 ThreadCount;
-    platform_semaphore_handle Semaphore;
+    volatile u32 NextThreadIndex;
+
+    // NOTE: Only workers with an index below ActiveThreadCount take part in a pass. Each worker
+    //       sleeps on its own semaphore so that waking the active ones can't be eaten by the others.
+    volatile u32 ActiveThreadCount;
+    platform_semaphore_handle *WakeSemaphores;
+    ray_counters *Counters;
+
+    // NOTE: If SignalIdle is set, IdleSemaphore is released when the workers run out of passes
+    volatile u32 SignalIdle;
+    platform_semaphore_handle IdleSemaphore;
 
     common_thread_params Common;
 
     u32 TileW, TileH;
     u32 TilesPerCol, TilesPerRow, TileCount;
-    volatile u32 NextTileIndex;
+
+    // NOTE: Tiles in the order they get handed out, see BuildTileOrder. TileCost is indexed by
+    //       tile index and holds the clocks the latest pass spent on each tile.
+    u32 TileOrderCapacity;
+    u32 *TileOrder;
+    u64 *TileCost;
+
+    // NOTE: PassTiles is TileOrder minus the converged tiles, and is what a pass actually hands out
+    b32 *TileConverged;
+    u32 *PassTiles;
+    u32 PassTileCount;
+    volatile u32 Converged;
+
+    // NOTE: Per pixel sum of squared luminance, next to the sums in the image buffer
+    u32 MomentsW, MomentsH;
+    u32 MomentsCapacity;
+    f32 *SecondMoments;
+
+    // NOTE: Passes finished since the accumulation was last reset. Once it reaches TargetPassCount
+    //       (if that's nonzero), no more passes get started.
+    volatile u32 FinishedPassCount;
+    u32 TargetPassCount;
+
+    tile_deque *Deques;
+    volatile u32 SequenceBase;
+    u32 SequenceEnd;
     volatile u32 RetiredTileCount;
+
+    // NOTE: Workers start up to PassBudget passes on their own before handing control back to
+    //       ManageDispatch. PassRunning stays set across those passes.
+    volatile u32 PassBudget;
+    volatile u32 PassRunning;
+    u64 PassBeginClock;
+
+    // NOTE: While JobPending is set, workers help with Job before looking for tiles. JobWorkerCount
+    //       is how many of them might still be touching it.
+    volatile u32 JobPending;
+    volatile u32 JobWorkerCount;
+    parallel_job Job;
+
+    // NOTE: Scratch for parallel jobs, indexed by ThreadIndex, so one per worker plus one for the
+    //       main thread at the end. Each reserves its own memory the first time it's pushed onto.
+    arena *ThreadArenas;
+
+    // NOTE: One ring per worker, plus one for the main thread at the end
+    profiler Profiler;
 };
 
 struct ray_state
 {
     arena Arena;
     scene *Scene;
+    render_settings Settings;
     render_context RenderContext;
     thread_dispatch Dispatch;
+    image_u32 BlueNoise;
+    int ShowTileHeatmap;
 };
 
 #endif /* RAY_H */
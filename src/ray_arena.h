@@ -244,6 +244,60 @@ CommitTemporaryMemory(temporary_memory *Temp)
     }
 }
 
+//
+// NOTE: Arena Arrays
+//
+
+template <typename T>
+struct arena_array
+{
+    u32 Count;
+    u32 Capacity;
+    T *Data;
+};
+
+#define ARENA_ARRAY_ALIGN 64
+
+template <typename T>
+internal void
+ReserveArray(arena *Arena, arena_array<T> *Array, u32 Capacity)
+{
+    if (Array->Capacity < Capacity)
+    {
+        char *End = (char *)(Array->Data + Array->Capacity);
+        if (Array->Data && (End == Arena->Base + Arena->Used))
+        {
+            // NOTE: The array is the last thing in the arena, so it can just grow in place.
+            PushSize_(Arena, sizeof(T)*(Capacity - Array->Capacity), 1, false, LOCATION_STRING("ReserveArray"));
+        }
+        else
+        {
+            // NOTE: Otherwise it moves to the end of the arena. The old storage is only given back when the
+            //       arena gets cleared, so reserve up front when you know how much you need.
+            T *Data = PushAlignedArrayNoClear(Arena, Capacity, T, ARENA_ARRAY_ALIGN);
+            if (Array->Count)
+            {
+                CopyArray(Array->Count, Array->Data, Data);
+            }
+            Array->Data = Data;
+        }
+        Array->Capacity = Capacity;
+    }
+}
+
+template <typename T>
+internal T *
+PushArrayItem(arena *Arena, arena_array<T> *Array)
+{
+    if (Array->Count >= Array->Capacity)
+    {
+        ReserveArray(Arena, Array, MAX(16, 2*Array->Capacity));
+    }
+    T *Result = &Array->Data[Array->Count++];
+    *Result = {};
+    return Result;
+}
+
 #define ScopedMemory(TempArena)                                       \
     for (temporary_memory ScopeMemory = BeginTemporaryMemory(TempArena); \
          ScopeMemory.Arena;                                              \
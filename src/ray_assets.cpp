@@ -68,28 +68,214 @@ ParseU32(char **Stream, u32 *OutValue)
 internal f32
 FloatFromBits(u32 Bits)
 {
-    return (f32&)Bits;
+    // NOTE: memcpy rather than a cast, which would break strict aliasing. Compilers turn it into a move.
+    f32 Result;
+    memcpy(&Result, &Bits, sizeof(Result));
+    return Result;
+}
+
+internal u32
+BitsFromFloat(f32 Value)
+{
+    u32 Result;
+    memcpy(&Result, &Value, sizeof(Result));
+    return Result;
 }
 
-internal vec3
-DecodeRadianceColor(radiance_color Col)
+internal u32
+RadianceToRGB9E5(radiance_color Col, u32 MinExponent)
 {
-    vec3 Result = {};
+    // NOTE: A radiance texel is (M + 0.5)*2^(Exp - 136), which is (2M + 1)*2^(Exp - 137), so with
+    //       mantissas of 2M + 1 only the exponent has to be rebased. Texels dimmer than MinExponent
+    //       lose their low bits, and an exponent of 9 or less is black, same as it always was.
+    u32 Result = 0;
     if (Col.Exp > 9)
     {
-        f32 Mul = FloatFromBits((Col.Exp - 9) << 23);
-        Result = Vec3(Mul*((f32)Col.R + 0.5f),
-                      Mul*((f32)Col.G + 0.5f),
-                      Mul*((f32)Col.B + 0.5f));
+        u32 Shift = (Col.Exp < MinExponent ? MinExponent - Col.Exp : 0);
+        if (Shift < 9)
+        {
+            u32 R = (2*(u32)Col.R + 1) >> Shift;
+            u32 G = (2*(u32)Col.G + 1) >> Shift;
+            u32 B = (2*(u32)Col.B + 1) >> Shift;
+            Result = R | (G << 9) | (B << 18) | ((Col.Exp + Shift - MinExponent) << 27);
+        }
     }
     return Result;
 }
 
-internal image *
-ParseHdr(arena *Arena, arena *TempArena, char *Input)
+internal u8 *
+SkipRunLengthChannels(u8 *At, u8 *End, u32 W, u8 *MaxExponent)
+{
+    // NOTE: Walks the four run length encoded channels of a scanline without decoding them, and
+    //       returns where the next scanline starts, or null if they don't add up to W pixels.
+    //       The exponents are looked at on the way past, to raise MaxExponent.
+    for (u32 ChannelIndex = 0; ChannelIndex < 4; ++ChannelIndex)
+    {
+        for (u32 X = 0; X < W;)
+        {
+            if (At >= End)
+            {
+                return nullptr;
+            }
+
+            u8 Code = *At++;
+            u32 Count = ((Code > 128) ? (Code & 127) : Code);
+            if (!Count || (X + Count > W))
+            {
+                return nullptr;
+            }
+
+            if ((ChannelIndex == 3) && (At + ((Code > 128) ? 1 : Count) <= End))
+            {
+                u32 LiteralCount = ((Code > 128) ? 1 : Count);
+                u8 Max = *MaxExponent;
+                for (u32 Index = 0; Index < LiteralCount; ++Index)
+                {
+                    Max = MAX(Max, At[Index]);
+                }
+                *MaxExponent = Max;
+            }
+
+            At += ((Code > 128) ? 1 : Count);
+            X += Count;
+        }
+    }
+
+    if (At > End)
+    {
+        return nullptr;
+    }
+    return At;
+}
+
+internal void
+DecodeRunLengthChannels(u8 *At, u32 W, u8 *Channels)
+{
+    // NOTE: Decodes into four planar rows of W bytes. SkipRunLengthChannels has already checked
+    //       the scanline, so there are no bounds checks here.
+    for (u32 ChannelIndex = 0; ChannelIndex < 4; ++ChannelIndex)
+    {
+        u8 *Dst = Channels + ChannelIndex*W;
+        u8 *DstEnd = Dst + W;
+        while (Dst < DstEnd)
+        {
+            u8 Code = *At++;
+            if (Code > 128)
+            {
+                // NOTE: Run
+                u32 RunCount = Code & 127;
+                memset(Dst, *At++, RunCount);
+                Dst += RunCount;
+            }
+            else
+            {
+                // NOTE: Literals
+                memcpy(Dst, At, Code);
+                At += Code;
+                Dst += Code;
+            }
+        }
+    }
+}
+
+internal void
+DecodeRadianceScanline(u8 *Channels, u32 W, u32 MinExponent, u32 *Dst)
+{
+    // NOTE: Same as RadianceToRGB9E5, straight from the planar channels. Only groups with a texel
+    //       that needs shifting down take the scalar path.
+    u8 *R = Channels;
+    u8 *G = R + W;
+    u8 *B = G + W;
+    u8 *E = B + W;
+
+    lane_u32 HalfBits = LaneU32(1 | (1 << 9) | (1 << 18));
+    lane_u32 LaneMinExponent = LaneU32(MinExponent);
+    lane_f32 LaneMinExponentF = LaneF32((f32)MinExponent);
+
+    u32 X = 0;
+    for (; X + LANE_WIDTH <= W; X += LANE_WIDTH)
+    {
+        lane_u32 Exp = LoadU8ToU32(E + X);
+        lane_f32 ExpF = ConvertToF32(Exp);
+        lane_u32 Valid = (ExpF > LaneF32(9.0f));
+        if (MaskIsZeroed(Valid & (ExpF < LaneMinExponentF)))
+        {
+            lane_u32 Texels = ((LoadU8ToU32(R + X) << 1) |
+                               (LoadU8ToU32(G + X) << 10) |
+                               (LoadU8ToU32(B + X) << 19) |
+                               HalfBits |
+                               ((Exp - LaneMinExponent) << 27));
+            StoreU32(Dst + X, Texels & Valid);
+        }
+        else
+        {
+            for (u32 LaneIndex = X; LaneIndex < X + LANE_WIDTH; ++LaneIndex)
+            {
+                radiance_color Col = { .R = R[LaneIndex], .G = G[LaneIndex], .B = B[LaneIndex], .Exp = E[LaneIndex] };
+                Dst[LaneIndex] = RadianceToRGB9E5(Col, MinExponent);
+            }
+        }
+    }
+
+    for (; X < W; ++X)
+    {
+        radiance_color Col = { .R = R[X], .G = G[X], .B = B[X], .Exp = E[X] };
+        Dst[X] = RadianceToRGB9E5(Col, MinExponent);
+    }
+}
+
+#define HDR_SCANLINES_PER_ITEM 16
+
+struct hdr_decode_job
+{
+    u32 W, H;
+    s32 AdvanceX, AdvanceY;
+
+    // NOTE: Where each scanline's run length data starts, in file order
+    u8 **Scanlines;
+
+    // NOTE: Four planar channel rows per item
+    u8 *Channels;
+    u32 *Pixels;
+    u32 MinExponent;
+};
+
+internal void
+DecodeHdrScanlines(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    hdr_decode_job *Job = (hdr_decode_job *)UserData;
+
+    u32 W = Job->W;
+    u8 *Channels = Job->Channels + (usize)ItemIndex*4*W;
+
+    u32 MinY = ItemIndex*HDR_SCANLINES_PER_ITEM;
+    u32 OnePastMaxY = MIN(MinY + HDR_SCANLINES_PER_ITEM, Job->H);
+    for (u32 Y = MinY; Y < OnePastMaxY; ++Y)
+    {
+        DecodeRunLengthChannels(Job->Scanlines[Y], W, Channels);
+
+        u32 DstY = ((Job->AdvanceY < 0) ? (Job->H - 1 - Y) : Y);
+        u32 *Dst = Job->Pixels + (usize)DstY*W;
+        DecodeRadianceScanline(Channels, W, Job->MinExponent, Dst);
+
+        if (Job->AdvanceX < 0)
+        {
+            for (u32 X = 0; X < W / 2; ++X)
+            {
+                u32 Swap = Dst[X];
+                Dst[X] = Dst[W - 1 - X];
+                Dst[W - 1 - X] = Swap;
+            }
+        }
+    }
+}
+
+internal image_rgb9e5 *
+ParseHdr(arena *Arena, arena *TempArena, string_u8 Input, thread_dispatch *Dispatch)
 {
     temporary_memory ResultTemp = BeginTemporaryMemory(Arena);
-    image *Result = PushStruct(Arena, image);
+    temporary_memory Temp = BeginTemporaryMemory(TempArena);
+    image_rgb9e5 *Result = PushStruct(Arena, image_rgb9e5);
 
     s32 AdvanceX =  1;
     s32 AdvanceY = -1;
@@ -103,7 +289,29 @@ ParseHdr(arena *Arena, arena *TempArena, char *Input)
     vec2 PrimaryB = {};
     vec2 PrimaryW = {};
 
-    char *At = Input;
+    u8 *End = Input.Data + Input.Count;
+    u8 *HeaderEnd = Input.Data;
+    char *Header = NULL;
+    char *At = NULL;
+
+    // NOTE: The file isn't zero terminated, so the text up to and including the resolution line
+    //       (the first line after the blank one) gets copied out and parsed from there.
+    while ((HeaderEnd + 1 < End) && !((HeaderEnd[0] == '\n') && (HeaderEnd[1] == '\n')))
+    {
+        ++HeaderEnd;
+    }
+    HeaderEnd += 2;
+    while ((HeaderEnd < End) && (*HeaderEnd != '\n'))
+    {
+        ++HeaderEnd;
+    }
+    HeaderEnd = MIN(HeaderEnd + 1, End);
+
+    Header = PushArrayNoClear(TempArena, (usize)(HeaderEnd - Input.Data) + 1, char);
+    memcpy(Header, Input.Data, (usize)(HeaderEnd - Input.Data));
+    Header[HeaderEnd - Input.Data] = 0;
+
+    At = Header;
     // NOTE: Parse header
     while (*At)
     {
@@ -229,121 +437,989 @@ ParseHdr(arena *Arena, arena *TempArena, char *Input)
 
     if (Result->W && Result->H)
     {
-        temporary_memory Temp = BeginTemporaryMemory(TempArena);
+        u32 W = Result->W;
+        u32 H = Result->H;
+
+        // NOTE: Scanlines have to be walked in order to find where the next one starts. That's
+        //       cheap next to decoding them, which can then happen in parallel.
+        u8 **Scanlines = PushArrayNoClear(TempArena, H, u8 *);
+        u8 MaxExponent = 0;
+        u8 *Data = Input.Data + (At - Header);
+        for (usize Y = 0; Y < H; ++Y)
+        {
+            if (End - Data < 4)
+            {
+                fprintf(stderr, "HDR PARSE ERROR: Unexpected end of file.\n");
+                goto Bail;
+            }
+
+            u16 Signature = (Data[0] << 8)|Data[1];
+            if (Signature != 0x0202)
+            {
+                fprintf(stderr, "HDR PARSE ERROR: .hdr format unsupported.\n");
+                goto Bail;
+            }
+
+            u16 ScanlineLength = (Data[2] << 8)|Data[3];
+            if (ScanlineLength != W)
+            {
+                fprintf(stderr, "HDR PARSE ERROR: Scanline length did not match image width.\n");
+                goto Bail;
+            }
 
-        radiance_color *RadiancePixels = PushArray(TempArena, (usize)Result->W*Result->H, radiance_color);
-        radiance_color *DstRow = RadiancePixels;
+            // NOTE: Yes, that work up above is completely useless, this format is a bit shit.
+
+            Scanlines[Y] = Data + 4;
+            Data = SkipRunLengthChannels(Data + 4, End, W, &MaxExponent);
+            if (!Data)
+            {
+                fprintf(stderr, "HDR PARSE ERROR: Malformed scanline.\n");
+                goto Bail;
+            }
+        }
 
-        if (AdvanceX < 0)
+        if (Data != End)
         {
-            DstRow += (usize)Result->W - 1;
+            fprintf(stderr, "HDR PARSE WARNING: Expected end of file, but there's more!\n");
         }
-        if (AdvanceY < 0)
+
+        Result->Pixels = PushArrayNoClear(Arena, (usize)W*H, u32);
+
+        hdr_decode_job Job = {};
+        Job.W = W;
+        Job.H = H;
+        Job.AdvanceX = AdvanceX;
+        Job.AdvanceY = AdvanceY;
+        Job.Scanlines = Scanlines;
+        Job.Pixels = Result->Pixels;
+
+        // NOTE: The brightest texel gets an exponent of 31. MinExponent has to stay above 10 so a
+        //       texel with an exponent of 0 still decodes with a normal f32 scale.
+        Job.MinExponent = MAX(MaxExponent, 42) - 31;
+        Result->ExponentBias = Job.MinExponent - 10;
+
+        u32 ItemCount = (H + HDR_SCANLINES_PER_ITEM - 1) / HDR_SCANLINES_PER_ITEM;
+        Job.Channels = PushArrayNoClear(TempArena, (usize)ItemCount*4*W, u8);
+        RunParallel(Dispatch, ItemCount, DecodeHdrScanlines, &Job);
+    }
+    else
+    {
+        fprintf(stderr, "HDR PARSE ERROR: Malformed resolution.\n");
+        goto Bail;
+    }
+
+    CommitTemporaryMemory(&ResultTemp);
+    EndTemporaryMemory(Temp);
+    return Result;
+
+Bail:
+    EndTemporaryMemory(Temp);
+    EndTemporaryMemory(ResultTemp);
+    return NULL;
+}
+
+internal image_rgb9e5 *
+LoadHdr(arena *Arena, arena *TempArena, const char *FileName, thread_dispatch *Dispatch)
+{
+    // NOTE: Dispatch can be null, in which case it all gets decoded on this thread
+    image_rgb9e5 *Result = NULL;
+    string_u8 File = Platform.MapFile(FileName);
+    if (File.Count)
+    {
+        Result = ParseHdr(Arena, TempArena, File, Dispatch);
+        Platform.UnmapFile(File);
+    }
+    else
+    {
+        fprintf(stderr, "Could not open %s\n", FileName);
+    }
+    return Result;
+}
+
+internal u32
+EncodeRGB9E5(vec3 Color, u32 ExponentBias)
+{
+    // NOTE: Picks the exponent that puts the largest mantissa in [256, 512), bumping it once if
+    //       rounding carries over. Anything too dim for an exponent of 0 keeps what bits it can.
+    f32 MaxComponent = MaxF(Color.X, MaxF(Color.Y, Color.Z));
+    u32 Result = 0;
+    if (MaxComponent > 0.0f)
+    {
+        s32 Exp = (s32)((BitsFromFloat(MaxComponent) >> 23) & 0xFF) - (s32)ExponentBias - 8;
+        Exp = MIN(MAX(Exp, 0), 31);
+
+        f32 RcpScale = FloatFromBits((u32)(254 - Exp - (s32)ExponentBias) << 23);
+        if (((u32)(MaxComponent*RcpScale + 0.5f) > 0x1FF) && (Exp < 31))
         {
-            DstRow += (usize)Result->W*(Result->H - 1);
+            Exp += 1;
+            RcpScale *= 0.5f;
         }
-        for (usize Y = 0; Y < Result->H; ++Y)
+
+        u32 R = MIN((u32)(MaxF(0.0f, Color.X)*RcpScale + 0.5f), 0x1FF);
+        u32 G = MIN((u32)(MaxF(0.0f, Color.Y)*RcpScale + 0.5f), 0x1FF);
+        u32 B = MIN((u32)(MaxF(0.0f, Color.Z)*RcpScale + 0.5f), 0x1FF);
+        Result = R | (G << 9) | (B << 18) | ((u32)Exp << 27);
+    }
+    return Result;
+}
+
+#define DOWNSAMPLE_ROWS_PER_ITEM 16
+
+struct image_downsample_job
+{
+    image_rgb9e5 *Source;
+    image_rgb9e5 *Dest;
+};
+
+internal void
+DownsampleRows(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    // NOTE: Wraps around horizontally and clamps vertically, which is what an equirect wants.
+    //       With an odd size the last column or row gets averaged in twice. The two source rows are
+    //       weighted by the solid angle their texels cover (the cosine of their latitude), otherwise
+    //       the rows near the poles count for too much and the small levels come out too dark or
+    //       too bright depending on what's up there.
+    image_downsample_job *Job = (image_downsample_job *)UserData;
+    image_rgb9e5 *Source = Job->Source;
+    image_rgb9e5 *Dest = Job->Dest;
+    u32 Bias = Source->ExponentBias;
+
+    u32 MinY = ItemIndex*DOWNSAMPLE_ROWS_PER_ITEM;
+    u32 OnePastMaxY = MIN(MinY + DOWNSAMPLE_ROWS_PER_ITEM, Dest->H);
+    for (u32 Y = MinY; Y < OnePastMaxY; ++Y)
+    {
+        u32 Y0 = MIN(2*Y, Source->H - 1);
+        u32 Y1 = MIN(2*Y + 1, Source->H - 1);
+        f32 Weight0 = CosF(Pi32*(((f32)Y0 + 0.5f) / (f32)Source->H - 0.5f));
+        f32 Weight1 = CosF(Pi32*(((f32)Y1 + 0.5f) / (f32)Source->H - 0.5f));
+        f32 RcpTotalWeight = 1.0f / (2.0f*(Weight0 + Weight1));
+        Weight0 *= RcpTotalWeight;
+        Weight1 *= RcpTotalWeight;
+
+        u32 *Row0 = Source->Pixels + (usize)Y0*Source->W;
+        u32 *Row1 = Source->Pixels + (usize)Y1*Source->W;
+        u32 *Dst = Dest->Pixels + (usize)Y*Dest->W;
+        for (u32 X = 0; X < Dest->W; ++X)
         {
-            u16 Signature = (At[0] << 8)|At[1];
-            At += 2;
+            u32 X0 = 2*X;
+            u32 X1 = (X0 + 1 < Source->W ? X0 + 1 : 0);
+            vec3 Color = (Weight0*(DecodeRGB9E5(Row0[X0], Bias) + DecodeRGB9E5(Row0[X1], Bias)) +
+                          Weight1*(DecodeRGB9E5(Row1[X0], Bias) + DecodeRGB9E5(Row1[X1], Bias)));
+            Dst[X] = EncodeRGB9E5(Color, Bias);
+        }
+    }
+}
 
-            if (Signature != 0x0202)
+internal void
+BuildImagePyramid(arena *Arena, image_rgb9e5 *Image, image_rgb9e5_pyramid *Pyramid, thread_dispatch *Dispatch)
+{
+    Pyramid->LevelCount = 1;
+    Pyramid->Levels[0] = *Image;
+    while (Pyramid->LevelCount < IMAGE_MAX_LEVEL_COUNT)
+    {
+        image_rgb9e5 *Source = &Pyramid->Levels[Pyramid->LevelCount - 1];
+        if ((Source->W == 1) && (Source->H == 1))
+        {
+            break;
+        }
+
+        image_rgb9e5 *Dest = &Pyramid->Levels[Pyramid->LevelCount++];
+        Dest->W = (Source->W + 1) / 2;
+        Dest->H = (Source->H + 1) / 2;
+        Dest->ExponentBias = Source->ExponentBias;
+        Dest->Pixels = PushArrayNoClear(Arena, (usize)Dest->W*Dest->H, u32);
+
+        image_downsample_job Job = { .Source = Source, .Dest = Dest };
+        RunParallel(Dispatch, (Dest->H + DOWNSAMPLE_ROWS_PER_ITEM - 1) / DOWNSAMPLE_ROWS_PER_ITEM, DownsampleRows, &Job);
+    }
+}
+
+internal always_inline bool
+IsDigit(char C)
+{
+    bool Result = ((C >= '0') && (C <= '9'));
+    return Result;
+}
+
+internal always_inline char *
+SkipSpaces(char *At)
+{
+    while ((*At == ' ') || (*At == '\t') || (*At == '\r'))
+    {
+        ++At;
+    }
+    return At;
+}
+
+internal always_inline char *
+SkipLine(char *At)
+{
+    while (*At && (*At != '\n'))
+    {
+        ++At;
+    }
+    if (*At)
+    {
+        ++At;
+    }
+    return At;
+}
+
+global const f64 PowersOfTen[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+internal bool
+ParseDecimalF32(char **Stream, f32 *OutValue)
+{
+    // NOTE: strtof is most of the time it takes to load a big mesh. This handles the plain decimal
+    //       notation those are written in, and anything else (inf, nan, hex floats, more than 19
+    //       significant digits, huge exponents) goes to ParseF32 instead.
+    char *At = SkipSpaces(*Stream);
+
+    bool Negative = (*At == '-');
+    if ((*At == '-') || (*At == '+'))
+    {
+        ++At;
+    }
+
+    u64 Mantissa = 0;
+    u32 SignificantCount = 0;
+    u32 DigitCount = 0;
+    s32 Exponent = 0;
+    while (IsDigit(*At))
+    {
+        Mantissa = 10*Mantissa + (u64)(*At - '0');
+        SignificantCount += (Mantissa != 0);
+        ++DigitCount;
+        ++At;
+    }
+    if (*At == '.')
+    {
+        ++At;
+        while (IsDigit(*At))
+        {
+            Mantissa = 10*Mantissa + (u64)(*At - '0');
+            SignificantCount += (Mantissa != 0);
+            ++DigitCount;
+            --Exponent;
+            ++At;
+        }
+    }
+
+    if ((*At == 'e') || (*At == 'E'))
+    {
+        char *ExponentAt = At + 1;
+        bool NegativeExponent = (*ExponentAt == '-');
+        if ((*ExponentAt == '-') || (*ExponentAt == '+'))
+        {
+            ++ExponentAt;
+        }
+        if (IsDigit(*ExponentAt))
+        {
+            s32 ExplicitExponent = 0;
+            while (IsDigit(*ExponentAt) && (ExplicitExponent < 10000))
             {
-                fprintf(stderr, "HDR PARSE ERROR: .hdr format unsupported.\n");
+                ExplicitExponent = 10*ExplicitExponent + (*ExponentAt - '0');
+                ++ExponentAt;
+            }
+            Exponent += (NegativeExponent ? -ExplicitExponent : ExplicitExponent);
+            At = ExponentAt;
+        }
+    }
+
+    if (!DigitCount || (SignificantCount > 19) || IsDigit(*At) ||
+        (Exponent < -22) || (Exponent > 22))
+    {
+        bool Result = ParseF32(Stream, OutValue);
+        return Result;
+    }
+
+    f64 Value = (f64)Mantissa;
+    Value = (Exponent < 0 ? Value / PowersOfTen[-Exponent] : Value*PowersOfTen[Exponent]);
+    *OutValue = (f32)(Negative ? -Value : Value);
+    *Stream = At;
+    return true;
+}
+
+internal bool
+ParseS32(char **Stream, s32 *OutValue)
+{
+    char *At = SkipSpaces(*Stream);
+
+    bool Negative = (*At == '-');
+    if ((*At == '-') || (*At == '+'))
+    {
+        ++At;
+    }
+
+    bool Result = IsDigit(*At);
+    s64 Value = 0;
+    while (IsDigit(*At))
+    {
+        Value = MIN(10*Value + (*At - '0'), 0x80000000ll);
+        ++At;
+    }
+
+    if (Result)
+    {
+        *OutValue = (s32)(Negative ? -Value : MIN(Value, 0x7fffffffll));
+        *Stream = At;
+    }
+    return Result;
+}
+
+internal bool
+ResolveObjIndex(s32 Index, u32 SeenCount, u32 *OutIndex)
+{
+    // NOTE: OBJ indices start at 1, and negative ones count back from the last one seen so far
+    bool Result = false;
+    if ((Index > 0) && ((u32)Index <= SeenCount))
+    {
+        *OutIndex = (u32)Index - 1;
+        Result = true;
+    }
+    else if ((Index < 0) && ((u32)-(s64)Index <= SeenCount))
+    {
+        *OutIndex = SeenCount - (u32)-(s64)Index;
+        Result = true;
+    }
+    return Result;
+}
+
+internal triangle_mesh *
+ParseObj(arena *Arena, char *Text)
+{
+    // NOTE: Positions, normals and faces (polygons get fanned). Everything else is skipped: texture
+    //       coordinates, groups, materials. If any face is missing normals, the whole mesh goes without.
+    //       The text gets walked twice, once to count and size everything and once to fill it in.
+    temporary_memory ResultTemp = BeginTemporaryMemory(Arena);
+    triangle_mesh *Result = PushStruct(Arena, triangle_mesh);
+
+    u64 VertexCount = 0;
+    u64 NormalCount = 0;
+    u64 TriangleCount = 0;
+    for (char *At = Text; *At; At = SkipLine(At))
+    {
+        At = SkipSpaces(At);
+        if ((At[0] == 'v') && ((At[1] == ' ') || (At[1] == '\t')))
+        {
+            ++VertexCount;
+        }
+        else if ((At[0] == 'v') && (At[1] == 'n') && ((At[2] == ' ') || (At[2] == '\t')))
+        {
+            ++NormalCount;
+        }
+        else if ((At[0] == 'f') && ((At[1] == ' ') || (At[1] == '\t')))
+        {
+            u32 CornerCount = 0;
+            At = SkipSpaces(At + 1);
+            while (*At && (*At != '\n') && (*At != '#'))
+            {
+                while (*At && (*At != ' ') && (*At != '\t') && (*At != '\r') && (*At != '\n'))
+                {
+                    ++At;
+                }
+                ++CornerCount;
+                At = SkipSpaces(At);
+            }
+            TriangleCount += (CornerCount >= 3 ? CornerCount - 2 : 0);
+        }
+    }
+
+    if (!VertexCount || !TriangleCount ||
+        (VertexCount > 0xffffffffu) || (NormalCount > 0xffffffffu) || (3*TriangleCount > 0xffffffffu))
+    {
+        fprintf(stderr, "OBJ PARSE ERROR: No triangles, or too many of them.\n");
+        goto Bail;
+    }
+
+    Result->VertexCount = (u32)VertexCount;
+    Result->NormalCount = (u32)NormalCount;
+    Result->TriangleCount = (u32)TriangleCount;
+    Result->Positions = PushArrayNoClear(Arena, Result->VertexCount, vec3);
+    Result->Indices = PushArrayNoClear(Arena, 3*(usize)Result->TriangleCount, u32);
+    if (NormalCount)
+    {
+        Result->Normals = PushArrayNoClear(Arena, Result->NormalCount, vec3);
+        Result->NormalIndices = PushArrayNoClear(Arena, 3*(usize)Result->TriangleCount, u32);
+    }
+
+    {
+        u32 VertexAt = 0;
+        u32 NormalAt = 0;
+        u32 TriangleAt = 0;
+        bool MissingNormals = !NormalCount;
+        u32 LineNumber = 1;
+        for (char *At = Text; *At; At = SkipLine(At), ++LineNumber)
+        {
+            At = SkipSpaces(At);
+            if ((At[0] == 'v') && ((At[1] == ' ') || (At[1] == '\t')))
+            {
+                vec3 *P = &Result->Positions[VertexAt++];
+                At += 1;
+                if (!ParseDecimalF32(&At, &P->X) || !ParseDecimalF32(&At, &P->Y) || !ParseDecimalF32(&At, &P->Z))
+                {
+                    fprintf(stderr, "OBJ PARSE ERROR: Malformed vertex on line %u.\n", LineNumber);
+                    goto Bail;
+                }
+            }
+            else if ((At[0] == 'v') && (At[1] == 'n') && ((At[2] == ' ') || (At[2] == '\t')))
+            {
+                vec3 *N = &Result->Normals[NormalAt++];
+                At += 2;
+                if (!ParseDecimalF32(&At, &N->X) || !ParseDecimalF32(&At, &N->Y) || !ParseDecimalF32(&At, &N->Z))
+                {
+                    fprintf(stderr, "OBJ PARSE ERROR: Malformed normal on line %u.\n", LineNumber);
+                    goto Bail;
+                }
+            }
+            else if ((At[0] == 'f') && ((At[1] == ' ') || (At[1] == '\t')))
+            {
+                // NOTE: Corners are v, v/vt, v/vt/vn or v//vn
+                u32 CornerCount = 0;
+                u32 First = 0, Previous = 0;
+                u32 FirstNormal = 0, PreviousNormal = 0;
+                At = SkipSpaces(At + 1);
+                while (*At && (*At != '\n') && (*At != '#'))
+                {
+                    s32 Index, NormalIndex = 0;
+                    u32 Vertex, Normal = 0;
+                    if (!ParseS32(&At, &Index) || !ResolveObjIndex(Index, VertexAt, &Vertex))
+                    {
+                        fprintf(stderr, "OBJ PARSE ERROR: Bad vertex index on line %u.\n", LineNumber);
+                        goto Bail;
+                    }
+                    if (*At == '/')
+                    {
+                        ++At;
+                        s32 TexCoordIndex;
+                        ParseS32(&At, &TexCoordIndex);
+                        if (*At == '/')
+                        {
+                            ++At;
+                            if (!ParseS32(&At, &NormalIndex) || !ResolveObjIndex(NormalIndex, NormalAt, &Normal))
+                            {
+                                fprintf(stderr, "OBJ PARSE ERROR: Bad normal index on line %u.\n", LineNumber);
+                                goto Bail;
+                            }
+                        }
+                    }
+                    MissingNormals = MissingNormals || !NormalIndex;
+
+                    if (CornerCount == 0)
+                    {
+                        First = Vertex;
+                        FirstNormal = Normal;
+                    }
+                    else if (CornerCount >= 2)
+                    {
+                        u32 *Triangle = Result->Indices + 3*(usize)TriangleAt;
+                        Triangle[0] = First;
+                        Triangle[1] = Previous;
+                        Triangle[2] = Vertex;
+                        if (Result->NormalIndices)
+                        {
+                            u32 *NormalTriangle = Result->NormalIndices + 3*(usize)TriangleAt;
+                            NormalTriangle[0] = FirstNormal;
+                            NormalTriangle[1] = PreviousNormal;
+                            NormalTriangle[2] = Normal;
+                        }
+                        ++TriangleAt;
+                    }
+                    Previous = Vertex;
+                    PreviousNormal = Normal;
+                    ++CornerCount;
+
+                    while (*At && (*At != ' ') && (*At != '\t') && (*At != '\r') && (*At != '\n'))
+                    {
+                        ++At;
+                    }
+                    At = SkipSpaces(At);
+                }
+            }
+        }
+
+        Assert(TriangleAt == Result->TriangleCount);
+        if (MissingNormals)
+        {
+            Result->NormalCount = 0;
+            Result->Normals = NULL;
+            Result->NormalIndices = NULL;
+        }
+    }
+
+    CommitTemporaryMemory(&ResultTemp);
+    return Result;
+
+Bail:
+    EndTemporaryMemory(ResultTemp);
+    return NULL;
+}
+
+internal u32
+PlyTypeSize(u32 Type)
+{
+    local_persist const u32 Sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    u32 Result = Sizes[Type];
+    return Result;
+}
+
+internal u32
+ParsePlyType(char *Name)
+{
+    u32 Result = PlyType_None;
+    if      (!strcmp(Name, "char")   || !strcmp(Name, "int8"))    Result = PlyType_S8;
+    else if (!strcmp(Name, "uchar")  || !strcmp(Name, "uint8"))   Result = PlyType_U8;
+    else if (!strcmp(Name, "short")  || !strcmp(Name, "int16"))   Result = PlyType_S16;
+    else if (!strcmp(Name, "ushort") || !strcmp(Name, "uint16"))  Result = PlyType_U16;
+    else if (!strcmp(Name, "int")    || !strcmp(Name, "int32"))   Result = PlyType_S32;
+    else if (!strcmp(Name, "uint")   || !strcmp(Name, "uint32"))  Result = PlyType_U32;
+    else if (!strcmp(Name, "float")  || !strcmp(Name, "float32")) Result = PlyType_F32;
+    else if (!strcmp(Name, "double") || !strcmp(Name, "float64")) Result = PlyType_F64;
+    return Result;
+}
+
+internal bool
+ParseWord(char **Stream, char *Dest, usize DestSize)
+{
+    // NOTE: Copies out the next run of non-blank characters on the line, cut short to fit
+    char *At = SkipSpaces(*Stream);
+    usize Count = 0;
+    while (*At && (*At != ' ') && (*At != '\t') && (*At != '\r') && (*At != '\n'))
+    {
+        if (Count + 1 < DestSize)
+        {
+            Dest[Count++] = *At;
+        }
+        ++At;
+    }
+    Dest[Count] = 0;
+    *Stream = At;
+    return (Count > 0);
+}
+
+internal f64
+ReadPlyValue(ply_reader *Reader, u32 Type)
+{
+    f64 Result = 0.0;
+    if (Reader->Binary)
+    {
+        u32 Size = PlyTypeSize(Type);
+        if (Reader->At + Size <= Reader->End)
+        {
+            u8 Bytes[8];
+            for (u32 ByteIndex = 0; ByteIndex < Size; ++ByteIndex)
+            {
+                Bytes[ByteIndex] = Reader->At[Reader->BigEndian ? Size - 1 - ByteIndex : ByteIndex];
+            }
+            Reader->At += Size;
+
+            switch (Type)
+            {
+                case PlyType_S8:  { s8  Value; memcpy(&Value, Bytes, 1); Result = Value; } break;
+                case PlyType_U8:  { u8  Value; memcpy(&Value, Bytes, 1); Result = Value; } break;
+                case PlyType_S16: { s16 Value; memcpy(&Value, Bytes, 2); Result = Value; } break;
+                case PlyType_U16: { u16 Value; memcpy(&Value, Bytes, 2); Result = Value; } break;
+                case PlyType_S32: { s32 Value; memcpy(&Value, Bytes, 4); Result = Value; } break;
+                case PlyType_U32: { u32 Value; memcpy(&Value, Bytes, 4); Result = Value; } break;
+                case PlyType_F32: { f32 Value; memcpy(&Value, Bytes, 4); Result = Value; } break;
+                case PlyType_F64: { f64 Value; memcpy(&Value, Bytes, 8); Result = Value; } break;
+            }
+        }
+        else
+        {
+            Reader->Error = true;
+        }
+    }
+    else
+    {
+        // NOTE: ReadEntireFile zero terminates, so the text parsers can't run off the end
+        char *At = (char *)Reader->At;
+        while ((*At == '\n') || (*At == '\r') || (*At == ' ') || (*At == '\t'))
+        {
+            ++At;
+        }
+
+        bool Parsed = false;
+        if ((Type == PlyType_F32) || (Type == PlyType_F64))
+        {
+            f32 Value;
+            Parsed = ParseDecimalF32(&At, &Value);
+            Result = Value;
+        }
+        else
+        {
+            s32 Value;
+            Parsed = ParseS32(&At, &Value);
+            Result = Value;
+        }
+
+        if (Parsed)
+        {
+            Reader->At = (u8 *)At;
+        }
+        else
+        {
+            Reader->Error = true;
+        }
+    }
+    return Result;
+}
+
+internal void
+SkipPlyElement(ply_reader *Reader, ply_element *Element)
+{
+    for (u32 PropertyIndex = 0; PropertyIndex < Element->PropertyCount; ++PropertyIndex)
+    {
+        ply_property *Property = &Element->Properties[PropertyIndex];
+        u32 ValueCount = 1;
+        if (Property->ListCountType)
+        {
+            ValueCount = (u32)ReadPlyValue(Reader, Property->ListCountType);
+        }
+        for (u32 ValueIndex = 0; (ValueIndex < ValueCount) && !Reader->Error; ++ValueIndex)
+        {
+            ReadPlyValue(Reader, Property->Type);
+        }
+    }
+}
+
+internal triangle_mesh *
+ParsePly(arena *Arena, string_u8 Input)
+{
+    // NOTE: ASCII and binary of either endianness. Takes x, y, z and optionally nx, ny, nz from the
+    //       vertex element and the vertex_indices list from the face element (polygons get fanned).
+    //       Everything else is read past.
+    temporary_memory ResultTemp = BeginTemporaryMemory(Arena);
+    triangle_mesh *Result = PushStruct(Arena, triangle_mesh);
+
+    u32 ElementCount = 0;
+    ply_element Elements[PLY_MAX_ELEMENT_COUNT];
+    ply_reader Reader = {};
+    Reader.End = Input.Data + Input.Count;
+
+    char *At = (char *)Input.Data;
+    char Word[64];
+    if (!ParseWord(&At, Word, sizeof(Word)) || strcmp(Word, "ply"))
+    {
+        fprintf(stderr, "PLY PARSE ERROR: Not a PLY file.\n");
+        goto Bail;
+    }
+
+    for (;;)
+    {
+        At = SkipLine(At);
+        if (!*At)
+        {
+            fprintf(stderr, "PLY PARSE ERROR: No end_header.\n");
+            goto Bail;
+        }
+
+        ParseWord(&At, Word, sizeof(Word));
+        if (!strcmp(Word, "end_header"))
+        {
+            Reader.At = (u8 *)SkipLine(At);
+            break;
+        }
+        else if (!strcmp(Word, "format"))
+        {
+            ParseWord(&At, Word, sizeof(Word));
+            if (!strcmp(Word, "binary_little_endian"))
+            {
+                Reader.Binary = true;
+            }
+            else if (!strcmp(Word, "binary_big_endian"))
+            {
+                Reader.Binary = true;
+                Reader.BigEndian = true;
+            }
+            else if (strcmp(Word, "ascii"))
+            {
+                fprintf(stderr, "PLY PARSE ERROR: Unknown format %s.\n", Word);
+                goto Bail;
+            }
+        }
+        else if (!strcmp(Word, "element"))
+        {
+            if (ElementCount >= PLY_MAX_ELEMENT_COUNT)
+            {
+                fprintf(stderr, "PLY PARSE ERROR: Too many elements.\n");
+                goto Bail;
+            }
+
+            ply_element *Element = &Elements[ElementCount++];
+            ZeroStruct(Element);
+            ParseWord(&At, Word, sizeof(Word));
+            Element->Kind = (!strcmp(Word, "vertex") ? PlyElement_Vertex :
+                             !strcmp(Word, "face")   ? PlyElement_Face :
+                                                       PlyElement_Other);
+            if (!ParseU32(&At, &Element->Count))
+            {
+                fprintf(stderr, "PLY PARSE ERROR: Element %s has no count.\n", Word);
+                goto Bail;
+            }
+        }
+        else if (!strcmp(Word, "property"))
+        {
+            ply_element *Element = (ElementCount ? &Elements[ElementCount - 1] : NULL);
+            if (!Element || (Element->PropertyCount >= PLY_MAX_PROPERTY_COUNT))
+            {
+                fprintf(stderr, "PLY PARSE ERROR: Property without an element, or too many properties.\n");
                 goto Bail;
             }
 
-            u16 ScanlineLength = (At[0] << 8)|At[1];
-            At += 2;
+            ply_property *Property = &Element->Properties[Element->PropertyCount++];
+            ZeroStruct(Property);
+            ParseWord(&At, Word, sizeof(Word));
+            if (!strcmp(Word, "list"))
+            {
+                ParseWord(&At, Word, sizeof(Word));
+                Property->ListCountType = ParsePlyType(Word);
+                ParseWord(&At, Word, sizeof(Word));
+                if (!Property->ListCountType)
+                {
+                    Property->Type = PlyType_None;
+                }
+                else
+                {
+                    Property->Type = ParsePlyType(Word);
+                }
+            }
+            else
+            {
+                Property->Type = ParsePlyType(Word);
+            }
 
-            if (ScanlineLength != Result->W)
+            if (!Property->Type)
             {
-                fprintf(stderr, "HDR PARSE ERROR: Scanline length did not match image width.\n");
+                fprintf(stderr, "PLY PARSE ERROR: Unknown property type %s.\n", Word);
                 goto Bail;
             }
 
-            // NOTE: Yes, that work up above is completely useless, this format is a bit shit.
+            ParseWord(&At, Word, sizeof(Word));
+            if (Element->Kind == PlyElement_Vertex)
+            {
+                Property->Role = (!strcmp(Word, "x")  ? PlyRole_X :
+                                  !strcmp(Word, "y")  ? PlyRole_Y :
+                                  !strcmp(Word, "z")  ? PlyRole_Z :
+                                  !strcmp(Word, "nx") ? PlyRole_NX :
+                                  !strcmp(Word, "ny") ? PlyRole_NY :
+                                  !strcmp(Word, "nz") ? PlyRole_NZ :
+                                                        PlyRole_Other);
+            }
+            else if ((Element->Kind == PlyElement_Face) && Property->ListCountType &&
+                     (!strcmp(Word, "vertex_indices") || !strcmp(Word, "vertex_index")))
+            {
+                Property->Role = PlyRole_VertexIndices;
+            }
+        }
+    }
+
+    for (u32 ElementIndex = 0; ElementIndex < ElementCount; ++ElementIndex)
+    {
+        ply_element *Element = &Elements[ElementIndex];
+        if (Element->Kind == PlyElement_Vertex)
+        {
+            u32 RoleMask = 0;
+            for (u32 PropertyIndex = 0; PropertyIndex < Element->PropertyCount; ++PropertyIndex)
+            {
+                RoleMask |= (1 << Element->Properties[PropertyIndex].Role);
+            }
+
+            u32 PositionMask = (1 << PlyRole_X)|(1 << PlyRole_Y)|(1 << PlyRole_Z);
+            u32 NormalMask = (1 << PlyRole_NX)|(1 << PlyRole_NY)|(1 << PlyRole_NZ);
+            if (((RoleMask & PositionMask) != PositionMask) || Result->Positions)
+            {
+                fprintf(stderr, "PLY PARSE ERROR: Vertices need exactly one x, y and z.\n");
+                goto Bail;
+            }
+
+            Result->VertexCount = Element->Count;
+            Result->Positions = PushArrayNoClear(Arena, Element->Count, vec3);
+            if ((RoleMask & NormalMask) == NormalMask)
+            {
+                Result->NormalCount = Element->Count;
+                Result->Normals = PushArrayNoClear(Arena, Element->Count, vec3);
+            }
 
-            for (usize ChannelIndex = 0; ChannelIndex < 4; ++ChannelIndex)
+            for (u32 VertexIndex = 0; (VertexIndex < Element->Count) && !Reader.Error; ++VertexIndex)
             {
-                radiance_color *Dst = DstRow;
-                for (usize X = 0; X < Result->W;)
+                f32 Values[PlyRole_VertexIndices] = {};
+                for (u32 PropertyIndex = 0; PropertyIndex < Element->PropertyCount; ++PropertyIndex)
                 {
-                    u8 Code = *At++;
-                    if (Code > 128)
+                    ply_property *Property = &Element->Properties[PropertyIndex];
+                    if (Property->ListCountType)
                     {
-                        // NOTE: Run
-                        u8 RunCount = Code & 127;
-                        u8 RunValue = *At++;
-                        while (RunCount--)
+                        u32 ValueCount = (u32)ReadPlyValue(&Reader, Property->ListCountType);
+                        for (u32 ValueIndex = 0; (ValueIndex < ValueCount) && !Reader.Error; ++ValueIndex)
                         {
-                            Assert(X < Result->W);
-                            Dst->E[ChannelIndex] = RunValue;
-                            Dst += AdvanceX;
-                            ++X;
+                            ReadPlyValue(&Reader, Property->Type);
                         }
                     }
                     else
                     {
-                        // NOTE: Literals
-                        u8 LiteralCount = Code;
-                        while (LiteralCount--)
+                        Values[Property->Role] = (f32)ReadPlyValue(&Reader, Property->Type);
+                    }
+                }
+
+                Result->Positions[VertexIndex] = Vec3(Values[PlyRole_X], Values[PlyRole_Y], Values[PlyRole_Z]);
+                if (Result->Normals)
+                {
+                    Result->Normals[VertexIndex] = Vec3(Values[PlyRole_NX], Values[PlyRole_NY], Values[PlyRole_NZ]);
+                }
+            }
+        }
+        else if (Element->Kind == PlyElement_Face)
+        {
+            // NOTE: Faces can be any polygon, so they get read twice: once to count the triangles
+            //       they fan out into, and again to write them.
+            ply_reader FaceStart = Reader;
+            u64 TriangleCount = 0;
+            for (u32 FaceIndex = 0; (FaceIndex < Element->Count) && !Reader.Error; ++FaceIndex)
+            {
+                for (u32 PropertyIndex = 0; PropertyIndex < Element->PropertyCount; ++PropertyIndex)
+                {
+                    ply_property *Property = &Element->Properties[PropertyIndex];
+                    u32 ValueCount = 1;
+                    if (Property->ListCountType)
+                    {
+                        ValueCount = (u32)ReadPlyValue(&Reader, Property->ListCountType);
+                        if ((Property->Role == PlyRole_VertexIndices) && (ValueCount >= 3))
                         {
-                            Assert(X < Result->W);
-                            Dst->E[ChannelIndex] = *At++;
-                            Dst += AdvanceX;
-                            ++X;
+                            TriangleCount += ValueCount - 2;
                         }
                     }
+                    for (u32 ValueIndex = 0; (ValueIndex < ValueCount) && !Reader.Error; ++ValueIndex)
+                    {
+                        ReadPlyValue(&Reader, Property->Type);
+                    }
                 }
             }
 
-            DstRow += AdvanceY*(ssize)Result->W;
-        }
+            if (Reader.Error || Result->Indices || (3*TriangleCount > 0xffffffffu))
+            {
+                break;
+            }
 
-        Result->Pixels = PushArrayNoClear(Arena, Result->W*Result->H, vec3);
+            Reader = FaceStart;
+            Result->TriangleCount = (u32)TriangleCount;
+            Result->Indices = PushArrayNoClear(Arena, 3*TriangleCount, u32);
 
-        radiance_color *Src = RadiancePixels;
-        vec3 *Dst = Result->Pixels;
-        for (usize I = 0; I < (usize)Result->W*Result->H; ++I)
+            u32 TriangleAt = 0;
+            for (u32 FaceIndex = 0; (FaceIndex < Element->Count) && !Reader.Error; ++FaceIndex)
+            {
+                for (u32 PropertyIndex = 0; PropertyIndex < Element->PropertyCount; ++PropertyIndex)
+                {
+                    ply_property *Property = &Element->Properties[PropertyIndex];
+                    u32 ValueCount = 1;
+                    if (Property->ListCountType)
+                    {
+                        ValueCount = (u32)ReadPlyValue(&Reader, Property->ListCountType);
+                    }
+
+                    u32 First = 0, Previous = 0;
+                    for (u32 ValueIndex = 0; (ValueIndex < ValueCount) && !Reader.Error; ++ValueIndex)
+                    {
+                        u32 Vertex = (u32)ReadPlyValue(&Reader, Property->Type);
+                        if (Property->Role == PlyRole_VertexIndices)
+                        {
+                            if (ValueIndex == 0)
+                            {
+                                First = Vertex;
+                            }
+                            else if (ValueIndex >= 2)
+                            {
+                                u32 *Triangle = Result->Indices + 3*(usize)TriangleAt++;
+                                Triangle[0] = First;
+                                Triangle[1] = Previous;
+                                Triangle[2] = Vertex;
+                            }
+                            Previous = Vertex;
+                        }
+                    }
+                }
+            }
+        }
+        else
         {
-            *Dst++ = DecodeRadianceColor(*Src++);
+            for (u32 Index = 0; (Index < Element->Count) && !Reader.Error; ++Index)
+            {
+                SkipPlyElement(&Reader, Element);
+            }
         }
 
-        EndTemporaryMemory(Temp);
+        if (Reader.Error)
+        {
+            break;
+        }
     }
-    else
+
+    if (Reader.Error)
     {
-        fprintf(stderr, "HDR PARSE ERROR: Malformed resolution.\n");
+        fprintf(stderr, "PLY PARSE ERROR: Truncated or malformed data.\n");
         goto Bail;
     }
 
-    if (*At != '\0')
+    if (!Result->VertexCount || !Result->TriangleCount)
+    {
+        fprintf(stderr, "PLY PARSE ERROR: No vertices or no faces.\n");
+        goto Bail;
+    }
+
+    for (usize Index = 0; Index < 3*(usize)Result->TriangleCount; ++Index)
+    {
+        if (Result->Indices[Index] >= Result->VertexCount)
+        {
+            fprintf(stderr, "PLY PARSE ERROR: Face refers to vertex %u of %u.\n", Result->Indices[Index], Result->VertexCount);
+            goto Bail;
+        }
+    }
+
+    // NOTE: PLY normals are per vertex, so they share the position indices
+    if (Result->Normals)
     {
-        fprintf(stderr, "HDR PARSE WARNING: Expected end of file, but there's more!\n");
+        Result->NormalIndices = Result->Indices;
     }
 
     CommitTemporaryMemory(&ResultTemp);
+    return Result;
 
 Bail:
-    if (!Result)
+    EndTemporaryMemory(ResultTemp);
+    return NULL;
+}
+
+internal triangle_mesh *
+ParseMesh(arena *Arena, string_u8 File)
+{
+    // NOTE: PLY files are recognised by their magic, everything else is taken to be OBJ.
+    //       File has to be zero terminated, the way ReadEntireFile leaves it.
+    triangle_mesh *Result = NULL;
+    if ((File.Count >= 4) && (memcmp(File.Data, "ply", 3) == 0) &&
+        ((File.Data[3] == '\n') || (File.Data[3] == '\r')))
     {
-        Result = NULL;
+        Result = ParsePly(Arena, File);
+    }
+    else
+    {
+        Result = ParseObj(Arena, (char *)File.Data);
     }
-
     return Result;
 }
 
-internal image *
-LoadHdr(arena *Arena, arena *TempArena, const char *FileName)
+internal triangle_mesh *
+LoadMesh(arena *Arena, arena *TempArena, const char *FileName)
 {
-    image *Result = NULL;
+    triangle_mesh *Result = NULL;
     ScopedMemory(TempArena)
     {
         string_u8 File = Platform.ReadEntireFile(TempArena, FileName);
         if (File.Count)
         {
-            Result = ParseHdr(Arena, TempArena, (char *)File.Data);
+            Result = ParseMesh(Arena, File);
         }
         else
         {
@@ -473,6 +1549,22 @@ LoadBitmap(arena *Arena, const char *FileName)
     return Result;
 }
 
+internal image_u32
+LoadBlueNoise(arena *Arena, const char *FileName)
+{
+    // NOTE: A tileable blue noise mask, with independent masks in red and green. The sampler wraps
+    //       lookups with a mask, so anything that isn't a power of two on both sides gets refused.
+    image_u32 Result = LoadBitmap(Arena, FileName);
+    if (ValidImage(&Result) &&
+        (((Result.W & (Result.W - 1)) != 0) ||
+         ((Result.H & (Result.H - 1)) != 0)))
+    {
+        fprintf(stderr, "%s is %ux%u, blue noise masks need power of two sizes\n", FileName, Result.W, Result.H);
+        ZeroStruct(&Result);
+    }
+    return Result;
+}
+
 internal void
 GenerateDebugFont(image_u32 *Image, int GlyphW, int GlyphH)
 {
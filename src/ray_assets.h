@@ -46,6 +46,137 @@ ValidImage(image_u32 *Image)
     return Result;
 }
 
+// NOTE: Three 9 bit mantissas with a shared 5 bit exponent, packed like GL_RGB9_E5 (R in the low
+//       bits, the exponent in the top 5). Instead of the fixed bias of 15 each image has its own,
+//       stored as the f32 exponent field of a texel with an exponent of 0. ParseHdr picks it so the
+//       brightest texel has an exponent of 31, which makes the conversion from the radiance
+//       format's 8 bit mantissas exact for everything within 31 stops of it.
+struct image_rgb9e5
+{
+    u32 W, H;
+    u32 ExponentBias;
+    u32 *Pixels;
+};
+
+internal inline bool
+ValidImage(image_rgb9e5 *Image)
+{
+    bool Result = ((Image->W > 0) &&
+                   (Image->H > 0) &&
+                   (Image->Pixels));
+    return Result;
+}
+
+internal always_inline vec3
+DecodeRGB9E5(u32 Texel, u32 ExponentBias)
+{
+    // NOTE: The mantissas get masked out in place, so G and B come out 2^9 and 2^18 too big and
+    //       that's folded into the scale. Everything here is exact.
+    __m128i Mantissas = _mm_and_si128(_mm_set1_epi32((s32)Texel), _mm_setr_epi32(0x1FF, 0x1FF << 9, 0x1FF << 18, 0));
+    __m128 Scale = _mm_castsi128_ps(_mm_set1_epi32((s32)(((Texel >> 27) + ExponentBias) << 23)));
+    __m128 Color = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(Mantissas), _mm_setr_ps(1.0f, 1.0f / 512.0f, 1.0f / 262144.0f, 0.0f)), Scale);
+
+    alignas(16) f32 Out[4];
+    _mm_store_ps(Out, Color);
+    vec3 Result = Vec3(Out[0], Out[1], Out[2]);
+    return Result;
+}
+
+internal always_inline vec3
+ReadTexel(image_rgb9e5 *Image, u32 Index)
+{
+    vec3 Result = DecodeRGB9E5(Image->Pixels[Index], Image->ExponentBias);
+    return Result;
+}
+
+#define IMAGE_MAX_LEVEL_COUNT 16
+
+// NOTE: Level 0 is the image itself, and every level after that is a 2x2 box filtered copy of the
+//       one before, rounded up in size, down to 1x1 (or as far as IMAGE_MAX_LEVEL_COUNT goes).
+//       All levels share the exponent bias of level 0.
+struct image_rgb9e5_pyramid
+{
+    u32 LevelCount;
+    image_rgb9e5 Levels[IMAGE_MAX_LEVEL_COUNT];
+};
+
+// NOTE: Indexed triangles, three indices per triangle. Positions and normals are indexed separately
+//       because that's how OBJ stores them, and NormalIndices can be the same array as Indices when
+//       they aren't (PLY). A mesh without normals has Normals and NormalIndices set to NULL and
+//       gets shaded with its face normals.
+struct triangle_mesh
+{
+    u32 VertexCount;
+    u32 NormalCount;
+    u32 TriangleCount;
+    vec3 *Positions;
+    vec3 *Normals;
+    u32 *Indices;
+    u32 *NormalIndices;
+};
+
+enum ply_type
+{
+    PlyType_None,
+    PlyType_S8,
+    PlyType_U8,
+    PlyType_S16,
+    PlyType_U16,
+    PlyType_S32,
+    PlyType_U32,
+    PlyType_F32,
+    PlyType_F64,
+};
+
+enum ply_role
+{
+    PlyRole_Other,
+    PlyRole_X,
+    PlyRole_Y,
+    PlyRole_Z,
+    PlyRole_NX,
+    PlyRole_NY,
+    PlyRole_NZ,
+    PlyRole_VertexIndices,
+};
+
+enum ply_element_kind
+{
+    PlyElement_Other,
+    PlyElement_Vertex,
+    PlyElement_Face,
+};
+
+// NOTE: ListCountType is PlyType_None for properties that aren't lists
+struct ply_property
+{
+    u32 Type;
+    u32 ListCountType;
+    u32 Role;
+};
+
+#define PLY_MAX_PROPERTY_COUNT 32
+#define PLY_MAX_ELEMENT_COUNT 16
+
+struct ply_element
+{
+    u32 Kind;
+    u32 Count;
+    u32 PropertyCount;
+    ply_property Properties[PLY_MAX_PROPERTY_COUNT];
+};
+
+// NOTE: Reads the body of a PLY file one value at a time, whatever its encoding. Running off the
+//       end of the data or into something that isn't a number sets Error and returns zeroes.
+struct ply_reader
+{
+    u8 *At;
+    u8 *End;
+    b32 Binary;
+    b32 BigEndian;
+    b32 Error;
+};
+
 #pragma pack(push, 1)
 struct bitmap_header {
     u16 FileType;
@@ -0,0 +1,576 @@
+//
+// NOTE: Benchmark mode. Renders a fixed set of scenes for a fixed number of samples with fixed seeds,
+//       once per integrator and thread count, and reports ray throughput. Results are printed and
+//       written out as CSV so they can be compared between commits. After that it times moving
+//       instances around, which only gets printed.
+//
+
+struct benchmark_scene
+{
+    const char *Name;
+    void (*Build)(scene *Scene, arena *TempArena, thread_dispatch *Dispatch);
+
+    // NOTE: A file the scene can't do without, the scene gets skipped if it isn't there
+    const char *RequiredFileName;
+};
+
+struct benchmark_integrator
+{
+    const char *Name;
+    render_settings Settings;
+};
+
+struct benchmark_result
+{
+    f64 Seconds;
+    ray_counters Counters;
+    vec3 MeanColor;
+};
+
+internal void
+BuildSphereFieldScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: A grid of small spheres on a ground plane, lit by a directional light so shadow rays
+    //       show up in the numbers too. The layout comes from a fixed seed.
+    u32 GridDim = 16;
+    ReserveSceneCapacity(Scene, 8, 2, GridDim*GridDim + 1, 1, 1);
+
+    AimAt(&Scene->NewCamera, Vec3(0, 6, -14), Vec3(0, 0, 0));
+
+    Scene->DirectionalLightD = Normalize(Vec3(1, 2, -1));
+    Scene->DirectionalLightEmission = Vec3(2.0f, 1.8f, 1.6f);
+
+    u32 GroundMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.5f, 0.5f, 0.5f) });
+    u32 SphereMaterialIndices[] =
+    {
+        AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.2f, 0.2f) }),
+        AddMaterial(Scene, { .Albedo = Vec3(0.2f, 0.3f, 0.8f) }),
+        AddMaterial(Scene, { .Flags = Material_Mirror, .Albedo = Vec3(0.9f, 0.9f, 0.9f) }),
+        AddMaterial(Scene, { .IOR = 1.5f, .Albedo = Vec3(1, 1, 1) }),
+    };
+
+    AddPlane(Scene,
+    {
+        .Material = GroundMaterialIndex,
+        .N = Vec3(0, 1, 0),
+        .d = 0.0f,
+    });
+
+    random_series Entropy = { 0x1337 };
+    for (u32 Z = 0; Z < GridDim; ++Z)
+    {
+        for (u32 X = 0; X < GridDim; ++X)
+        {
+            f32 r = 0.2f + 0.2f*RandomUnilateral(&Entropy);
+            vec2 Jitter = 0.25f*RandomBilateralVec2(&Entropy);
+            u32 MaterialIndex = SphereMaterialIndices[Xorshift(&Entropy) % ArrayCount(SphereMaterialIndices)];
+
+            AddSphere(Scene,
+            {
+                .Material = MaterialIndex,
+                .P = Vec3((f32)X - 0.5f*(f32)GridDim + Jitter.X, r, (f32)Z - 0.5f*(f32)GridDim + Jitter.Y),
+                .r = r,
+            });
+        }
+    }
+}
+
+internal void
+BuildSphereLightRoomScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: A closed room lit only by emissive spheres of different sizes and brightness, so
+    //       nothing escapes to the sky and all the light has to come from light sampling or luck
+    ReserveSceneCapacity(Scene, 8, 8, 8, 1, 1);
+
+    AimAt(&Scene->NewCamera, Vec3(0, 2, -7), Vec3(0, 1.5f, 0));
+
+    u32 WallMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.7f, 0.7f, 0.7f) });
+    u32 RedWallMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.7f, 0.15f, 0.1f) });
+    u32 GreenWallMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.1f, 0.6f, 0.15f) });
+    u32 SphereMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.6f, 0.6f, 0.8f) });
+    u32 WarmLightMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0, 0, 0), .Emissive = Vec3(60.0f, 45.0f, 30.0f) });
+    u32 CoolLightMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0, 0, 0), .Emissive = Vec3(4.0f, 6.0f, 9.0f) });
+
+    AddPlane(Scene, { .Material = WallMaterialIndex,      .N = Vec3( 0,  1,  0), .d =  0.0f });
+    AddPlane(Scene, { .Material = WallMaterialIndex,      .N = Vec3( 0, -1,  0), .d = -4.0f });
+    AddPlane(Scene, { .Material = RedWallMaterialIndex,   .N = Vec3( 1,  0,  0), .d = -4.0f });
+    AddPlane(Scene, { .Material = GreenWallMaterialIndex, .N = Vec3(-1,  0,  0), .d = -4.0f });
+    AddPlane(Scene, { .Material = WallMaterialIndex,      .N = Vec3( 0,  0, -1), .d = -4.0f });
+    AddPlane(Scene, { .Material = WallMaterialIndex,      .N = Vec3( 0,  0,  1), .d = -8.0f });
+
+    AddSphere(Scene, { .Material = SphereMaterialIndex,    .P = Vec3(-1.2f, 1.0f,  0.5f), .r = 1.0f });
+    AddSphere(Scene, { .Material = SphereMaterialIndex,    .P = Vec3( 1.5f, 0.6f, -0.5f), .r = 0.6f });
+    AddSphere(Scene, { .Material = WarmLightMaterialIndex, .P = Vec3( 0.0f, 3.6f,  0.0f), .r = 0.15f });
+    AddSphere(Scene, { .Material = WarmLightMaterialIndex, .P = Vec3( 2.5f, 3.5f,  2.5f), .r = 0.1f });
+    AddSphere(Scene, { .Material = CoolLightMaterialIndex, .P = Vec3(-3.0f, 3.0f, -2.0f), .r = 0.5f });
+}
+
+internal triangle_mesh *
+GenerateTorus(arena *Arena, vec3 Center, f32 MajorRadius, f32 MinorRadius, u32 MajorSegments, u32 MinorSegments)
+{
+    // NOTE: A torus around the Y axis, with exact vertex normals
+    triangle_mesh *Result = PushStruct(Arena, triangle_mesh);
+    Result->VertexCount = Result->NormalCount = MajorSegments*MinorSegments;
+    Result->TriangleCount = 2*MajorSegments*MinorSegments;
+    Result->Positions = PushArrayNoClear(Arena, Result->VertexCount, vec3);
+    Result->Normals = PushArrayNoClear(Arena, Result->NormalCount, vec3);
+    Result->Indices = PushArrayNoClear(Arena, 3*Result->TriangleCount, u32);
+    Result->NormalIndices = Result->Indices;
+
+    for (u32 I = 0; I < MajorSegments; ++I)
+    {
+        f32 Phi = Tau32*(f32)I / (f32)MajorSegments;
+        vec3 Ring = Vec3(CosF(Phi), 0.0f, SinF(Phi));
+        for (u32 J = 0; J < MinorSegments; ++J)
+        {
+            f32 Theta = Tau32*(f32)J / (f32)MinorSegments;
+            vec3 N = CosF(Theta)*Ring + Vec3(0.0f, SinF(Theta), 0.0f);
+
+            u32 Vertex = I*MinorSegments + J;
+            Result->Positions[Vertex] = Center + MajorRadius*Ring + MinorRadius*N;
+            Result->Normals[Vertex] = N;
+
+            u32 NextI = ((I + 1) % MajorSegments)*MinorSegments;
+            u32 NextJ = (J + 1) % MinorSegments;
+            u32 *Quad = Result->Indices + 6*Vertex;
+            Quad[0] = I*MinorSegments + J;
+            Quad[1] = NextI + J;
+            Quad[2] = NextI + NextJ;
+            Quad[3] = I*MinorSegments + J;
+            Quad[4] = NextI + NextJ;
+            Quad[5] = I*MinorSegments + NextJ;
+        }
+    }
+
+    return Result;
+}
+
+internal affine_transform
+RotateScaleTranslate(f32 Yaw, f32 Tilt, f32 Scale, vec3 P)
+{
+    // NOTE: Tilt around X, then yaw around Y
+    f32 CosYaw = CosF(Yaw), SinYaw = SinF(Yaw);
+    f32 CosTilt = CosF(Tilt), SinTilt = SinF(Tilt);
+    vec3 YawX = Vec3(CosYaw, 0.0f, -SinYaw);
+    vec3 YawZ = Vec3(SinYaw, 0.0f, CosYaw);
+
+    affine_transform Result;
+    Result.X = Scale*YawX;
+    Result.Y = Scale*(CosTilt*Vec3(0, 1, 0) + SinTilt*YawZ);
+    Result.Z = Scale*(CosTilt*YawZ - SinTilt*Vec3(0, 1, 0));
+    Result.P = P;
+    return Result;
+}
+
+internal void
+BuildMeshScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: Two instances of a finely tessellated torus (about 150k triangles) on a ground plane,
+    //       one diffuse and one glass so rays end up inside a mesh too
+    ReserveSceneCapacity(Scene, 4, 2, 1, 2, 3);
+
+    AimAt(&Scene->NewCamera, Vec3(0, 3, -6), Vec3(0, 0.5f, 0));
+
+    Scene->DirectionalLightD = Normalize(Vec3(-1, 2, -1));
+    Scene->DirectionalLightEmission = Vec3(2.0f, 1.8f, 1.6f);
+
+    u32 GroundMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.5f, 0.5f, 0.5f) });
+    u32 DiffuseMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.4f, 0.2f) });
+    u32 GlassMaterialIndex = AddMaterial(Scene, { .IOR = 1.5f, .Albedo = Vec3(1, 1, 1) });
+
+    AddPlane(Scene,
+    {
+        .Material = GroundMaterialIndex,
+        .N = Vec3(0, 1, 0),
+        .d = 0.0f,
+    });
+
+    u32 TorusMesh = AddMesh(Scene, DiffuseMaterialIndex, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.5f, 384, 200), TempArena, Dispatch);
+    AddInstance(Scene, { .Mesh = TorusMesh, .ObjectToWorld = RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(-1.3f, 0.5f, 0.5f)) });
+    AddInstance(Scene, { .Mesh = TorusMesh, .Material = GlassMaterialIndex, .ObjectToWorld = RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(1.3f, 0.5f, -0.5f)) });
+}
+
+internal void
+BuildInstanceFieldScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: 1024 randomly turned, tilted and scaled copies of one 20k triangle torus, so
+    //       the top level has some real work to do. The layout comes from a fixed seed.
+    u32 GridDim = 32;
+    ReserveSceneCapacity(Scene, 8, 2, 1, 2, GridDim*GridDim + 1);
+
+    AimAt(&Scene->NewCamera, Vec3(0, 8, -20), Vec3(0, 0, 0));
+
+    Scene->DirectionalLightD = Normalize(Vec3(1, 2, -1));
+    Scene->DirectionalLightEmission = Vec3(2.0f, 1.8f, 1.6f);
+
+    u32 GroundMaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.5f, 0.5f, 0.5f) });
+    u32 TorusMaterialIndices[] =
+    {
+        AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.2f, 0.2f) }),
+        AddMaterial(Scene, { .Albedo = Vec3(0.2f, 0.3f, 0.8f) }),
+        AddMaterial(Scene, { .Flags = Material_Mirror, .Albedo = Vec3(0.9f, 0.9f, 0.9f) }),
+        AddMaterial(Scene, { .IOR = 1.5f, .Albedo = Vec3(1, 1, 1) }),
+    };
+
+    AddPlane(Scene,
+    {
+        .Material = GroundMaterialIndex,
+        .N = Vec3(0, 1, 0),
+        .d = 0.0f,
+    });
+
+    u32 TorusMesh = AddMesh(Scene, TorusMaterialIndices[0], GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.35f, 128, 80), TempArena, Dispatch);
+
+    random_series Entropy = { 0x1337 };
+    for (u32 Z = 0; Z < GridDim; ++Z)
+    {
+        for (u32 X = 0; X < GridDim; ++X)
+        {
+            f32 Scale = 0.25f + 0.15f*RandomUnilateral(&Entropy);
+            f32 Yaw = Tau32*RandomUnilateral(&Entropy);
+            f32 Tilt = 0.5f*Pi32*RandomUnilateral(&Entropy);
+            vec2 Jitter = 0.2f*RandomBilateralVec2(&Entropy);
+            u32 MaterialIndex = TorusMaterialIndices[Xorshift(&Entropy) % ArrayCount(TorusMaterialIndices)];
+            vec3 P = Vec3((f32)X - 0.5f*(f32)GridDim + Jitter.X, 1.4f*Scale, (f32)Z - 0.5f*(f32)GridDim + Jitter.Y);
+
+            AddInstance(Scene,
+            {
+                .Mesh = TorusMesh,
+                .Material = MaterialIndex,
+                .ObjectToWorld = RotateScaleTranslate(Yaw, Tilt, Scale, P),
+            });
+        }
+    }
+}
+
+global benchmark_scene BenchmarkScenes[] =
+{
+    { "test",          BuildTestScene, TEST_SCENE_ENVIRONMENT_MAP },
+    { "sphere_field",  BuildSphereFieldScene },
+    { "sphere_lights", BuildSphereLightRoomScene },
+    { "mesh",          BuildMeshScene },
+    { "instances",     BuildInstanceFieldScene },
+};
+
+global benchmark_integrator BenchmarkIntegrators[] =
+{
+    { "single",    { .ContinuousPasses = true } },
+    { "packet",    { .PacketPrimaryRays = true, .ContinuousPasses = true } },
+    { "wavefront", { .WavefrontIntegrator = true, .ContinuousPasses = true } },
+};
+
+internal ray_counters
+SumRayCounters(thread_dispatch *Dispatch)
+{
+    ray_counters Result = {};
+    for (u32 ThreadIndex = 0; ThreadIndex < Dispatch->ThreadCount; ++ThreadIndex)
+    {
+        ray_counters *Counters = &Dispatch->Counters[ThreadIndex];
+        Result.PrimaryRays += Counters->PrimaryRays;
+        Result.TotalRays   += Counters->TotalRays;
+        Result.ShadowRays  += Counters->ShadowRays;
+    }
+    return Result;
+}
+
+internal benchmark_result
+RunBenchmark(thread_dispatch *Dispatch, arena *Arena, common_thread_params Common, u32 SampleCount)
+{
+    scene *Scene = Common.Scene;
+    app_imagebuffer *Buffer = Common.Buffer;
+
+    ZeroArray(Buffer->W*Buffer->H, Buffer->Backbuffer);
+    ZeroArray(Buffer->W*Buffer->H, Buffer->Frontbuffer);
+    Scene->Camera = Scene->NewCamera;
+    if (Dispatch->SecondMoments)
+    {
+        ZeroArray(Dispatch->MomentsW*Dispatch->MomentsH, Dispatch->SecondMoments);
+    }
+
+    // NOTE: FrameIndex feeds the per tile seeds, so resetting it makes every run trace the same paths
+    //       no matter how many threads there are
+    FrameIndex = 0;
+
+    ray_counters CountersBefore = SumRayCounters(Dispatch);
+    f64 StartTime = Platform.GetSeconds();
+
+    Dispatch->SignalIdle = true;
+    MEMORY_BARRIER;
+
+    BeginPasses(Dispatch, Arena, 16, 16, Common, SampleCount - 1);
+    Platform.WaitOnSemaphore(Dispatch->IdleSemaphore);
+
+    benchmark_result Result = {};
+    Result.Seconds = Platform.GetSeconds() - StartTime;
+
+    ray_counters CountersAfter = SumRayCounters(Dispatch);
+    Result.Counters.PrimaryRays = CountersAfter.PrimaryRays - CountersBefore.PrimaryRays;
+    Result.Counters.TotalRays   = CountersAfter.TotalRays   - CountersBefore.TotalRays;
+    Result.Counters.ShadowRays  = CountersAfter.ShadowRays  - CountersBefore.ShadowRays;
+
+    // NOTE: The mean is there to catch runs that got faster by rendering something different
+    u32 PixelCount = Buffer->W*Buffer->H;
+    for (u32 PixelIndex = 0; PixelIndex < PixelCount; ++PixelIndex)
+    {
+        app_pixel Pixel = Buffer->Backbuffer[PixelIndex];
+        if (Pixel.w > 0.0f)
+        {
+            Result.MeanColor += (1.0f / Pixel.w)*Vec3(Pixel.r, Pixel.g, Pixel.b);
+        }
+    }
+    Result.MeanColor *= 1.0f / (f32)PixelCount;
+
+    return Result;
+}
+
+//
+// NOTE: Instance motion. Times MoveInstance plus the UpdateInstanceBVH that applies it, the way it
+//       happens between passes, and then keeps teleporting instances around to show when the refit
+//       tree has worn down enough for a background rebuild.
+//
+
+#define MOTION_INSTANCE_COUNT 20000
+#define MOTION_REPEAT_COUNT 20
+#define MOTION_FRAME_COUNT 200
+
+internal void
+BuildInstanceMotionScene(scene *Scene, arena *TempArena, thread_dispatch *Dispatch)
+{
+    // NOTE: Lots of small, cheap tori scattered over a 200x200 square, so the top level is big and
+    //       the meshes don't matter. The layout comes from a fixed seed.
+    ReserveSceneCapacity(Scene, 2, 1, 1, 2, MOTION_INSTANCE_COUNT + 1);
+
+    u32 MaterialIndex = AddMaterial(Scene, { .Albedo = Vec3(0.8f, 0.8f, 0.8f) });
+    u32 TorusMesh = AddMesh(Scene, MaterialIndex, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.35f, 16, 8), TempArena, Dispatch);
+
+    random_series Entropy = { 0x1337 };
+    for (u32 I = 0; I < MOTION_INSTANCE_COUNT; ++I)
+    {
+        f32 Yaw = Tau32*RandomUnilateral(&Entropy);
+        f32 Scale = 0.3f + 0.3f*RandomUnilateral(&Entropy);
+        vec2 P = 100.0f*RandomBilateralVec2(&Entropy);
+        AddInstance(Scene, { .Mesh = TorusMesh, .ObjectToWorld = RotateScaleTranslate(Yaw, 0.0f, Scale, Vec3(P.X, 1.0f, P.Y)) });
+    }
+}
+
+internal void
+RunInstanceMotionBenchmark(arena *Arena, thread_dispatch *Dispatch)
+{
+    scene *Scene = PushStruct(Arena, scene);
+    BuildInstanceMotionScene(Scene, Arena, Dispatch);
+    BuildSphereBVH(Scene, Arena, Dispatch);
+
+    f64 StartTime = Platform.GetSeconds();
+    BuildInstanceBVH(Scene, Arena, Dispatch);
+    f64 BuildSeconds = Platform.GetSeconds() - StartTime;
+
+    printf("\nInstance motion: %u instances, %u top level nodes, full build %.2f ms\n\n",
+           MOTION_INSTANCE_COUNT, Scene->InstanceBVH.NodeCount, 1.0e3*BuildSeconds);
+    printf("%9s %14s %11s\n", "moved", "move+refit us", "cost ratio");
+
+    // NOTE: Small nudges to different instances each time, best of a few runs
+    random_series Entropy = { 0xbeef };
+    u32 MoveCounts[] = { 1, 10, 100, 1000, MOTION_INSTANCE_COUNT };
+    for (u32 CountIndex = 0; CountIndex < ArrayCount(MoveCounts); ++CountIndex)
+    {
+        u32 MoveCount = MoveCounts[CountIndex];
+        f64 BestSeconds = F64_MAX;
+        for (u32 Repeat = 0; Repeat < MOTION_REPEAT_COUNT; ++Repeat)
+        {
+            f64 RepeatStartTime = Platform.GetSeconds();
+            u32 FirstInstance = Xorshift(&Entropy);
+            for (u32 Move = 0; Move < MoveCount; ++Move)
+            {
+                u32 InstanceIndex = 1 + (FirstInstance + Move) % MOTION_INSTANCE_COUNT;
+                affine_transform ObjectToWorld = Scene->Instances.Data[InstanceIndex].ObjectToWorld;
+                ObjectToWorld.P += 0.05f*Vec3(RandomBilateral(&Entropy), 0.0f, RandomBilateral(&Entropy));
+                MoveInstance(Scene, InstanceIndex, ObjectToWorld);
+            }
+            UpdateInstanceBVH(Scene, Arena, Dispatch);
+            BestSeconds = MIN(BestSeconds, Platform.GetSeconds() - RepeatStartTime);
+        }
+
+        printf("%9u %14.1f %11.3f\n", MoveCount, 1.0e6*BestSeconds,
+               GetBVHCostRatio(&Scene->InstanceBVH, &Scene->InstanceRefit));
+    }
+
+    // NOTE: Now every instance drifts along a velocity of its own, every frame. These frames take
+    //       no time at all, so a rebuild that's been started gets waited on, the way a real frame
+    //       would give it time.
+    printf("\nMoving all instances for %u frames, rebuilding at a cost ratio of %.2f\n\n",
+           MOTION_FRAME_COUNT, (f64)BVH_REBUILD_COST_RATIO);
+
+    vec3 *Velocities = PushArrayNoClear(&Scene->Arena, MOTION_INSTANCE_COUNT + 1, vec3);
+    for (u32 InstanceIndex = 1; InstanceIndex <= MOTION_INSTANCE_COUNT; ++InstanceIndex)
+    {
+        vec2 Velocity = 0.3f*RandomBilateralVec2(&Entropy);
+        Velocities[InstanceIndex] = Vec3(Velocity.X, 0.0f, Velocity.Y);
+    }
+
+    u32 RebuildCount = 0;
+    for (u32 Frame = 0; Frame < MOTION_FRAME_COUNT; ++Frame)
+    {
+        for (u32 InstanceIndex = 1; InstanceIndex <= MOTION_INSTANCE_COUNT; ++InstanceIndex)
+        {
+            affine_transform ObjectToWorld = Scene->Instances.Data[InstanceIndex].ObjectToWorld;
+            ObjectToWorld.P += Velocities[InstanceIndex];
+            MoveInstance(Scene, InstanceIndex, ObjectToWorld);
+        }
+
+        bool Swapping = (Scene->InstanceRebuild.State == BVHRebuild_Done);
+        f64 FrameStartTime = Platform.GetSeconds();
+        UpdateInstanceBVH(Scene, Arena, Dispatch);
+        f64 UpdateSeconds = Platform.GetSeconds() - FrameStartTime;
+        f32 CostRatio = GetBVHCostRatio(&Scene->InstanceBVH, &Scene->InstanceRefit);
+
+        if (Swapping)
+        {
+            printf("frame %3u: rebuilt tree swapped in, cost ratio %.3f, update %.1f us\n", Frame, (f64)CostRatio, 1.0e6*UpdateSeconds);
+        }
+        if (Scene->InstanceRebuild.State != BVHRebuild_Idle)
+        {
+            printf("frame %3u: cost ratio %.3f, rebuild started, update %.1f us\n", Frame, (f64)CostRatio, 1.0e6*UpdateSeconds);
+            ++RebuildCount;
+            while (Scene->InstanceRebuild.State == BVHRebuild_Building)
+            {
+                _mm_pause();
+            }
+        }
+    }
+    printf("\n%u rebuilds in %u frames\n", RebuildCount, MOTION_FRAME_COUNT);
+
+    CancelBVHRebuild(&Scene->InstanceRebuild);
+    DeallocateArena(&Scene->InstanceArena);
+    DeallocateArena(&Scene->Arena);
+}
+
+internal int
+RayBenchmark(platform_api API, app_benchmark_params *Params)
+{
+    Platform = API;
+
+    RayState = BootstrapPushStruct(ray_state, Arena);
+    arena *Arena = &RayState->Arena;
+
+    if (!Params->W || !Params->H)
+    {
+        fprintf(stderr, "Can't benchmark an empty image\n");
+        return -1;
+    }
+
+    thread_dispatch *Dispatch = &RayState->Dispatch;
+    InitThreadDispatcher(Dispatch, Arena);
+
+    u32 SampleCount = MAX(1, Params->SampleCount);
+
+    app_imagebuffer Buffer = {};
+    Buffer.W = Params->W;
+    Buffer.H = Params->H;
+    Buffer.Backbuffer = PushArray(Arena, Buffer.W*Buffer.H, app_pixel);
+    Buffer.Frontbuffer = PushArray(Arena, Buffer.W*Buffer.H, app_pixel);
+
+    usize CsvCapacity = Kilobytes(64);
+    usize CsvAt = 0;
+    char *Csv = PushArrayNoClear(Arena, CsvCapacity, char);
+
+#define AppendCsv(...) CsvAt += MIN((usize)snprintf(Csv + CsvAt, CsvCapacity - CsvAt, __VA_ARGS__), CsvCapacity - CsvAt - 1)
+
+    AppendCsv("scene,integrator,threads,width,height,samples,seconds,"
+              "primary_rays_per_second,total_rays_per_second,shadow_rays_per_second,"
+              "samples_per_pixel_per_second,speedup,mean_r,mean_g,mean_b\n");
+
+    printf("Benchmarking %ux%u at %u samples per pixel, up to %u threads\n\n",
+           Buffer.W, Buffer.H, SampleCount, Dispatch->ThreadCount);
+    printf("%-14s %-10s %7s %9s %12s %12s %12s %10s %8s\n",
+           "scene", "integrator", "threads", "seconds", "primary/s", "total/s", "shadow/s", "spp/s", "speedup");
+
+    for (u32 SceneIndex = 0; SceneIndex < ArrayCount(BenchmarkScenes); ++SceneIndex)
+    {
+        benchmark_scene *BenchmarkScene = &BenchmarkScenes[SceneIndex];
+
+        platform_file_info RequiredFileInfo;
+        if (BenchmarkScene->RequiredFileName && !Platform.GetFileInfo(BenchmarkScene->RequiredFileName, &RequiredFileInfo))
+        {
+            fprintf(stderr, "Skipping the %s scene, %s is missing\n", BenchmarkScene->Name, BenchmarkScene->RequiredFileName);
+            continue;
+        }
+
+        scene *Scene = RayState->Scene = PushStruct(Arena, scene);
+        BenchmarkScene->Build(Scene, Arena, Dispatch);
+        BuildSphereBVH(Scene, Arena, Dispatch);
+        BuildInstanceBVH(Scene, Arena, Dispatch);
+        BuildLightList(Scene, Arena);
+
+        for (u32 IntegratorIndex = 0; IntegratorIndex < ArrayCount(BenchmarkIntegrators); ++IntegratorIndex)
+        {
+            benchmark_integrator *Integrator = &BenchmarkIntegrators[IntegratorIndex];
+
+            common_thread_params Common =
+            {
+                .Settings = Integrator->Settings,
+                .Scene = Scene,
+                .Buffer = &Buffer,
+            };
+
+            // NOTE: Warm up caches and wake up the workers before timing anything
+            RunBenchmark(Dispatch, Arena, Common, 1);
+
+            f64 SingleThreadSeconds = 0.0;
+            for (u32 ThreadCount = 1;;)
+            {
+                Common.Settings.ThreadCount = (int)ThreadCount;
+                benchmark_result Result = RunBenchmark(Dispatch, Arena, Common, SampleCount);
+
+                if (ThreadCount == 1)
+                {
+                    SingleThreadSeconds = Result.Seconds;
+                }
+
+                f64 RcpSeconds = 1.0 / Result.Seconds;
+                f64 PrimaryRaysPerSecond = RcpSeconds*(f64)Result.Counters.PrimaryRays;
+                f64 TotalRaysPerSecond = RcpSeconds*(f64)Result.Counters.TotalRays;
+                f64 ShadowRaysPerSecond = RcpSeconds*(f64)Result.Counters.ShadowRays;
+                f64 SamplesPerPixelPerSecond = RcpSeconds*(f64)SampleCount;
+                f64 Speedup = SingleThreadSeconds*RcpSeconds;
+
+                printf("%-14s %-10s %7u %9.3f %11.2fM %11.2fM %11.2fM %10.2f %7.2fx\n",
+                       BenchmarkScene->Name, Integrator->Name, ThreadCount, Result.Seconds,
+                       1.0e-6*PrimaryRaysPerSecond, 1.0e-6*TotalRaysPerSecond, 1.0e-6*ShadowRaysPerSecond,
+                       SamplesPerPixelPerSecond, Speedup);
+
+                AppendCsv("%s,%s,%u,%u,%u,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
+                          BenchmarkScene->Name, Integrator->Name, ThreadCount, Buffer.W, Buffer.H, SampleCount,
+                          Result.Seconds, PrimaryRaysPerSecond, TotalRaysPerSecond, ShadowRaysPerSecond,
+                          SamplesPerPixelPerSecond, Speedup,
+                          Result.MeanColor.X, Result.MeanColor.Y, Result.MeanColor.Z);
+
+                // NOTE: Powers of two, and always finish on every thread there is
+                if (ThreadCount == Dispatch->ThreadCount)
+                {
+                    break;
+                }
+                ThreadCount = MIN(2*ThreadCount, Dispatch->ThreadCount);
+            }
+        }
+
+        Platform.UnmapFile(Scene->IBLCache);
+        DeallocateArena(&Scene->Arena);
+    }
+
+#undef AppendCsv
+
+    RunInstanceMotionBenchmark(Arena, Dispatch);
+
+    int Result = 0;
+    if (Platform.WriteEntireFile(Params->OutputFileName, string_u8 { .Count = CsvAt, .Data = (u8 *)Csv }))
+    {
+        printf("\nWrote %s\n", Params->OutputFileName);
+    }
+    else
+    {
+        fprintf(stderr, "Could not write %s\n", Params->OutputFileName);
+        Result = -1;
+    }
+
+    return Result;
+}
@@ -0,0 +1,1390 @@
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_TWO_BIN_SET_MIN_COUNT 256
+
+internal inline aabb
+InvertedBounds(void)
+{
+    aabb Result;
+    Result.Min = Vec3(F32_MAX, F32_MAX, F32_MAX);
+    Result.Max = Vec3(F32_MIN, F32_MIN, F32_MIN);
+    return Result;
+}
+
+internal inline aabb
+Union(aabb A, aabb B)
+{
+    aabb Result;
+    Result.Min = Min(A.Min, B.Min);
+    Result.Max = Max(A.Max, B.Max);
+    return Result;
+}
+
+internal inline aabb
+Union(aabb A, vec3 P)
+{
+    aabb Result;
+    Result.Min = Min(A.Min, P);
+    Result.Max = Max(A.Max, P);
+    return Result;
+}
+
+internal inline aabb
+TransformBounds(affine_transform *T, aabb Bounds)
+{
+    // NOTE: Transform the center, and the half extents by the absolute value of the linear part
+    // SOURCE: Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems 1990
+    vec3 Center = 0.5f*(Bounds.Min + Bounds.Max);
+    vec3 HalfExtent = 0.5f*(Bounds.Max - Bounds.Min);
+
+    vec3 AbsX = Vec3(AbsoluteValueF(T->X.X), AbsoluteValueF(T->X.Y), AbsoluteValueF(T->X.Z));
+    vec3 AbsY = Vec3(AbsoluteValueF(T->Y.X), AbsoluteValueF(T->Y.Y), AbsoluteValueF(T->Y.Z));
+    vec3 AbsZ = Vec3(AbsoluteValueF(T->Z.X), AbsoluteValueF(T->Z.Y), AbsoluteValueF(T->Z.Z));
+
+    vec3 NewCenter = TransformPoint(T, Center);
+    vec3 NewHalfExtent = HalfExtent.X*AbsX + HalfExtent.Y*AbsY + HalfExtent.Z*AbsZ;
+
+    aabb Result;
+    Result.Min = NewCenter - NewHalfExtent;
+    Result.Max = NewCenter + NewHalfExtent;
+    return Result;
+}
+
+internal inline f32
+SurfaceArea(aabb Bounds)
+{
+    vec3 Dim = Bounds.Max - Bounds.Min;
+    f32 Result = 2.0f*(Dim.X*Dim.Y + Dim.Y*Dim.Z + Dim.Z*Dim.X);
+    return Result;
+}
+
+internal always_inline f32
+RayIntersectBounds(vec3 RayP, vec3 RayInvD, aabb Bounds, f32 tMax)
+{
+    // NOTE: Returns the entry distance, or F32_MAX on a miss
+    vec3 t0 = (Bounds.Min - RayP)*RayInvD;
+    vec3 t1 = (Bounds.Max - RayP)*RayInvD;
+
+    f32 tNear = MaxF(0.0f, Max3(Min(t0, t1)));
+    f32 tFar  = MinF(tMax, Min3(Max(t0, t1)));
+
+    f32 Result = (tNear <= tFar ? tNear : F32_MAX);
+    return Result;
+}
+
+internal always_inline lane_u32
+RayIntersectBounds(lane_v3 RayP, lane_v3 RayInvD, aabb Bounds, lane_f32 tMax)
+{
+    // NOTE: Returns the mask of lanes whose ray enters the box before their tMax
+    lane_f32 t0X = (LaneF32(Bounds.Min.X) - RayP.X)*RayInvD.X;
+    lane_f32 t0Y = (LaneF32(Bounds.Min.Y) - RayP.Y)*RayInvD.Y;
+    lane_f32 t0Z = (LaneF32(Bounds.Min.Z) - RayP.Z)*RayInvD.Z;
+    lane_f32 t1X = (LaneF32(Bounds.Max.X) - RayP.X)*RayInvD.X;
+    lane_f32 t1Y = (LaneF32(Bounds.Max.Y) - RayP.Y)*RayInvD.Y;
+    lane_f32 t1Z = (LaneF32(Bounds.Max.Z) - RayP.Z)*RayInvD.Z;
+
+    lane_f32 tNear = Max(Max(LaneF32(0.0f), Min(t0X, t1X)), Max(Min(t0Y, t1Y), Min(t0Z, t1Z)));
+    lane_f32 tFar  = Min(Min(tMax, Max(t0X, t1X)), Min(Max(t0Y, t1Y), Max(t0Z, t1Z)));
+
+    lane_u32 Result = (tNear <= tFar);
+    return Result;
+}
+
+//
+// NOTE: The builder keeps its boxes as 4 wide mins and maxes, so growing one is a single min and
+//       max. They're loaded straight out of bvh_build_primitive, which leaves junk in the fourth lane.
+//
+
+internal always_inline __m128
+LoadBoundsMin(bvh_build_primitive *Primitive)
+{
+    __m128 Result = _mm_loadu_ps(&Primitive->Bounds.Min.X);
+    return Result;
+}
+
+internal always_inline __m128
+LoadBoundsMax(bvh_build_primitive *Primitive)
+{
+    __m128 Result = _mm_loadu_ps(&Primitive->Bounds.Max.X);
+    return Result;
+}
+
+internal always_inline __m128
+LoadCentroid(bvh_build_primitive *Primitive)
+{
+    // NOTE: The fourth lane is the index, which would make a denormal, so it's masked off
+    __m128 Result = _mm_and_ps(_mm_loadu_ps(&Primitive->Centroid.X), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+    return Result;
+}
+
+internal always_inline vec3
+Vec3FromM128(__m128 A)
+{
+    alignas(16) f32 Lanes[4];
+    _mm_store_ps(Lanes, A);
+    vec3 Result = Vec3(Lanes[0], Lanes[1], Lanes[2]);
+    return Result;
+}
+
+internal always_inline aabb
+AABBFromM128(__m128 Min, __m128 Max)
+{
+    aabb Result;
+    Result.Min = Vec3FromM128(Min);
+    Result.Max = Vec3FromM128(Max);
+    return Result;
+}
+
+internal void
+ComputeBVHBounds(bvh_build_primitive *Primitives, u32 Count, aabb *OutBounds, aabb *OutCentroidBounds)
+{
+    __m128 Min = _mm_set1_ps(F32_MAX);
+    __m128 Max = _mm_set1_ps(F32_MIN);
+    __m128 CentroidMin = _mm_set1_ps(F32_MAX);
+    __m128 CentroidMax = _mm_set1_ps(F32_MIN);
+    for (usize I = 0; I < Count; ++I)
+    {
+        __m128 Centroid = LoadCentroid(&Primitives[I]);
+        Min = _mm_min_ps(Min, LoadBoundsMin(&Primitives[I]));
+        Max = _mm_max_ps(Max, LoadBoundsMax(&Primitives[I]));
+        CentroidMin = _mm_min_ps(CentroidMin, Centroid);
+        CentroidMax = _mm_max_ps(CentroidMax, Centroid);
+    }
+    *OutBounds = AABBFromM128(Min, Max);
+    *OutCentroidBounds = AABBFromM128(CentroidMin, CentroidMax);
+}
+
+internal inline vec3
+BVHBinScale(aabb CentroidBounds)
+{
+    // NOTE: An axis without extent gets a scale of 0, which puts everything in its first bin
+    //       and so never yields a split
+    vec3 Extent = CentroidBounds.Max - CentroidBounds.Min;
+    vec3 Result;
+    for (int Axis = 0; Axis < 3; ++Axis)
+    {
+        Result[Axis] = (Extent[Axis] > 0.0f ? (f32)BVH_BIN_COUNT / Extent[Axis] : 0.0f);
+    }
+    return Result;
+}
+
+internal always_inline u32
+BVHBinIndex(f32 Centroid, f32 AxisMin, f32 BinScale)
+{
+    u32 Result = MIN((u32)((Centroid - AxisMin)*BinScale), BVH_BIN_COUNT - 1);
+    return Result;
+}
+
+internal void
+ClearBVHBins(bvh_bins *Bins)
+{
+    for (int Axis = 0; Axis < 3; ++Axis)
+    {
+        for (usize BinIndex = 0; BinIndex < BVH_BIN_COUNT; ++BinIndex)
+        {
+            Bins->Min[Axis][BinIndex] = _mm_set1_ps(F32_MAX);
+            Bins->Max[Axis][BinIndex] = _mm_set1_ps(F32_MIN);
+            Bins->Count[Axis][BinIndex] = 0;
+        }
+    }
+}
+
+internal void
+MergeBVHBins(bvh_bins *Into, bvh_bins *From)
+{
+    for (int Axis = 0; Axis < 3; ++Axis)
+    {
+        for (usize BinIndex = 0; BinIndex < BVH_BIN_COUNT; ++BinIndex)
+        {
+            Into->Min[Axis][BinIndex] = _mm_min_ps(Into->Min[Axis][BinIndex], From->Min[Axis][BinIndex]);
+            Into->Max[Axis][BinIndex] = _mm_max_ps(Into->Max[Axis][BinIndex], From->Max[Axis][BinIndex]);
+            Into->Count[Axis][BinIndex] += From->Count[Axis][BinIndex];
+        }
+    }
+}
+
+internal always_inline void
+BinPrimitive(bvh_bins *Bins, bvh_build_primitive *Primitive, __m128 AxisMin, __m128 BinScale)
+{
+    // NOTE: The bin indices come out the same as BVHBinIndex's, which the partition relies on
+    __m128 Min = LoadBoundsMin(Primitive);
+    __m128 Max = LoadBoundsMax(Primitive);
+    __m128i BinIndices = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(LoadCentroid(Primitive), AxisMin), BinScale));
+    BinIndices = _mm_min_epi32(BinIndices, _mm_set1_epi32(BVH_BIN_COUNT - 1));
+
+    u32 BinX = (u32)_mm_cvtsi128_si32(BinIndices);
+    u32 BinY = (u32)_mm_extract_epi32(BinIndices, 1);
+    u32 BinZ = (u32)_mm_extract_epi32(BinIndices, 2);
+
+    Bins->Min[0][BinX] = _mm_min_ps(Bins->Min[0][BinX], Min);
+    Bins->Max[0][BinX] = _mm_max_ps(Bins->Max[0][BinX], Max);
+    Bins->Count[0][BinX] += 1;
+    Bins->Min[1][BinY] = _mm_min_ps(Bins->Min[1][BinY], Min);
+    Bins->Max[1][BinY] = _mm_max_ps(Bins->Max[1][BinY], Max);
+    Bins->Count[1][BinY] += 1;
+    Bins->Min[2][BinZ] = _mm_min_ps(Bins->Min[2][BinZ], Min);
+    Bins->Max[2][BinZ] = _mm_max_ps(Bins->Max[2][BinZ], Max);
+    Bins->Count[2][BinZ] += 1;
+}
+
+internal void
+BinPrimitives(bvh_bins *Bins, bvh_build_primitive *Primitives, u32 Count, aabb CentroidBounds)
+{
+    // NOTE: All three axes in the one pass over the primitives
+    vec3 Scale = BVHBinScale(CentroidBounds);
+    __m128 AxisMin = _mm_setr_ps(CentroidBounds.Min.X, CentroidBounds.Min.Y, CentroidBounds.Min.Z, 0.0f);
+    __m128 BinScale = _mm_setr_ps(Scale.X, Scale.Y, Scale.Z, 0.0f);
+
+    usize I = 0;
+    if (Count >= BVH_TWO_BIN_SET_MIN_COUNT)
+    {
+        // NOTE: Neighbouring primitives tend to land in the same bins, so every update waits on the
+        //       store of the one before. Alternating between two sets of bins halves that chain.
+        bvh_bins OddBins;
+        ClearBVHBins(&OddBins);
+        for (; I + 1 < Count; I += 2)
+        {
+            BinPrimitive(Bins, &Primitives[I + 0], AxisMin, BinScale);
+            BinPrimitive(&OddBins, &Primitives[I + 1], AxisMin, BinScale);
+        }
+        MergeBVHBins(Bins, &OddBins);
+    }
+
+    for (; I < Count; ++I)
+    {
+        BinPrimitive(Bins, &Primitives[I], AxisMin, BinScale);
+    }
+}
+
+internal always_inline f32
+SurfaceArea(__m128 Min, __m128 Max)
+{
+    // NOTE: Same sum in the same order as the aabb version, without going through memory
+    __m128 Dim = _mm_sub_ps(Max, Min);
+    __m128 Products = _mm_mul_ps(Dim, _mm_shuffle_ps(Dim, Dim, _MM_SHUFFLE(3, 0, 2, 1)));
+    __m128 Sum = _mm_add_ss(_mm_add_ss(Products, _mm_shuffle_ps(Products, Products, 1)), _mm_movehl_ps(Products, Products));
+    f32 Result = 2.0f*_mm_cvtss_f32(Sum);
+    return Result;
+}
+
+internal bool
+ChooseBVHSplit(bvh_build_task *Task, bvh_bins *Bins, bvh_split *OutSplit)
+{
+    // NOTE: Picks the cheapest split plane out of the bins according to the surface area heuristic.
+    //       Returns false if the node is better off as a leaf.
+    u32 Count = Task->Count;
+
+    f32 BestCost = F32_MAX;
+    u32 BestAxis = 0;
+    u32 BestSplit = 0;
+
+    for (int Axis = 0; Axis < 3; ++Axis)
+    {
+        // NOTE: Only the boundaries right below a non-empty bin are worth looking at, the ones below
+        //       an empty bin split the primitives the same way as the next one up. Small nodes
+        //       only fill a few of the bins, so this saves most of the sweep.
+        u32 Used[BVH_BIN_COUNT];
+        u32 UsedCount = 0;
+        for (u32 BinIndex = 0; BinIndex < BVH_BIN_COUNT; ++BinIndex)
+        {
+            Used[UsedCount] = BinIndex;
+            UsedCount += (Bins->Count[Axis][BinIndex] != 0);
+        }
+
+        // NOTE: Sweep from both sides so each candidate split knows the area and count on its left and right
+        f32 LeftCost[BVH_BIN_COUNT];
+        __m128 LeftMin = _mm_set1_ps(F32_MAX);
+        __m128 LeftMax = _mm_set1_ps(F32_MIN);
+        u32 LeftCount = 0;
+        for (u32 I = 0; I + 1 < UsedCount; ++I)
+        {
+            u32 BinIndex = Used[I];
+            LeftMin = _mm_min_ps(LeftMin, Bins->Min[Axis][BinIndex]);
+            LeftMax = _mm_max_ps(LeftMax, Bins->Max[Axis][BinIndex]);
+            LeftCount += Bins->Count[Axis][BinIndex];
+            LeftCost[I] = (f32)LeftCount*SurfaceArea(LeftMin, LeftMax);
+        }
+
+        __m128 RightMin = _mm_set1_ps(F32_MAX);
+        __m128 RightMax = _mm_set1_ps(F32_MIN);
+        u32 RightCount = 0;
+        for (u32 I = UsedCount - 1; I > 0; --I)
+        {
+            u32 BinIndex = Used[I];
+            RightMin = _mm_min_ps(RightMin, Bins->Min[Axis][BinIndex]);
+            RightMax = _mm_max_ps(RightMax, Bins->Max[Axis][BinIndex]);
+            RightCount += Bins->Count[Axis][BinIndex];
+
+            f32 Cost = LeftCost[I - 1] + (f32)RightCount*SurfaceArea(RightMin, RightMax);
+            if (Cost < BestCost)
+            {
+                BestCost = Cost;
+                BestAxis = Axis;
+                BestSplit = BinIndex;
+            }
+        }
+    }
+
+    f32 ParentArea = SurfaceArea(Task->Bounds);
+    f32 LeafCost = (f32)Count;
+    f32 SplitCost = (ParentArea > 0.0f ? BVH_TRAVERSAL_COST + BestCost / ParentArea : F32_MAX);
+
+    OutSplit->Axis = BestAxis;
+    OutSplit->Bin = BestSplit;
+
+    bool Result = ((Count > BVH_MAX_LEAF_COUNT) || (SplitCost < LeafCost));
+    return Result;
+}
+
+internal void
+AllocateBVHChildren(bvh_builder *Builder, bvh_build_task *Task, u32 LeftCount, bvh_build_task *Children)
+{
+    // NOTE: Turns the node into an interior one. The children's bounds are up to the caller.
+    u32 LeftIndex = Builder->NodeCount;
+    Builder->NodeCount += 2;
+
+    bvh_node *Node = &Builder->Nodes[Task->NodeIndex];
+    Node->LeftFirst = LeftIndex;
+    Node->Count = 0;
+
+    Children[0].NodeIndex = LeftIndex + 0;
+    Children[0].First = Task->First;
+    Children[0].Count = LeftCount;
+    Children[0].Depth = Task->Depth + 1;
+
+    Children[1].NodeIndex = LeftIndex + 1;
+    Children[1].First = Task->First + LeftCount;
+    Children[1].Count = Task->Count - LeftCount;
+    Children[1].Depth = Task->Depth + 1;
+}
+
+internal void
+PartitionBVHNode(bvh_builder *Builder, bvh_build_task *Task, bvh_split *Split, bvh_build_task *Children)
+{
+    u32 Count = Task->Count;
+    bvh_build_primitive *Primitives = Builder->Primitives + Task->First;
+
+    u32 LeftCount = Count / 2;
+    bool BoundsKnown = false;
+    if (Split->Bin)
+    {
+        // NOTE: Partition the primitives in place around the chosen bin boundary, and pick up the
+        //       bounds of both sides along the way. Every primitive gets looked at exactly once.
+        u32 Axis = Split->Axis;
+        f32 BinScale = BVHBinScale(Task->CentroidBounds)[Axis];
+        f32 AxisMin = Task->CentroidBounds.Min[Axis];
+
+        __m128 Min[2] = { _mm_set1_ps(F32_MAX), _mm_set1_ps(F32_MAX) };
+        __m128 Max[2] = { _mm_set1_ps(F32_MIN), _mm_set1_ps(F32_MIN) };
+        __m128 CentroidMin[2] = { _mm_set1_ps(F32_MAX), _mm_set1_ps(F32_MAX) };
+        __m128 CentroidMax[2] = { _mm_set1_ps(F32_MIN), _mm_set1_ps(F32_MIN) };
+
+        u32 I = 0;
+        u32 J = Count;
+        while (I < J)
+        {
+            bvh_build_primitive *Primitive = &Primitives[I];
+            u32 Side = 0;
+            if (BVHBinIndex(Primitive->Centroid[Axis], AxisMin, BinScale) < Split->Bin)
+            {
+                ++I;
+            }
+            else
+            {
+                --J;
+                Swap(Primitives[I], Primitives[J]);
+                Primitive = &Primitives[J];
+                Side = 1;
+            }
+
+            __m128 Centroid = LoadCentroid(Primitive);
+            Min[Side] = _mm_min_ps(Min[Side], LoadBoundsMin(Primitive));
+            Max[Side] = _mm_max_ps(Max[Side], LoadBoundsMax(Primitive));
+            CentroidMin[Side] = _mm_min_ps(CentroidMin[Side], Centroid);
+            CentroidMax[Side] = _mm_max_ps(CentroidMax[Side], Centroid);
+        }
+
+        if ((I > 0) && (I < Count))
+        {
+            LeftCount = I;
+            BoundsKnown = true;
+            for (u32 Side = 0; Side < 2; ++Side)
+            {
+                Children[Side].Bounds = AABBFromM128(Min[Side], Max[Side]);
+                Children[Side].CentroidBounds = AABBFromM128(CentroidMin[Side], CentroidMax[Side]);
+            }
+        }
+    }
+
+    if (!BoundsKnown)
+    {
+        ComputeBVHBounds(Primitives, LeftCount, &Children[0].Bounds, &Children[0].CentroidBounds);
+        ComputeBVHBounds(Primitives + LeftCount, Count - LeftCount, &Children[1].Bounds, &Children[1].CentroidBounds);
+    }
+
+    AllocateBVHChildren(Builder, Task, LeftCount, Children);
+}
+
+internal inline bool
+BVHNodeMightSplit(bvh_builder *Builder, bvh_build_task *Task)
+{
+    // NOTE: Starts the node off as a leaf, and says whether it's worth binning at all
+    bvh_node *Node = &Builder->Nodes[Task->NodeIndex];
+    Node->Bounds = Task->Bounds;
+    Node->LeftFirst = Task->First;
+    Node->Count = Task->Count;
+
+    bool Result = ((Task->Count > 1) && (Task->Depth + 1 < BVH_MAX_DEPTH));
+    return Result;
+}
+
+internal void
+BuildBVHNode(bvh_builder *Builder, bvh_build_task *Task)
+{
+    if (BVHNodeMightSplit(Builder, Task))
+    {
+        bvh_bins Bins;
+        ClearBVHBins(&Bins);
+        BinPrimitives(&Bins, Builder->Primitives + Task->First, Task->Count, Task->CentroidBounds);
+
+        bvh_split Split;
+        if (ChooseBVHSplit(Task, &Bins, &Split))
+        {
+            bvh_build_task Children[2];
+            PartitionBVHNode(Builder, Task, &Split, Children);
+            BuildBVHNode(Builder, &Children[0]);
+            BuildBVHNode(Builder, &Children[1]);
+        }
+    }
+}
+
+internal void
+BinPrimitivesItem(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    bvh_bin_job *Job = (bvh_bin_job *)UserData;
+    u32 First = ItemIndex*BVH_BIN_ITEM_COUNT;
+    u32 Count = MIN(Job->Count - First, BVH_BIN_ITEM_COUNT);
+
+    // NOTE: Without bins it just gathers the bounds, which is how the root gets them
+    if (Job->ItemBins)
+    {
+        bvh_bins *Bins = &Job->ItemBins[ItemIndex];
+        ClearBVHBins(Bins);
+        BinPrimitives(Bins, Job->Primitives + First, Count, Job->CentroidBounds);
+    }
+    else
+    {
+        ComputeBVHBounds(Job->Primitives + First, Count, &Job->ItemBounds[ItemIndex], &Job->ItemCentroidBounds[ItemIndex]);
+    }
+}
+
+internal void
+ScatterPrimitivesItem(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    // NOTE: The binning already said how many of each item's primitives go left, so every item
+    //       knows where its share of both sides goes and can copy them over on its own
+    bvh_bin_job *Job = (bvh_bin_job *)UserData;
+    u32 First = ItemIndex*BVH_BIN_ITEM_COUNT;
+    u32 Count = MIN(Job->Count - First, BVH_BIN_ITEM_COUNT);
+
+    u32 Axis = Job->Split.Axis;
+    f32 BinScale = BVHBinScale(Job->CentroidBounds)[Axis];
+    f32 AxisMin = Job->CentroidBounds.Min[Axis];
+
+    bvh_build_primitive *Dest[2] =
+    {
+        Job->Scratch + Job->ItemLeftFirst[ItemIndex],
+        Job->Scratch + Job->ItemRightFirst[ItemIndex],
+    };
+
+    __m128 Min[2] = { _mm_set1_ps(F32_MAX), _mm_set1_ps(F32_MAX) };
+    __m128 Max[2] = { _mm_set1_ps(F32_MIN), _mm_set1_ps(F32_MIN) };
+    __m128 CentroidMin[2] = { _mm_set1_ps(F32_MAX), _mm_set1_ps(F32_MAX) };
+    __m128 CentroidMax[2] = { _mm_set1_ps(F32_MIN), _mm_set1_ps(F32_MIN) };
+
+    for (u32 I = First; I < First + Count; ++I)
+    {
+        bvh_build_primitive *Primitive = &Job->Primitives[I];
+        u32 Side = (BVHBinIndex(Primitive->Centroid[Axis], AxisMin, BinScale) < Job->Split.Bin ? 0 : 1);
+        *Dest[Side]++ = *Primitive;
+
+        __m128 Centroid = LoadCentroid(Primitive);
+        Min[Side] = _mm_min_ps(Min[Side], LoadBoundsMin(Primitive));
+        Max[Side] = _mm_max_ps(Max[Side], LoadBoundsMax(Primitive));
+        CentroidMin[Side] = _mm_min_ps(CentroidMin[Side], Centroid);
+        CentroidMax[Side] = _mm_max_ps(CentroidMax[Side], Centroid);
+    }
+
+    for (u32 Side = 0; Side < 2; ++Side)
+    {
+        Job->ItemBounds[2*ItemIndex + Side] = AABBFromM128(Min[Side], Max[Side]);
+        Job->ItemCentroidBounds[2*ItemIndex + Side] = AABBFromM128(CentroidMin[Side], CentroidMax[Side]);
+    }
+}
+
+internal void
+GatherPrimitivesItem(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    bvh_bin_job *Job = (bvh_bin_job *)UserData;
+    u32 First = ItemIndex*BVH_BIN_ITEM_COUNT;
+    u32 Count = MIN(Job->Count - First, BVH_BIN_ITEM_COUNT);
+    CopyArray(Count, Job->Scratch + First, Job->Primitives + First);
+}
+
+internal void
+BuildBVHSubtree(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    bvh_subtree_job *Job = (bvh_subtree_job *)UserData;
+    bvh_build_task Task = Job->Tasks[ItemIndex];
+    arena *Arena = &Job->ThreadArenas[ThreadIndex];
+
+    bvh_builder Builder = {};
+    Builder.Nodes = PushArrayNoClear(Arena, 2*(usize)Task.Count - 1, bvh_node);
+    Builder.Primitives = Job->Primitives;
+    Builder.NodeCount = 1;
+
+    Task.NodeIndex = 0;
+    BuildBVHNode(&Builder, &Task);
+
+    // NOTE: Hand back what the subtree didn't use, nothing else has been pushed since
+    ResetArenaTo(Arena, (char *)(Builder.Nodes + Builder.NodeCount));
+
+    Job->SubtreeNodes[ItemIndex] = Builder.Nodes;
+    Job->SubtreeNodeCounts[ItemIndex] = Builder.NodeCount;
+}
+
+internal void
+CopyBVHSubtree(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    bvh_subtree_job *Job = (bvh_subtree_job *)UserData;
+    bvh_build_task *Task = &Job->Tasks[ItemIndex];
+    bvh_node *Source = Job->SubtreeNodes[ItemIndex];
+    u32 NodeCount = Job->SubtreeNodeCounts[ItemIndex];
+
+    // NOTE: Local node I > 0 ends up at FirstNode + I - 1
+    u32 Offset = Job->FirstNode[ItemIndex] - 1;
+    for (u32 I = 0; I < NodeCount; ++I)
+    {
+        bvh_node Node = Source[I];
+        if (Node.Count == 0)
+        {
+            Node.LeftFirst += Offset;
+        }
+        Job->Nodes[(I == 0 ? Task->NodeIndex : Offset + I)] = Node;
+    }
+
+    for (u32 I = Task->First; I < Task->First + Task->Count; ++I)
+    {
+        Job->PrimitiveIndices[I] = Job->Primitives[I].Index;
+    }
+}
+
+internal bool
+SplitBVHNodeParallel(bvh_builder *Builder, bvh_build_task *Task, bvh_bin_job *Job, thread_dispatch *Dispatch, bvh_build_task *Children)
+{
+    // NOTE: Same as a BuildBVHNode step, with the binning and the partition spread over the workers.
+    //       Returns false if the node stays a leaf.
+    //       The partition goes through Job->Scratch instead of swapping in place, so the primitives
+    //       on either side come out in a different order, but the sides themselves are the same.
+    u32 ItemCount = (Task->Count + BVH_BIN_ITEM_COUNT - 1) / BVH_BIN_ITEM_COUNT;
+    Job->Primitives = Builder->Primitives + Task->First;
+    Job->Count = Task->Count;
+    Job->CentroidBounds = Task->CentroidBounds;
+    RunParallel(Dispatch, ItemCount, BinPrimitivesItem, Job);
+
+    bvh_bins Bins = Job->ItemBins[0];
+    for (u32 ItemIndex = 1; ItemIndex < ItemCount; ++ItemIndex)
+    {
+        MergeBVHBins(&Bins, &Job->ItemBins[ItemIndex]);
+    }
+
+    if (!ChooseBVHSplit(Task, &Bins, &Job->Split))
+    {
+        return false;
+    }
+
+    if (!Job->Split.Bin)
+    {
+        PartitionBVHNode(Builder, Task, &Job->Split, Children);
+        return true;
+    }
+
+    u32 LeftCount = 0;
+    for (u32 ItemIndex = 0; ItemIndex < ItemCount; ++ItemIndex)
+    {
+        Job->ItemLeftFirst[ItemIndex] = LeftCount;
+        for (u32 BinIndex = 0; BinIndex < Job->Split.Bin; ++BinIndex)
+        {
+            LeftCount += Job->ItemBins[ItemIndex].Count[Job->Split.Axis][BinIndex];
+        }
+    }
+
+    u32 RightAt = LeftCount;
+    for (u32 ItemIndex = 0; ItemIndex < ItemCount; ++ItemIndex)
+    {
+        u32 ItemLeftCount = ((ItemIndex + 1 < ItemCount ? Job->ItemLeftFirst[ItemIndex + 1] : LeftCount) -
+                             Job->ItemLeftFirst[ItemIndex]);
+        Job->ItemRightFirst[ItemIndex] = RightAt;
+        RightAt += MIN(Task->Count - ItemIndex*BVH_BIN_ITEM_COUNT, BVH_BIN_ITEM_COUNT) - ItemLeftCount;
+    }
+
+    RunParallel(Dispatch, ItemCount, ScatterPrimitivesItem, Job);
+    RunParallel(Dispatch, ItemCount, GatherPrimitivesItem, Job);
+
+    for (u32 Side = 0; Side < 2; ++Side)
+    {
+        Children[Side].Bounds = InvertedBounds();
+        Children[Side].CentroidBounds = InvertedBounds();
+        for (u32 ItemIndex = 0; ItemIndex < ItemCount; ++ItemIndex)
+        {
+            Children[Side].Bounds = Union(Children[Side].Bounds, Job->ItemBounds[2*ItemIndex + Side]);
+            Children[Side].CentroidBounds = Union(Children[Side].CentroidBounds, Job->ItemCentroidBounds[2*ItemIndex + Side]);
+        }
+    }
+
+    AllocateBVHChildren(Builder, Task, LeftCount, Children);
+    return true;
+}
+
+internal bvh
+BuildBVHParallel(arena *Arena, arena *TempArena, u32 PrimitiveCount, bvh_build_primitive *Primitives, thread_dispatch *Dispatch)
+{
+    bvh Result = {};
+    ScopedMemory(TempArena)
+    {
+        u32 ThreadCount = Dispatch->ThreadCount + 1;
+        u32 SubtreeCountTarget = BVH_SUBTREES_PER_THREAD*ThreadCount;
+        u32 SubtreeMinCount = MAX(BVH_MIN_SUBTREE_COUNT, PrimitiveCount / SubtreeCountTarget);
+
+        // NOTE: Every split of the top turns one task into two, and nothing gets split once there'd
+        //       be more than TaskCapacity of them, so the top can't have more than 2*TaskCapacity nodes
+        u32 TaskCapacity = 4*SubtreeCountTarget;
+        bvh_build_task *Pending = PushArrayNoClear(TempArena, TaskCapacity, bvh_build_task);
+        bvh_build_task *Subtrees = PushArrayNoClear(TempArena, TaskCapacity, bvh_build_task);
+        u32 PendingCount = 0;
+        u32 SubtreeCount = 0;
+
+        bvh_builder Top = {};
+        Top.Nodes = PushArrayNoClear(TempArena, 2*TaskCapacity, bvh_node);
+        Top.Primitives = Primitives;
+        Top.NodeCount = 1;
+
+        u32 MaxItemCount = (PrimitiveCount + BVH_BIN_ITEM_COUNT - 1) / BVH_BIN_ITEM_COUNT;
+        bvh_bin_job Job = {};
+        Job.Scratch = PushArrayNoClear(TempArena, PrimitiveCount, bvh_build_primitive);
+        Job.ItemBounds = PushArrayNoClear(TempArena, 2*MaxItemCount, aabb);
+        Job.ItemCentroidBounds = PushArrayNoClear(TempArena, 2*MaxItemCount, aabb);
+        Job.ItemLeftFirst = PushArrayNoClear(TempArena, MaxItemCount, u32);
+        Job.ItemRightFirst = PushArrayNoClear(TempArena, MaxItemCount, u32);
+
+        //
+        // NOTE: The root's bounds, in parallel
+        //
+
+        bvh_build_task *Root = &Pending[PendingCount++];
+        ZeroStruct(Root);
+        Root->Count = PrimitiveCount;
+        Root->Bounds = InvertedBounds();
+        Root->CentroidBounds = InvertedBounds();
+
+        Job.Primitives = Primitives;
+        Job.Count = PrimitiveCount;
+        RunParallel(Dispatch, MaxItemCount, BinPrimitivesItem, &Job);
+        for (u32 ItemIndex = 0; ItemIndex < MaxItemCount; ++ItemIndex)
+        {
+            Root->Bounds = Union(Root->Bounds, Job.ItemBounds[ItemIndex]);
+            Root->CentroidBounds = Union(Root->CentroidBounds, Job.ItemCentroidBounds[ItemIndex]);
+        }
+
+        Job.ItemBins = PushArrayNoClear(TempArena, MaxItemCount, bvh_bins);
+
+        //
+        // NOTE: Split the top
+        //
+
+        while (PendingCount)
+        {
+            bvh_build_task Task = Pending[--PendingCount];
+            if ((Task.Count > SubtreeMinCount) && (PendingCount + SubtreeCount + 2 <= TaskCapacity) &&
+                BVHNodeMightSplit(&Top, &Task))
+            {
+                if (SplitBVHNodeParallel(&Top, &Task, &Job, Dispatch, &Pending[PendingCount]))
+                {
+                    PendingCount += 2;
+                    continue;
+                }
+            }
+
+            // NOTE: Anything that isn't split here becomes a subtree, even if that's just a leaf
+            Subtrees[SubtreeCount++] = Task;
+        }
+
+        //
+        // NOTE: Build the subtrees on the workers, the biggest ones first so none of them is left
+        //       running on its own at the end
+        //
+
+        for (u32 I = 1; I < SubtreeCount; ++I)
+        {
+            bvh_build_task Task = Subtrees[I];
+            u32 J = I;
+            for (; (J > 0) && (Subtrees[J - 1].Count < Task.Count); --J)
+            {
+                Subtrees[J] = Subtrees[J - 1];
+            }
+            Subtrees[J] = Task;
+        }
+
+        temporary_memory *ThreadMemory = PushArrayNoClear(TempArena, ThreadCount, temporary_memory);
+        for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+        {
+            ThreadMemory[ThreadIndex] = BeginTemporaryMemory(&Dispatch->ThreadArenas[ThreadIndex]);
+        }
+
+        bvh_subtree_job SubtreeJob = {};
+        SubtreeJob.Primitives = Primitives;
+        SubtreeJob.Tasks = Subtrees;
+        SubtreeJob.ThreadArenas = Dispatch->ThreadArenas;
+        SubtreeJob.SubtreeNodes = PushArrayNoClear(TempArena, SubtreeCount, bvh_node *);
+        SubtreeJob.SubtreeNodeCounts = PushArrayNoClear(TempArena, SubtreeCount, u32);
+        SubtreeJob.FirstNode = PushArrayNoClear(TempArena, SubtreeCount, u32);
+        RunParallel(Dispatch, SubtreeCount, BuildBVHSubtree, &SubtreeJob);
+
+        //
+        // NOTE: Stitch the top and the subtrees together
+        //
+
+        u32 NodeCount = Top.NodeCount;
+        for (u32 I = 0; I < SubtreeCount; ++I)
+        {
+            SubtreeJob.FirstNode[I] = NodeCount;
+            NodeCount += SubtreeJob.SubtreeNodeCounts[I] - 1;
+        }
+
+        Result.NodeCount = NodeCount;
+        Result.Nodes = PushAlignedArrayNoClear(Arena, NodeCount, bvh_node, 64);
+        CopyArray(Top.NodeCount, Top.Nodes, Result.Nodes);
+
+        Result.PrimitiveCount = PrimitiveCount;
+        Result.Primitives = PushArrayNoClear(Arena, PrimitiveCount, u32);
+
+        SubtreeJob.Nodes = Result.Nodes;
+        SubtreeJob.PrimitiveIndices = Result.Primitives;
+        RunParallel(Dispatch, SubtreeCount, CopyBVHSubtree, &SubtreeJob);
+
+        for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+        {
+            EndTemporaryMemory(ThreadMemory[ThreadIndex]);
+        }
+    }
+    return Result;
+}
+
+internal bvh
+BuildBVH(arena *Arena, arena *TempArena, u32 PrimitiveCount, bvh_build_primitive *Primitives, thread_dispatch *Dispatch)
+{
+    // NOTE: Dispatch can be NULL, and small builds don't bother with it either
+    bvh Result = {};
+    if (Dispatch && Dispatch->ThreadCount && (PrimitiveCount >= BVH_PARALLEL_MIN_COUNT))
+    {
+        Result = BuildBVHParallel(Arena, TempArena, PrimitiveCount, Primitives, Dispatch);
+    }
+    else if (PrimitiveCount > 0)
+    {
+        ScopedMemory(TempArena)
+        {
+            bvh_builder Builder = {};
+            Builder.Nodes = PushArrayNoClear(TempArena, 2*PrimitiveCount - 1, bvh_node);
+            Builder.Primitives = Primitives;
+            Builder.NodeCount = 1;
+
+            bvh_build_task Root = {};
+            Root.Count = PrimitiveCount;
+            ComputeBVHBounds(Primitives, PrimitiveCount, &Root.Bounds, &Root.CentroidBounds);
+            BuildBVHNode(&Builder, &Root);
+
+            Result.NodeCount = Builder.NodeCount;
+            Result.Nodes = PushAlignedArrayNoClear(Arena, Result.NodeCount, bvh_node, 64);
+            CopyArray(Result.NodeCount, Builder.Nodes, Result.Nodes);
+
+            Result.PrimitiveCount = PrimitiveCount;
+            Result.Primitives = PushArrayNoClear(Arena, PrimitiveCount, u32);
+            for (usize I = 0; I < PrimitiveCount; ++I)
+            {
+                Result.Primitives[I] = Primitives[I].Index;
+            }
+        }
+    }
+    return Result;
+}
+
+internal inline f32
+BVHNodeCost(bvh_node *Node)
+{
+    // NOTE: The same costs ChooseBVHSplit weighs the areas by
+    f32 Result = (Node->Count ? (f32)Node->Count : BVH_TRAVERSAL_COST);
+    return Result;
+}
+
+internal f32
+GetBVHCost(bvh *BVH, bvh_refit *Refit)
+{
+    f32 Result = 0.0f;
+    f32 RootArea = (BVH->NodeCount ? SurfaceArea(BVH->Nodes[0].Bounds) : 0.0f);
+    if (RootArea > 0.0f)
+    {
+        Result = (f32)(Refit->AreaCost / (f64)RootArea);
+    }
+    return Result;
+}
+
+internal f32
+GetBVHCostRatio(bvh *BVH, bvh_refit *Refit)
+{
+    // NOTE: How much worse the tree is than it was when it was built, 1 for a fresh one
+    f32 Result = 1.0f;
+    if (Refit->BuildCost > 0.0f)
+    {
+        Result = GetBVHCost(BVH, Refit) / Refit->BuildCost;
+    }
+    return Result;
+}
+
+internal bvh_refit
+InitBVHRefit(arena *Arena, bvh *BVH)
+{
+    bvh_refit Result = {};
+    Result.Parents = PushArrayNoClear(Arena, BVH->NodeCount, u32);
+    Result.Dirty = PushArray(Arena, BVH->NodeCount, u8);
+
+    for (u32 NodeIndex = 0; NodeIndex < BVH->NodeCount; ++NodeIndex)
+    {
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        if (!Node->Count)
+        {
+            Result.Parents[Node->LeftFirst] = NodeIndex;
+            Result.Parents[Node->LeftFirst + 1] = NodeIndex;
+        }
+        Result.AreaCost += (f64)BVHNodeCost(Node)*(f64)SurfaceArea(Node->Bounds);
+    }
+
+    Result.BuildCost = GetBVHCost(BVH, &Result);
+    return Result;
+}
+
+internal void
+RefitBVHLeaf(bvh *BVH, bvh_refit *Refit, u32 NodeIndex, aabb Bounds)
+{
+    // NOTE: Only marks the way up to the root, the nodes on it get fixed up by RefitBVH
+    bvh_node *Node = &BVH->Nodes[NodeIndex];
+    Assert(Node->Count);
+
+    Refit->AreaCost += (f64)BVHNodeCost(Node)*((f64)SurfaceArea(Bounds) - (f64)SurfaceArea(Node->Bounds));
+    Node->Bounds = Bounds;
+
+    u32 Index = NodeIndex;
+    while (!Refit->Dirty[Index])
+    {
+        Refit->Dirty[Index] = true;
+        ++Refit->DirtyCount;
+        if (Index == 0)
+        {
+            break;
+        }
+        Index = Refit->Parents[Index];
+    }
+}
+
+internal inline f64
+RefitBVHInterior(bvh *BVH, bvh_node *Node)
+{
+    // NOTE: Returns how much that changed the area cost by
+    aabb Bounds = Union(BVH->Nodes[Node->LeftFirst].Bounds, BVH->Nodes[Node->LeftFirst + 1].Bounds);
+    f64 Result = BVH_TRAVERSAL_COST*((f64)SurfaceArea(Bounds) - (f64)SurfaceArea(Node->Bounds));
+    Node->Bounds = Bounds;
+    return Result;
+}
+
+internal f64
+RefitBVHNode(bvh *BVH, bvh_refit *Refit, u32 NodeIndex)
+{
+    // NOTE: Children first, and only down the dirty paths
+    f64 Result = 0.0;
+    if (Refit->Dirty[NodeIndex])
+    {
+        Refit->Dirty[NodeIndex] = false;
+
+        bvh_node *Node = &BVH->Nodes[NodeIndex];
+        if (!Node->Count)
+        {
+            Result += RefitBVHNode(BVH, Refit, Node->LeftFirst);
+            Result += RefitBVHNode(BVH, Refit, Node->LeftFirst + 1);
+            Result += RefitBVHInterior(BVH, Node);
+        }
+    }
+    return Result;
+}
+
+internal void
+RefitBVHSubtree(void *UserData, u32 ItemIndex, u32 ThreadIndex)
+{
+    bvh_refit_job *Job = (bvh_refit_job *)UserData;
+    Job->AreaCostDeltas[ItemIndex] = RefitBVHNode(Job->BVH, Job->Refit, Job->Roots[ItemIndex]);
+}
+
+internal void
+RefitBVH(arena *TempArena, bvh *BVH, bvh_refit *Refit, thread_dispatch *Dispatch)
+{
+    // NOTE: Brings every node marked by RefitBVHLeaf up to date, bottom up. Dispatch can be NULL,
+    //       and a handful of moved leaves doesn't bother with it either.
+    if (!Refit->DirtyCount)
+    {
+        return;
+    }
+
+    if (Dispatch && Dispatch->ThreadCount && (Refit->DirtyCount >= BVH_PARALLEL_REFIT_MIN_COUNT))
+    {
+        ScopedMemory(TempArena)
+        {
+            // NOTE: Go down the dirty part of the tree a level at a time until there are enough
+            //       subtrees to go around. The nodes that got passed through on the way are refit
+            //       here afterwards, in reverse, so every node comes after its children.
+            u32 TargetCount = BVH_REFIT_SUBTREES_PER_THREAD*(Dispatch->ThreadCount + 1);
+            u32 *Roots = PushArrayNoClear(TempArena, 2*TargetCount, u32);
+            u32 *NextRoots = PushArrayNoClear(TempArena, 2*TargetCount, u32);
+            u32 *Top = PushArrayNoClear(TempArena, BVH_MAX_DEPTH*TargetCount, u32);
+            u32 RootCount = 1;
+            u32 TopCount = 0;
+            Roots[0] = 0;
+
+            for (u32 Depth = 0; (Depth < BVH_MAX_DEPTH) && (RootCount < TargetCount); ++Depth)
+            {
+                u32 NextRootCount = 0;
+                bool Expanded = false;
+                for (u32 RootIndex = 0; RootIndex < RootCount; ++RootIndex)
+                {
+                    u32 NodeIndex = Roots[RootIndex];
+                    bvh_node *Node = &BVH->Nodes[NodeIndex];
+                    if (Node->Count)
+                    {
+                        NextRoots[NextRootCount++] = NodeIndex;
+                    }
+                    else
+                    {
+                        Expanded = true;
+                        Refit->Dirty[NodeIndex] = false;
+                        Top[TopCount++] = NodeIndex;
+                        for (u32 Child = Node->LeftFirst; Child < Node->LeftFirst + 2; ++Child)
+                        {
+                            if (Refit->Dirty[Child])
+                            {
+                                NextRoots[NextRootCount++] = Child;
+                            }
+                        }
+                    }
+                }
+
+                if (!Expanded)
+                {
+                    break;
+                }
+                Swap(Roots, NextRoots);
+                RootCount = NextRootCount;
+            }
+
+            bvh_refit_job Job = {};
+            Job.BVH = BVH;
+            Job.Refit = Refit;
+            Job.Roots = Roots;
+            Job.AreaCostDeltas = PushArrayNoClear(TempArena, RootCount, f64);
+            RunParallel(Dispatch, RootCount, RefitBVHSubtree, &Job);
+
+            for (u32 RootIndex = 0; RootIndex < RootCount; ++RootIndex)
+            {
+                Refit->AreaCost += Job.AreaCostDeltas[RootIndex];
+            }
+            for (u32 TopIndex = TopCount; TopIndex > 0; --TopIndex)
+            {
+                Refit->AreaCost += RefitBVHInterior(BVH, &BVH->Nodes[Top[TopIndex - 1]]);
+            }
+        }
+    }
+    else
+    {
+        Refit->AreaCost += RefitBVHNode(BVH, Refit, 0);
+    }
+
+    Refit->DirtyCount = 0;
+}
+
+internal void
+BVHRebuildThreadProc(void *UserData, platform_semaphore_handle ParentSemaphore)
+{
+    bvh_rebuild *Rebuild = (bvh_rebuild *)UserData;
+    Platform.ReleaseSemaphore(ParentSemaphore, 1, nullptr);
+
+    for (;;)
+    {
+        Platform.WaitOnSemaphore(Rebuild->WakeSemaphore);
+        Assert(Rebuild->State == BVHRebuild_Building);
+
+        Rebuild->Result = BuildBVH(&Rebuild->Arena, &Rebuild->TempArena, Rebuild->PrimitiveCount, Rebuild->Primitives, nullptr);
+        MEMORY_BARRIER;
+        Rebuild->State = BVHRebuild_Done;
+    }
+}
+
+internal void
+StartBVHRebuild(bvh_rebuild *Rebuild, u32 PrimitiveCount, bvh_build_primitive *Primitives)
+{
+    // NOTE: Primitives get copied, the caller can let go of them right away. The thread is only
+    //       started the first time it's needed, most trees never get rebuilt.
+    Assert(Rebuild->State == BVHRebuild_Idle);
+
+    if (!Rebuild->ThreadStarted)
+    {
+        Rebuild->ThreadStarted = true;
+        Rebuild->WakeSemaphore = Platform.CreateSemaphore(0, 1);
+        Platform.CreateThread(BVHRebuildThreadProc, Rebuild);
+    }
+
+    // NOTE: Arena may still hold the tree this one is replacing, but that was handed back by
+    //       FinishBVHRebuild, so by the time anyone starts another rebuild it's done with
+    ClearArena(&Rebuild->Arena);
+    ClearArena(&Rebuild->TempArena);
+    Rebuild->PrimitiveCount = PrimitiveCount;
+    Rebuild->Primitives = PushArrayNoClear(&Rebuild->TempArena, PrimitiveCount, bvh_build_primitive);
+    CopyArray(PrimitiveCount, Primitives, Rebuild->Primitives);
+
+    MEMORY_BARRIER;
+    Rebuild->State = BVHRebuild_Building;
+    MEMORY_BARRIER;
+    Platform.ReleaseSemaphore(Rebuild->WakeSemaphore, 1, nullptr);
+}
+
+internal bool
+FinishBVHRebuild(bvh_rebuild *Rebuild, arena *Arena, bvh *OutBVH)
+{
+    // NOTE: If the rebuild is done, the new tree replaces OutBVH and Arena trades places with the
+    //       one it was built in. Whatever else was in Arena has to be dead by then.
+    bool Result = false;
+    if (Rebuild->State == BVHRebuild_Done)
+    {
+        MEMORY_BARRIER;
+        Swap(*Arena, Rebuild->Arena);
+        *OutBVH = Rebuild->Result;
+        Rebuild->State = BVHRebuild_Idle;
+        Result = true;
+    }
+    return Result;
+}
+
+internal void
+CancelBVHRebuild(bvh_rebuild *Rebuild)
+{
+    // NOTE: For when the tree gets rebuilt some other way, whatever the thread comes up with is stale
+    while (Rebuild->State == BVHRebuild_Building)
+    {
+        _mm_pause();
+    }
+    Rebuild->State = BVHRebuild_Idle;
+}
+
+internal always_inline f32
+BVH8Scale(s8 Exponent)
+{
+    f32 Result = FloatFromBits((u32)(Exponent + 127) << 23);
+    return Result;
+}
+
+internal void
+QuantizeChildBounds(bvh8_node *Node, u32 ChildCount, aabb *ChildBounds)
+{
+    aabb Bounds = InvertedBounds();
+    for (u32 Child = 0; Child < ChildCount; ++Child)
+    {
+        Bounds = Union(Bounds, ChildBounds[Child]);
+    }
+
+    Node->Origin = Bounds.Min;
+    Node->ChildCount = (u8)ChildCount;
+
+    u8 *QMin[3] = { Node->QMinX, Node->QMinY, Node->QMinZ };
+    u8 *QMax[3] = { Node->QMaxX, Node->QMaxY, Node->QMaxZ };
+    for (int Axis = 0; Axis < 3; ++Axis)
+    {
+        // NOTE: The finest power of two spacing that still gets from Min to Max in 255 steps
+        f32 Origin = Bounds.Min[Axis];
+        f32 Extent = Bounds.Max[Axis] - Origin;
+        int Exponent = -126;
+        if (Extent > 0.0f)
+        {
+            frexpf(Extent / 255.0f, &Exponent);
+            Exponent = MAX(Exponent, -126);
+        }
+        while ((Exponent < 127) && (Origin + 255.0f*BVH8Scale((s8)Exponent) < Bounds.Max[Axis]))
+        {
+            ++Exponent;
+        }
+        Node->Exponent[Axis] = (s8)Exponent;
+        f32 Scale = BVH8Scale((s8)Exponent);
+
+        for (u32 Child = 0; Child < BVH8_WIDTH; ++Child)
+        {
+            s32 Lo = 0;
+            s32 Hi = 0;
+            if (Child < ChildCount)
+            {
+                // NOTE: Round outwards, and then make sure of it, since the divides can round either way
+                f32 Min = ChildBounds[Child].Min[Axis];
+                f32 Max = ChildBounds[Child].Max[Axis];
+                Lo = MAX(0, MIN((s32)FloorF((Min - Origin) / Scale), 255));
+                Hi = MAX(0, MIN((s32)CeilF((Max - Origin) / Scale), 255));
+                while ((Lo > 0) && (Origin + (f32)Lo*Scale > Min))
+                {
+                    --Lo;
+                }
+                while ((Hi < 255) && (Origin + (f32)Hi*Scale < Max))
+                {
+                    ++Hi;
+                }
+            }
+            QMin[Axis][Child] = (u8)Lo;
+            QMax[Axis][Child] = (u8)Hi;
+        }
+    }
+}
+
+internal u32
+PushBVH8Nodes(bvh8_collapser *Collapser, u32 Count)
+{
+    Assert(Collapser->NodeCount + Count <= Collapser->NodeCapacity);
+    u32 Result = Collapser->NodeCount;
+    Collapser->NodeCount += Count;
+    return Result;
+}
+
+internal inline bool
+IsBVH8Interior(bvh8_collapse_child *Child)
+{
+    // NOTE: Leaves bigger than a child slot can hold (only the depth limit makes those) turn into
+    //       a node of smaller leaves that all share the original bounds
+    bool Result = (!Child->Count || (Child->Count > BVH8_MAX_LEAF_COUNT));
+    return Result;
+}
+
+internal bvh8_collapse_child
+BVH8CollapseChild(bvh *Binary, u32 BinaryIndex)
+{
+    // NOTE: Binary subtrees with only a few primitives left are taken as one leaf. The builder
+    //       partitions in place, so they cover a single run of Binary->Primitives, from the first
+    //       primitive of their leftmost leaf to the last one of their rightmost.
+    bvh_node *Nodes = Binary->Nodes;
+    bvh_node *Node = &Nodes[BinaryIndex];
+
+    bvh8_collapse_child Result = {};
+    Result.Bounds = Node->Bounds;
+    Result.BinaryIndex = BinaryIndex;
+    Result.First = Node->LeftFirst;
+    Result.Count = Node->Count;
+    if (!Node->Count)
+    {
+        bvh_node *Leftmost = Node;
+        while (!Leftmost->Count)
+        {
+            Leftmost = &Nodes[Leftmost->LeftFirst];
+        }
+        bvh_node *Rightmost = Node;
+        while (!Rightmost->Count)
+        {
+            Rightmost = &Nodes[Rightmost->LeftFirst + 1];
+        }
+
+        u32 Count = Rightmost->LeftFirst + Rightmost->Count - Leftmost->LeftFirst;
+        if (Count <= BVH8_COLLAPSE_LEAF_COUNT)
+        {
+            Result.First = Leftmost->LeftFirst;
+            Result.Count = Count;
+        }
+    }
+    return Result;
+}
+
+internal u32
+GatherBVH8Children(bvh8_collapser *Collapser, bvh8_collapse_child *Source, bvh8_collapse_child *Children)
+{
+    u32 ChildCount = 0;
+    if (Source->Count)
+    {
+        u32 ChunkCount = MIN(BVH8_WIDTH, (Source->Count + BVH8_MAX_LEAF_COUNT - 1) / BVH8_MAX_LEAF_COUNT);
+        u32 ChunkSize = (Source->Count + ChunkCount - 1) / ChunkCount;
+        for (u32 At = 0; At < Source->Count; At += ChunkSize)
+        {
+            bvh8_collapse_child *Child = &Children[ChildCount++];
+            Child->Bounds = Source->Bounds;
+            Child->BinaryIndex = Source->BinaryIndex;
+            Child->First = Source->First + At;
+            Child->Count = MIN(ChunkSize, Source->Count - At);
+        }
+    }
+    else
+    {
+        bvh *Binary = Collapser->Binary;
+        u32 Left = Binary->Nodes[Source->BinaryIndex].LeftFirst;
+        Children[ChildCount++] = BVH8CollapseChild(Binary, Left);
+        Children[ChildCount++] = BVH8CollapseChild(Binary, Left + 1);
+
+        // NOTE: Keep opening up the interior child with the largest surface area until the node is full
+        while (ChildCount < BVH8_WIDTH)
+        {
+            s32 BestChild = -1;
+            f32 BestArea = -1.0f;
+            for (u32 Child = 0; Child < ChildCount; ++Child)
+            {
+                if (!Children[Child].Count && (SurfaceArea(Children[Child].Bounds) > BestArea))
+                {
+                    BestChild = (s32)Child;
+                    BestArea = SurfaceArea(Children[Child].Bounds);
+                }
+            }
+
+            if (BestChild < 0)
+            {
+                break;
+            }
+
+            u32 Opened = Binary->Nodes[Children[BestChild].BinaryIndex].LeftFirst;
+            Children[BestChild] = BVH8CollapseChild(Binary, Opened);
+            Children[ChildCount++] = BVH8CollapseChild(Binary, Opened + 1);
+        }
+    }
+    return ChildCount;
+}
+
+internal void
+CollapseBVH8Node(bvh8_collapser *Collapser, u32 NodeIndex, bvh8_collapse_child *Source)
+{
+    // NOTE: Source is either a binary interior node (Count is zero) or a run of primitives
+    bvh8_collapse_child Children[BVH8_WIDTH];
+    u32 ChildCount = GatherBVH8Children(Collapser, Source, Children);
+
+    // NOTE: All the interior children get their nodes in one go, and the leaves' primitives are
+    //       appended in slot order, so both can be found again from a single base index
+    u32 InteriorCount = 0;
+    aabb ChildBounds[BVH8_WIDTH];
+    for (u32 Child = 0; Child < ChildCount; ++Child)
+    {
+        ChildBounds[Child] = Children[Child].Bounds;
+        InteriorCount += IsBVH8Interior(&Children[Child]);
+    }
+
+    bvh8_node *Node = &Collapser->Nodes[NodeIndex];
+    QuantizeChildBounds(Node, ChildCount, ChildBounds);
+    Node->ChildBase = PushBVH8Nodes(Collapser, InteriorCount);
+    Node->TriangleBase = Collapser->PrimitiveCount;
+
+    u32 InteriorAt = 0;
+    for (u32 Child = 0; Child < BVH8_WIDTH; ++Child)
+    {
+        u8 Meta = BVH8_META_EMPTY;
+        if (Child < ChildCount)
+        {
+            bvh8_collapse_child *Leaf = &Children[Child];
+            if (IsBVH8Interior(Leaf))
+            {
+                Meta = (u8)(BVH8_META_INTERIOR|InteriorAt++);
+            }
+            else
+            {
+                Meta = (u8)(BVH8_META_LEAF|(Leaf->Count - 1));
+                CopyArray(Leaf->Count, Collapser->Binary->Primitives + Leaf->First,
+                          Collapser->Primitives + Collapser->PrimitiveCount);
+                Collapser->PrimitiveCount += Leaf->Count;
+            }
+        }
+        Node->Meta[Child] = Meta;
+    }
+
+    u32 ChildBase = Node->ChildBase;
+    InteriorAt = 0;
+    for (u32 Child = 0; Child < ChildCount; ++Child)
+    {
+        if (IsBVH8Interior(&Children[Child]))
+        {
+            CollapseBVH8Node(Collapser, ChildBase + InteriorAt++, &Children[Child]);
+        }
+    }
+}
+
+internal bvh8
+CollapseBVH8(arena *Arena, bvh *Binary)
+{
+    // NOTE: Every node but the ones split off oversized leaves uses up at least one binary interior
+    //       node, so the capacity below is never exceeded, and whatever's left over is given back.
+    //       The primitives are put back into Binary->Primitives in the order the wide leaves
+    //       reference them, which leaves the binary BVH's own leaves pointing at the wrong ones.
+    bvh8 Result = {};
+    if (Binary->NodeCount)
+    {
+        Assert(Binary->PrimitiveCount <= BVH8_LEAF_FIRST_MASK);
+
+        bvh8_collapser Collapser = {};
+        Collapser.Binary = Binary;
+        Collapser.NodeCapacity = Binary->NodeCount + Binary->PrimitiveCount / BVH8_MAX_LEAF_COUNT + 1;
+        Collapser.Nodes = PushAlignedArrayNoClear(Arena, Collapser.NodeCapacity, bvh8_node, 64);
+        Collapser.Primitives = PushArrayNoClear(Arena, Binary->PrimitiveCount, u32);
+
+        // NOTE: The root goes through the same path as an oversized leaf if the binary root is a leaf,
+        //       which just makes it a node with a single leaf when it fits
+        bvh_node *BinaryRoot = &Binary->Nodes[0];
+        bvh8_collapse_child Root = { BinaryRoot->Bounds, 0, BinaryRoot->LeftFirst, BinaryRoot->Count };
+        CollapseBVH8Node(&Collapser, PushBVH8Nodes(&Collapser, 1), &Root);
+
+        Assert(Collapser.PrimitiveCount == Binary->PrimitiveCount);
+        CopyArray(Binary->PrimitiveCount, Collapser.Primitives, Binary->Primitives);
+
+        ResetArenaTo(Arena, (char *)(Collapser.Nodes + Collapser.NodeCount));
+        Result.NodeCount = Collapser.NodeCount;
+        Result.Nodes = Collapser.Nodes;
+    }
+    return Result;
+}
+
+internal always_inline u32
+RayIntersectBVH8Node(vec3 RayP, vec3 RayInvD, bvh8_node *Node, f32 tMax, f32 *OutNear)
+{
+    // NOTE: Slab tests all the children at once. Returns a bit for every child the ray enters
+    //       before tMax, and writes the entry distances to OutNear.
+    lane_f32 Zero = LaneF32(0.0f);
+    lane_f32 tMaxLane = LaneF32(tMax);
+
+    lane_f32 ScaleX = LaneF32(BVH8Scale(Node->Exponent[0]));
+    lane_f32 ScaleY = LaneF32(BVH8Scale(Node->Exponent[1]));
+    lane_f32 ScaleZ = LaneF32(BVH8Scale(Node->Exponent[2]));
+    lane_f32 RelX = LaneF32(Node->Origin.X - RayP.X);
+    lane_f32 RelY = LaneF32(Node->Origin.Y - RayP.Y);
+    lane_f32 RelZ = LaneF32(Node->Origin.Z - RayP.Z);
+    lane_f32 InvDX = LaneF32(RayInvD.X);
+    lane_f32 InvDY = LaneF32(RayInvD.Y);
+    lane_f32 InvDZ = LaneF32(RayInvD.Z);
+
+    u32 Result = 0;
+    for (u32 Sub = 0; Sub < BVH8_WIDTH / LANE_WIDTH; ++Sub)
+    {
+        u32 Offset = Sub*LANE_WIDTH;
+        lane_f32 t0X = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMinX + Offset)), ScaleX, RelX)*InvDX;
+        lane_f32 t0Y = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMinY + Offset)), ScaleY, RelY)*InvDY;
+        lane_f32 t0Z = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMinZ + Offset)), ScaleZ, RelZ)*InvDZ;
+        lane_f32 t1X = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMaxX + Offset)), ScaleX, RelX)*InvDX;
+        lane_f32 t1Y = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMaxY + Offset)), ScaleY, RelY)*InvDY;
+        lane_f32 t1Z = MulAdd(ConvertToF32(LoadU8ToU32(Node->QMaxZ + Offset)), ScaleZ, RelZ)*InvDZ;
+
+        lane_f32 tNear = Max(Max(Zero, Min(t0X, t1X)), Max(Min(t0Y, t1Y), Min(t0Z, t1Z)));
+        lane_f32 tFar  = Min(Min(tMaxLane, Max(t0X, t1X)), Min(Max(t0Y, t1Y), Max(t0Z, t1Z)));
+
+        StoreF32(OutNear + Offset, tNear);
+        Result |= MoveMask(tNear <= tFar) << Offset;
+    }
+
+    Result &= (1u << Node->ChildCount) - 1;
+    return Result;
+}
@@ -0,0 +1,257 @@
+#ifndef RAY_BVH_H
+#define RAY_BVH_H
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_COUNT 8
+#define BVH_MAX_DEPTH 64
+
+// NOTE: With a dispatcher, BuildBVH splits the top of the tree on the main thread, binning each
+//       node in parallel, until the nodes are down to about BVH_SUBTREES_PER_THREAD per thread.
+//       Those subtrees are then built by the workers, each on its own.
+#define BVH_PARALLEL_MIN_COUNT 65536
+#define BVH_BIN_ITEM_COUNT 32768
+#define BVH_SUBTREES_PER_THREAD 8
+#define BVH_MIN_SUBTREE_COUNT 4096
+
+struct aabb
+{
+    vec3 Min;
+    vec3 Max;
+};
+
+struct bvh_node
+{
+    aabb Bounds;
+    // NOTE: For interior nodes (Count == 0), LeftFirst is the index of the left child and the
+    //       right child sits directly after it. For leaves, LeftFirst indexes bvh::Primitives.
+    u32 LeftFirst;
+    u32 Count;
+};
+
+struct bvh
+{
+    u32 NodeCount;
+    bvh_node *Nodes;
+
+    u32 PrimitiveCount;
+    u32 *Primitives;
+};
+
+struct bvh_build_primitive
+{
+    aabb Bounds;
+    vec3 Centroid;
+    u32 Index;
+};
+
+// NOTE: Per axis bins. Min and Max are 4 wide so BinPrimitives can grow them with SSE, their fourth
+//       lane is junk.
+struct bvh_bins
+{
+    __m128 Min[3][BVH_BIN_COUNT];
+    __m128 Max[3][BVH_BIN_COUNT];
+    u32 Count[3][BVH_BIN_COUNT];
+};
+
+// NOTE: A node that still needs building. Its bounds and the bounds of its centroids come from
+//       the partition of its parent, so nobody has to go over its primitives just to get them.
+struct bvh_build_task
+{
+    u32 NodeIndex;
+    u32 First;
+    u32 Count;
+    u32 Depth;
+    aabb Bounds;
+    aabb CentroidBounds;
+};
+
+struct bvh_builder
+{
+    u32 NodeCount;
+    bvh_node *Nodes;
+    bvh_build_primitive *Primitives;
+};
+
+// NOTE: Where to split a node: BVH_BIN_COUNT bins along Axis, with Bin the first one on the right.
+//       Bin is 0 when there's no plane to split on, and then the node gets cut down the middle.
+struct bvh_split
+{
+    u32 Axis;
+    u32 Bin;
+};
+
+// NOTE: The top of a parallel build, one node at a time. Items are BVH_BIN_ITEM_COUNT primitives
+//       each, and the Item arrays have one entry per item (two for the bounds, one per side).
+struct bvh_bin_job
+{
+    bvh_build_primitive *Primitives;
+    u32 Count;
+    aabb CentroidBounds;
+
+    bvh_bins *ItemBins;
+    aabb *ItemBounds;
+    aabb *ItemCentroidBounds;
+
+    bvh_split Split;
+    u32 *ItemLeftFirst;
+    u32 *ItemRightFirst;
+    bvh_build_primitive *Scratch;
+};
+
+struct bvh_subtree_job
+{
+    bvh_build_primitive *Primitives;
+    bvh_build_task *Tasks;
+    arena *ThreadArenas;
+
+    // NOTE: Each subtree is built with its root at 0 in its own node array. When it's copied into
+    //       the final one, the root goes in the slot its parent left for it (Tasks[].NodeIndex)
+    //       and the rest of it goes at FirstNode.
+    bvh_node **SubtreeNodes;
+    u32 *SubtreeNodeCounts;
+    u32 *FirstNode;
+
+    bvh_node *Nodes;
+    u32 *PrimitiveIndices;
+};
+
+//
+// NOTE: Refitting. When primitives move, the leaves they're in get new bounds and everything above
+//       them is grown or shrunk to match, while the topology stays what the last build made it. That
+//       gets worse the further things move from where they were built, so the SAH cost is kept up to
+//       date as nodes change, and once it's BVH_REBUILD_COST_RATIO times what the build came out at,
+//       the tree should be built again.
+//
+
+#define BVH_REBUILD_COST_RATIO 1.5f
+#define BVH_PARALLEL_REFIT_MIN_COUNT 4096
+#define BVH_REFIT_SUBTREES_PER_THREAD 4
+
+struct bvh_refit
+{
+    // NOTE: Parents[0] is unused, the root has no parent
+    u32 *Parents;
+
+    // NOTE: Set on the leaves that got new bounds and on everything above them, until RefitBVH
+    u8 *Dirty;
+    u32 DirtyCount;
+
+    // NOTE: Sum of node cost times surface area, without the division by the area of the root.
+    //       BuildCost is the full SAH cost of the tree right after it was built.
+    f64 AreaCost;
+    f32 BuildCost;
+};
+
+// NOTE: Refits the dirty nodes under each of Roots in parallel. The part of the tree above them is
+//       refit on the calling thread afterwards.
+struct bvh_refit_job
+{
+    bvh *BVH;
+    bvh_refit *Refit;
+    u32 *Roots;
+    f64 *AreaCostDeltas;
+};
+
+enum bvh_rebuild_state
+{
+    BVHRebuild_Idle,
+    BVHRebuild_Building,
+    BVHRebuild_Done,
+};
+
+// NOTE: Builds a BVH on a thread of its own, so a tree that has been refit too many times can be
+//       replaced without stalling whoever is using it. The finished tree lives in Arena, and gets
+//       handed over by swapping arenas with the old one (FinishBVHRebuild).
+struct bvh_rebuild
+{
+    volatile u32 State;
+    b32 ThreadStarted;
+    platform_semaphore_handle WakeSemaphore;
+
+    arena Arena;
+    arena TempArena;
+    u32 PrimitiveCount;
+    bvh_build_primitive *Primitives;
+    bvh Result;
+};
+
+//
+// NOTE: Wide BVH with quantized bounds, collapsed from a binary one
+//
+
+#define BVH8_WIDTH 8
+#define BVH8_MAX_LEAF_COUNT 16
+#define BVH8_STACK_SIZE (BVH8_WIDTH*BVH_MAX_DEPTH)
+
+// NOTE: Binary subtrees this small become a single leaf instead of a node of their own. Most
+//       binary leaves only hold a triangle or two, and without this the bottom of the wide tree
+//       fills up with nodes that only use two or three of their slots.
+#define BVH8_COLLAPSE_LEAF_COUNT 4
+
+// NOTE: One byte of metadata per child slot. The interior children of a node sit next to each other
+//       from ChildBase on, and the triangles of its leaves next to each other from TriangleBase on,
+//       both in slot order. So an interior child only keeps its rank among the interior children, and
+//       a leaf only its count minus one; where a leaf starts is the sum of the counts of the leaves
+//       in the slots before it.
+#define BVH8_META_EMPTY 0x00
+#define BVH8_META_INTERIOR 0x40
+#define BVH8_META_LEAF 0x80
+#define BVH8_META_VALUE_MASK 0x3f
+
+// NOTE: Traversal stack entries are either a node (the index) or a leaf (BVH8_LEAF_BIT, the count minus
+//       one above BVH8_LEAF_COUNT_SHIFT, and the index of its first primitive below that)
+#define BVH8_LEAF_BIT 0x80000000u
+#define BVH8_LEAF_COUNT_SHIFT 27
+#define BVH8_LEAF_FIRST_MASK ((1u << BVH8_LEAF_COUNT_SHIFT) - 1)
+
+// NOTE: Child bounds are stored in 8 bits per plane, on a grid that starts at Origin and whose
+//       spacing along each axis is 2^Exponent. They're rounded outwards, so a quantized box always
+//       contains the real one. Slots from ChildCount on are unused. 80 bytes in all.
+// SOURCE: Ylitie, Karras, Laine, "Efficient Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs", HPG 2017
+struct alignas(16) bvh8_node
+{
+    vec3 Origin;
+    s8 Exponent[3];
+    u8 ChildCount;
+
+    u32 ChildBase;
+    u32 TriangleBase;
+    u8 Meta[BVH8_WIDTH];
+
+    u8 QMinX[BVH8_WIDTH];
+    u8 QMinY[BVH8_WIDTH];
+    u8 QMinZ[BVH8_WIDTH];
+    u8 QMaxX[BVH8_WIDTH];
+    u8 QMaxY[BVH8_WIDTH];
+    u8 QMaxZ[BVH8_WIDTH];
+};
+
+// NOTE: The root is node 0, and it's always an interior node even if all it has is one leaf
+struct bvh8
+{
+    u32 NodeCount;
+    bvh8_node *Nodes;
+};
+
+// NOTE: A child slot while collapsing. Either the binary interior node BinaryIndex (Count is zero),
+//       or Count primitives of bvh::Primitives from First on, which become a leaf if they fit.
+struct bvh8_collapse_child
+{
+    aabb Bounds;
+    u32 BinaryIndex;
+    u32 First;
+    u32 Count;
+};
+
+struct bvh8_collapser
+{
+    bvh *Binary;
+    u32 NodeCount;
+    u32 NodeCapacity;
+    bvh8_node *Nodes;
+
+    u32 PrimitiveCount;
+    u32 *Primitives;
+};
+
+#endif /* RAY_BVH_H */
@@ -0,0 +1,236 @@
+#ifndef RAY_FAST_MATH_H
+#define RAY_FAST_MATH_H
+
+//
+// NOTE: Polynomial sin/cos, atan2 and asin plus a refined rsqrt, for the sampling and IBL lookup code
+//       that used to go through libm once per ray. Every function comes in a scalar form and a lane
+//       form, and the lane form is SSE or AVX2 depending on LANE_WIDTH. Lane groups use atan2 and asin
+//       for IBL lookups and rsqrt for camera rays. Sampling draws one direction at a time, so it calls
+//       the scalar sincos. Both forms use the same reduction and coefficients, and without FMA they
+//       agree bit for bit. AVX2 builds have FMA, so MulAdd fuses there (and the
+//       compiler is free to contract the scalar forms too), and the two can be a rounding step apart.
+//
+//       Worst errors against double precision libm over the whole domain (SinCos over [-64pi, 64pi]).
+//       They hold for both forms with and without FMA, and -test checks all of them:
+//         FastSinCos          9.2e-8 absolute
+//         FastATan2           2.8e-7 absolute (radians), atan2(0, 0) is 0
+//         FastASin            1.7e-7 absolute (radians), inputs outside [-1, 1] are clamped
+//         FastRcpSquareRoot   2.5e-7 relative
+//
+// SOURCE: The coefficients are the single precision ones from Cephes (sinf.c, atanf.c, asinf.c)
+//
+
+#define FAST_SINCOS_MAX_ERROR 9.2e-8
+#define FAST_ATAN2_MAX_ERROR  2.8e-7
+#define FAST_ASIN_MAX_ERROR   1.7e-7
+#define FAST_RSQRT_MAX_ERROR  2.5e-7
+
+// NOTE: Pi/2 split three ways (Cody-Waite), so Quadrant*PI_OVER_2_HI is exact for any quadrant we'll see
+#define FAST_PI_OVER_2_HI  1.5703125f
+#define FAST_PI_OVER_2_MID 4.837512969970703125e-4f
+#define FAST_PI_OVER_2_LO  7.54978995489188216e-8f
+
+#define FAST_SIN_C0 -1.9515295891e-4f
+#define FAST_SIN_C1  8.3321608736e-3f
+#define FAST_SIN_C2 -1.6666654611e-1f
+
+#define FAST_COS_C0  2.443315711809948e-5f
+#define FAST_COS_C1 -1.388731625493765e-3f
+#define FAST_COS_C2  4.166664568298827e-2f
+
+#define FAST_TAN_PI_OVER_8 0.414213562373095f
+#define FAST_ATAN_C0  8.05374449538e-2f
+#define FAST_ATAN_C1 -1.38776856032e-1f
+#define FAST_ATAN_C2  1.99777106478e-1f
+#define FAST_ATAN_C3 -3.33329491539e-1f
+
+#define FAST_ASIN_C0 4.2163199048e-2f
+#define FAST_ASIN_C1 2.4181311049e-2f
+#define FAST_ASIN_C2 4.5470025998e-2f
+#define FAST_ASIN_C3 7.4953002686e-2f
+#define FAST_ASIN_C4 1.6666752422e-1f
+
+//
+// NOTE: Scalar
+//
+
+internal always_inline void
+FastSinCosF(f32 A, f32 *OutSin, f32 *OutCos)
+{
+    // NOTE: Reduce to R in [-pi/4, pi/4] around the nearest multiple of pi/2, evaluate both polynomials
+    //       and let the quadrant pick which one is the sine and what the signs are
+    s32 Quadrant = _mm_cvtss_si32(_mm_set_ss(A*(2.0f / Pi32)));
+    f32 Q = (f32)Quadrant;
+    f32 R = A - Q*FAST_PI_OVER_2_HI;
+    R = R - Q*FAST_PI_OVER_2_MID;
+    R = R - Q*FAST_PI_OVER_2_LO;
+    f32 R2 = R*R;
+
+    f32 S = R + R*R2*(FAST_SIN_C2 + R2*(FAST_SIN_C1 + R2*FAST_SIN_C0));
+    f32 C = 1.0f - 0.5f*R2 + R2*R2*(FAST_COS_C2 + R2*(FAST_COS_C1 + R2*FAST_COS_C0));
+
+    // NOTE: Done with masks so there's no branch, the quadrant of a random azimuth is anyone's guess
+    __m128 Odd = _mm_castsi128_ps(_mm_cvtsi32_si128(-(Quadrant & 1)));
+    __m128 SinSign = _mm_castsi128_ps(_mm_cvtsi32_si128((s32)(((u32)Quadrant & 2) << 30)));
+    __m128 CosSign = _mm_castsi128_ps(_mm_cvtsi32_si128((s32)(((u32)(Quadrant + 1) & 2) << 30)));
+    __m128 SinR = _mm_set_ss(S);
+    __m128 CosR = _mm_set_ss(C);
+    *OutSin = _mm_cvtss_f32(_mm_xor_ps(_mm_blendv_ps(SinR, CosR, Odd), SinSign));
+    *OutCos = _mm_cvtss_f32(_mm_xor_ps(_mm_blendv_ps(CosR, SinR, Odd), CosSign));
+}
+
+internal always_inline f32
+FastATan2F(f32 Y, f32 X)
+{
+    f32 AbsY = AbsoluteValueF(Y);
+    f32 AbsX = AbsoluteValueF(X);
+    f32 A = MinF(AbsX, AbsY) / MaxF(MaxF(AbsX, AbsY), 1.0e-30f);
+
+    // NOTE: Past tan(pi/8) the polynomial runs on (A - 1)/(A + 1) instead, with pi/4 added back on
+    f32 Offset = 0.0f;
+    if (A > FAST_TAN_PI_OVER_8)
+    {
+        A = (A - 1.0f) / (A + 1.0f);
+        Offset = 0.25f*Pi32;
+    }
+    f32 Z = A*A;
+    f32 Result = Offset + (A + A*Z*(FAST_ATAN_C3 + Z*(FAST_ATAN_C2 + Z*(FAST_ATAN_C1 + Z*FAST_ATAN_C0))));
+
+    if (AbsY > AbsX) Result = 0.5f*Pi32 - Result;
+    if (X < 0.0f)    Result = Pi32 - Result;
+    Result = CopySignF(Result, Y);
+    return Result;
+}
+
+internal always_inline f32
+FastASinF(f32 A)
+{
+    // NOTE: Near +-1 the series converges too slowly, so there it goes through
+    //       asin(x) = pi/2 - 2 asin(sqrt((1 - x)/2)) instead
+    f32 AbsA = MinF(AbsoluteValueF(A), 1.0f);
+    bool Big = (AbsA > 0.5f);
+    f32 Z = (Big ? 0.5f*(1.0f - AbsA) : AbsA*AbsA);
+    f32 S = (Big ? SquareRootF(Z) : AbsA);
+
+    f32 P = S + S*Z*(FAST_ASIN_C4 + Z*(FAST_ASIN_C3 + Z*(FAST_ASIN_C2 + Z*(FAST_ASIN_C1 + Z*FAST_ASIN_C0))));
+    f32 Result = (Big ? 0.5f*Pi32 - 2.0f*P : P);
+    Result = CopySignF(Result, A);
+    return Result;
+}
+
+internal always_inline f32
+FastRcpSquareRootF(f32 A)
+{
+    // NOTE: rsqrtss is good to about 12 bits, one Newton-Raphson step brings that to about 23
+    f32 Estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(A)));
+    f32 Result = Estimate*(1.5f - 0.5f*A*Estimate*Estimate);
+    return Result;
+}
+
+internal always_inline vec3
+NormalizeFast(vec3 A)
+{
+    // NOTE: HandmadeMath's FastNormalize is a plain 1/sqrt with HANDMADE_MATH_NO_SSE
+    vec3 Result = FastRcpSquareRootF(Dot(A, A))*A;
+    return Result;
+}
+
+//
+// NOTE: Lanes
+//
+
+internal always_inline lane_f32
+Abs(lane_f32 A)
+{
+    lane_f32 Result = CastToF32(AndNot(CastToU32(A), LaneU32(0x80000000)));
+    return Result;
+}
+
+internal always_inline lane_f32
+CopySign(lane_f32 ValueOf, lane_f32 SignOf)
+{
+    lane_u32 SignMask = LaneU32(0x80000000);
+    lane_f32 Result = CastToF32(AndNot(CastToU32(ValueOf), SignMask) | (CastToU32(SignOf) & SignMask));
+    return Result;
+}
+
+internal always_inline void
+FastSinCos(lane_f32 A, lane_f32 *OutSin, lane_f32 *OutCos)
+{
+    lane_u32 Quadrant = RoundToU32(A*LaneF32(2.0f / Pi32));
+    lane_f32 Q = ConvertToF32(Quadrant);
+    lane_f32 R = A - Q*LaneF32(FAST_PI_OVER_2_HI);
+    R = R - Q*LaneF32(FAST_PI_OVER_2_MID);
+    R = R - Q*LaneF32(FAST_PI_OVER_2_LO);
+    lane_f32 R2 = R*R;
+
+    lane_f32 S = MulAdd(R2, MulAdd(R2, LaneF32(FAST_SIN_C0), LaneF32(FAST_SIN_C1)), LaneF32(FAST_SIN_C2));
+    S = MulAdd(R*R2, S, R);
+    lane_f32 C = MulAdd(R2, MulAdd(R2, LaneF32(FAST_COS_C0), LaneF32(FAST_COS_C1)), LaneF32(FAST_COS_C2));
+    C = MulAdd(R2*R2, C, LaneF32(1.0f) - LaneF32(0.5f)*R2);
+
+    lane_u32 One = LaneU32(1);
+    lane_u32 Odd = ((Quadrant & One) == One);
+    lane_u32 SinSign = (Quadrant & LaneU32(2)) << 30;
+    lane_u32 CosSign = ((Quadrant + One) & LaneU32(2)) << 30;
+    *OutSin = CastToF32(CastToU32(Select(Odd, C, S)) ^ SinSign);
+    *OutCos = CastToF32(CastToU32(Select(Odd, S, C)) ^ CosSign);
+}
+
+internal always_inline lane_f32
+FastATan2(lane_f32 Y, lane_f32 X)
+{
+    lane_f32 AbsY = Abs(Y);
+    lane_f32 AbsX = Abs(X);
+    lane_f32 A = Min(AbsX, AbsY) / Max(Max(AbsX, AbsY), LaneF32(1.0e-30f));
+
+    lane_u32 Big = (A > LaneF32(FAST_TAN_PI_OVER_8));
+    A = Select(Big, (A - LaneF32(1.0f)) / (A + LaneF32(1.0f)), A);
+    lane_f32 Offset = Select(Big, LaneF32(0.25f*Pi32), LaneF32(0.0f));
+    lane_f32 Z = A*A;
+
+    lane_f32 P = MulAdd(Z, MulAdd(Z, MulAdd(Z, LaneF32(FAST_ATAN_C0), LaneF32(FAST_ATAN_C1)), LaneF32(FAST_ATAN_C2)), LaneF32(FAST_ATAN_C3));
+    lane_f32 Result = Offset + MulAdd(A*Z, P, A);
+
+    Result = Select(AbsY > AbsX, LaneF32(0.5f*Pi32) - Result, Result);
+    Result = Select(X < LaneF32(0.0f), LaneF32(Pi32) - Result, Result);
+    Result = CopySign(Result, Y);
+    return Result;
+}
+
+internal always_inline lane_f32
+FastASin(lane_f32 A)
+{
+    lane_f32 AbsA = Min(Abs(A), LaneF32(1.0f));
+    lane_u32 Big = (AbsA > LaneF32(0.5f));
+    lane_f32 Z = Select(Big, LaneF32(0.5f)*(LaneF32(1.0f) - AbsA), AbsA*AbsA);
+    lane_f32 S = Select(Big, SquareRoot(Z), AbsA);
+
+    lane_f32 P = MulAdd(Z, LaneF32(FAST_ASIN_C0), LaneF32(FAST_ASIN_C1));
+    P = MulAdd(Z, P, LaneF32(FAST_ASIN_C2));
+    P = MulAdd(Z, P, LaneF32(FAST_ASIN_C3));
+    P = MulAdd(Z, P, LaneF32(FAST_ASIN_C4));
+    P = MulAdd(S*Z, P, S);
+
+    lane_f32 Result = Select(Big, LaneF32(0.5f*Pi32) - LaneF32(2.0f)*P, P);
+    Result = CopySign(Result, A);
+    return Result;
+}
+
+internal always_inline lane_f32
+FastRcpSquareRoot(lane_f32 A)
+{
+    lane_f32 Estimate = ApproxRcpSquareRoot(A);
+    lane_f32 Result = Estimate*(LaneF32(1.5f) - LaneF32(0.5f)*A*Estimate*Estimate);
+    return Result;
+}
+
+internal always_inline lane_v3
+NormalizeFast(lane_v3 A)
+{
+    // NOTE: Summed in the same order as the scalar Dot, so this matches NormalizeFast(vec3) without FMA
+    lane_v3 Result = FastRcpSquareRoot(A.X*A.X + A.Y*A.Y + A.Z*A.Z)*A;
+    return Result;
+}
+
+#endif /* RAY_FAST_MATH_H */
@@ -29,6 +29,34 @@ ASinF(float A)
     return Result;
 }
 
+static inline float
+AbsoluteValueF(float A)
+{
+    f32 Result = fabsf(A);
+    return Result;
+}
+
+static inline float
+FloorF(float A)
+{
+    f32 Result = floorf(A);
+    return Result;
+}
+
+static inline float
+CeilF(float A)
+{
+    f32 Result = ceilf(A);
+    return Result;
+}
+
+static inline float
+Log2F(float A)
+{
+    f32 Result = log2f(A);
+    return Result;
+}
+
 static inline float
 MinF(float A, float B)
 {
@@ -41,6 +69,24 @@ MaxF(float A, float B)
     return A > B ? A : B;
 }
 
+static inline vec3
+Min(vec3 A, vec3 B)
+{
+    return Vec3(MinF(A.X, B.X), MinF(A.Y, B.Y), MinF(A.Z, B.Z));
+}
+
+static inline vec3
+Max(vec3 A, vec3 B)
+{
+    return Vec3(MaxF(A.X, B.X), MaxF(A.Y, B.Y), MaxF(A.Z, B.Z));
+}
+
+static inline vec3
+Lerp(vec3 A, float t, vec3 B)
+{
+    return (1.0f - t)*A + t*B;
+}
+
 static inline vec3
 Reflect(vec3 D, vec3 N)
 {
@@ -51,15 +97,12 @@ static inline float
 CopySignF(float ValueOf, float SignOf)
 {
 #if 1
-#if 0
+    // NOTE: This has to be a bitwise select. blendv picks whole lanes by the top bit of the mask,
+    //       which would just hand back ValueOf.
     __m128 SignMask = _mm_castsi128_ps(_mm_set1_epi32(1 << 31));
     __m128 NotSignMask = _mm_castsi128_ps(_mm_set1_epi32(~(1 << 31)));
     float Result = _mm_cvtss_f32(_mm_or_ps(_mm_and_ps(SignMask, _mm_set_ss(SignOf)),
                                            _mm_and_ps(NotSignMask, _mm_set_ss(ValueOf))));
-#else
-    __m128 SignMask = _mm_castsi128_ps(_mm_set1_epi32(1 << 31));
-    float Result = _mm_cvtss_f32(_mm_blendv_ps(_mm_set_ss(SignOf), _mm_set_ss(ValueOf), SignMask));
-#endif
 #else
     int SignMask = 1 << 31;
     int SignAsBits = *(int *)&SignOf;
@@ -92,10 +135,73 @@ Max3(vec3 A)
     return MaxF(A.X, MaxF(A.Y, A.Z));
 }
 
+static inline float
+Min3(vec3 A)
+{
+    return MinF(A.X, MinF(A.Y, A.Z));
+}
+
 static inline float
 SquareF(float X)
 {
     return X*X;
 }
 
+// NOTE: X, Y and Z are the columns of the linear part, P is the translation
+struct affine_transform
+{
+    vec3 X;
+    vec3 Y;
+    vec3 Z;
+    vec3 P;
+};
+
+static inline affine_transform
+IdentityTransform(void)
+{
+    affine_transform Result = { Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1), Vec3(0, 0, 0) };
+    return Result;
+}
+
+static inline vec3
+TransformVector(affine_transform *T, vec3 V)
+{
+    return V.X*T->X + V.Y*T->Y + V.Z*T->Z;
+}
+
+static inline vec3
+TransformPoint(affine_transform *T, vec3 P)
+{
+    return TransformVector(T, P) + T->P;
+}
+
+static inline vec3
+TransformNormal(affine_transform *InverseT, vec3 N)
+{
+    // NOTE: Normals go through the inverse transpose, so this takes the inverse of the transform
+    //       the normal is being moved by. The result isn't normalized.
+    return Vec3(Dot(InverseT->X, N), Dot(InverseT->Y, N), Dot(InverseT->Z, N));
+}
+
+static inline affine_transform
+Inverse(affine_transform T)
+{
+    // NOTE: The rows of the inverse linear part are the cross products of pairs of columns
+    //       over the determinant
+    vec3 Row0 = Cross(T.Y, T.Z);
+    vec3 Row1 = Cross(T.Z, T.X);
+    vec3 Row2 = Cross(T.X, T.Y);
+    float RcpDet = 1.0f / Dot(T.X, Row0);
+    Row0 *= RcpDet;
+    Row1 *= RcpDet;
+    Row2 *= RcpDet;
+
+    affine_transform Result;
+    Result.X = Vec3(Row0.X, Row1.X, Row2.X);
+    Result.Y = Vec3(Row0.Y, Row1.Y, Row2.Y);
+    Result.Z = Vec3(Row0.Z, Row1.Z, Row2.Z);
+    Result.P = -TransformVector(&Result, T.P);
+    return Result;
+}
+
 #endif /* RAY_HANDMADE_MATH_H */
@@ -0,0 +1,237 @@
+#ifndef RAY_LANE_H
+#define RAY_LANE_H
+
+//
+// NOTE: Lane-wide SIMD wrappers. The width follows the target: 8 lanes when built with -mavx2,
+//       4 lanes with the baseline -msse4.1. Masks are lane_u32 with all bits set in true lanes.
+//
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANE_WIDTH 8
+#else
+#define LANE_WIDTH 4
+#endif
+
+#if LANE_WIDTH == 8
+
+struct lane_f32
+{
+    __m256 V;
+};
+
+struct lane_u32
+{
+    __m256i V;
+};
+
+internal always_inline lane_f32 LaneF32(f32 A)              { return { _mm256_set1_ps(A) }; }
+internal always_inline lane_u32 LaneU32(u32 A)              { return { _mm256_set1_epi32((int)A) }; }
+internal always_inline lane_f32 LoadF32(const f32 *A)       { return { _mm256_loadu_ps(A) }; }
+internal always_inline lane_u32 LoadU32(const u32 *A)       { return { _mm256_loadu_si256((const __m256i *)A) }; }
+internal always_inline lane_u32 LoadU8ToU32(const u8 *A)    { return { _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)A)) }; }
+internal always_inline void     StoreF32(f32 *Dest, lane_f32 A) { _mm256_storeu_ps(Dest, A.V); }
+internal always_inline void     StoreU32(u32 *Dest, lane_u32 A) { _mm256_storeu_si256((__m256i *)Dest, A.V); }
+
+internal always_inline lane_f32 operator+(lane_f32 A, lane_f32 B) { return { _mm256_add_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator-(lane_f32 A, lane_f32 B) { return { _mm256_sub_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator*(lane_f32 A, lane_f32 B) { return { _mm256_mul_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator/(lane_f32 A, lane_f32 B) { return { _mm256_div_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator-(lane_f32 A)             { return { _mm256_xor_ps(A.V, _mm256_set1_ps(-0.0f)) }; }
+
+internal always_inline lane_f32
+MulAdd(lane_f32 A, lane_f32 B, lane_f32 C)
+{
+#if defined(__FMA__)
+    return { _mm256_fmadd_ps(A.V, B.V, C.V) };
+#else
+    return { _mm256_add_ps(_mm256_mul_ps(A.V, B.V), C.V) };
+#endif
+}
+
+internal always_inline lane_f32 Min(lane_f32 A, lane_f32 B) { return { _mm256_min_ps(A.V, B.V) }; }
+internal always_inline lane_f32 Max(lane_f32 A, lane_f32 B) { return { _mm256_max_ps(A.V, B.V) }; }
+internal always_inline lane_f32 SquareRoot(lane_f32 A)      { return { _mm256_sqrt_ps(A.V) }; }
+internal always_inline lane_f32 ApproxRcpSquareRoot(lane_f32 A) { return { _mm256_rsqrt_ps(A.V) }; }
+
+internal always_inline lane_u32 operator< (lane_f32 A, lane_f32 B) { return { _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_LT_OQ)) }; }
+internal always_inline lane_u32 operator<=(lane_f32 A, lane_f32 B) { return { _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_LE_OQ)) }; }
+internal always_inline lane_u32 operator> (lane_f32 A, lane_f32 B) { return { _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_GT_OQ)) }; }
+internal always_inline lane_u32 operator>=(lane_f32 A, lane_f32 B) { return { _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_GE_OQ)) }; }
+internal always_inline lane_u32 operator==(lane_f32 A, lane_f32 B) { return { _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_EQ_OQ)) }; }
+
+internal always_inline lane_u32 operator+(lane_u32 A, lane_u32 B) { return { _mm256_add_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator-(lane_u32 A, lane_u32 B) { return { _mm256_sub_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator*(lane_u32 A, lane_u32 B) { return { _mm256_mullo_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator&(lane_u32 A, lane_u32 B) { return { _mm256_and_si256(A.V, B.V) }; }
+internal always_inline lane_u32 operator|(lane_u32 A, lane_u32 B) { return { _mm256_or_si256(A.V, B.V) }; }
+internal always_inline lane_u32 operator^(lane_u32 A, lane_u32 B) { return { _mm256_xor_si256(A.V, B.V) }; }
+internal always_inline lane_u32 operator<<(lane_u32 A, int Shift) { return { _mm256_slli_epi32(A.V, Shift) }; }
+internal always_inline lane_u32 operator>>(lane_u32 A, int Shift) { return { _mm256_srli_epi32(A.V, Shift) }; }
+internal always_inline lane_u32 operator==(lane_u32 A, lane_u32 B) { return { _mm256_cmpeq_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 AndNot(lane_u32 A, lane_u32 B)    { return { _mm256_andnot_si256(B.V, A.V) }; }
+
+internal always_inline lane_f32 Select(lane_u32 Mask, lane_f32 A, lane_f32 B) { return { _mm256_blendv_ps(B.V, A.V, _mm256_castsi256_ps(Mask.V)) }; }
+internal always_inline lane_u32 Select(lane_u32 Mask, lane_u32 A, lane_u32 B) { return { _mm256_blendv_epi8(B.V, A.V, Mask.V) }; }
+
+internal always_inline u32      MoveMask(lane_u32 Mask)        { return (u32)_mm256_movemask_ps(_mm256_castsi256_ps(Mask.V)); }
+internal always_inline lane_f32 ConvertToF32(lane_u32 A)       { return { _mm256_cvtepi32_ps(A.V) }; }
+internal always_inline lane_u32 ConvertToU32(lane_f32 A)       { return { _mm256_cvttps_epi32(A.V) }; }
+internal always_inline lane_u32 RoundToU32(lane_f32 A)         { return { _mm256_cvtps_epi32(A.V) }; }
+internal always_inline lane_f32 CastToF32(lane_u32 A)          { return { _mm256_castsi256_ps(A.V) }; }
+internal always_inline lane_u32 CastToU32(lane_f32 A)          { return { _mm256_castps_si256(A.V) }; }
+
+internal always_inline f32
+HorizontalMin(lane_f32 A)
+{
+    __m128 M = _mm_min_ps(_mm256_castps256_ps128(A.V), _mm256_extractf128_ps(A.V, 1));
+    M = _mm_min_ps(M, _mm_shuffle_ps(M, M, _MM_SHUFFLE(1, 0, 3, 2)));
+    M = _mm_min_ps(M, _mm_shuffle_ps(M, M, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(M);
+}
+
+#else
+
+struct lane_f32
+{
+    __m128 V;
+};
+
+struct lane_u32
+{
+    __m128i V;
+};
+
+internal always_inline lane_f32 LaneF32(f32 A)              { return { _mm_set1_ps(A) }; }
+internal always_inline lane_u32 LaneU32(u32 A)              { return { _mm_set1_epi32((int)A) }; }
+internal always_inline lane_f32 LoadF32(const f32 *A)       { return { _mm_loadu_ps(A) }; }
+internal always_inline lane_u32 LoadU32(const u32 *A)       { return { _mm_loadu_si128((const __m128i *)A) }; }
+internal always_inline lane_u32 LoadU8ToU32(const u8 *A)    { return { _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const s32 *)A)) }; }
+internal always_inline void     StoreF32(f32 *Dest, lane_f32 A) { _mm_storeu_ps(Dest, A.V); }
+internal always_inline void     StoreU32(u32 *Dest, lane_u32 A) { _mm_storeu_si128((__m128i *)Dest, A.V); }
+
+internal always_inline lane_f32 operator+(lane_f32 A, lane_f32 B) { return { _mm_add_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator-(lane_f32 A, lane_f32 B) { return { _mm_sub_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator*(lane_f32 A, lane_f32 B) { return { _mm_mul_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator/(lane_f32 A, lane_f32 B) { return { _mm_div_ps(A.V, B.V) }; }
+internal always_inline lane_f32 operator-(lane_f32 A)             { return { _mm_xor_ps(A.V, _mm_set1_ps(-0.0f)) }; }
+
+internal always_inline lane_f32
+MulAdd(lane_f32 A, lane_f32 B, lane_f32 C)
+{
+    return { _mm_add_ps(_mm_mul_ps(A.V, B.V), C.V) };
+}
+
+internal always_inline lane_f32 Min(lane_f32 A, lane_f32 B) { return { _mm_min_ps(A.V, B.V) }; }
+internal always_inline lane_f32 Max(lane_f32 A, lane_f32 B) { return { _mm_max_ps(A.V, B.V) }; }
+internal always_inline lane_f32 SquareRoot(lane_f32 A)      { return { _mm_sqrt_ps(A.V) }; }
+internal always_inline lane_f32 ApproxRcpSquareRoot(lane_f32 A) { return { _mm_rsqrt_ps(A.V) }; }
+
+internal always_inline lane_u32 operator< (lane_f32 A, lane_f32 B) { return { _mm_castps_si128(_mm_cmplt_ps(A.V, B.V)) }; }
+internal always_inline lane_u32 operator<=(lane_f32 A, lane_f32 B) { return { _mm_castps_si128(_mm_cmple_ps(A.V, B.V)) }; }
+internal always_inline lane_u32 operator> (lane_f32 A, lane_f32 B) { return { _mm_castps_si128(_mm_cmpgt_ps(A.V, B.V)) }; }
+internal always_inline lane_u32 operator>=(lane_f32 A, lane_f32 B) { return { _mm_castps_si128(_mm_cmpge_ps(A.V, B.V)) }; }
+internal always_inline lane_u32 operator==(lane_f32 A, lane_f32 B) { return { _mm_castps_si128(_mm_cmpeq_ps(A.V, B.V)) }; }
+
+internal always_inline lane_u32 operator+(lane_u32 A, lane_u32 B) { return { _mm_add_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator-(lane_u32 A, lane_u32 B) { return { _mm_sub_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator*(lane_u32 A, lane_u32 B) { return { _mm_mullo_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 operator&(lane_u32 A, lane_u32 B) { return { _mm_and_si128(A.V, B.V) }; }
+internal always_inline lane_u32 operator|(lane_u32 A, lane_u32 B) { return { _mm_or_si128(A.V, B.V) }; }
+internal always_inline lane_u32 operator^(lane_u32 A, lane_u32 B) { return { _mm_xor_si128(A.V, B.V) }; }
+internal always_inline lane_u32 operator<<(lane_u32 A, int Shift) { return { _mm_slli_epi32(A.V, Shift) }; }
+internal always_inline lane_u32 operator>>(lane_u32 A, int Shift) { return { _mm_srli_epi32(A.V, Shift) }; }
+internal always_inline lane_u32 operator==(lane_u32 A, lane_u32 B) { return { _mm_cmpeq_epi32(A.V, B.V) }; }
+internal always_inline lane_u32 AndNot(lane_u32 A, lane_u32 B)    { return { _mm_andnot_si128(B.V, A.V) }; }
+
+internal always_inline lane_f32 Select(lane_u32 Mask, lane_f32 A, lane_f32 B) { return { _mm_blendv_ps(B.V, A.V, _mm_castsi128_ps(Mask.V)) }; }
+internal always_inline lane_u32 Select(lane_u32 Mask, lane_u32 A, lane_u32 B) { return { _mm_blendv_epi8(B.V, A.V, Mask.V) }; }
+
+internal always_inline u32      MoveMask(lane_u32 Mask)        { return (u32)_mm_movemask_ps(_mm_castsi128_ps(Mask.V)); }
+internal always_inline lane_f32 ConvertToF32(lane_u32 A)       { return { _mm_cvtepi32_ps(A.V) }; }
+internal always_inline lane_u32 ConvertToU32(lane_f32 A)       { return { _mm_cvttps_epi32(A.V) }; }
+internal always_inline lane_u32 RoundToU32(lane_f32 A)         { return { _mm_cvtps_epi32(A.V) }; }
+internal always_inline lane_f32 CastToF32(lane_u32 A)          { return { _mm_castsi128_ps(A.V) }; }
+internal always_inline lane_u32 CastToU32(lane_f32 A)          { return { _mm_castps_si128(A.V) }; }
+
+internal always_inline f32
+HorizontalMin(lane_f32 A)
+{
+    __m128 M = A.V;
+    M = _mm_min_ps(M, _mm_shuffle_ps(M, M, _MM_SHUFFLE(1, 0, 3, 2)));
+    M = _mm_min_ps(M, _mm_shuffle_ps(M, M, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(M);
+}
+
+#endif
+
+internal always_inline lane_u32 operator&(lane_u32 A, lane_f32 B) { return A & CastToU32(B); }
+internal always_inline lane_f32 operator+=(lane_f32 &A, lane_f32 B) { return A = A + B; }
+internal always_inline lane_f32 operator-=(lane_f32 &A, lane_f32 B) { return A = A - B; }
+internal always_inline lane_f32 operator*=(lane_f32 &A, lane_f32 B) { return A = A * B; }
+internal always_inline lane_u32 operator&=(lane_u32 &A, lane_u32 B) { return A = A & B; }
+internal always_inline lane_u32 operator|=(lane_u32 &A, lane_u32 B) { return A = A | B; }
+internal always_inline lane_u32 operator^=(lane_u32 &A, lane_u32 B) { return A = A ^ B; }
+
+internal always_inline bool MaskIsZeroed(lane_u32 Mask) { return MoveMask(Mask) == 0; }
+internal always_inline bool MaskIsFull(lane_u32 Mask)   { return MoveMask(Mask) == ((1u << LANE_WIDTH) - 1); }
+
+internal always_inline f32
+ExtractF32(lane_f32 A, u32 Lane)
+{
+    f32 Values[LANE_WIDTH];
+    StoreF32(Values, A);
+    return Values[Lane];
+}
+
+internal always_inline u32
+ExtractU32(lane_u32 A, u32 Lane)
+{
+    u32 Values[LANE_WIDTH];
+    StoreU32(Values, A);
+    return Values[Lane];
+}
+
+//
+// NOTE: Lane Vectors
+//
+
+struct lane_v3
+{
+    lane_f32 X, Y, Z;
+};
+
+internal always_inline lane_v3
+LaneV3(vec3 A)
+{
+    lane_v3 Result = { LaneF32(A.X), LaneF32(A.Y), LaneF32(A.Z) };
+    return Result;
+}
+
+internal always_inline lane_v3
+LaneV3(lane_f32 X, lane_f32 Y, lane_f32 Z)
+{
+    lane_v3 Result = { X, Y, Z };
+    return Result;
+}
+
+internal always_inline lane_v3 operator+(lane_v3 A, lane_v3 B)  { return { A.X + B.X, A.Y + B.Y, A.Z + B.Z }; }
+internal always_inline lane_v3 operator-(lane_v3 A, lane_v3 B)  { return { A.X - B.X, A.Y - B.Y, A.Z - B.Z }; }
+internal always_inline lane_v3 operator*(lane_v3 A, lane_v3 B)  { return { A.X*B.X, A.Y*B.Y, A.Z*B.Z }; }
+internal always_inline lane_v3 operator*(lane_f32 A, lane_v3 B) { return { A*B.X, A*B.Y, A*B.Z }; }
+
+internal always_inline lane_f32
+Dot(lane_v3 A, lane_v3 B)
+{
+    lane_f32 Result = MulAdd(A.X, B.X, MulAdd(A.Y, B.Y, A.Z*B.Z));
+    return Result;
+}
+
+internal always_inline lane_v3
+Select(lane_u32 Mask, lane_v3 A, lane_v3 B)
+{
+    lane_v3 Result = { Select(Mask, A.X, B.X), Select(Mask, A.Y, B.Y), Select(Mask, A.Z, B.Z) };
+    return Result;
+}
+
+#endif /* RAY_LANE_H */
@@ -0,0 +1,62 @@
+internal void
+WorkOnParallelJob(parallel_job *Job, u32 ThreadIndex)
+{
+    for (;;)
+    {
+        u32 ItemIndex = AtomicAddU32(&Job->NextItem, 1);
+        if (ItemIndex >= Job->ItemCount)
+        {
+            break;
+        }
+
+        Job->Proc(Job->UserData, ItemIndex, ThreadIndex);
+        AtomicAddU32(&Job->FinishedItemCount, 1);
+    }
+}
+
+internal void
+RunParallel(thread_dispatch *Dispatch, u32 ItemCount, parallel_job_proc *Proc, void *UserData)
+{
+    // NOTE: Calls Proc for every item on the workers and the calling thread, and returns once all
+    //       of them are done. Without a dispatcher it all happens right here, as thread 0.
+    if (!Dispatch || !Dispatch->ThreadCount)
+    {
+        for (u32 ItemIndex = 0; ItemIndex < ItemCount; ++ItemIndex)
+        {
+            Proc(UserData, ItemIndex, 0);
+        }
+        return;
+    }
+
+    Assert(!Dispatch->PassRunning);
+    Assert(!Dispatch->JobPending);
+
+    parallel_job *Job = &Dispatch->Job;
+    Job->Proc = Proc;
+    Job->UserData = UserData;
+    Job->ItemCount = ItemCount;
+    Job->NextItem = 0;
+    Job->FinishedItemCount = 0;
+    MEMORY_BARRIER;
+    Dispatch->JobPending = true;
+    MEMORY_BARRIER;
+
+    for (u32 ThreadIndex = 0; ThreadIndex < Dispatch->ThreadCount; ++ThreadIndex)
+    {
+        Platform.ReleaseSemaphore(Dispatch->WakeSemaphores[ThreadIndex], 1, nullptr);
+    }
+
+    WorkOnParallelJob(Job, Dispatch->ThreadCount);
+    while (Job->FinishedItemCount != ItemCount)
+    {
+        _mm_pause();
+    }
+
+    // NOTE: The exchange is a full barrier, so a worker either sees JobPending cleared or gets
+    //       counted in JobWorkerCount before we stop waiting on it.
+    AtomicCompareExchangeU32(&Dispatch->JobPending, true, false);
+    while (Dispatch->JobWorkerCount)
+    {
+        _mm_pause();
+    }
+}
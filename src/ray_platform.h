@@ -199,6 +199,14 @@ enum
     MemFlag_NoLeakCheck = 0x1,
 };
 
+// NOTE: ModifiedTime is in whatever units the platform counts in. It's only ever compared for
+//       equality against an earlier value from the same machine.
+struct platform_file_info
+{
+    u64 Size;
+    u64 ModifiedTime;
+};
+
 typedef struct platform_api
 {
     void *(*Reserve)(usize Size, u32 Flags, const char *Tag);
@@ -207,10 +215,15 @@ typedef struct platform_api
     void (*Deallocate)(void *Pointer);
     string_u8 (*ReadEntireFile)(arena *Arena, const char *FileName);
     bool (*WriteEntireFile)(const char *FileName, string_u8 Data);
+    // NOTE: Mapped files are read only, and unlike ReadEntireFile there's no terminating zero
+    string_u8 (*MapFile)(const char *FileName);
+    void (*UnmapFile)(string_u8 File);
+    bool (*GetFileInfo)(const char *FileName, platform_file_info *Info);
     platform_thread_handle (*CreateThread)(platform_thread_proc Proc, void *UserData);
     platform_semaphore_handle (*CreateSemaphore)(int InitialCount, int MaxCount);
     void (*WaitOnSemaphore)(platform_semaphore_handle Handle);
     void (*ReleaseSemaphore)(platform_semaphore_handle Handle, int Count, int *PreviousCount);
+    f64 (*GetSeconds)(void);
     usize PageSize;
     u32 LogicalCoreCount;
 } platform_api;
@@ -393,6 +406,14 @@ typedef struct app_input
     f32 FrameTime;
     b32 ExitRequested; 
     b32 CaptureCursor;
+
+    // NOTE: Set by batch renderers that want exactly this many passes, 0 for no limit
+    u32 TargetPassCount;
+
+    // NOTE: Written by the app, so batch renderers know when they're done
+    u32 FinishedPassCount;
+    b32 Converged;
+
     s32 ClientMouseX;
     s32 ClientMouseY;
     s32 MouseDeltaX;
@@ -410,6 +431,8 @@ typedef struct app_init_params
     const char *WindowTitle;
     int WindowX, WindowY;
     int WindowW, WindowH;
+    // NOTE: Filled in by the platform layer from the command line
+    const char *MeshFileName;
 } app_init_params;
 
 typedef struct app_render_commands
@@ -419,11 +442,21 @@ typedef struct app_render_commands
     char *CommandBuffer;
 } app_render_commands;
 
+typedef struct app_benchmark_params
+{
+    u32 W, H;
+    u32 SampleCount;
+    const char *OutputFileName;
+} app_benchmark_params;
+
 typedef struct app_links
 {
     void (*AppInit)(app_init_params *Params);
     void (*AppTick)(platform_api PlatformAPI, app_input *Input, app_imagebuffer *ImageBuffer, app_render_commands *RenderCommands);
-    void (*AppExit)(void);
+    void (*AppExit)(app_input *Input);
+    int (*AppBenchmark)(platform_api PlatformAPI, app_benchmark_params *Params);
+    int (*AppTest)(platform_api PlatformAPI);
+    bool (*AppExportTrace)(const char *FileName);
 } app_links;
 
 app_links AppLinks(void);
@@ -458,6 +491,19 @@ AtomicAddS64(volatile s64 *Dest, s64 Value) {
     return Result;
 }
 
+// NOTE: These return the value Dest held before the exchange, which equals Expected if it went through
+internal inline u32
+AtomicCompareExchangeU32(volatile u32 *Dest, u32 Expected, u32 Desired) {
+    __atomic_compare_exchange_n(Dest, &Expected, Desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return Expected;
+}
+
+internal inline u64
+AtomicCompareExchangeU64(volatile u64 *Dest, u64 Expected, u64 Desired) {
+    __atomic_compare_exchange_n(Dest, &Expected, Desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return Expected;
+}
+
 typedef struct ticket_mutex
 {
     volatile u32 Ticket;
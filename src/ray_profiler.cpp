@@ -0,0 +1,107 @@
+internal always_inline u64
+ReadClock(void)
+{
+    u64 Result = __rdtsc();
+    return Result;
+}
+
+internal void
+InitProfiler(profiler *Profiler, arena *Arena, u32 RingCount)
+{
+    Profiler->StartClock = ReadClock();
+    Profiler->StartSeconds = Platform.GetSeconds();
+    Profiler->RingCount = RingCount;
+    Profiler->Rings = PushAlignedArray(Arena, RingCount, profile_ring, 64);
+}
+
+internal always_inline void
+RecordProfileEvent(profile_ring *Ring, profile_event_type Type, u32 Data, u64 BeginClock, u64 EndClock)
+{
+    u32 WriteCount = Ring->WriteCount;
+
+    profile_event *Event = &Ring->Events[WriteCount % PROFILE_RING_SIZE];
+    Event->BeginClock = BeginClock;
+    Event->EndClock = EndClock;
+    Event->Type = Type;
+    Event->Data = Data;
+
+    MEMORY_BARRIER;
+    Ring->WriteCount = WriteCount + 1;
+}
+
+internal bool
+ExportChromeTrace(profiler *Profiler, arena *TempArena, const char *FileName)
+{
+    // NOTE: Writes the contents of the rings in the chrome://tracing (and Perfetto) trace event format.
+    //       The rings aren't locked, so the newest event of a thread that's busy writing can come
+    //       out torn. That's fine for what this is for.
+    local_persist const char *EventNames[ProfileEvent_COUNT] =
+    {
+        "Tile",
+        "Pass",
+        "Wait",
+        "Dispatch",
+    };
+
+    bool Result = false;
+
+    f64 SecondsElapsed = Platform.GetSeconds() - Profiler->StartSeconds;
+    u64 ClocksElapsed = ReadClock() - Profiler->StartClock;
+    f64 MicrosecondsPerClock = (ClocksElapsed ? 1.0e6*SecondsElapsed / (f64)ClocksElapsed : 0.0);
+
+    ScopedMemory(TempArena)
+    {
+        usize EventCount = 0;
+        for (u32 RingIndex = 0; RingIndex < Profiler->RingCount; ++RingIndex)
+        {
+            EventCount += MIN(Profiler->Rings[RingIndex].WriteCount, PROFILE_RING_SIZE);
+        }
+
+        usize Capacity = 256*(EventCount + Profiler->RingCount + 1);
+        usize At = 0;
+        char *Json = PushArrayNoClear(TempArena, Capacity, char);
+
+#define AppendJson(...) At += MIN((usize)snprintf(Json + At, Capacity - At, __VA_ARGS__), Capacity - At - 1)
+
+        AppendJson("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+        bool First = true;
+        for (u32 RingIndex = 0; RingIndex < Profiler->RingCount; ++RingIndex)
+        {
+            // NOTE: The last ring belongs to the main thread
+            bool IsMainThread = (RingIndex == Profiler->RingCount - 1);
+            AppendJson("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                       (First ? "" : ",\n"), RingIndex, (IsMainThread ? "Main" : "Worker"), RingIndex);
+            First = false;
+
+            profile_ring *Ring = &Profiler->Rings[RingIndex];
+            u32 WriteCount = Ring->WriteCount;
+            MEMORY_BARRIER;
+
+            u32 ReadCount = MIN(WriteCount, PROFILE_RING_SIZE);
+            for (u32 ReadIndex = WriteCount - ReadCount; ReadIndex != WriteCount; ++ReadIndex)
+            {
+                profile_event *Event = &Ring->Events[ReadIndex % PROFILE_RING_SIZE];
+                if ((Event->Type >= ProfileEvent_COUNT) ||
+                    (Event->BeginClock < Profiler->StartClock) ||
+                    (Event->EndClock < Event->BeginClock))
+                {
+                    continue;
+                }
+
+                f64 Timestamp = MicrosecondsPerClock*(f64)(Event->BeginClock - Profiler->StartClock);
+                f64 Duration = MicrosecondsPerClock*(f64)(Event->EndClock - Event->BeginClock);
+                AppendJson(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"data\":%u}}",
+                           EventNames[Event->Type], RingIndex, Timestamp, Duration, Event->Data);
+            }
+        }
+
+        AppendJson("\n]}\n");
+
+#undef AppendJson
+
+        Result = Platform.WriteEntireFile(FileName, string_u8 { .Count = At, .Data = (u8 *)Json });
+    }
+
+    return Result;
+}
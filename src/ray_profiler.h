@@ -0,0 +1,46 @@
+#ifndef RAY_PROFILER_H
+#define RAY_PROFILER_H
+
+#ifndef _WIN32
+#include <x86intrin.h>
+#endif
+
+enum profile_event_type
+{
+    ProfileEvent_Tile,
+    ProfileEvent_Pass,
+    ProfileEvent_Wait,
+    ProfileEvent_Dispatch,
+    ProfileEvent_COUNT,
+};
+
+struct profile_event
+{
+    u64 BeginClock;
+    u64 EndClock;
+    u32 Type;
+    u32 Data;
+};
+
+#define PROFILE_RING_SIZE 4096
+
+// NOTE: Each thread writes only to its own ring, and only ever moves WriteCount forward, so
+//       recording an event is a couple of stores. Old events get overwritten once it wraps.
+struct alignas(64) profile_ring
+{
+    volatile u32 WriteCount;
+    profile_event Events[PROFILE_RING_SIZE];
+};
+
+struct profiler
+{
+    // NOTE: The clock is the raw timestamp counter. The start clock and start time are there to
+    //       work out its frequency when exporting.
+    u64 StartClock;
+    f64 StartSeconds;
+
+    u32 RingCount;
+    profile_ring *Rings;
+};
+
+#endif /* RAY_PROFILER_H */
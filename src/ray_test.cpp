@@ -0,0 +1,800 @@
+//
+// NOTE: Test mode. Checks what can be checked without looking at a picture, against references that
+//       don't share any code with what's being checked. Every check prints one line, and the exit
+//       code says whether all of them passed, so this can run unattended next to the benchmark.
+//
+
+struct test_state
+{
+    u32 CheckCount;
+    u32 FailCount;
+};
+
+internal void
+ReportCheck(test_state *State, bool Passed, const char *Format, ...)
+{
+    ++State->CheckCount;
+    if (!Passed)
+    {
+        ++State->FailCount;
+    }
+
+    char Line[256];
+    va_list Args;
+    va_start(Args, Format);
+    vsnprintf(Line, sizeof(Line), Format, Args);
+    va_end(Args);
+
+    printf("%-6s %s\n", (Passed ? "ok" : "FAILED"), Line);
+}
+
+internal void
+ReportErrorBound(test_state *State, const char *Name, f64 MaxError, f64 Bound, f32 WorstInput)
+{
+    ReportCheck(State, (MaxError <= Bound), "%-28s max error %.3g, bound %.3g (worst at %.9g)", Name, MaxError, Bound, (f64)WorstInput);
+}
+
+internal void
+ReportLaneMismatches(test_state *State, const char *Name, u32 MismatchCount, u32 Count)
+{
+    // NOTE: See ray_fast_math.h, with FMA the lane forms are allowed to round differently
+#if defined(__FMA__)
+    ReportCheck(State, true, "%-28s %u of %u differ from scalar (FMA build, not required to match)", Name, MismatchCount, Count);
+#else
+    ReportCheck(State, (MismatchCount == 0), "%-28s %u of %u differ from scalar", Name, MismatchCount, Count);
+#endif
+}
+
+//
+// NOTE: Fast math, swept over the domains the header comment of ray_fast_math.h gives bounds for
+//
+
+#define TEST_SWEEP_COUNT (1 << 22)
+
+internal void
+TestFastSinCos(test_state *State)
+{
+    f64 MaxError = 0.0;
+    f64 MaxLaneError = 0.0;
+    f32 WorstInput = 0.0f;
+    f32 WorstLaneInput = 0.0f;
+    u32 MismatchCount = 0;
+    for (u32 First = 0; First < TEST_SWEEP_COUNT; First += LANE_WIDTH)
+    {
+        f32 A[LANE_WIDTH], LaneSin[LANE_WIDTH], LaneCos[LANE_WIDTH];
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            A[Lane] = (f32)(-64.0*Pi64 + 128.0*Pi64*((f64)(First + Lane) + 0.5) / (f64)TEST_SWEEP_COUNT);
+        }
+        lane_f32 SinResult, CosResult;
+        FastSinCos(LoadF32(A), &SinResult, &CosResult);
+        StoreF32(LaneSin, SinResult);
+        StoreF32(LaneCos, CosResult);
+
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            f64 ExpectedSin = sin((f64)A[Lane]);
+            f64 ExpectedCos = cos((f64)A[Lane]);
+            f32 Sin, Cos;
+            FastSinCosF(A[Lane], &Sin, &Cos);
+
+            f64 Error = MAX(fabs((f64)Sin - ExpectedSin), fabs((f64)Cos - ExpectedCos));
+            f64 LaneError = MAX(fabs((f64)LaneSin[Lane] - ExpectedSin), fabs((f64)LaneCos[Lane] - ExpectedCos));
+            if (Error > MaxError)
+            {
+                MaxError = Error;
+                WorstInput = A[Lane];
+            }
+            if (LaneError > MaxLaneError)
+            {
+                MaxLaneError = LaneError;
+                WorstLaneInput = A[Lane];
+            }
+            MismatchCount += ((Sin != LaneSin[Lane]) || (Cos != LaneCos[Lane]));
+        }
+    }
+
+    ReportErrorBound(State, "FastSinCosF", MaxError, FAST_SINCOS_MAX_ERROR, WorstInput);
+    ReportErrorBound(State, "FastSinCos", MaxLaneError, FAST_SINCOS_MAX_ERROR, WorstLaneInput);
+    ReportLaneMismatches(State, "FastSinCos", MismatchCount, TEST_SWEEP_COUNT);
+}
+
+internal void
+TestFastATan2(test_state *State, arena *Arena)
+{
+    // NOTE: Every angle around the circle at a few radii, so all the octant fixups get hit,
+    //       plus the axes and the origin
+    f32 Radii[] = { 1.0e-3f, 1.0f, 1.0e3f };
+    u32 AngleCount = TEST_SWEEP_COUNT / ArrayCount(Radii);
+    u32 Count = AngleCount*ArrayCount(Radii) + 5;
+
+    temporary_memory Temp = BeginTemporaryMemory(Arena);
+    f32 *Ys = PushArrayNoClear(Arena, Count, f32);
+    f32 *Xs = PushArrayNoClear(Arena, Count, f32);
+    u32 At = 0;
+    for (u32 RadiusIndex = 0; RadiusIndex < ArrayCount(Radii); ++RadiusIndex)
+    {
+        for (u32 Index = 0; Index < AngleCount; ++Index)
+        {
+            f64 Angle = -Pi64 + 2.0*Pi64*(f64)Index / (f64)AngleCount;
+            Ys[At] = (f32)((f64)Radii[RadiusIndex]*sin(Angle));
+            Xs[At] = (f32)((f64)Radii[RadiusIndex]*cos(Angle));
+            ++At;
+        }
+    }
+    f32 AxisYs[] = { 0.0f, 1.0f, -1.0f, 0.0f, 0.0f };
+    f32 AxisXs[] = { 0.0f, 0.0f, 0.0f, 1.0f, -1.0f };
+    for (u32 Index = 0; Index < ArrayCount(AxisYs); ++Index)
+    {
+        Ys[At] = AxisYs[Index];
+        Xs[At] = AxisXs[Index];
+        ++At;
+    }
+
+    f64 MaxError = 0.0;
+    f64 MaxLaneError = 0.0;
+    f32 WorstInput = 0.0f;
+    f32 WorstLaneInput = 0.0f;
+    u32 MismatchCount = 0;
+    for (u32 First = 0; First < Count; First += LANE_WIDTH)
+    {
+        f32 Y[LANE_WIDTH], X[LANE_WIDTH], LaneResult[LANE_WIDTH];
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            u32 Index = MIN(First + Lane, Count - 1);
+            Y[Lane] = Ys[Index];
+            X[Lane] = Xs[Index];
+        }
+        StoreF32(LaneResult, FastATan2(LoadF32(Y), LoadF32(X)));
+
+        for (u32 Lane = 0; (Lane < LANE_WIDTH) && (First + Lane < Count); ++Lane)
+        {
+            f64 Expected = atan2((f64)Y[Lane], (f64)X[Lane]);
+            f32 Result = FastATan2F(Y[Lane], X[Lane]);
+
+            // NOTE: Both ends are the same angle, so -pi and pi are equally right on the negative x axis
+            f64 Error = fabs((f64)Result - Expected);
+            f64 LaneError = fabs((f64)LaneResult[Lane] - Expected);
+            if (Error > 1.0)     Error = fabs(Error - 2.0*Pi64);
+            if (LaneError > 1.0) LaneError = fabs(LaneError - 2.0*Pi64);
+
+            if (Error > MaxError)
+            {
+                MaxError = Error;
+                WorstInput = Y[Lane] / X[Lane];
+            }
+            if (LaneError > MaxLaneError)
+            {
+                MaxLaneError = LaneError;
+                WorstLaneInput = Y[Lane] / X[Lane];
+            }
+            MismatchCount += (Result != LaneResult[Lane]);
+        }
+    }
+
+    ReportErrorBound(State, "FastATan2F", MaxError, FAST_ATAN2_MAX_ERROR, WorstInput);
+    ReportErrorBound(State, "FastATan2", MaxLaneError, FAST_ATAN2_MAX_ERROR, WorstLaneInput);
+    ReportCheck(State, (FastATan2F(0.0f, 0.0f) == 0.0f), "%-28s atan2(0, 0) is %g", "FastATan2F", (f64)FastATan2F(0.0f, 0.0f));
+    ReportLaneMismatches(State, "FastATan2", MismatchCount, Count);
+
+    EndTemporaryMemory(Temp);
+}
+
+internal void
+TestFastASin(test_state *State)
+{
+    // NOTE: A little past [-1, 1] on both ends, where the inputs are supposed to get clamped
+    f64 MaxError = 0.0;
+    f64 MaxLaneError = 0.0;
+    f32 WorstInput = 0.0f;
+    f32 WorstLaneInput = 0.0f;
+    u32 MismatchCount = 0;
+    for (u32 First = 0; First < TEST_SWEEP_COUNT; First += LANE_WIDTH)
+    {
+        f32 A[LANE_WIDTH], LaneResult[LANE_WIDTH];
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            A[Lane] = (f32)(-1.0625 + 2.125*(f64)(First + Lane) / (f64)(TEST_SWEEP_COUNT - 1));
+        }
+        StoreF32(LaneResult, FastASin(LoadF32(A)));
+
+        for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+        {
+            f64 Expected = asin(fmin(fmax((f64)A[Lane], -1.0), 1.0));
+            f32 Result = FastASinF(A[Lane]);
+
+            f64 Error = fabs((f64)Result - Expected);
+            f64 LaneError = fabs((f64)LaneResult[Lane] - Expected);
+            if (Error > MaxError)
+            {
+                MaxError = Error;
+                WorstInput = A[Lane];
+            }
+            if (LaneError > MaxLaneError)
+            {
+                MaxLaneError = LaneError;
+                WorstLaneInput = A[Lane];
+            }
+            MismatchCount += (Result != LaneResult[Lane]);
+        }
+    }
+
+    ReportErrorBound(State, "FastASinF", MaxError, FAST_ASIN_MAX_ERROR, WorstInput);
+    ReportErrorBound(State, "FastASin", MaxLaneError, FAST_ASIN_MAX_ERROR, WorstLaneInput);
+    ReportLaneMismatches(State, "FastASin", MismatchCount, TEST_SWEEP_COUNT);
+}
+
+internal void
+TestFastRcpSquareRoot(test_state *State)
+{
+    // NOTE: The same mantissas at every exponent of a normal f32, since rsqrt's estimate repeats
+    //       every two binades anyway
+    u32 MantissaCount = 1 << 14;
+    f64 MaxError = 0.0;
+    f64 MaxLaneError = 0.0;
+    f32 WorstInput = 0.0f;
+    f32 WorstLaneInput = 0.0f;
+    u32 MismatchCount = 0;
+    u32 Count = 0;
+    for (s32 Exponent = -125; Exponent <= 127; ++Exponent)
+    {
+        for (u32 First = 0; First < MantissaCount; First += LANE_WIDTH)
+        {
+            f32 A[LANE_WIDTH], LaneResult[LANE_WIDTH];
+            for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+            {
+                A[Lane] = (f32)ldexp(1.0 + (f64)(First + Lane) / (f64)MantissaCount, Exponent);
+            }
+            StoreF32(LaneResult, FastRcpSquareRoot(LoadF32(A)));
+
+            for (u32 Lane = 0; Lane < LANE_WIDTH; ++Lane)
+            {
+                f64 Expected = 1.0 / sqrt((f64)A[Lane]);
+                f32 Result = FastRcpSquareRootF(A[Lane]);
+
+                f64 Error = fabs((f64)Result - Expected) / Expected;
+                f64 LaneError = fabs((f64)LaneResult[Lane] - Expected) / Expected;
+                if (Error > MaxError)
+                {
+                    MaxError = Error;
+                    WorstInput = A[Lane];
+                }
+                if (LaneError > MaxLaneError)
+                {
+                    MaxLaneError = LaneError;
+                    WorstLaneInput = A[Lane];
+                }
+                MismatchCount += (Result != LaneResult[Lane]);
+                ++Count;
+            }
+        }
+    }
+
+    ReportErrorBound(State, "FastRcpSquareRootF", MaxError, FAST_RSQRT_MAX_ERROR, WorstInput);
+    ReportErrorBound(State, "FastRcpSquareRoot", MaxLaneError, FAST_RSQRT_MAX_ERROR, WorstLaneInput);
+    ReportLaneMismatches(State, "FastRcpSquareRoot", MismatchCount, Count);
+}
+
+//
+// NOTE: Mesh parsers, on small files written out here so the expected result is known exactly
+//
+
+internal string_u8
+TestFile(arena *Arena, const void *Data, usize Count)
+{
+    // NOTE: Zero terminated, like ReadEntireFile
+    string_u8 Result = { .Count = Count, .Data = PushArrayNoClear(Arena, Count + 1, u8) };
+    memcpy(Result.Data, Data, Count);
+    Result.Data[Count] = 0;
+    return Result;
+}
+
+internal string_u8
+TestFile(arena *Arena, const char *Text)
+{
+    string_u8 Result = TestFile(Arena, Text, strlen(Text));
+    return Result;
+}
+
+internal bool
+MeshIndicesAre(triangle_mesh *Mesh, u32 *Expected, u32 ExpectedCount, bool Normals = false)
+{
+    u32 *Indices = (Normals ? Mesh->NormalIndices : Mesh->Indices);
+    bool Result = (Mesh && Indices && (3*Mesh->TriangleCount == ExpectedCount) &&
+                   MemoryIsEqual(ExpectedCount*sizeof(u32), Indices, Expected));
+    return Result;
+}
+
+internal bool
+MeshIsConsistent(triangle_mesh *Mesh)
+{
+    // NOTE: What everything downstream of the parser relies on, whatever the file looked like
+    bool Result = (Mesh->VertexCount && Mesh->TriangleCount && Mesh->Positions && Mesh->Indices);
+    for (usize Index = 0; Result && (Index < 3*(usize)Mesh->TriangleCount); ++Index)
+    {
+        Result = ((Mesh->Indices[Index] < Mesh->VertexCount) &&
+                  (!Mesh->NormalIndices || (Mesh->NormalIndices[Index] < Mesh->NormalCount)));
+    }
+    return Result;
+}
+
+internal void
+TestObjParser(test_state *State, arena *Arena)
+{
+    ScopedMemory(Arena)
+    {
+        // NOTE: CRLF line ends, a quad, negative (relative) indices, texture coordinates that get
+        //       skipped and a comment after the face
+        const char *Quad =
+            "# quad\r\n"
+            "v 0 0 0\r\n"
+            "v 1 0 0\r\n"
+            "v 1 1 0\r\n"
+            "v 0 1 0\r\n"
+            "vt 0 0\r\n"
+            "vn 0 0 1\r\n"
+            "f -4/1/-1 -3/1/-1 -2/1/-1 -1/1/-1 # comment\r\n";
+        triangle_mesh *Mesh = ParseMesh(Arena, TestFile(Arena, Quad));
+        u32 QuadIndices[] = { 0, 1, 2, 0, 2, 3 };
+        u32 QuadNormalIndices[] = { 0, 0, 0, 0, 0, 0 };
+        ReportCheck(State, (Mesh && (Mesh->VertexCount == 4) && (Mesh->NormalCount == 1) &&
+                            MeshIndicesAre(Mesh, QuadIndices, ArrayCount(QuadIndices)) &&
+                            MeshIndicesAre(Mesh, QuadNormalIndices, ArrayCount(QuadNormalIndices), true) &&
+                            (Mesh->Positions[2].X == 1.0f) && (Mesh->Positions[2].Y == 1.0f) && (Mesh->Normals[0].Z == 1.0f)),
+                    "%-28s CRLF, quad, negative indices, v/vt/vn", "ParseObj");
+
+        // NOTE: Negative indices count back from the vertices seen so far, not from the end of the file.
+        //       One face without normals means none of them get any. No newline at the very end.
+        const char *Relative =
+            "v 0 0 0\n"
+            "v 1 0 0\n"
+            "v 0 1 0\n"
+            "vn 0 0 1\n"
+            "f 1//1 2//1 3//1\n"
+            "v 5 5 5\n"
+            "f -1 -2 -3\n"
+            "f 1 2 3 4 -1";
+        Mesh = ParseMesh(Arena, TestFile(Arena, Relative));
+        u32 RelativeIndices[] = { 0, 1, 2, 3, 2, 1, 0, 1, 2, 0, 2, 3, 0, 3, 3 };
+        ReportCheck(State, (Mesh && (Mesh->VertexCount == 4) && !Mesh->Normals && !Mesh->NormalIndices &&
+                            MeshIndicesAre(Mesh, RelativeIndices, ArrayCount(RelativeIndices))),
+                    "%-28s relative indices, pentagon, partial normals, no final newline", "ParseObj");
+
+        const char *BadFiles[] =
+        {
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n",
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -1 -2 -4\n",
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 3 2 1\nv 1 1 0\nf 1 2 5\n",
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1//1 2//1 3//1\n",
+            "v 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n",
+            "v 0 0 0\nv 1 0 0\nv 0 1 0\n",
+        };
+        u32 RejectedCount = 0;
+        for (u32 Index = 0; Index < ArrayCount(BadFiles); ++Index)
+        {
+            RejectedCount += !ParseMesh(Arena, TestFile(Arena, BadFiles[Index]));
+        }
+        ReportCheck(State, (RejectedCount == ArrayCount(BadFiles)), "%-28s %u of %u bad files rejected", "ParseObj",
+                    RejectedCount, (u32)ArrayCount(BadFiles));
+
+        // NOTE: A cut off OBJ can still be a valid one, so all that's asked is no crash and a usable mesh
+        usize QuadLength = strlen(Quad);
+        u32 BrokenCount = 0;
+        for (usize Length = 0; Length < QuadLength; ++Length)
+        {
+            triangle_mesh *Truncated = ParseMesh(Arena, TestFile(Arena, Quad, Length));
+            BrokenCount += (Truncated && !MeshIsConsistent(Truncated));
+        }
+        ReportCheck(State, (BrokenCount == 0), "%-28s %u of %u truncations gave a broken mesh", "ParseObj", BrokenCount, (u32)QuadLength);
+    }
+}
+
+struct test_writer
+{
+    u8 *At;
+    bool BigEndian;
+};
+
+internal void
+WriteTestValue(test_writer *Writer, const void *Value, u32 Size)
+{
+    // NOTE: Assumes a little endian host, which is all we build for
+    for (u32 ByteIndex = 0; ByteIndex < Size; ++ByteIndex)
+    {
+        *Writer->At++ = ((u8 *)Value)[Writer->BigEndian ? Size - 1 - ByteIndex : ByteIndex];
+    }
+}
+
+internal usize
+WriteTestPly(u8 *Dest, bool BigEndian)
+{
+    // NOTE: A quad and a triangle on four vertices with normals, plus an extra per vertex property
+    //       and an extra element that should both be read past
+    const char *Header = (BigEndian ? "ply\nformat binary_big_endian 1.0\n" : "ply\nformat binary_little_endian 1.0\n");
+    const char *Rest =
+        "comment written by ray_test.cpp\n"
+        "element vertex 4\n"
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "property ushort flags\n"
+        "property float nx\n"
+        "property float ny\n"
+        "property float nz\n"
+        "element face 2\n"
+        "property list uchar uint vertex_indices\n"
+        "element edge 1\n"
+        "property int vertex1\n"
+        "property int vertex2\n"
+        "end_header\n";
+
+    test_writer Writer = { .At = Dest, .BigEndian = BigEndian };
+    memcpy(Writer.At, Header, strlen(Header));
+    Writer.At += strlen(Header);
+    memcpy(Writer.At, Rest, strlen(Rest));
+    Writer.At += strlen(Rest);
+
+    f32 Positions[4][3] = { { 0.0f, 0.0f, 0.0f }, { 1.5f, 0.0f, 0.0f }, { 1.5f, -2.25f, 0.0f }, { 0.0f, -2.25f, 1.0e-3f } };
+    for (u32 VertexIndex = 0; VertexIndex < 4; ++VertexIndex)
+    {
+        u16 Flags = 0xbeef;
+        f32 Normal[3] = { 0.0f, 0.0f, (f32)VertexIndex };
+        WriteTestValue(&Writer, &Positions[VertexIndex][0], 4);
+        WriteTestValue(&Writer, &Positions[VertexIndex][1], 4);
+        WriteTestValue(&Writer, &Positions[VertexIndex][2], 4);
+        WriteTestValue(&Writer, &Flags, 2);
+        WriteTestValue(&Writer, &Normal[0], 4);
+        WriteTestValue(&Writer, &Normal[1], 4);
+        WriteTestValue(&Writer, &Normal[2], 4);
+    }
+
+    u8 QuadCount = 4;
+    u32 Quad[] = { 0, 1, 2, 3 };
+    WriteTestValue(&Writer, &QuadCount, 1);
+    for (u32 Index = 0; Index < 4; ++Index) WriteTestValue(&Writer, &Quad[Index], 4);
+
+    u8 TriangleCount = 3;
+    u32 Triangle[] = { 3, 2, 1 };
+    WriteTestValue(&Writer, &TriangleCount, 1);
+    for (u32 Index = 0; Index < 3; ++Index) WriteTestValue(&Writer, &Triangle[Index], 4);
+
+    s32 Edge[] = { 0, 1 };
+    WriteTestValue(&Writer, &Edge[0], 4);
+    WriteTestValue(&Writer, &Edge[1], 4);
+
+    usize Result = (usize)(Writer.At - Dest);
+    return Result;
+}
+
+internal void
+TestPlyParser(test_state *State, arena *Arena)
+{
+    ScopedMemory(Arena)
+    {
+        const char *Ascii =
+            "ply\r\n"
+            "format ascii 1.0\r\n"
+            "element vertex 4\r\n"
+            "property float x\r\n"
+            "property float y\r\n"
+            "property float z\r\n"
+            "property uchar red\r\n"
+            "element face 1\r\n"
+            "property list uchar int vertex_indices\r\n"
+            "end_header\r\n"
+            "0 0 0 255\r\n"
+            "1 0 0 255\r\n"
+            "1 1 0 255\r\n"
+            "0 1 -0.5e1 255\r\n"
+            "4 0 1 2 3\r\n";
+        triangle_mesh *Mesh = ParseMesh(Arena, TestFile(Arena, Ascii));
+        u32 QuadIndices[] = { 0, 1, 2, 0, 2, 3 };
+        ReportCheck(State, (Mesh && (Mesh->VertexCount == 4) && !Mesh->Normals &&
+                            MeshIndicesAre(Mesh, QuadIndices, ArrayCount(QuadIndices)) &&
+                            (Mesh->Positions[3].Y == 1.0f) && (Mesh->Positions[3].Z == -5.0f)),
+                    "%-28s ASCII, CRLF, quad, extra property", "ParsePly");
+
+        u32 BinaryIndices[] = { 0, 1, 2, 0, 2, 3, 3, 2, 1 };
+        triangle_mesh *Binary[2] = {};
+        for (u32 BigEndian = 0; BigEndian < 2; ++BigEndian)
+        {
+            u8 Bytes[1024];
+            usize Count = WriteTestPly(Bytes, BigEndian);
+            Mesh = Binary[BigEndian] = ParseMesh(Arena, TestFile(Arena, Bytes, Count));
+            ReportCheck(State, (Mesh && (Mesh->VertexCount == 4) && (Mesh->NormalCount == 4) &&
+                                MeshIndicesAre(Mesh, BinaryIndices, ArrayCount(BinaryIndices)) &&
+                                (Mesh->NormalIndices == Mesh->Indices) &&
+                                (Mesh->Positions[2].X == 1.5f) && (Mesh->Positions[2].Y == -2.25f) &&
+                                (Mesh->Positions[3].Z == 1.0e-3f) && (Mesh->Normals[3].Z == 3.0f)),
+                        "%-28s binary %s endian, quad + triangle, skipped property and element", "ParsePly",
+                        (BigEndian ? "big" : "little"));
+
+            // NOTE: Every value in a binary PLY is needed, so any cut, in the header or in the data,
+            //       has to be refused rather than read past the end
+            u32 AcceptedCount = 0;
+            for (usize Length = 0; Length < Count; ++Length)
+            {
+                AcceptedCount += (ParseMesh(Arena, TestFile(Arena, Bytes, Length)) != NULL);
+            }
+            ReportCheck(State, (AcceptedCount == 0), "%-28s %u of %zu truncations of the %s endian file accepted", "ParsePly",
+                        AcceptedCount, Count, (BigEndian ? "big" : "little"));
+        }
+        ReportCheck(State, (Binary[0] && Binary[1] &&
+                            MemoryIsEqual(4*sizeof(vec3), Binary[0]->Positions, Binary[1]->Positions) &&
+                            MemoryIsEqual(4*sizeof(vec3), Binary[0]->Normals, Binary[1]->Normals)),
+                    "%-28s big and little endian agree", "ParsePly");
+
+        const char *BadFiles[] =
+        {
+            "ply\nformat ascii 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\n"
+            "element face 1\nproperty list uchar int vertex_indices\nend_header\n0 0 0\n1 0 0\n0 1 0\n3 0 1 3\n",
+            "ply\nformat ascii 1.0\nelement vertex 3\nproperty float x\nproperty float y\n"
+            "element face 1\nproperty list uchar int vertex_indices\nend_header\n0 0\n1 0\n0 1\n3 0 1 2\n",
+            "ply\nformat binary_middle_endian 1.0\nelement vertex 0\nend_header\n",
+            "ply\nformat ascii 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\n",
+        };
+        u32 RejectedCount = 0;
+        for (u32 Index = 0; Index < ArrayCount(BadFiles); ++Index)
+        {
+            RejectedCount += !ParseMesh(Arena, TestFile(Arena, BadFiles[Index]));
+        }
+        ReportCheck(State, (RejectedCount == ArrayCount(BadFiles)), "%-28s %u of %u bad files rejected", "ParsePly",
+                    RejectedCount, (u32)ArrayCount(BadFiles));
+    }
+}
+
+//
+// NOTE: Mesh BVH, against testing every triangle
+//
+
+internal void
+TestMeshBVH(test_state *State, arena *Arena)
+{
+    ScopedMemory(Arena)
+    {
+        scene *Scene = PushStruct(Arena, scene);
+        ReserveSceneCapacity(Scene, 2, 1, 1, 2, 1);
+        u32 MeshIndex = AddMesh(Scene, 0, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.4f, 96, 48), Arena, 0);
+        mesh *Mesh = &Scene->Meshes.Data[MeshIndex];
+        triangle_mesh *Geometry = Mesh->Geometry;
+
+        // NOTE: Half the rays come from outside aimed somewhere into the bounds, the other half
+        //       start inside the bounds and go anywhere
+        u32 RayCount = 1 << 14;
+        u32 MissedCount = 0;
+        u32 WrongCount = 0;
+        u32 ShadowWrongCount = 0;
+        random_series Entropy = { 0x5eed };
+        for (u32 RayIndex = 0; RayIndex < RayCount; ++RayIndex)
+        {
+            vec3 Target = Vec3(1.4f*RandomBilateral(&Entropy), 0.4f*RandomBilateral(&Entropy), 1.4f*RandomBilateral(&Entropy));
+            vec3 Direction = Vec3(RandomBilateral(&Entropy), RandomBilateral(&Entropy), RandomBilateral(&Entropy));
+            vec3 RayP = ((RayIndex & 1) ? Target : Target - 3.0f*Normalize(Direction));
+            vec3 RayD = ((RayIndex & 1) ? Normalize(Direction) : Normalize(Target - RayP));
+            vec3 RayInvD = Vec3(1.0f / RayD.X, 1.0f / RayD.Y, 1.0f / RayD.Z);
+            triangle_ray TriRay = TriangleRay(RayD);
+
+            f32 Expected = F32_MAX;
+            for (u32 Triangle = 0; Triangle < Geometry->TriangleCount; ++Triangle)
+            {
+                u32 *Indices = Geometry->Indices + 3*Triangle;
+                f32 U, V;
+                RayIntersectTriangle(RayP, &TriRay, Geometry->Positions[Indices[0]], Geometry->Positions[Indices[1]],
+                                     Geometry->Positions[Indices[2]], &Expected, &U, &V);
+            }
+
+            f32 t = F32_MAX;
+            u32 Triangle = 0;
+            f32 U, V;
+            bool Hit = TraceMesh<false>(Mesh, RayP, RayInvD, &TriRay, &t, &Triangle, &U, &V);
+            MissedCount += (Expected < F32_MAX) && !Hit;
+            WrongCount += (t != Expected);
+
+            f32 tShadow = F32_MAX;
+            bool ShadowHit = TraceMesh<true>(Mesh, RayP, RayInvD, &TriRay, &tShadow, &Triangle, &U, &V);
+            ShadowWrongCount += (ShadowHit != (Expected < F32_MAX));
+        }
+
+        ReportCheck(State, !MissedCount && !WrongCount, "%-28s %u of %u rays missed, %u nearest hits wrong (%u triangles, %u nodes)",
+                    "TraceMesh", MissedCount, RayCount, WrongCount, Geometry->TriangleCount, Mesh->BVH.NodeCount);
+        ReportCheck(State, !ShadowWrongCount, "%-28s %u of %u shadow rays wrong", "TraceMesh", ShadowWrongCount, RayCount);
+
+        DeallocateArena(&Scene->Arena);
+    }
+}
+
+//
+// NOTE: Instance moves, which have to wait for the pass boundary
+//
+
+internal void
+TestInstanceMoves(test_state *State, arena *Arena)
+{
+    ScopedMemory(Arena)
+    {
+        scene *Scene = PushStruct(Arena, scene);
+        ReserveSceneCapacity(Scene, 2, 1, 1, 2, 3);
+        u32 MeshIndex = AddMesh(Scene, 0, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.4f, 16, 8), Arena, 0);
+        u32 Moved = AddInstance(Scene, { .Mesh = MeshIndex, .ObjectToWorld = RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(-2, 0, 0)) });
+        AddInstance(Scene, { .Mesh = MeshIndex, .ObjectToWorld = RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(2, 0, 0)) });
+        BuildInstanceBVH(Scene, Arena, 0);
+
+        // NOTE: Moved twice, only the last one counts
+        instance Before = Scene->Instances.Data[Moved];
+        aabb RootBefore = Scene->InstanceBVH.Nodes[0].Bounds;
+        MoveInstance(Scene, Moved, RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(-2, 5, 0)));
+        MoveInstance(Scene, Moved, RotateScaleTranslate(0.0f, 0.0f, 1.0f, Vec3(-2, 0, 7)));
+        bool Untouched = (StructsAreEqual(&Scene->Instances.Data[Moved], &Before) &&
+                          StructsAreEqual(&Scene->InstanceBVH.Nodes[0].Bounds, &RootBefore) &&
+                          !Scene->InstancesMoved);
+        ReportCheck(State, Untouched, "%-28s %u moves queued, instance and tree untouched", "MoveInstance", Scene->PendingMoves.Count);
+
+        UpdateInstanceBVH(Scene, Arena, 0);
+        aabb Root = Scene->InstanceBVH.Nodes[0].Bounds;
+        bool Applied = ((Scene->Instances.Data[Moved].ObjectToWorld.P.Z == 7.0f) &&
+                        (Scene->Instances.Data[Moved].ObjectToWorld.P.Y == 0.0f) &&
+                        (Root.Max.Z > 7.0f) && (Root.Max.Y < 5.0f) &&
+                        !Scene->PendingMoves.Count && Scene->InstancesMoved);
+        ReportCheck(State, Applied, "%-28s applied and refit by UpdateInstanceBVH", "MoveInstance");
+
+        DeallocateArena(&Scene->InstanceArena);
+        DeallocateArena(&Scene->Arena);
+    }
+}
+
+//
+// NOTE: Parallel BVH build and refit, against the serial ones
+//
+
+internal f32
+TraceTestRay(mesh *Mesh, vec3 RayP, vec3 RayD, bool *ShadowHit)
+{
+    vec3 RayInvD = Vec3(1.0f / RayD.X, 1.0f / RayD.Y, 1.0f / RayD.Z);
+    triangle_ray TriRay = TriangleRay(RayD);
+
+    f32 t = F32_MAX;
+    u32 Triangle = 0;
+    f32 U, V;
+    TraceMesh<false>(Mesh, RayP, RayInvD, &TriRay, &t, &Triangle, &U, &V);
+
+    f32 tShadow = F32_MAX;
+    *ShadowHit = TraceMesh<true>(Mesh, RayP, RayInvD, &TriRay, &tShadow, &Triangle, &U, &V);
+    return t;
+}
+
+internal void
+TestParallelBVH(test_state *State, arena *Arena, thread_dispatch *Dispatch)
+{
+    ScopedMemory(Arena)
+    {
+        // NOTE: The same torus twice, once built across the workers and once on this thread
+        scene *Scene = PushStruct(Arena, scene);
+        ReserveSceneCapacity(Scene, 2, 1, 1, 3, 1);
+        u32 ParallelIndex = AddMesh(Scene, 0, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.4f, 256, 160), Arena, Dispatch);
+        u32 SerialIndex = AddMesh(Scene, 0, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.4f, 256, 160), Arena, 0);
+        mesh *Parallel = &Scene->Meshes.Data[ParallelIndex];
+        mesh *Serial = &Scene->Meshes.Data[SerialIndex];
+
+        u32 RayCount = 1 << 14;
+        u32 WrongCount = 0;
+        u32 HitCount = 0;
+        random_series Entropy = { 0x5eed };
+        for (u32 RayIndex = 0; RayIndex < RayCount; ++RayIndex)
+        {
+            vec3 Target = Vec3(1.4f*RandomBilateral(&Entropy), 0.4f*RandomBilateral(&Entropy), 1.4f*RandomBilateral(&Entropy));
+            vec3 Direction = Vec3(RandomBilateral(&Entropy), RandomBilateral(&Entropy), RandomBilateral(&Entropy));
+            vec3 RayP = ((RayIndex & 1) ? Target : Target - 3.0f*Normalize(Direction));
+            vec3 RayD = ((RayIndex & 1) ? Normalize(Direction) : Normalize(Target - RayP));
+
+            bool ParallelShadow, SerialShadow;
+            f32 tParallel = TraceTestRay(Parallel, RayP, RayD, &ParallelShadow);
+            f32 tSerial = TraceTestRay(Serial, RayP, RayD, &SerialShadow);
+            WrongCount += (tParallel != tSerial) || (ParallelShadow != SerialShadow);
+            HitCount += (tSerial < F32_MAX);
+        }
+
+        bool BuiltInParallel = (Dispatch->ThreadCount && (Parallel->Geometry->TriangleCount >= BVH_PARALLEL_MIN_COUNT));
+        ReportCheck(State, BuiltInParallel && HitCount && !WrongCount,
+                    "%-28s %u of %u rays differ from the serial build (%u triangles, %u threads)", "BuildBVHParallel",
+                    WrongCount, RayCount, Parallel->Geometry->TriangleCount, Dispatch->ThreadCount);
+
+        DeallocateArena(&Scene->Arena);
+    }
+
+    ScopedMemory(Arena)
+    {
+        // NOTE: Two identical grids of instances get the same nudges, then one is refit across the
+        //       workers and the other on this thread. Every node is a plain union of its children,
+        //       so the two trees have to come out bit for bit the same.
+        u32 GridSize = 128;
+        scene *Scenes[2];
+        for (u32 SceneIndex = 0; SceneIndex < ArrayCount(Scenes); ++SceneIndex)
+        {
+            scene *Scene = Scenes[SceneIndex] = PushStruct(Arena, scene);
+            ReserveSceneCapacity(Scene, 2, 1, 1, 2, GridSize*GridSize + 1);
+            u32 MeshIndex = AddMesh(Scene, 0, GenerateTorus(&Scene->Arena, Vec3(0, 0, 0), 1.0f, 0.4f, 16, 8), Arena, 0);
+            for (u32 Y = 0; Y < GridSize; ++Y)
+            {
+                for (u32 X = 0; X < GridSize; ++X)
+                {
+                    vec3 P = Vec3(3.0f*(f32)X, 0.0f, 3.0f*(f32)Y);
+                    AddInstance(Scene, { .Mesh = MeshIndex, .ObjectToWorld = RotateScaleTranslate(0.0f, 0.0f, 1.0f, P) });
+                }
+            }
+            BuildInstanceBVH(Scene, Arena, 0);
+
+            random_series Entropy = { 0x5eed };
+            for (u32 InstanceIndex = 1; InstanceIndex < Scene->Instances.Count; ++InstanceIndex)
+            {
+                vec3 P = Scene->Instances.Data[InstanceIndex].ObjectToWorld.P;
+                vec3 Nudge = 0.2f*Vec3(RandomBilateral(&Entropy), RandomBilateral(&Entropy), RandomBilateral(&Entropy));
+                PlaceInstance(Scene, InstanceIndex, RotateScaleTranslate(0.0f, 0.0f, 1.0f, P + Nudge));
+                RefitInstanceLeaf(Scene, Scene->InstanceLeaves[InstanceIndex]);
+            }
+        }
+
+        u32 DirtyCount = Scenes[0]->InstanceRefit.DirtyCount;
+        RefitBVH(Arena, &Scenes[0]->InstanceBVH, &Scenes[0]->InstanceRefit, Dispatch);
+        RefitBVH(Arena, &Scenes[1]->InstanceBVH, &Scenes[1]->InstanceRefit, 0);
+
+        bvh *ParallelBVH = &Scenes[0]->InstanceBVH;
+        bvh *SerialBVH = &Scenes[1]->InstanceBVH;
+        u32 WrongCount = 0;
+        for (u32 NodeIndex = 0; NodeIndex < ParallelBVH->NodeCount; ++NodeIndex)
+        {
+            WrongCount += !StructsAreEqual(&ParallelBVH->Nodes[NodeIndex], &SerialBVH->Nodes[NodeIndex]);
+        }
+
+        f64 ParallelCost = Scenes[0]->InstanceRefit.AreaCost;
+        f64 SerialCost = Scenes[1]->InstanceRefit.AreaCost;
+        bool CostMatches = (fabs(ParallelCost - SerialCost) <= 1e-9*SerialCost);
+        bool RefitInParallel = (Dispatch->ThreadCount && (DirtyCount >= BVH_PARALLEL_REFIT_MIN_COUNT));
+        ReportCheck(State, RefitInParallel && !WrongCount && CostMatches && (ParallelBVH->NodeCount == SerialBVH->NodeCount),
+                    "%-28s %u of %u nodes differ from the serial refit (%u dirty)", "RefitBVH",
+                    WrongCount, ParallelBVH->NodeCount, DirtyCount);
+
+        for (u32 SceneIndex = 0; SceneIndex < ArrayCount(Scenes); ++SceneIndex)
+        {
+            DeallocateArena(&Scenes[SceneIndex]->InstanceArena);
+            DeallocateArena(&Scenes[SceneIndex]->Arena);
+        }
+    }
+}
+
+internal int
+RayTest(platform_api API)
+{
+    Platform = API;
+
+    test_state State = {};
+    arena Arena = {};
+
+    TestFastSinCos(&State);
+    TestFastATan2(&State, &Arena);
+    TestFastASin(&State);
+    TestFastRcpSquareRoot(&State);
+    TestMeshBVH(&State, &Arena);
+    TestInstanceMoves(&State, &Arena);
+
+    // NOTE: At least a few workers even on one core, so the parallel paths really run
+    //       concurrently. They never exit, so the dispatcher gets an arena of its own that
+    //       doesn't get freed.
+    u32 LogicalCoreCount = Platform.LogicalCoreCount;
+    Platform.LogicalCoreCount = MAX(LogicalCoreCount, 4);
+    arena DispatchArena = {};
+    thread_dispatch *Dispatch = PushStruct(&DispatchArena, thread_dispatch);
+    InitThreadDispatcher(Dispatch, &DispatchArena);
+    Platform.LogicalCoreCount = LogicalCoreCount;
+    TestParallelBVH(&State, &Arena, Dispatch);
+
+    // NOTE: The parsers say what's wrong with every file they refuse, so the errors on stderr
+    //       from here on are expected
+    TestObjParser(&State, &Arena);
+    TestPlyParser(&State, &Arena);
+
+    DeallocateArena(&Arena);
+
+    printf("\n%u of %u checks passed\n", State.CheckCount - State.FailCount, State.CheckCount);
+    return (State.FailCount ? -1 : 0);
+}
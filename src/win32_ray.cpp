@@ -2,6 +2,7 @@
 #include "external/robustwin32io.cpp"
 
 #include <stdio.h>
+#include <string.h>
 
 extern "C"
 {
@@ -126,6 +127,63 @@ Win32WriteEntireFile(const char *FileName, string_u8 Data)
     return Result;
 }
 
+internal string_u8
+Win32MapFile(const char *FileName)
+{
+    string_u8 Result = {};
+
+    HANDLE FileHandle = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (FileHandle != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER FileSize;
+        if (GetFileSizeEx(FileHandle, &FileSize) && (FileSize.QuadPart > 0))
+        {
+            HANDLE MappingHandle = CreateFileMappingA(FileHandle, 0, PAGE_READONLY, 0, 0, 0);
+            if (MappingHandle)
+            {
+                void *Data = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+                if (Data)
+                {
+                    Result.Data = (u8 *)Data;
+                    Result.Count = (usize)FileSize.QuadPart;
+                }
+
+                // NOTE: The view keeps the mapping and the file alive by itself
+                CloseHandle(MappingHandle);
+            }
+        }
+
+        CloseHandle(FileHandle);
+    }
+
+    return Result;
+}
+
+internal void
+Win32UnmapFile(string_u8 File)
+{
+    if (File.Data)
+    {
+        UnmapViewOfFile(File.Data);
+    }
+}
+
+internal bool
+Win32GetFileInfo(const char *FileName, platform_file_info *Info)
+{
+    bool Result = false;
+
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if (GetFileAttributesExA(FileName, GetFileExInfoStandard, &Data))
+    {
+        Info->Size = ((u64)Data.nFileSizeHigh << 32) | (u64)Data.nFileSizeLow;
+        Info->ModifiedTime = ((u64)Data.ftLastWriteTime.dwHighDateTime << 32) | (u64)Data.ftLastWriteTime.dwLowDateTime;
+        Result = true;
+    }
+
+    return Result;
+}
+
 internal platform_semaphore_handle
 Win32CreateSemaphore(int InitialCount, int MaxCount)
 {
@@ -467,6 +525,13 @@ Win32GetSecondsElapsed(LARGE_INTEGER Start, LARGE_INTEGER End)
     return Result;
 }
 
+internal f64
+Win32GetSeconds(void)
+{
+    f64 Result = (f64)Win32GetClock().QuadPart / (f64)G_PerfFreq.QuadPart;
+    return Result;
+}
+
 internal void
 Win32ResizeImageBuffer(app_imagebuffer *ImageBuffer, u32 ClientW, u32 ClientH)
 {
@@ -591,17 +656,38 @@ main(int ArgumentCount, char **Arguments)
         .Deallocate = Win32Deallocate,
         .WriteEntireFile = Win32WriteEntireFile,
         .ReadEntireFile = Win32ReadEntireFile,
+        .MapFile = Win32MapFile,
+        .UnmapFile = Win32UnmapFile,
+        .GetFileInfo = Win32GetFileInfo,
         .PageSize = SystemInfo.dwPageSize,
         .CreateThread = Win32CreateThread,
         .CreateSemaphore = Win32CreateSemaphore,
         .WaitOnSemaphore = Win32WaitOnSemaphore,
         .ReleaseSemaphore = Win32ReleaseSemaphore,
+        .GetSeconds = Win32GetSeconds,
         .LogicalCoreCount = SystemInfo.dwNumberOfProcessors,
     };
     Platform = API;
 
     app_links Links = AppLinks();
 
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "-benchmark") == 0) && Links.AppBenchmark)
+    {
+        app_benchmark_params BenchmarkParams =
+        {
+            .W = 640,
+            .H = 360,
+            .SampleCount = 16,
+            .OutputFileName = "benchmark.csv",
+        };
+        return Links.AppBenchmark(API, &BenchmarkParams);
+    }
+
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "-test") == 0) && Links.AppTest)
+    {
+        return Links.AppTest(API);
+    }
+
     app_init_params Params =
     {
         .WindowTitle = "Unnamed Window",
@@ -609,6 +695,7 @@ main(int ArgumentCount, char **Arguments)
         .WindowY = CW_USEDEFAULT,
         .WindowW = CW_USEDEFAULT,
         .WindowH = CW_USEDEFAULT,
+        .MeshFileName = (((ArgumentCount > 2) && (strcmp(Arguments[1], "-mesh") == 0)) ? Arguments[2] : nullptr),
     };
 
     if (Links.AppInit)
@@ -906,7 +993,7 @@ main(int ArgumentCount, char **Arguments)
 
     if (Links.AppExit)
     {
-        Links.AppExit();
+        Links.AppExit(&Input);
     }
 
     Win32ResizeImageBuffer(&ImageBuffer, 0, 0);